@@ -188,4 +188,12 @@ extern void CatalogTupleDelete(Relation heapRel, ItemPointer tid);
 #define pg_plan_queries(querytrees, query_string, cursorOptions, boundParams) \
 	pg_plan_queries(querytrees, cursorOptions, boundParams)
 
+/* 9.4 only has the older CRC-32 variant */
+#include "utils/pg_crc.h"
+typedef pg_crc32 pg_crc32c;
+#define INIT_CRC32C(crc) INIT_CRC32(crc)
+#define COMP_CRC32C(crc, data, len) COMP_CRC32(crc, data, len)
+#define FIN_CRC32C(crc) FIN_CRC32(crc)
+#define EQ_CRC32C(c1, c2) EQ_CRC32(c1, c2)
+
 #endif
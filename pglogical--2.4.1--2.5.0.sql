@@ -0,0 +1,25 @@
+CREATE FUNCTION pglogical.show_subscription_receive_queue(subscription_name name DEFAULT NULL,
+    OUT subscription_name text, OUT queued_messages integer, OUT queued_bytes bigint)
+RETURNS SETOF record STABLE LANGUAGE c AS 'MODULE_PATHNAME', 'pglogical_show_subscription_receive_queue';
+
+CREATE FUNCTION pglogical.show_subscription_compression(subscription_name name DEFAULT NULL,
+    OUT subscription_name text, OUT compressed_bytes bigint,
+    OUT decompressed_bytes bigint, OUT decompress_time double precision)
+RETURNS SETOF record STABLE LANGUAGE c AS 'MODULE_PATHNAME', 'pglogical_show_subscription_compression';
+
+CREATE FUNCTION pglogical.show_output_stats(
+    OUT pid integer, OUT slot_name text, OUT changes bigint,
+    OUT filtered_origin bigint, OUT filtered_table bigint,
+    OUT filtered_action bigint, OUT filtered_row bigint,
+    OUT sent_insert bigint, OUT sent_update bigint, OUT sent_delete bigint,
+    OUT bytes_relation bigint, OUT bytes_insert bigint,
+    OUT bytes_update bigint, OUT bytes_delete bigint, OUT bytes_other bigint,
+    OUT relmeta_hits bigint, OUT relmeta_misses bigint,
+    OUT relmeta_invalidations bigint,
+    OUT filter_time double precision, OUT encode_time double precision,
+    OUT compressed_batches bigint, OUT compress_raw_bytes bigint,
+    OUT compressed_bytes bigint, OUT compress_time double precision)
+RETURNS SETOF record VOLATILE LANGUAGE c AS 'MODULE_PATHNAME', 'pglogical_show_output_stats';
+
+CREATE VIEW pglogical.output_stats AS
+    SELECT * FROM pglogical.show_output_stats();
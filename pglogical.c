@@ -53,7 +53,11 @@
 
 #include "pglogical_executor.h"
 #include "pglogical_node.h"
+#include "pglogical_compress.h"
 #include "pglogical_conflict.h"
+#include "pglogical_fanout.h"
+#include "pglogical_queue.h"
+#include "pglogical_spool.h"
 #include "pglogical_worker.h"
 #include "pglogical.h"
 
@@ -88,10 +92,35 @@ static const struct config_enum_entry server_message_level_options[] = {
 	{NULL, 0, false}
 };
 
+static const struct config_enum_entry stream_compression_options[] = {
+	{"none", PGLOGICAL_COMPRESSION_NONE, false},
+#if PG_VERSION_NUM >= 90500
+	{"pglz", PGLOGICAL_COMPRESSION_PGLZ, false},
+#endif
+#ifdef USE_LZ4
+	{"lz4", PGLOGICAL_COMPRESSION_LZ4, false},
+#endif
+#ifdef USE_ZSTD
+	{"zstd", PGLOGICAL_COMPRESSION_ZSTD, false},
+#endif
+	{NULL, 0, false}
+};
+
 bool	pglogical_synchronous_commit = false;
+bool	pglogical_synchronous_feedback = false;
 char   *pglogical_temp_directory = "";
 bool	pglogical_use_spi = false;
 bool	pglogical_batch_inserts = true;
+int		pglogical_batch_inserts_buffer_size = 1024;
+int		pglogical_apply_prefetch_depth = 0;
+int		pglogical_receive_queue_size = 8192;
+int		pglogical_apply_group_size = 0;
+int		pglogical_apply_group_timeout = 100;
+int		pglogical_apply_memory_limit = 0;
+int		pglogical_stream_apply_workers = 0;
+int		pglogical_apply_idle_timeout = 0;
+int		pglogical_stream_compression = PGLOGICAL_COMPRESSION_NONE;
+bool	pglogical_changed_columns_only = false;
 static char *pglogical_temp_directory_config;
 
 void _PG_init(void);
@@ -478,16 +507,19 @@ pglogical_identify_system(PGconn *streamConn, uint64* sysid,
 	PQclear(res);
 }
 
-void
-pglogical_start_replication(PGconn *streamConn, const char *slot_name,
-							XLogRecPtr start_pos, const char *forward_origins,
-							const char *replication_sets,
-							const char *replicate_only_table,
-							bool force_text_transfer)
+/*
+ * Build the START_REPLICATION command asking for the stream we want.
+ */
+char *
+pglogical_start_replication_command(const char *slot_name,
+									XLogRecPtr start_pos,
+									const char *forward_origins,
+									const char *replication_sets,
+									const char *replicate_only_table,
+									bool force_text_transfer,
+									bool streaming)
 {
 	StringInfoData	command;
-	PGresult	   *res;
-	char		   *sqlstate;
 	const char	   *want_binary = (force_text_transfer ? "0" : "1");
 
 	initStringInfo(&command);
@@ -563,6 +595,20 @@ pglogical_start_replication(PGconn *streamConn, const char *slot_name,
 		appendStringInfoString(&command, quote_literal_cstr(replication_sets));
 	}
 
+	/* Ask for large transactions while they are still in progress. */
+	if (streaming)
+		appendStringInfoString(&command, ", \"pglogical.streaming\" 'true'");
+
+	/* Ask for compressed batches of changes. */
+	if (pglogical_stream_compression != PGLOGICAL_COMPRESSION_NONE)
+		appendStringInfo(&command, ", \"pglogical.compression\" '%s'",
+						 pglogical_compression_name(pglogical_stream_compression));
+
+	/* Ask for UPDATEs without the columns that didn't change. */
+	if (pglogical_changed_columns_only)
+		appendStringInfoString(&command,
+							   ", \"pglogical.changed_columns_only\" 'true'");
+
 	/* Tell the upstream that we want unbounded metadata cache size */
 	appendStringInfoString(&command, ", \"relmeta_cache_size\" '-1'");
 
@@ -574,12 +620,35 @@ pglogical_start_replication(PGconn *streamConn, const char *slot_name,
 
 	appendStringInfoChar(&command, ')');
 
-	res = PQexec(streamConn, command.data);
+	return command.data;
+}
+
+void
+pglogical_start_replication(PGconn *streamConn, const char *slot_name,
+							XLogRecPtr start_pos, const char *forward_origins,
+							const char *replication_sets,
+							const char *replicate_only_table,
+							bool force_text_transfer,
+							bool streaming)
+{
+	char		   *command;
+	PGresult	   *res;
+	char		   *sqlstate;
+
+	command = pglogical_start_replication_command(slot_name, start_pos,
+												  forward_origins,
+												  replication_sets,
+												  replicate_only_table,
+												  force_text_transfer,
+												  streaming);
+
+	res = PQexec(streamConn, command);
 	sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
 	if (PQresultStatus(res) != PGRES_COPY_BOTH)
 		elog(FATAL, "could not send replication command \"%s\": %s\n, sqlstate: %s",
-			 command.data, PQresultErrorMessage(res), sqlstate);
+			 command, PQresultErrorMessage(res), sqlstate);
 	PQclear(res);
+	pfree(command);
 }
 
 /*
@@ -800,6 +869,138 @@ _PG_init(void)
 							 0,
 							 NULL, NULL, NULL);
 
+	DefineCustomBoolVariable("pglogical.synchronous_feedback",
+							 "report each applied transaction to the provider as soon as it's flushed",
+							 NULL,
+							 &pglogical_synchronous_feedback,
+							 false, PGC_POSTMASTER,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.receive_queue_size",
+							"Maximum amount of data the apply worker receives ahead of apply",
+							NULL,
+							&pglogical_receive_queue_size,
+							8192,
+							0, MAX_KILOBYTES,
+							PGC_POSTMASTER,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pglogical.spool_stream",
+							 "Spool the replication stream locally before applying it",
+							 NULL,
+							 &pglogical_spool_stream,
+							 false,
+							 PGC_POSTMASTER,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.apply_group_size",
+							"Maximum number of remote transactions applied in one local transaction",
+							NULL,
+							&pglogical_apply_group_size,
+							0,
+							0, 10000,
+							PGC_POSTMASTER,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.apply_group_timeout",
+							"Maximum time remote transactions are grouped before local commit",
+							NULL,
+							&pglogical_apply_group_timeout,
+							100,
+							1, 3600 * 1000,
+							PGC_POSTMASTER,
+							GUC_UNIT_MS,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.apply_memory_limit",
+							"Memory use of the apply worker above which it's reported",
+							NULL,
+							&pglogical_apply_memory_limit,
+							0,
+							0, MAX_KILOBYTES,
+							PGC_POSTMASTER,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.stream_apply_workers",
+							"Maximum number of helpers applying streamed transactions for each subscription",
+							NULL,
+							&pglogical_stream_apply_workers,
+							0,
+							0, 64,
+							PGC_POSTMASTER,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomEnumVariable("pglogical.stream_compression",
+							 "Compression the subscriber asks the provider to use for batches of changes",
+							 NULL,
+							 &pglogical_stream_compression,
+							 PGLOGICAL_COMPRESSION_NONE,
+							 stream_compression_options,
+							 PGC_SIGHUP, 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pglogical.changed_columns_only",
+							 "Ask the provider to send only the changed columns of updated rows",
+							 NULL,
+							 &pglogical_changed_columns_only,
+							 false,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pglogical.fanout_cache",
+							 "Share the transactions sent to subscribers asking for the same changes between walsenders",
+							 NULL,
+							 &pglogical_fanout_cache,
+							 false,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pglogical.queue_messages",
+							 "Send replicated DDL, TRUNCATE and sequence changes as logical decoding messages instead of through the queue table",
+							 NULL,
+							 &pglogical_queue_messages,
+							 false,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.apply_idle_timeout",
+							"Time after which the apply worker of an idle subscription exits until there are changes again",
+							NULL,
+							&pglogical_apply_idle_timeout,
+							0,
+							0, INT_MAX,
+							PGC_POSTMASTER,
+							GUC_UNIT_MS,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.apply_prefetch_depth",
+							"Number of messages the apply worker reads ahead to prefetch the blocks they need",
+							NULL,
+							&pglogical_apply_prefetch_depth,
+							0,
+							0, 1024,
+							PGC_POSTMASTER,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pglogical.keyless_tuple_hash",
+							 "Hash the rows of tables without usable index for lookups",
+							 NULL,
+							 &pglogical_keyless_tuple_hash,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+
 	DefineCustomBoolVariable("pglogical.use_spi",
 							 "Use SPI instead of low-level API for applying changes",
 							 NULL,
@@ -822,6 +1023,17 @@ _PG_init(void)
 							 0,
 							 NULL, NULL, NULL);
 
+	DefineCustomIntVariable("pglogical.batch_inserts_buffer_size",
+							"Maximum amount of memory used to buffer batched inserts",
+							NULL,
+							&pglogical_batch_inserts_buffer_size,
+							1024,
+							64,
+							MAX_KILOBYTES,
+							PGC_POSTMASTER,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
 	/*
 	 * We can't use the temp_tablespace safely for our dumps, because Pg's
 	 * crash recovery is very careful to delete only particularly formatted
@@ -852,6 +1064,9 @@ _PG_init(void)
 	/* Init workers. */
 	pglogical_worker_shmem_init();
 
+	/* Init output plugin statistics. */
+	pglogical_output_stats_shmem_init();
+
 	/* Init executor module */
 	pglogical_executor_init();
 
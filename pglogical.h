@@ -26,11 +26,11 @@
 
 #include "pglogical_compat.h"
 
-#define PGLOGICAL_VERSION "2.4.1"
-#define PGLOGICAL_VERSION_NUM 20401
+#define PGLOGICAL_VERSION "2.5.0"
+#define PGLOGICAL_VERSION_NUM 20500
 
 #define PGLOGICAL_MIN_PROTO_VERSION_NUM 1
-#define PGLOGICAL_MAX_PROTO_VERSION_NUM 1
+#define PGLOGICAL_MAX_PROTO_VERSION_NUM 3
 
 #define EXTENSION_NAME "pglogical"
 
@@ -41,9 +41,20 @@
 #endif
 
 extern bool pglogical_synchronous_commit;
+extern bool pglogical_synchronous_feedback;
 extern char *pglogical_temp_directory;
 extern bool pglogical_use_spi;
 extern bool pglogical_batch_inserts;
+extern int pglogical_batch_inserts_buffer_size;
+extern int pglogical_apply_prefetch_depth;
+extern int pglogical_receive_queue_size;
+extern int pglogical_apply_group_size;
+extern int pglogical_apply_group_timeout;
+extern int pglogical_apply_memory_limit;
+extern int pglogical_stream_apply_workers;
+extern int pglogical_apply_idle_timeout;
+extern int pglogical_stream_compression;
+extern bool pglogical_changed_columns_only;
 extern char *pglogical_extra_connection_options;
 
 extern char *shorten_hash(const char *str, int maxlen);
@@ -64,16 +75,26 @@ extern PGconn *pglogical_connect_replica(const char *connstring,
 extern void pglogical_identify_system(PGconn *streamConn, uint64* sysid,
 									  TimeLineID *timeline, XLogRecPtr *xlogpos,
 									  Name *dbname);
+extern char *pglogical_start_replication_command(const char *slot_name,
+												XLogRecPtr start_pos,
+												const char *forward_origins,
+												const char *replication_sets,
+												const char *replicate_only_table,
+												bool force_text_transfer,
+												bool streaming);
 extern void pglogical_start_replication(PGconn *streamConn,
 										const char *slot_name,
 										XLogRecPtr start_pos,
 										const char *forward_origins,
 										const char *replication_sets,
 										const char *replicate_only_table,
-										bool force_text_transfer);
+										bool force_text_transfer,
+										bool streaming);
 
 extern void pglogical_manage_extension(void);
 
+extern void pglogical_output_stats_shmem_init(void);
+
 extern void apply_work(PGconn *streamConn);
 
 extern bool synchronize_sequences(void);
@@ -42,14 +42,20 @@
 #include "pgxc/pgxcnode.h"
 #endif
 
+#include "portability/instr_time.h"
+
 #include "replication/origin.h"
 #include "replication/reorderbuffer.h"
 
 #include "rewrite/rewriteHandler.h"
 
+#include "storage/buffile.h"
+#include "storage/dsm.h"
 #include "storage/ipc.h"
 #include "storage/lmgr.h"
 #include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/spin.h"
 
 #include "tcop/pquery.h"
 #include "tcop/utility.h"
@@ -68,6 +74,7 @@
 #include "pglogical_relcache.h"
 #include "pglogical_repset.h"
 #include "pglogical_rpc.h"
+#include "pglogical_spool.h"
 #include "pglogical_sync.h"
 #include "pglogical_worker.h"
 #include "pglogical_apply.h"
@@ -77,8 +84,10 @@
 
 
 void pglogical_apply_main(Datum main_arg);
+void pglogical_stream_main(Datum main_arg);
 
 static bool			in_remote_transaction = false;
+static bool			remote_xact_changed = false;
 static XLogRecPtr	remote_origin_lsn = InvalidXLogRecPtr;
 static RepOriginId	remote_origin_id = InvalidRepOriginId;
 static TimeOffset	apply_delay = 0;
@@ -92,6 +101,9 @@ PGLogicalSubscription	   *MySubscription = NULL;
 
 static PGconn	   *applyconn = NULL;
 
+/* Did we ask the provider to stream in-progress transactions? */
+static bool			apply_streaming = false;
+
 typedef struct PGLogicalApplyFunctions
 {
 	pglogical_apply_begin_fn	on_begin;
@@ -116,11 +128,93 @@ static PGLogicalApplyFunctions apply_api =
 	.multi_insert_finish = pglogical_apply_heap_mi_finish
 };
 
-/* Number of tuples inserted after which we switch to multi-insert. */
+/*
+ * Number of tuples inserted after which we switch to multi-insert. This is
+ * only the initial value, the threshold is adjusted for each relation based
+ * on how many of its runs of inserts were long enough for a batch to pay off
+ * (see multi_insert_end).
+ */
 #define MIN_MULTI_INSERT_TUPLES 5
-static PGLogicalRelation   *last_insert_rel = NULL;
-static int					last_insert_rel_cnt = 0;
-static bool					use_multi_insert = false;
+#define MAX_MULTI_INSERT_THRESHOLD 128
+
+/* Number of runs of inserts after which the threshold is reconsidered. */
+#define MULTI_INSERT_RATE_RUNS 16
+
+/* Maximum number of relations with multi-insert in progress at once. */
+#define MAX_MULTI_INSERT_RELS 8
+
+typedef struct MultiInsertRel
+{
+	PGLogicalRelation  *rel;
+	int					ninserts;	/* Tuples inserted since last flush. */
+	int					nrun;		/* Tuples inserted in this run. */
+	bool				active;		/* Is multi-insert in progress? */
+} MultiInsertRel;
+
+static MultiInsertRel	mi_rels[MAX_MULTI_INSERT_RELS];
+static int				mi_nrels = 0;
+
+/*
+ * An UPDATE or DELETE decoded by the lookahead, kept so that it doesn't have
+ * to be decoded again when applied, see prefetch_message().
+ */
+typedef struct DecodedChange
+{
+	MemoryContext		context;	/* Holds all of the below. */
+	uint32				remoteid;
+	uint32				generation;	/* pglogical_relcache_generation when
+									 * decoded. */
+	bool				hasoldtup;
+	PGLogicalTupleData *oldtup;
+	PGLogicalTupleData *newtup;
+} DecodedChange;
+
+/*
+ * Messages received from the provider but not applied yet.
+ *
+ * The queue is filled ahead of apply (see apply_receive_ahead) so that the
+ * provider can keep sending while we apply, and so that the blocks needed by
+ * the queued messages can be prefetched (see apply_prefetch_lookahead). It's
+ * a ring buffer which grows as needed, the amount of data in it is bounded by
+ * pglogical.receive_queue_size.
+ */
+typedef struct ReceivedMessage
+{
+	char	   *buf;			/* malloc'd by libpq */
+	int			len;
+	DecodedChange *decoded;		/* Set by the lookahead, if any. */
+} ReceivedMessage;
+
+static ReceivedMessage *recvq_msgs = NULL;
+static int				recvq_size = 0;		/* Allocated slots. */
+static int				recvq_head = 0;		/* Oldest queued message. */
+static int				recvq_count = 0;	/* Number of queued messages. */
+static Size				recvq_bytes = 0;	/* Size of queued messages. */
+static int				recvq_examined = 0;	/* How many of them we have
+											 * already prefetched for. */
+static int				recvq_status = 0;	/* Failed PQgetCopyData result
+											 * to report once drained. */
+static MemoryContext	LookaheadContext = NULL;
+
+/* Decoded form of the message being applied, if any. */
+static DecodedChange   *decoded_change = NULL;
+static char			   *decoded_buf = NULL;
+
+/* Is the message being applied read from the spool rather than libpq? */
+static bool				copybuf_spooled = false;
+
+/*
+ * BEGIN of the next transaction, held back until apply_delay_until because
+ * of the subscription's apply_delay.
+ */
+static char			   *delayed_buf = NULL;
+static int				delayed_len = 0;
+static bool				delayed_spooled = false;
+static TimestampTz		apply_delay_until = 0;
+/* Commit LSN of the transaction being received into the spool. */
+static XLogRecPtr		spool_xact_lsn = InvalidXLogRecPtr;
+
+#define INITIAL_RECVQ_SIZE	64
 
 /*
  * A message counter for the xact, for debugging. We don't send
@@ -129,6 +223,115 @@ static bool					use_multi_insert = false;
  */
 static uint32			xact_action_counter;
 
+/*
+ * Remote transactions applied in the current local transaction but not
+ * committed yet, see apply_group_defer().
+ */
+#define APPLY_GROUP_MAX_ACTIONS		10000
+
+static int				group_xacts = 0;
+static uint32			group_actions = 0;
+static XLogRecPtr		group_end_lsn = InvalidXLogRecPtr;
+static TimestampTz		group_commit_time = 0;
+static TimestampTz		group_start_time = 0;
+static bool				remote_xact_ends_group = false;
+
+/*
+ * How often the memory use is compared to pglogical.apply_memory_limit, in
+ * changes, and whether it was already reported for the transaction.
+ */
+#define APPLY_MEMORY_CHECK_INTERVAL	1000
+
+static bool				apply_memory_reported = false;
+
+/*
+ * Relations changed since the last CommandCounterIncrement() and whether the
+ * next change has to see the effects of the previous one regardless of the
+ * relation, see apply_prepare_change().
+ */
+#define MAX_CHANGED_RELS			16
+
+static Oid				changed_rels[MAX_CHANGED_RELS];
+static int				nchanged_rels = 0;
+static bool				command_counter_needed = false;
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * Transactions the provider streams to us before they commit, see
+ * handle_stream_start(). Each is either passed on to a helper worker through
+ * a shared memory queue as it arrives, or, when no helper can be had, kept
+ * in a temporary file and applied on commit.
+ */
+#define STREAM_QUEUE_SIZE			(16 * 1024 * 1024)
+
+/* How long to wait for room in the queue of a helper, in milliseconds. */
+#define STREAM_SEND_TIMEOUT			10000L
+
+/*
+ * Waits between the apply worker and its helpers go through heavyweight
+ * locks, so that the deadlock detector sees them. The helper holds the
+ * transaction lock until its transaction ends and the apply worker waits on
+ * it for the commit. The apply worker holds the stream lock between the
+ * blocks of the transaction and the helper waits on it once it has applied
+ * a block. The locks use the advisory lock tag with fields of their own.
+ */
+#define STREAM_LOCK_XACT			3
+#define STREAM_LOCK_STREAM			4
+
+/* Start of the dynamic shared memory segment of a helper. */
+typedef struct StreamShared
+{
+	slock_t		mutex;
+	bool		locked;			/* Does the helper hold the transaction lock? */
+	bool		committed;		/* Has the helper committed? */
+	bool		abandoned;		/* Is the file used instead of the helper? */
+	XLogRecPtr	local_end;		/* End of its local commit record. */
+	PGPROC	   *leader;			/* Apply worker to wake up on commit. */
+} StreamShared;
+
+#define STREAM_SHARED_SIZE			MAXALIGN(sizeof(StreamShared))
+
+/* Where a subtransaction starts in the file of a streamed transaction. */
+typedef struct StreamSubXact
+{
+	TransactionId	xid;
+	int				nrecords;
+	int				fileno;
+	off_t			offset;
+} StreamSubXact;
+
+typedef struct StreamXact
+{
+	TransactionId	xid;
+
+	/* Helper applying the transaction. */
+	PGLogicalWorker *worker;
+	uint16			generation;
+	dsm_segment	   *seg;
+	StreamShared   *shared;
+	shm_mq_handle  *mqh;
+	bool			locked;		/* Do we hold its stream lock? */
+
+	/*
+	 * The file keeping it until commit, also while a helper applies it, so
+	 * that it can still be applied if the helper exits or gets stuck.
+	 */
+	BufFile		   *file;
+	int				nrecords;
+	List		   *subxacts;
+} StreamXact;
+
+static List			   *stream_xacts = NIL;		/* Open streamed xacts. */
+static StreamXact	   *stream_current = NULL;	/* Between STREAM START and
+												 * STREAM STOP. */
+static bool				stream_replaying = false;
+
+/* Remote subtransactions with a savepoint in the helper. */
+static TransactionId   *stream_subxids = NULL;
+static int				stream_nsubxids = 0;
+static int				stream_maxsubxids = 0;
+#endif
+
 typedef struct PGLFlushPosition
 {
 	dlist_node node;
@@ -156,13 +359,34 @@ struct ActionErrCallbackArg
 struct ActionErrCallbackArg errcallback_arg;
 static TransactionId remote_xid;
 
+static MultiInsertRel *multi_insert_get_rel(PGLogicalRelation *rel);
 static void multi_insert_finish(void);
+static bool multi_insert_holds_rel(PGLogicalRelation *rel);
 
-static void handle_queued_message(HeapTuple msgtup, bool tx_just_started);
+static void apply_track_commit(XLogRecPtr end_lsn, XLogRecPtr local_end);
+static void apply_remote_commit(XLogRecPtr end_lsn, TimestampTz commit_time);
+static void handle_queued_message(QueuedMessage *queued_message,
+								  bool tx_just_started);
 static void handle_startup_param(const char *key, const char *value);
 static bool parse_bool_param(const char *key, const char *value);
 static void process_syncing_tables(XLogRecPtr end_lsn);
 static void start_sync_worker(Name nspname, Name relname);
+static bool apply_receive_spool(void);
+static void recvq_forget_decoded(void);
+static PGLogicalRelation *apply_take_decoded(StringInfo s, bool *hasoldtup,
+											 PGLogicalTupleData **oldtup,
+											 PGLogicalTupleData **newtup);
+static void replication_handler(StringInfo s);
+#if PG_VERSION_NUM >= 140000
+static void handle_stream_start(StringInfo s);
+static void handle_stream_abort(StringInfo s);
+static void handle_stream_commit(StringInfo s);
+static void stream_handler(StringInfo s);
+static void stream_relation(StringInfo s);
+static int stream_helper_count(void);
+#endif
+static bool send_feedback(PGconn *conn, XLogRecPtr recvpos, int64 now,
+						  bool force);
 
 /*
  * Check if given relation is in process of being synchronized.
@@ -257,9 +481,67 @@ action_error_callback(void *arg)
 	pfree(si.data);
 }
 
+/*
+ * Make the changes applied so far visible to the following ones.
+ */
+static void
+apply_command_counter_increment(void)
+{
+	if (nchanged_rels == 0 && !command_counter_needed)
+		return;
+
+	CommandCounterIncrement();
+	if (ActiveSnapshotSet())
+		UpdateActiveSnapshotCommandId();
+
+	nchanged_rels = 0;
+	command_counter_needed = false;
+}
+
+/*
+ * Called before a change is applied to the relation.
+ *
+ * We don't increment the command counter after every change, as that costs
+ * time and, more importantly, the command ids, of which a transaction only
+ * has 2^32. A change only needs to see the previous ones when it touches the
+ * same relation, as it may have to find or lock the rows they wrote, or when
+ * triggers are involved, as those can look anywhere.
+ */
+static void
+apply_prepare_change(PGLogicalRelation *rel)
+{
+	Oid		relid = RelationGetRelid(rel->rel);
+	bool	needed;
+	int		i;
+
+	needed = command_counter_needed || rel->hasTriggers ||
+		nchanged_rels >= MAX_CHANGED_RELS;
+
+#if PG_VERSION_NUM >= 100000
+	/* Rows are routed between partitions, don't try to keep track. */
+	if (rel->rel->rd_rel->relkind == RELKIND_PARTITIONED_TABLE ||
+		rel->rel->rd_rel->relispartition)
+		needed = true;
+#endif
+
+	for (i = 0; i < nchanged_rels && !needed; i++)
+	{
+		if (changed_rels[i] == relid)
+			needed = true;
+	}
+
+	if (needed)
+		apply_command_counter_increment();
+
+	changed_rels[nchanged_rels++] = relid;
+	command_counter_needed = rel->hasTriggers;
+}
+
 static bool
 ensure_transaction(void)
 {
+	remote_xact_changed = true;
+
 	if (IsTransactionState())
 	{
 		if (CurrentMemoryContext != MessageContext)
@@ -277,12 +559,152 @@ ensure_transaction(void)
 	SetCurrentStatementStartTimestamp();
 
 	StartTransactionCommand();
+	nchanged_rels = 0;
+	command_counter_needed = false;
 	apply_api.on_begin();
 	MemoryContextSwitchTo(MessageContext);
 
 	return true;
 }
 
+/*
+ * Commit the local transaction and remember the remote position it covers,
+ * so that it can be reported as flushed once the commit is flushed locally.
+ */
+static void
+commit_local_transaction(XLogRecPtr end_lsn)
+{
+	/* Deferred triggers must see the last change too. */
+	apply_command_counter_increment();
+
+	apply_api.on_commit();
+
+	/* We need to write end_lsn to the commit record. */
+	replorigin_session_origin_lsn = end_lsn;
+
+	CommitTransactionCommand();
+
+	apply_track_commit(end_lsn, XactLastCommitEnd);
+}
+
+/*
+ * Remember that the remote transaction ending at end_lsn was committed
+ * locally at local_end.
+ */
+static void
+apply_track_commit(XLogRecPtr end_lsn, XLogRecPtr local_end)
+{
+	PGLFlushPosition *flushpos;
+
+	MemoryContextSwitchTo(TopMemoryContext);
+
+	/* Track commit lsn  */
+	flushpos = (PGLFlushPosition *) palloc(sizeof(PGLFlushPosition));
+	flushpos->local_end = local_end;
+	flushpos->remote_end = end_lsn;
+
+	dlist_push_tail(&lsn_mapping, &flushpos->node);
+	MemoryContextSwitchTo(MessageContext);
+
+	/*
+	 * Flush the commit and report it to the provider right away instead of
+	 * waiting for the main loop to notice, a provider waiting for us as a
+	 * synchronous standby can't commit until then. Transactions replayed
+	 * from the spool were confirmed when they were spooled.
+	 */
+	if (pglogical_synchronous_feedback && applyconn != NULL &&
+		!pglogical_spool_active())
+	{
+		XLogFlush(local_end);
+		send_feedback(applyconn, end_lsn, GetCurrentTimestamp(), false);
+	}
+}
+
+/*
+ * Decide if the commit of the remote transaction which has just been applied
+ * can be deferred so that the following remote transactions are applied in
+ * the same local transaction.
+ *
+ * Committing many tiny transactions one by one costs more than applying them.
+ * The group is bounded by pglogical.apply_group_size transactions and
+ * pglogical.apply_group_timeout, and it's also committed whenever there is
+ * no more data to apply at the moment.
+ */
+static bool
+apply_group_defer(XLogRecPtr end_lsn, TimestampTz commit_time)
+{
+	TimestampTz		now;
+
+	if (pglogical_apply_group_size <= 1 ||
+		MyPGLogicalWorker->worker_type != PGLOGICAL_WORKER_APPLY ||
+		MyApplyWorker->replay_stop_lsn != InvalidXLogRecPtr)
+		return false;
+
+	/*
+	 * Forwarded transactions advance the origin of the node they came from
+	 * using the local commit position, and queued messages may contain DDL
+	 * which is better committed on its own.
+	 */
+	if (remote_origin_id != InvalidRepOriginId || remote_xact_ends_group)
+		return false;
+
+	/*
+	 * All the rows written by the group get the commit timestamp of its last
+	 * transaction, which would skew timestamp based conflict resolution.
+	 */
+	if (pglogical_conflict_resolver == PGLOGICAL_RESOLVE_LAST_UPDATE_WINS ||
+		pglogical_conflict_resolver == PGLOGICAL_RESOLVE_FIRST_UPDATE_WINS)
+		return false;
+
+	if (group_xacts + 1 >= pglogical_apply_group_size ||
+		group_actions + xact_action_counter >= APPLY_GROUP_MAX_ACTIONS)
+		return false;
+
+	now = GetCurrentTimestamp();
+	if (group_xacts == 0)
+		group_start_time = now;
+	else if (TimestampDifferenceExceeds(group_start_time, now,
+										pglogical_apply_group_timeout))
+		return false;
+
+	group_xacts++;
+	group_actions += xact_action_counter;
+	group_end_lsn = end_lsn;
+	group_commit_time = commit_time;
+
+	return true;
+}
+
+/*
+ * Commit the remote transactions whose commit was deferred, if any.
+ *
+ * Can be called at the start of the next remote transaction, before it has
+ * written anything.
+ */
+static void
+apply_group_commit(void)
+{
+	XLogRecPtr		origin_lsn = replorigin_session_origin_lsn;
+	TimestampTz		origin_timestamp = replorigin_session_origin_timestamp;
+
+	if (group_xacts == 0)
+		return;
+
+	Assert(IsTransactionState());
+
+	multi_insert_finish();
+
+	/* The commit record has to carry the position of the last transaction. */
+	replorigin_session_origin_timestamp = group_commit_time;
+	commit_local_transaction(group_end_lsn);
+
+	replorigin_session_origin_lsn = origin_lsn;
+	replorigin_session_origin_timestamp = origin_timestamp;
+
+	group_xacts = 0;
+	group_actions = 0;
+}
+
 static void
 handle_begin(StringInfo s)
 {
@@ -297,30 +719,19 @@ handle_begin(StringInfo s)
 	replorigin_session_origin_timestamp = commit_time;
 	replorigin_session_origin_lsn = commit_lsn;
 	remote_origin_id = InvalidRepOriginId;
+	remote_xact_changed = false;
+	remote_xact_ends_group = false;
+	apply_memory_reported = false;
+
+#if PG_VERSION_NUM >= 140000
+	/* It may have to wait for a helper, see stream_start_helper(). */
+	if (stream_helper_count() > 0)
+		MyApplyWorker->stream_file_lsn = commit_lsn;
+#endif
 
 	VALGRIND_PRINTF("PGLOGICAL_APPLY: begin %u\n", remote_xid);
 
-	/* don't want the overhead otherwise */
-	if (apply_delay > 0)
-	{
-		TimestampTz		current;
-		current = GetCurrentIntegerTimestamp();
-
-		/* ensure no weirdness due to clock drift */
-		if (current > replorigin_session_origin_timestamp)
-		{
-			long		sec;
-			int			usec;
-
-			current = TimestampTzPlusMilliseconds(current,
-												  -apply_delay);
-
-			TimestampDifference(current, replorigin_session_origin_timestamp,
-								&sec, &usec);
-			/* FIXME: deal with overflow? */
-			pg_usleep(usec + (sec * USECS_PER_SEC));
-		}
-	}
+	/* The apply_delay, if any, was already waited out by apply_work(). */
 
 	in_remote_transaction = true;
 
@@ -342,29 +753,32 @@ handle_commit(StringInfo s)
 
 	pglogical_read_commit(s, &commit_lsn, &end_lsn, &commit_time);
 
+	apply_remote_commit(end_lsn, commit_time);
+}
+
+/*
+ * Commit the remote transaction which has just been applied, unless it's
+ * grouped with the following ones.
+ */
+static void
+apply_remote_commit(XLogRecPtr end_lsn, TimestampTz commit_time)
+{
+	bool			deferred = false;
+
 	Assert(commit_time == replorigin_session_origin_timestamp);
 
 	if (IsTransactionState())
 	{
-		PGLFlushPosition *flushpos;
-
 		multi_insert_finish();
 
-		apply_api.on_commit();
-
-		/* We need to write end_lsn to the commit record. */
-		replorigin_session_origin_lsn = end_lsn;
-
-		CommitTransactionCommand();
-		MemoryContextSwitchTo(TopMemoryContext);
-
-		/* Track commit lsn  */
-		flushpos = (PGLFlushPosition *) palloc(sizeof(PGLFlushPosition));
-		flushpos->local_end = XactLastCommitEnd;
-		flushpos->remote_end = end_lsn;
-
-		dlist_push_tail(&lsn_mapping, &flushpos->node);
-		MemoryContextSwitchTo(MessageContext);
+		if (apply_group_defer(end_lsn, commit_time))
+			deferred = true;
+		else
+		{
+			commit_local_transaction(end_lsn);
+			group_xacts = 0;
+			group_actions = 0;
+		}
 	}
 
 	/*
@@ -472,6 +886,13 @@ handle_commit(StringInfo s)
 	xact_action_counter = 0;
 	remote_xid = InvalidTransactionId;
 
+	/* The rest waits for the commit of the group. */
+	if (deferred)
+	{
+		pgstat_report_activity(STATE_IDLE, NULL);
+		return;
+	}
+
 	process_syncing_tables(end_lsn);
 
 	/*
@@ -500,6 +921,9 @@ handle_origin(StringInfo s)
 	 * ORIGIN message can only come inside remote transaction and before
 	 * any actual writes.
 	 */
+	if (in_remote_transaction && !remote_xact_changed)
+		apply_group_commit();
+
 	if (!in_remote_transaction || IsTransactionState())
 		elog(ERROR, "ORIGIN message sent out of order");
 
@@ -521,15 +945,70 @@ handle_relation(StringInfo s)
 {
 	multi_insert_finish();
 
+#if PG_VERSION_NUM >= 140000
+	/* Every open streamed transaction may need it. */
+	stream_relation(s);
+#endif
+
 	(void) pglogical_read_rel(s);
 }
 
+/*
+ * Insert one row into the relation, either directly or by adding it to the
+ * multi-insert batch of the relation.
+ *
+ * Returns true if the row went into the multi-insert batch, which then keeps
+ * the relation open.
+ */
+static bool
+apply_insert_tuple(PGLogicalRelation *rel, PGLogicalTupleData *newtup)
+{
+	/* Handle multi_insert capabilities. */
+	if (pglogical_batch_inserts &&
+		RelationGetRelid(rel->rel) != QueueRelid &&
+		apply_api.can_multi_insert &&
+		apply_api.can_multi_insert(rel))
+	{
+		MultiInsertRel *mirel = multi_insert_get_rel(rel);
+
+		if (mirel->active)
+		{
+			/* The batch may have to see the rows inserted before it. */
+			if (mirel->ninserts == 0)
+				apply_prepare_change(rel);
+
+			apply_api.multi_insert_add_tuple(rel, newtup);
+			mirel->ninserts++;
+			mirel->nrun++;
+			return true;
+		}
+
+		mirel->nrun++;
+		if (++mirel->ninserts > rel->mi_threshold)
+		{
+			/* Switch to multi-insert, starting with the next tuple. */
+			mirel->active = true;
+			mirel->ninserts = 0;
+		}
+	}
+	else
+		multi_insert_finish();
+
+	/* Normal insert. */
+	apply_prepare_change(rel);
+	apply_api.do_insert(rel, newtup);
+
+	return false;
+}
+
 static void
 handle_insert(StringInfo s)
 {
 	PGLogicalTupleData	newtup;
 	PGLogicalRelation  *rel;
+	bool				first_change = !remote_xact_changed;
 	bool				started_tx = ensure_transaction();
+	int					cursor = s->cursor;
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
@@ -539,54 +1018,45 @@ handle_insert(StringInfo s)
 	rel = pglogical_read_insert(s, RowExclusiveLock, &newtup);
 	errcallback_arg.rel = rel;
 
+	/*
+	 * Queued messages expect to be executed at the start of the transaction
+	 * when they come first, so commit the previously grouped transactions.
+	 */
+	if (RelationGetRelid(rel->rel) == QueueRelid && first_change &&
+		group_xacts > 0)
+	{
+		pglogical_relation_close(rel, NoLock);
+		PopActiveSnapshot();
+
+		apply_group_commit();
+
+		started_tx = ensure_transaction();
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		s->cursor = cursor;
+		rel = pglogical_read_insert(s, RowExclusiveLock, &newtup);
+		errcallback_arg.rel = rel;
+	}
+
 	/* If in list of relations which are being synchronized, skip. */
 	if (!should_apply_changes_for_rel(rel->nspname, rel->relname))
 	{
 		pglogical_relation_close(rel, NoLock);
 		PopActiveSnapshot();
-		CommandCounterIncrement();
 		return;
 	}
 
-	/* Handle multi_insert capabilities. */
-	if (use_multi_insert)
-	{
-		if (rel != last_insert_rel)
-		{
-			multi_insert_finish();
-			/* Fall through to normal insert. */
-		}
-		else
-		{
-			apply_api.multi_insert_add_tuple(rel, &newtup);
-			last_insert_rel_cnt++;
-			return;
-		}
-	}
-	else if (pglogical_batch_inserts &&
-			 RelationGetRelid(rel->rel) != QueueRelid &&
-			 apply_api.can_multi_insert &&
-			 apply_api.can_multi_insert(rel))
+	if (apply_insert_tuple(rel, &newtup))
 	{
-		if (rel != last_insert_rel)
-		{
-			last_insert_rel = rel;
-			last_insert_rel_cnt = 0;
-		}
-		else if (last_insert_rel_cnt++ >= MIN_MULTI_INSERT_TUPLES)
-		{
-			use_multi_insert = true;
-			last_insert_rel_cnt = 0;
-		}
+		PopActiveSnapshot();
+		return;
 	}
 
-	/* Normal insert. */
-	apply_api.do_insert(rel, &newtup);
-
 	/* if INSERT was into our queue, process the message. */
 	if (RelationGetRelid(rel->rel) == QueueRelid)
 	{
 		HeapTuple		ht;
+		QueuedMessage  *queued_message;
 		LockRelId		lockid = rel->rel->rd_lockInfo.lockRelId;
 		Relation		qrel;
 
@@ -596,16 +1066,21 @@ handle_insert(StringInfo s)
 
 		ht = heap_form_tuple(RelationGetDescr(rel->rel),
 							 newtup.values, newtup.nulls);
+		queued_message = queued_message_from_tuple(ht,
+												   RelationGetDescr(rel->rel),
+												   true);
 
 		LockRelationIdForSession(&lockid, RowExclusiveLock);
 		pglogical_relation_close(rel, NoLock);
 
 		PopActiveSnapshot();
-		CommandCounterIncrement();
+		apply_command_counter_increment();
 
 		apply_api.on_commit();
 
-		handle_queued_message(ht, started_tx);
+		handle_queued_message(queued_message, started_tx);
+		remote_xact_ends_group = true;
+		command_counter_needed = true;
 
 		heap_freetuple(ht);
 
@@ -626,74 +1101,222 @@ handle_insert(StringInfo s)
 		pglogical_relation_close(rel, NoLock);
 
 		PopActiveSnapshot();
-		CommandCounterIncrement();
-	}
-}
-
-static void
-multi_insert_finish(void)
-{
-	if (use_multi_insert && last_insert_rel_cnt)
-	{
-		const char *old_action = errcallback_arg.action_name;
-		PGLogicalRelation *old_rel = errcallback_arg.rel;
-		errcallback_arg.action_name = "multi INSERT";
-		errcallback_arg.rel = last_insert_rel;
-
-		apply_api.multi_insert_finish(last_insert_rel);
-		pglogical_relation_close(last_insert_rel, NoLock);
-		use_multi_insert = false;
-		last_insert_rel = NULL;
-		last_insert_rel_cnt = 0;
-
-		errcallback_arg.rel = old_rel;
-		errcallback_arg.action_name = old_action;
 	}
 }
 
+/*
+ * Handle INSERT BATCH message.
+ *
+ * The rows go through the same path as single INSERTs, so a long enough
+ * batch ends up in the multi-insert batch of the relation. The queue table
+ * is never sent this way.
+ */
 static void
-handle_update(StringInfo s)
+handle_insert_batch(StringInfo s)
 {
-	PGLogicalTupleData	oldtup;
+	PGLogicalBatchReader batch;
 	PGLogicalTupleData	newtup;
 	PGLogicalRelation  *rel;
-	bool				hasoldtup;
-
-	errcallback_arg.action_name = "UPDATE";
-	xact_action_counter++;
 
 	ensure_transaction();
 
-	multi_insert_finish();
-
 	PushActiveSnapshot(GetTransactionSnapshot());
 
-	rel = pglogical_read_update(s, RowExclusiveLock, &hasoldtup, &oldtup,
-								&newtup);
+	errcallback_arg.action_name = "INSERT";
+
+	rel = pglogical_read_insert_batch(s, RowExclusiveLock, &batch);
 	errcallback_arg.rel = rel;
 
 	/* If in list of relations which are being synchronized, skip. */
 	if (!should_apply_changes_for_rel(rel->nspname, rel->relname))
 	{
-		pglogical_relation_close(rel, NoLock);
+		xact_action_counter += batch.nrows;
+		if (!multi_insert_holds_rel(rel))
+			pglogical_relation_close(rel, NoLock);
 		PopActiveSnapshot();
-		CommandCounterIncrement();
 		return;
 	}
 
-	apply_api.do_update(rel, hasoldtup ? &oldtup : &newtup, &newtup);
+	while (batch.row < batch.nrows)
+	{
+		xact_action_counter++;
+
+		pglogical_read_batch_tuple(&batch, rel, &newtup);
+		apply_insert_tuple(rel, &newtup);
+	}
+
+	if (!multi_insert_holds_rel(rel))
+		pglogical_relation_close(rel, NoLock);
+
+	PopActiveSnapshot();
+}
+
+/*
+ * Find the multi-insert tracking entry for the relation, adding it if needed.
+ *
+ * Inserts into several relations can be batched at the same time, as long as
+ * none of them has row triggers. Triggers could observe the changed order in
+ * which the rows end up being written, so such relation is always batched on
+ * its own.
+ */
+static MultiInsertRel *
+multi_insert_get_rel(PGLogicalRelation *rel)
+{
+	MultiInsertRel *mirel;
+	int				i;
+
+	for (i = 0; i < mi_nrels; i++)
+	{
+		if (mi_rels[i].rel == rel)
+		{
+			if (mi_nrels > 1 && rel->hasTriggers)
+				break;
+			return &mi_rels[i];
+		}
+		else if (mi_rels[i].rel->hasTriggers || rel->hasTriggers)
+			break;
+	}
+
+	if (i < mi_nrels || mi_nrels >= MAX_MULTI_INSERT_RELS)
+		multi_insert_finish();
+
+	if (rel->mi_threshold <= 0)
+		rel->mi_threshold = MIN_MULTI_INSERT_TUPLES;
+
+	mirel = &mi_rels[mi_nrels++];
+	mirel->rel = rel;
+	mirel->ninserts = 0;
+	mirel->nrun = 0;
+	mirel->active = false;
+
+	return mirel;
+}
+
+/*
+ * End the run of inserts into the relation, writing out its multi-insert
+ * batch, and adapt its switch threshold.
+ *
+ * A run counts as a hit when it was long enough for a batch started at the
+ * initial threshold to pay off, whether it was batched or not, so that the
+ * hit rate doesn't depend on the threshold itself. After every
+ * MULTI_INSERT_RATE_RUNS runs, switch to multi-insert sooner when most of
+ * them were hits and later when few were.
+ */
+static void
+multi_insert_end(MultiInsertRel *mirel)
+{
+	PGLogicalRelation *rel = mirel->rel;
+
+	rel->mi_runs++;
+	if (mirel->nrun >= 2 * MIN_MULTI_INSERT_TUPLES)
+		rel->mi_hits++;
+
+	if (rel->mi_runs >= MULTI_INSERT_RATE_RUNS)
+	{
+		if (rel->mi_hits * 4 >= rel->mi_runs * 3)
+			rel->mi_threshold = Max(rel->mi_threshold / 2, 1);
+		else if (rel->mi_hits * 4 < rel->mi_runs)
+			rel->mi_threshold = Min(rel->mi_threshold * 2,
+									MAX_MULTI_INSERT_THRESHOLD);
+		rel->mi_runs = 0;
+		rel->mi_hits = 0;
+	}
+
+	if (!mirel->active)
+		return;
+
+	if (mirel->ninserts > 0)
+	{
+		const char *old_action = errcallback_arg.action_name;
+		PGLogicalRelation *old_rel = errcallback_arg.rel;
+		errcallback_arg.action_name = "multi INSERT";
+		errcallback_arg.rel = rel;
+
+		apply_prepare_change(rel);
+		apply_api.multi_insert_finish(rel);
+		pglogical_relation_close(rel, NoLock);
+
+		errcallback_arg.rel = old_rel;
+		errcallback_arg.action_name = old_action;
+	}
+}
+
+/*
+ * Does a multi-insert batch in progress keep the relation open?
+ */
+static bool
+multi_insert_holds_rel(PGLogicalRelation *rel)
+{
+	int		i;
+
+	for (i = 0; i < mi_nrels; i++)
+	{
+		if (mi_rels[i].rel == rel)
+			return mi_rels[i].active && mi_rels[i].ninserts > 0;
+	}
+
+	return false;
+}
+
+static void
+multi_insert_finish(void)
+{
+	int		i;
+
+	for (i = 0; i < mi_nrels; i++)
+		multi_insert_end(&mi_rels[i]);
+
+	mi_nrels = 0;
+}
+
+static void
+handle_update(StringInfo s)
+{
+	PGLogicalTupleData	oldtupbuf;
+	PGLogicalTupleData	newtupbuf;
+	PGLogicalTupleData *oldtup = &oldtupbuf;
+	PGLogicalTupleData *newtup = &newtupbuf;
+	PGLogicalRelation  *rel;
+	bool				hasoldtup;
+
+	errcallback_arg.action_name = "UPDATE";
+	xact_action_counter++;
+
+	ensure_transaction();
+
+	multi_insert_finish();
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	rel = apply_take_decoded(s, &hasoldtup, &oldtup, &newtup);
+	if (rel == NULL)
+		rel = pglogical_read_update(s, RowExclusiveLock, &hasoldtup, oldtup,
+									newtup);
+	errcallback_arg.rel = rel;
+
+	/* If in list of relations which are being synchronized, skip. */
+	if (!should_apply_changes_for_rel(rel->nspname, rel->relname))
+	{
+		pglogical_relation_close(rel, NoLock);
+		PopActiveSnapshot();
+		return;
+	}
+
+	apply_prepare_change(rel);
+	apply_api.do_update(rel, hasoldtup ? oldtup : newtup, newtup);
 
 	pglogical_relation_close(rel, NoLock);
 
 	PopActiveSnapshot();
-	CommandCounterIncrement();
 }
 
 static void
 handle_delete(StringInfo s)
 {
-	PGLogicalTupleData	oldtup;
+	PGLogicalTupleData	oldtupbuf;
+	PGLogicalTupleData *oldtup = &oldtupbuf;
 	PGLogicalRelation  *rel;
+	bool				hasoldtup;
 
 	memset(&errcallback_arg, 0, sizeof(struct ActionErrCallbackArg));
 	xact_action_counter++;
@@ -704,7 +1327,9 @@ handle_delete(StringInfo s)
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
-	rel = pglogical_read_delete(s, RowExclusiveLock, &oldtup);
+	rel = apply_take_decoded(s, &hasoldtup, &oldtup, NULL);
+	if (rel == NULL)
+		rel = pglogical_read_delete(s, RowExclusiveLock, oldtup);
 	errcallback_arg.rel = rel;
 
 	/* If in list of relations which are being synchronized, skip. */
@@ -712,16 +1337,15 @@ handle_delete(StringInfo s)
 	{
 		pglogical_relation_close(rel, NoLock);
 		PopActiveSnapshot();
-		CommandCounterIncrement();
 		return;
 	}
 
-	apply_api.do_delete(rel, &oldtup);
+	apply_prepare_change(rel);
+	apply_api.do_delete(rel, oldtup);
 
 	pglogical_relation_close(rel, NoLock);
 
 	PopActiveSnapshot();
-	CommandCounterIncrement();
 }
 
 inline static bool
@@ -802,6 +1426,13 @@ handle_startup_param(const char *key, const char *value)
 		elog(DEBUG1, "changeset origin forwarding enabled: %s", fwd ? "t" : "f");
 	}
 
+	if (strcmp(key, "streaming") == 0)
+	{
+		bool streaming = parse_bool_param(key, value);
+		elog(DEBUG1, "streaming of in-progress transactions enabled: %s",
+			 streaming ? "t" : "f");
+	}
+
 	/*
 	 * We just ignore a bunch of parameters here because we specify what we
 	 * require when we send our params to the upstream. It's required to ERROR
@@ -1083,15 +1714,15 @@ handle_sql(QueuedMessage *queued_message, bool tx_just_started)
  * Handles messages comming from the queue.
  */
 static void
-handle_queued_message(HeapTuple msgtup, bool tx_just_started)
+handle_queued_message(QueuedMessage *queued_message, bool tx_just_started)
 {
-	QueuedMessage  *queued_message;
 	const char	   *old_action_name;
 
 	old_action_name = errcallback_arg.action_name;
 	errcallback_arg.is_ddl_or_drop = true;
 
-	queued_message = queued_message_from_tuple(msgtup);
+	/* The rows decoded ahead may not fit the tables after it. */
+	recvq_forget_decoded();
 
 	switch (queued_message->message_type)
 	{
@@ -1120,11 +1751,97 @@ handle_queued_message(HeapTuple msgtup, bool tx_just_started)
 	errcallback_arg.is_ddl_or_drop = false;
 }
 
+/*
+ * Handle QUEUED MESSAGE, the queued message sent as logical decoding message
+ * rather than as INSERT into the queue table.
+ */
+static void
+handle_queued_logical_message(StringInfo s)
+{
+	QueuedMessage  *queued_message;
+	const char	   *message;
+	int				len;
+	bool			first_change = !remote_xact_changed;
+	bool			started_tx;
+
+	errcallback_arg.action_name = "QUEUED_MESSAGE";
+	xact_action_counter++;
+
+	message = pglogical_read_queued_message(s, &len);
+
+	started_tx = ensure_transaction();
+
+	/* See handle_insert(). */
+	if (first_change && group_xacts > 0)
+	{
+		apply_group_commit();
+		started_tx = ensure_transaction();
+	}
+
+	multi_insert_finish();
+
+	MemoryContextSwitchTo(MessageContext);
+
+	queued_message = queued_message_from_logical_message(message, len, true);
+
+	/* Passed on to our own subscribers, same as rows of the queue table. */
+	queue_forward_logical_message(message, len);
+
+	apply_command_counter_increment();
+
+	apply_api.on_commit();
+
+	handle_queued_message(queued_message, started_tx);
+	remote_xact_ends_group = true;
+	command_counter_needed = true;
+
+	apply_api.on_begin();
+	MemoryContextSwitchTo(MessageContext);
+}
+
+/*
+ * Keep the memory used by the apply worker within
+ * pglogical.apply_memory_limit where we can and report when we can't.
+ *
+ * The batched inserts are the only thing which can be given back before the
+ * transaction ends, the rest is held by the executor and by the transaction
+ * itself.
+ */
+static void
+apply_check_memory(void)
+{
+#if PG_VERSION_NUM >= 130000
+	Size		limit = (Size) pglogical_apply_memory_limit * 1024;
+	Size		used;
+
+	used = MemoryContextMemAllocated(TopMemoryContext, true);
+	if (used <= limit)
+		return;
+
+	multi_insert_finish();
+
+	used = MemoryContextMemAllocated(TopMemoryContext, true);
+	if (used <= limit || apply_memory_reported)
+		return;
+
+	apply_memory_reported = true;
+
+	ereport(LOG,
+			(errmsg("apply worker for subscription \"%s\" uses %zu kB of memory, more than pglogical.apply_memory_limit",
+					MySubscription->name, used / 1024),
+			 errdetail("The transaction holds %zu kB, the message being applied %zu kB, after %u changes of remote transaction %u.",
+					   MemoryContextMemAllocated(TopTransactionContext, true) / 1024,
+					   MemoryContextMemAllocated(MessageContext, true) / 1024,
+					   xact_action_counter, remote_xid)));
+#endif
+}
+
 static void
 replication_handler(StringInfo s)
 {
 	ErrorContextCallback errcallback;
 	char action = pq_getmsgbyte(s);
+	StringInfoData raw;
 
 	memset(&errcallback_arg, 0, sizeof(struct ActionErrCallbackArg));
 	errcallback.callback = action_error_callback;
@@ -1134,6 +1851,26 @@ replication_handler(StringInfo s)
 
 	Assert(CurrentMemoryContext == MessageContext);
 
+	/* Compressed messages are handled as the message they wrap. */
+	if (action == 'Z')
+	{
+		int			len = s->len - s->cursor;
+		instr_time	start;
+		instr_time	duration;
+
+		INSTR_TIME_SET_CURRENT(start);
+		pglogical_read_compressed(s, &raw);
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, start);
+
+		MyApplyWorker->compressed_bytes += len;
+		MyApplyWorker->decompressed_bytes += raw.len;
+		MyApplyWorker->decompress_time += INSTR_TIME_GET_MILLISEC(duration);
+
+		s = &raw;
+		action = pq_getmsgbyte(s);
+	}
+
 	switch (action)
 	{
 		/* BEGIN */
@@ -1156,6 +1893,10 @@ replication_handler(StringInfo s)
 		case 'I':
 			handle_insert(s);
 			break;
+		/* INSERT BATCH */
+		case 'M':
+			handle_insert_batch(s);
+			break;
 		/* UPDATE */
 		case 'U':
 			handle_update(s);
@@ -1164,10 +1905,28 @@ replication_handler(StringInfo s)
 		case 'D':
 			handle_delete(s);
 			break;
+		/* QUEUED MESSAGE */
+		case 'Q':
+			handle_queued_logical_message(s);
+			break;
 		/* STARTUP MESSAGE */
 		case 'S':
 			handle_startup(s);
 			break;
+#if PG_VERSION_NUM >= 140000
+		/* STREAM START */
+		case 's':
+			handle_stream_start(s);
+			break;
+		/* STREAM ABORT */
+		case 'a':
+			handle_stream_abort(s);
+			break;
+		/* STREAM COMMIT */
+		case 'c':
+			handle_stream_commit(s);
+			break;
+#endif
 		default:
 			elog(ERROR, "unknown action of type %c", action);
 	}
@@ -1177,16 +1936,19 @@ replication_handler(StringInfo s)
 	if (error_context_stack == &errcallback)
 		error_context_stack = errcallback.previous;
 
-	if (action == 'C')
-	{
-		/*
-		 * We clobber MessageContext on commit. It doesn't matter much when we
-		 * do it so long as we do so periodically, to prevent the context from
-		 * growing too much. We might want to clean it up even 'n'th message
-		 * too, but that adds testing burden and isn't done for now.
-		 */
-		MemoryContextReset(MessageContext);
-	}
+	/*
+	 * Nothing allocated in MessageContext while handling a message is needed
+	 * once it's done, so clobber it after every message rather than only on
+	 * commit or when the main loop runs out of data to apply, otherwise a
+	 * huge transaction received in one go grows it without bounds.
+	 */
+	MemoryContextReset(MessageContext);
+
+	if (pglogical_apply_memory_limit > 0 &&
+		(action == 'M' ||
+		 ((action == 'I' || action == 'U' || action == 'D') &&
+		  xact_action_counter % APPLY_MEMORY_CHECK_INTERVAL == 0)))
+		apply_check_memory();
 }
 
 /*
@@ -1272,6 +2034,17 @@ send_feedback(PGconn *conn, XLogRecPtr recvpos, int64 now, bool force)
 		flushpos = writepos = recvpos;
 	}
 
+	/* Whatever is safely spooled can be confirmed as flushed. */
+	if (pglogical_spool_writing())
+	{
+		XLogRecPtr	spooled = pglogical_spool_flushed_lsn();
+
+		if (writepos < spooled)
+			writepos = spooled;
+		if (flushpos < spooled)
+			flushpos = spooled;
+	}
+
 	if (writepos < last_writepos)
 		writepos = last_writepos;
 
@@ -1328,76 +2101,810 @@ send_feedback(PGconn *conn, XLogRecPtr recvpos, int64 now, bool force)
 }
 
 /*
- * Apply main loop.
+ * Publish the receive queue fill for monitoring.
  */
-void
-apply_work(PGconn *streamConn)
+static void
+recvq_report(void)
 {
-	int			fd;
-	char	   *copybuf = NULL;
-	XLogRecPtr	last_received = InvalidXLogRecPtr;
+	MyApplyWorker->recvq_messages = recvq_count;
+	MyApplyWorker->recvq_bytes = recvq_bytes;
+}
 
-	applyconn = streamConn;
-	fd = PQsocket(applyconn);
+/*
+ * Get next message from the receive queue, or from the connection if the
+ * queue is empty. Same return values as PQgetCopyData.
+ */
+static int
+apply_get_next_message(char **buffer)
+{
+	if (pglogical_spool_active())
+	{
+		int		r = pglogical_spool_read(buffer);
 
-	/* Init the MessageContext which we use for easier cleanup. */
-	MessageContext = AllocSetContextCreate(TopMemoryContext,
-										   "MessageContext",
-										   ALLOCSET_DEFAULT_SIZES);
+		while (r == 0 && pglogical_spool_writing() && apply_receive_spool())
+			r = pglogical_spool_read(buffer);
 
-	MemoryContextSwitchTo(MessageContext);
+		if (r > 0)
+		{
+			copybuf_spooled = true;
+			return r;
+		}
 
-	/* mark as idle, before starting to loop */
-	pgstat_report_activity(STATE_IDLE, NULL);
-	Assert(CurrentMemoryContext == MessageContext);
+		/*
+		 * When spooling, everything comes through the spool, otherwise we
+		 * were just replaying what was left in it and can continue with the
+		 * connection now.
+		 */
+		if (pglogical_spool_writing())
+			return recvq_status;
+	}
 
-	while (!got_SIGTERM)
+	if (recvq_count > 0)
 	{
-		int			rc;
-		int			r;
+		ReceivedMessage	   *msg = &recvq_msgs[recvq_head];
 
-		/*
-		 * Background workers mustn't call usleep() or any direct equivalent:
-		 * instead, they may wait on their process latch, which sleeps as
-		 * necessary, but is awakened if postmaster dies.  That way the
-		 * background process goes away immediately in an emergency.
-		 */
-		rc = WaitLatchOrSocket(&MyProc->procLatch,
-							   WL_SOCKET_READABLE | WL_LATCH_SET |
-							   WL_TIMEOUT | WL_POSTMASTER_DEATH,
-							   fd, 1000L);
+		*buffer = msg->buf;
+		if (msg->decoded != NULL)
+		{
+			Assert(decoded_change == NULL);
+			decoded_change = msg->decoded;
+			decoded_buf = msg->buf;
+			msg->decoded = NULL;
+		}
+		recvq_head = (recvq_head + 1) % recvq_size;
+		recvq_count--;
+		recvq_bytes -= msg->len;
+		if (recvq_examined > 0)
+			recvq_examined--;
+		recvq_report();
+
+		return msg->len;
+	}
 
-		ResetLatch(&MyProc->procLatch);
+	if (recvq_status != 0)
+		return recvq_status;
 
-		Assert(CurrentMemoryContext == MessageContext);
+	return PQgetCopyData(applyconn, buffer, 1);
+}
 
-		/* emergency bailout if postmaster has died */
-		if (rc & WL_POSTMASTER_DEATH)
-			proc_exit(1);
+/*
+ * Check if the message is BEGIN of a transaction which is not supposed to be
+ * applied yet because of apply_delay.
+ */
+static bool
+apply_delay_message(char *buf, int len)
+{
+	StringInfoData	s;
+	TimestampTz		commit_time;
+	TimestampTz		current;
 
-		if (rc & WL_SOCKET_READABLE)
-			PQconsumeInput(applyconn);
+	memset(&s, 0, sizeof(StringInfoData));
+	s.data = buf;
+	s.len = len;
+	s.maxlen = -1;
+	s.cursor = 0;
 
-		if (PQstatus(applyconn) == CONNECTION_BAD)
+	/* 'w', dataStart, walEnd, sendTime, action */
+	if (len <= 25 || buf[0] != 'w' || buf[25] != 'B')
+		return false;
+
+	s.cursor = 26;
+	pq_getmsgbyte(&s);			/* flags */
+	pq_getmsgint64(&s);			/* commit_lsn */
+	commit_time = pq_getmsgint64(&s);
+
+	current = GetCurrentIntegerTimestamp();
+
+	/* ensure no weirdness due to clock drift */
+	if (current <= commit_time)
+		return false;
+
+	apply_delay_until = TimestampTzPlusMilliseconds(commit_time, apply_delay);
+
+	return current < apply_delay_until;
+}
+
+/*
+ * Milliseconds left until the held back transaction can be applied.
+ */
+static long
+apply_delay_remaining(void)
+{
+	long		sec;
+	int			usec;
+
+	TimestampDifference(GetCurrentIntegerTimestamp(), apply_delay_until,
+						&sec, &usec);
+
+	return sec * 1000 + (usec + 999) / 1000;
+}
+
+/*
+ * Get next message to apply, see apply_get_next_message().
+ *
+ * When the next transaction has to wait for apply_delay, its BEGIN is held
+ * back and 0 is returned until the time comes, as if there was nothing
+ * received yet. The main loop keeps receiving and sending feedback meanwhile.
+ */
+static int
+apply_get_copy_data(char **buffer)
+{
+	int		r;
+
+	if (delayed_buf != NULL)
+	{
+		if (GetCurrentIntegerTimestamp() < apply_delay_until)
 		{
-			elog(ERROR, "connection to other side has died");
+			*buffer = NULL;
+			return 0;
 		}
 
-		Assert(CurrentMemoryContext == MessageContext);
+		*buffer = delayed_buf;
+		copybuf_spooled = delayed_spooled;
+		r = delayed_len;
+		delayed_buf = NULL;
 
-		for (;;)
-		{
-			if (got_SIGTERM)
-				break;
+		return r;
+	}
 
-			/* We must not have fallen out of MessageContext by accident */
-			Assert(CurrentMemoryContext == MessageContext);
+	r = apply_get_next_message(buffer);
 
-			Assert(copybuf == NULL);
-			r = PQgetCopyData(applyconn, &copybuf, 1);
+	if (r > 0 && apply_delay > 0 && apply_delay_message(*buffer, r))
+	{
+		delayed_buf = *buffer;
+		delayed_len = r;
+		delayed_spooled = copybuf_spooled;
+		copybuf_spooled = false;
 
-			if (r == -1)
-			{
+		*buffer = NULL;
+		return 0;
+	}
+
+	return r;
+}
+
+/*
+ * Write received message into the spool.
+ *
+ * Keepalives are not spooled, only the position they report is remembered.
+ */
+static void
+spool_message(char *buf, int len, XLogRecPtr *recvpos, bool *reply_requested)
+{
+	StringInfoData	s;
+	XLogRecPtr		start_lsn;
+	XLogRecPtr		end_lsn;
+	char			action;
+
+	memset(&s, 0, sizeof(StringInfoData));
+	s.data = buf;
+	s.len = len;
+	s.maxlen = -1;
+	s.cursor = 0;
+
+	switch (pq_getmsgbyte(&s))
+	{
+		case 'k':
+			end_lsn = pq_getmsgint64(&s);
+			pq_getmsgint64(&s);		/* sendTime */
+			if (pq_getmsgbyte(&s))
+				*reply_requested = true;
+			if (*recvpos < end_lsn)
+				*recvpos = end_lsn;
+			return;
+		case 'w':
+			break;
+		default:
+			/* other message types are purposefully ignored */
+			return;
+	}
+
+	start_lsn = pq_getmsgint64(&s);
+	end_lsn = pq_getmsgint64(&s);
+	pq_getmsgint64(&s);			/* sendTime */
+
+	if (*recvpos < start_lsn)
+		*recvpos = start_lsn;
+	if (*recvpos < end_lsn)
+		*recvpos = end_lsn;
+
+	action = pq_getmsgbyte(&s);
+	switch (action)
+	{
+		case 'B':
+			pq_getmsgbyte(&s);	/* flags */
+			spool_xact_lsn = pq_getmsgint64(&s);
+			pglogical_spool_write(buf, len, spool_xact_lsn, InvalidXLogRecPtr);
+			break;
+		case 'C':
+			pq_getmsgbyte(&s);	/* flags */
+			pq_getmsgint64(&s);	/* commit_lsn */
+			end_lsn = pq_getmsgint64(&s);
+			pglogical_spool_write(buf, len, spool_xact_lsn, end_lsn);
+			spool_xact_lsn = InvalidXLogRecPtr;
+			break;
+		case 'R':
+			pq_getmsgbyte(&s);	/* flags */
+			pglogical_spool_write_metadata(pq_getmsgint(&s, 4), buf, len,
+										   spool_xact_lsn);
+			break;
+		default:
+			pglogical_spool_write(buf, len, spool_xact_lsn, InvalidXLogRecPtr);
+			break;
+	}
+}
+
+/*
+ * Receive whatever the provider has sent so far into the spool and confirm
+ * it as flushed once it's on disk.
+ */
+static bool
+apply_receive_spool(void)
+{
+	Size		limit = (Size) pglogical_receive_queue_size * 1024;
+	Size		received = 0;
+	XLogRecPtr	recvpos = InvalidXLogRecPtr;
+	bool		reply_requested = false;
+
+	if (recvq_status != 0)
+		return false;
+
+	/* Errors are reported by the main loop when it checks the connection. */
+	(void) PQconsumeInput(applyconn);
+
+	do
+	{
+		char	   *buf = NULL;
+		int			r = PQgetCopyData(applyconn, &buf, 1);
+
+		if (r == 0)
+			break;
+		else if (r < 0)
+		{
+			/* Let apply_get_copy_data() report it in order. */
+			recvq_status = r;
+			break;
+		}
+
+		spool_message(buf, r, &recvpos, &reply_requested);
+		PQfreemem(buf);
+		received += r;
+	} while (received < limit);
+
+	if (received == 0)
+		return false;
+
+	pglogical_spool_flush();
+	send_feedback(applyconn, recvpos, GetCurrentTimestamp(), reply_requested);
+
+	return true;
+}
+
+/*
+ * Add message to the end of the receive queue.
+ */
+static void
+recvq_push(char *buf, int len)
+{
+	ReceivedMessage	   *msg;
+
+	if (recvq_count == recvq_size)
+	{
+		int					newsize = Max(recvq_size * 2, INITIAL_RECVQ_SIZE);
+		ReceivedMessage	   *newmsgs;
+		int					i;
+
+		newmsgs = MemoryContextAlloc(TopMemoryContext,
+									 newsize * sizeof(ReceivedMessage));
+		for (i = 0; i < recvq_count; i++)
+			newmsgs[i] = recvq_msgs[(recvq_head + i) % recvq_size];
+
+		if (recvq_msgs)
+			pfree(recvq_msgs);
+		recvq_msgs = newmsgs;
+		recvq_size = newsize;
+		recvq_head = 0;
+	}
+
+	msg = &recvq_msgs[(recvq_head + recvq_count) % recvq_size];
+	msg->buf = buf;
+	msg->len = len;
+	msg->decoded = NULL;
+	recvq_count++;
+	recvq_bytes += len;
+}
+
+/*
+ * Receive whatever the provider has sent so far into the receive queue,
+ * without waiting for more.
+ *
+ * Keepalives asking for reply are answered right away, instead of when apply
+ * gets to them, so that a long apply doesn't make the provider think we are
+ * gone. The reply only confirms what was already confirmed before, the
+ * keepalive itself is still processed in order.
+ */
+static void
+apply_receive_ahead(void)
+{
+	Size		limit = (Size) pglogical_receive_queue_size * 1024;
+
+	if (pglogical_spool_writing())
+	{
+		(void) apply_receive_spool();
+		return;
+	}
+
+	if (limit == 0 && pglogical_apply_prefetch_depth <= 0)
+		return;
+
+	if (recvq_status != 0)
+		return;
+
+	/* Errors are reported by the main loop when it checks the connection. */
+	(void) PQconsumeInput(applyconn);
+
+	while (recvq_bytes < limit || recvq_count < pglogical_apply_prefetch_depth)
+	{
+		char	   *buf = NULL;
+		int			r = PQgetCopyData(applyconn, &buf, 1);
+
+		if (r == 0)
+			break;
+		else if (r < 0)
+		{
+			/* Let apply_get_copy_data() report it in order. */
+			recvq_status = r;
+			break;
+		}
+
+		/* 'k', walEnd, sendTime, replyRequested */
+		if (buf[0] == 'k' && r >= 18 && buf[17])
+			send_feedback(applyconn, InvalidXLogRecPtr, GetCurrentTimestamp(),
+						  true);
+
+		recvq_push(buf, r);
+	}
+
+	recvq_report();
+}
+
+/*
+ * Prefetch the blocks the queued message will need once applied.
+ *
+ * Only UPDATEs and DELETEs are looked at, as those are the ones which have to
+ * find existing rows. Returns false when the message can't be looked at yet
+ * because it depends on the messages before it being applied first (e.g. a
+ * RELATION or COMMIT message); the lookahead stops there.
+ *
+ * The decoded rows are kept with the message, so the change is decoded only
+ * once: here, while the reads prefetched for the messages before it are in
+ * progress, rather than after them when it's applied.
+ */
+static bool
+prefetch_message(ReceivedMessage *msg)
+{
+	StringInfoData		s;
+	MemoryContext		oldctx;
+	PGLogicalRelation  *rel;
+	DecodedChange	   *decoded;
+	MemoryContext		context;
+	char				action;
+
+	memset(&s, 0, sizeof(StringInfoData));
+	s.data = msg->buf;
+	s.len = msg->len;
+	s.maxlen = -1;
+	s.cursor = 0;
+
+	/* Keepalives and unknown messages don't matter for apply. */
+	if (pq_getmsgbyte(&s) != 'w')
+		return true;
+
+	pq_getmsgint64(&s);			/* start_lsn */
+	pq_getmsgint64(&s);			/* end_lsn */
+	pq_getmsgint64(&s);			/* sendTime */
+
+	action = pq_getmsgbyte(&s);
+	switch (action)
+	{
+		case 'I':
+		case 'M':
+		case 'Z':
+			return true;
+		case 'U':
+		case 'D':
+			break;
+		default:
+			return false;
+	}
+
+	context = AllocSetContextCreate(LookaheadContext,
+									"pglogical decoded change",
+									ALLOCSET_DEFAULT_SIZES);
+	oldctx = MemoryContextSwitchTo(context);
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	decoded = palloc(sizeof(DecodedChange));
+	decoded->context = context;
+	decoded->oldtup = palloc(sizeof(PGLogicalTupleData));
+
+	if (action == 'U')
+	{
+		decoded->newtup = palloc(sizeof(PGLogicalTupleData));
+		rel = pglogical_read_update(&s, RowExclusiveLock, &decoded->hasoldtup,
+									decoded->oldtup, decoded->newtup);
+	}
+	else
+	{
+		decoded->newtup = NULL;
+		rel = pglogical_read_delete(&s, RowExclusiveLock, decoded->oldtup);
+		decoded->hasoldtup = true;
+	}
+
+	decoded->remoteid = rel->remoteid;
+	decoded->generation = pglogical_relcache_generation;
+
+	if (should_apply_changes_for_rel(rel->nspname, rel->relname))
+		pglogical_tuple_prefetch_replidx(rel->rel,
+										 decoded->hasoldtup ?
+										 decoded->oldtup : decoded->newtup);
+
+	if (!multi_insert_holds_rel(rel))
+		pglogical_relation_close(rel, NoLock);
+
+	PopActiveSnapshot();
+	MemoryContextSwitchTo(oldctx);
+
+	msg->decoded = decoded;
+
+	return true;
+}
+
+/*
+ * Forget the changes decoded by the lookahead, they are decoded again if the
+ * lookahead gets to them.
+ */
+static void
+recvq_forget_decoded(void)
+{
+	int		i;
+
+	for (i = 0; i < recvq_examined; i++)
+	{
+		ReceivedMessage *msg = &recvq_msgs[(recvq_head + i) % recvq_size];
+
+		if (msg->decoded != NULL)
+		{
+			MemoryContextDelete(msg->decoded->context);
+			msg->decoded = NULL;
+		}
+	}
+	recvq_examined = 0;
+}
+
+/*
+ * Take the decoded form of the UPDATE or DELETE being applied from the
+ * lookahead, if it's there and still valid.
+ *
+ * Returns the opened relation, or NULL when the message has to be decoded.
+ */
+static PGLogicalRelation *
+apply_take_decoded(StringInfo s, bool *hasoldtup, PGLogicalTupleData **oldtup,
+				   PGLogicalTupleData **newtup)
+{
+	DecodedChange	   *decoded = decoded_change;
+	PGLogicalRelation  *rel;
+
+	if (decoded == NULL || decoded_buf != s->data)
+		return NULL;
+
+	/* The tuples follow the mapping of the relation at the time. */
+	if (decoded->generation != pglogical_relcache_generation)
+		return NULL;
+
+	rel = pglogical_relation_open(decoded->remoteid, RowExclusiveLock);
+
+	/* Locking it may have let in an invalidation. */
+	if (decoded->generation != pglogical_relcache_generation)
+	{
+		pglogical_relation_close(rel, NoLock);
+		return NULL;
+	}
+
+	*hasoldtup = decoded->hasoldtup;
+	*oldtup = decoded->oldtup;
+	if (newtup != NULL)
+		*newtup = decoded->newtup;
+
+	return rel;
+}
+
+/*
+ * Done with the message being applied.
+ */
+static void
+apply_release_decoded(void)
+{
+	if (decoded_change != NULL)
+		MemoryContextDelete(decoded_change->context);
+
+	decoded_change = NULL;
+	decoded_buf = NULL;
+}
+
+/*
+ * Issue prefetch requests for the heap blocks that the next
+ * pglogical_apply_prefetch_depth queued messages will touch, so that many
+ * reads are in flight instead of one at a time.
+ *
+ * Messages can only be decoded inside the transaction they belong to, so the
+ * lookahead never goes past the end of the current remote transaction.
+ */
+static void
+apply_prefetch_lookahead(void)
+{
+	int		limit = Min(recvq_count, pglogical_apply_prefetch_depth);
+
+	if (!in_remote_transaction || !IsTransactionState())
+		return;
+
+	if (LookaheadContext == NULL)
+		LookaheadContext = AllocSetContextCreate(TopMemoryContext,
+												 "pglogical lookahead",
+												 ALLOCSET_DEFAULT_SIZES);
+
+	while (recvq_examined < limit)
+	{
+		ReceivedMessage *msg;
+
+		msg = &recvq_msgs[(recvq_head + recvq_examined) % recvq_size];
+		if (!prefetch_message(msg))
+			break;
+		recvq_examined++;
+	}
+}
+
+/*
+ * Remember the relation metadata applied so far, in case the stream has to be
+ * spooled later, see apply_delay_spill(), or passed on to a streamed
+ * transaction, see stream_begin().
+ */
+static void
+apply_remember_relation(char *buf, int len)
+{
+	StringInfoData	s;
+	uint32			relid;
+
+	if (!apply_streaming && (apply_delay <= 0 || pglogical_spool_active()))
+		return;
+
+	/* 'w', dataStart, walEnd, sendTime, action */
+	if (len <= 25 || buf[0] != 'w' || buf[25] != 'R')
+		return;
+
+	memset(&s, 0, sizeof(StringInfoData));
+	s.data = buf;
+	s.len = len;
+	s.maxlen = -1;
+	s.cursor = 26;
+
+	pq_getmsgbyte(&s);			/* flags */
+	relid = pq_getmsgint(&s, 4);
+
+	pglogical_spool_remember_metadata(relid, buf, len);
+}
+
+/*
+ * Move the held back transaction and everything received after it into the
+ * local spool, and continue spooling the rest of the stream, so that we can
+ * keep receiving for as long as the apply_delay requires without using more
+ * memory.
+ */
+static void
+apply_delay_spill(void)
+{
+	XLogRecPtr	recvpos = InvalidXLogRecPtr;
+	bool		reply_requested = false;
+
+	Assert(delayed_buf != NULL && !delayed_spooled);
+
+	elog(LOG, "apply of subscription %s is delayed by more than pglogical.receive_queue_size of data, spooling the rest locally",
+		 MySubscription->name);
+
+	(void) pglogical_spool_open(MySubscription->id,
+								replorigin_session_get_progress(false), true);
+
+	spool_message(delayed_buf, delayed_len, &recvpos, &reply_requested);
+	PQfreemem(delayed_buf);
+	delayed_buf = NULL;
+
+	recvq_forget_decoded();
+
+	while (recvq_count > 0)
+	{
+		ReceivedMessage	   *msg = &recvq_msgs[recvq_head];
+
+		spool_message(msg->buf, msg->len, &recvpos, &reply_requested);
+		PQfreemem(msg->buf);
+		recvq_head = (recvq_head + 1) % recvq_size;
+		recvq_count--;
+	}
+	recvq_bytes = 0;
+	recvq_examined = 0;
+	recvq_report();
+
+	pglogical_spool_flush();
+}
+
+/*
+ * Keep receiving while the next transaction waits for apply_delay, spilling
+ * to the spool once the receive queue is full.
+ *
+ * Returns false when nothing more can be received for now.
+ */
+static bool
+apply_delay_receive(void)
+{
+	Size		limit = (Size) pglogical_receive_queue_size * 1024;
+
+	if (!pglogical_spool_writing())
+	{
+		apply_receive_ahead();
+
+		/* The error is reported once the delayed transaction is applied. */
+		if (recvq_status != 0)
+			return false;
+
+		if (recvq_bytes < limit)
+			return true;
+
+		/* Can't spill while replaying what's left in the spool. */
+		if (pglogical_spool_active())
+			return false;
+
+		apply_delay_spill();
+
+		/*
+		 * The held back BEGIN is read again from the spool, nothing to wait
+		 * for until then.
+		 */
+		SetLatch(&MyProc->procLatch);
+	}
+
+	(void) apply_receive_spool();
+
+	return true;
+}
+
+/*
+ * The manager asks us to exit once the subscription has been idle for
+ * pglogical.apply_idle_timeout, and watches the stream itself until there is
+ * something to apply again.
+ *
+ * Only exit when nothing that was received is held locally, so that the
+ * manager can stream from the replication origin position. Otherwise carry
+ * on and let the manager ask again later.
+ */
+static void
+apply_park(XLogRecPtr last_received, bool received)
+{
+	bool		idle;
+
+	idle = !received && !in_remote_transaction && group_xacts == 0 &&
+		recvq_count == 0 && delayed_buf == NULL &&
+		!pglogical_spool_active() &&
+		list_length(SyncingTables) == 0 && !MyApplyWorker->sync_pending;
+#if PG_VERSION_NUM >= 140000
+	idle = idle && stream_xacts == NIL;
+#endif
+
+	if (!idle)
+	{
+		LWLockAcquire(PGLogicalCtx->lock, LW_EXCLUSIVE);
+		MyApplyWorker->park_requested = false;
+		MyApplyWorker->last_active = GetCurrentTimestamp();
+		LWLockRelease(PGLogicalCtx->lock);
+		return;
+	}
+
+	send_feedback(applyconn, last_received, GetCurrentTimestamp(), true);
+
+	elog(LOG, "apply worker for subscription \"%s\" is idle, exiting until there are changes",
+		 MySubscription->name);
+
+	/* Release the slot on the provider right away. */
+	PQfinish(applyconn);
+
+	proc_exit(0);
+}
+
+/*
+ * Apply main loop.
+ */
+void
+apply_work(PGconn *streamConn)
+{
+	int			fd;
+	char	   *copybuf = NULL;
+	XLogRecPtr	last_received = InvalidXLogRecPtr;
+
+	applyconn = streamConn;
+	fd = PQsocket(applyconn);
+
+	/* Init the MessageContext which we use for easier cleanup. */
+	MessageContext = AllocSetContextCreate(TopMemoryContext,
+										   "MessageContext",
+										   ALLOCSET_DEFAULT_SIZES);
+
+	MemoryContextSwitchTo(MessageContext);
+
+	/* mark as idle, before starting to loop */
+	pgstat_report_activity(STATE_IDLE, NULL);
+	Assert(CurrentMemoryContext == MessageContext);
+
+	MyApplyWorker->last_active = GetCurrentTimestamp();
+
+	while (!got_SIGTERM)
+	{
+		int			rc;
+		int			r;
+		bool		received = false;
+		int			events = WL_SOCKET_READABLE | WL_LATCH_SET |
+							 WL_TIMEOUT | WL_POSTMASTER_DEATH;
+		long		timeout = 1000L;
+
+		/*
+		 * While the next transaction waits for apply_delay, keep receiving
+		 * so that the provider isn't stalled, and wake up when it's time.
+		 */
+		if (delayed_buf != NULL)
+		{
+			if (!apply_delay_receive())
+				events &= ~WL_SOCKET_READABLE;
+			timeout = Min(timeout, apply_delay_remaining());
+			if (timeout < 0)
+				timeout = 0;
+		}
+
+		/*
+		 * Background workers mustn't call usleep() or any direct equivalent:
+		 * instead, they may wait on their process latch, which sleeps as
+		 * necessary, but is awakened if postmaster dies.  That way the
+		 * background process goes away immediately in an emergency.
+		 */
+		rc = WaitLatchOrSocket(&MyProc->procLatch, events, fd, timeout);
+
+		ResetLatch(&MyProc->procLatch);
+
+		Assert(CurrentMemoryContext == MessageContext);
+
+		/* emergency bailout if postmaster has died */
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		if (rc & WL_SOCKET_READABLE)
+			PQconsumeInput(applyconn);
+
+		if (PQstatus(applyconn) == CONNECTION_BAD)
+		{
+			elog(ERROR, "connection to other side has died");
+		}
+
+		Assert(CurrentMemoryContext == MessageContext);
+
+		for (;;)
+		{
+			if (got_SIGTERM)
+				break;
+
+			/* We must not have fallen out of MessageContext by accident */
+			Assert(CurrentMemoryContext == MessageContext);
+
+			Assert(copybuf == NULL);
+			r = apply_get_copy_data(&copybuf);
+
+			if (r == -1)
+			{
 				elog(ERROR, "data stream ended");
 			}
 			else if (r == -2)
@@ -1409,95 +2916,914 @@ apply_work(PGconn *streamConn)
 				elog(ERROR, "invalid COPY status %d", r);
 			else if (r == 0)
 			{
-				/* need to wait for new data */
-				break;
+				/* need to wait for new data */
+				break;
+			}
+			else
+			{
+				int c;
+				StringInfoData s;
+
+				/*
+				 * We're using a StringInfo to wrap existing data here, as a
+				 * cursor. We init it manually to avoid a redundant allocation.
+				 */
+				memset(&s, 0, sizeof(StringInfoData));
+				s.data = copybuf;
+				s.len = r;
+				s.maxlen = -1;
+				s.cursor = 0;
+
+				c = pq_getmsgbyte(&s);
+
+				if (c == 'w')
+				{
+					XLogRecPtr	start_lsn;
+					XLogRecPtr	end_lsn;
+
+					start_lsn = pq_getmsgint64(&s);
+					end_lsn = pq_getmsgint64(&s);
+					pq_getmsgint64(&s); /* sendTime */
+
+					if (last_received < start_lsn)
+						last_received = start_lsn;
+
+					if (last_received < end_lsn)
+						last_received = end_lsn;
+
+					received = true;
+
+					apply_receive_ahead();
+					apply_prefetch_lookahead();
+					apply_remember_relation(copybuf, r);
+
+#if PG_VERSION_NUM >= 140000
+					if (stream_current != NULL)
+						stream_handler(&s);
+					else
+#endif
+						replication_handler(&s);
+				}
+				else if (c == 'k')
+				{
+					XLogRecPtr endpos;
+					bool reply_requested;
+
+					endpos = pq_getmsgint64(&s);
+					/* timestamp = */ pq_getmsgint64(&s);
+					reply_requested = pq_getmsgbyte(&s);
+
+					send_feedback(applyconn, endpos,
+								  GetCurrentTimestamp(),
+								  reply_requested);
+
+					if (last_received < endpos)
+						last_received = endpos;
+				}
+				/* other message types are purposefully ignored */
+
+				apply_release_decoded();
+
+				/* copybuf is malloc'd not palloc'd, unless it's spooled */
+				if (copybuf != NULL)
+				{
+					if (!copybuf_spooled)
+						PQfreemem(copybuf);
+					copybuf = NULL;
+					copybuf_spooled = false;
+				}
+			}
+
+			/* We must not have fallen out of MessageContext by accident */
+			Assert(CurrentMemoryContext == MessageContext);
+		}
+
+		/* nothing more to apply now, commit what was grouped so far */
+		if (!in_remote_transaction && group_xacts > 0)
+		{
+			apply_group_commit();
+			ProcessCompletedNotifies();
+		}
+
+		/* confirm all writes at once */
+		send_feedback(applyconn, last_received, GetCurrentTimestamp(), false);
+
+		/* remove what was already applied from the spool */
+		pglogical_spool_cleanup();
+
+		if (!in_remote_transaction)
+			process_syncing_tables(last_received);
+
+		if (received)
+			MyApplyWorker->last_active = GetCurrentTimestamp();
+		if (MyApplyWorker->park_requested)
+			apply_park(last_received, received);
+		
+		/* We must not have switched out of MessageContext by mistake */
+		Assert(CurrentMemoryContext == MessageContext);
+
+		/* Cleanup the memory. */
+		MemoryContextResetAndDeleteChildren(MessageContext);
+
+		/*
+		 * Only do a leak check if we're between txns; we don't want lots of
+		 * noise due to resources that only exist in a txn.
+		 */
+		if (!IsTransactionState())
+		{
+			VALGRIND_DO_ADDED_LEAK_CHECK;
+		}
+	}
+}
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * Should the provider stream large transactions to us before they commit?
+ *
+ * Not with apply_delay, which holds transactions back by their commit
+ * timestamp, nor when the stream is spooled locally first. Timestamp based
+ * conflict resolution needs the commit timestamp before the changes are
+ * applied too.
+ */
+static bool
+apply_stream_wanted(void)
+{
+	if (pglogical_stream_apply_workers <= 0 ||
+		MyPGLogicalWorker->worker_type != PGLOGICAL_WORKER_APPLY)
+		return false;
+
+	if (pglogical_spool_stream || apply_delay > 0)
+		return false;
+
+	if (pglogical_conflict_resolver == PGLOGICAL_RESOLVE_LAST_UPDATE_WINS ||
+		pglogical_conflict_resolver == PGLOGICAL_RESOLVE_FIRST_UPDATE_WINS)
+		return false;
+
+	return true;
+}
+
+static StreamXact *
+stream_find(TransactionId xid)
+{
+	ListCell   *lc;
+
+	foreach (lc, stream_xacts)
+	{
+		StreamXact *stream = lfirst(lc);
+
+		if (stream->xid == xid)
+			return stream;
+	}
+
+	return NULL;
+}
+
+/*
+ * Number of helpers applying streamed transactions right now.
+ */
+static int
+stream_helper_count(void)
+{
+	ListCell   *lc;
+	int			count = 0;
+
+	foreach (lc, stream_xacts)
+	{
+		StreamXact *stream = lfirst(lc);
+
+		if (stream->worker != NULL)
+			count++;
+	}
+
+	return count;
+}
+
+static bool
+stream_helper_alive(StreamXact *stream)
+{
+	bool		alive;
+
+	LWLockAcquire(PGLogicalCtx->lock, LW_SHARED);
+	alive = pglogical_worker_running(stream->worker) &&
+		stream->worker->generation == stream->generation;
+	LWLockRelease(PGLogicalCtx->lock);
+
+	return alive;
+}
+
+/*
+ * Wait for the helper to make progress. Returns false if it has exited.
+ */
+static bool
+stream_helper_wait(StreamXact *stream)
+{
+	int			rc;
+
+	if (!stream_helper_alive(stream))
+		return false;
+
+	rc = WaitLatch(&MyProc->procLatch,
+				   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+				   1000L);
+
+	ResetLatch(&MyProc->procLatch);
+
+	/* emergency bailout if postmaster has died */
+	if (rc & WL_POSTMASTER_DEATH)
+		proc_exit(1);
+
+	CHECK_FOR_INTERRUPTS();
+
+	/* The helper finds out that we're gone. */
+	if (got_SIGTERM)
+		proc_exit(0);
+
+	return true;
+}
+
+static void
+stream_lock(TransactionId xid, uint16 kind, LOCKMODE lockmode)
+{
+	LOCKTAG		tag;
+
+	SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, MyApplyWorker->subid, xid, kind);
+	(void) LockAcquire(&tag, lockmode, true, false);
+}
+
+static void
+stream_unlock(TransactionId xid, uint16 kind, LOCKMODE lockmode)
+{
+	LOCKTAG		tag;
+
+	SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, MyApplyWorker->subid, xid, kind);
+	LockRelease(&tag, lockmode, true);
+}
+
+/*
+ * Let the helper go on past the last block it was sent.
+ */
+static void
+stream_release(StreamXact *stream)
+{
+	if (stream->locked)
+	{
+		stream_unlock(stream->xid, STREAM_LOCK_STREAM, AccessExclusiveLock);
+		stream->locked = false;
+	}
+}
+
+/*
+ * Stop passing the transaction on to its helper and apply it from the file
+ * once it commits instead. The helper rolls back what it has applied when it
+ * finds the queue detached.
+ */
+static void
+stream_abandon(StreamXact *stream)
+{
+	SpinLockAcquire(&stream->shared->mutex);
+	stream->shared->abandoned = true;
+	SpinLockRelease(&stream->shared->mutex);
+
+	stream_release(stream);
+
+	shm_mq_detach(stream->mqh);
+	stream->mqh = NULL;
+	dsm_detach(stream->seg);
+	stream->seg = NULL;
+	stream->shared = NULL;
+	stream->worker = NULL;
+}
+
+/*
+ * Pass a message on to the helper of the streamed transaction, if it still
+ * has one.
+ */
+static void
+stream_send(StreamXact *stream, const char *data, int len)
+{
+	TimestampTz		start = 0;
+	shm_mq_result	res;
+
+	if (stream->worker == NULL)
+		return;
+
+	while ((res = shm_mq_send(stream->mqh, len, data, true)) ==
+		   SHM_MQ_WOULD_BLOCK)
+	{
+		/*
+		 * The helper may wait for a lock of another helper which waits for
+		 * the stream lock we hold, the deadlock detector can't see that we
+		 * wait for the queue. Don't wait forever.
+		 */
+		if (start == 0)
+			start = GetCurrentTimestamp();
+		else if (TimestampDifferenceExceeds(start, GetCurrentTimestamp(),
+											STREAM_SEND_TIMEOUT))
+		{
+			ereport(LOG,
+					(errmsg("helper applying streamed transaction %u is not making progress, applying the transaction once it commits",
+							stream->xid)));
+			stream_abandon(stream);
+			return;
+		}
+
+		if (!stream_helper_wait(stream))
+			break;
+	}
+
+	if (res != SHM_MQ_SUCCESS)
+	{
+		ereport(LOG,
+				(errmsg("helper applying streamed transaction %u exited, applying the transaction once it commits",
+						stream->xid)));
+		stream_abandon(stream);
+	}
+}
+
+/*
+ * Pass a change on to the streamed transaction.
+ */
+static void
+stream_write(StreamXact *stream, const char *data, int len)
+{
+	BufFileWrite(stream->file, &len, sizeof(len));
+	BufFileWrite(stream->file, (void *) data, len);
+	stream->nrecords++;
+
+	stream_send(stream, data, len);
+}
+
+static void
+stream_file_read(StreamXact *stream, void *ptr, size_t size)
+{
+	if (BufFileRead(stream->file, ptr, size) != size)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from file of streamed transaction %u",
+						stream->xid)));
+}
+
+/*
+ * Pass a remembered RELATION message on, see apply_remember_relation().
+ */
+static void
+stream_write_metadata(const char *data, int len, void *arg)
+{
+	/* 'w', dataStart, walEnd, sendTime */
+	stream_write((StreamXact *) arg, data + 25, len - 25);
+}
+
+/*
+ * Apply a remembered RELATION message again, see stream_file_replay().
+ */
+static void
+stream_read_metadata(const char *data, int len, void *arg)
+{
+	StringInfoData	s;
+
+	memset(&s, 0, sizeof(StringInfoData));
+	s.data = (char *) data;
+	s.len = len;
+	s.maxlen = -1;
+	s.cursor = 26;
+
+	(void) pglogical_read_rel(&s);
+}
+
+/*
+ * Start a helper which applies the streamed transaction as it arrives.
+ *
+ * Returns false when no helper should be used, the transaction is then kept
+ * in a file and applied once it commits.
+ */
+static bool
+stream_start_helper(StreamXact *stream)
+{
+	PGLogicalWorker	worker;
+	shm_mq		   *mq;
+	int				slot;
+
+	if (stream_helper_count() >= pglogical_stream_apply_workers)
+		return false;
+
+	/*
+	 * The previous apply worker failed while waiting for a helper, possibly
+	 * because of a deadlock with it. Use files until past that transaction,
+	 * so that the same deadlock doesn't happen again.
+	 */
+	if (replorigin_session_get_progress(false) < MyApplyWorker->stream_file_lsn)
+		return false;
+
+	/*
+	 * Whether a change of a table being synchronized is applied depends on
+	 * where its transaction commits, which is not known yet.
+	 */
+	if (list_length(SyncingTables) > 0 || MyApplyWorker->sync_pending)
+		return false;
+
+	stream->seg = dsm_create(STREAM_SHARED_SIZE + STREAM_QUEUE_SIZE,
+							 DSM_CREATE_NULL_IF_MAXSEGMENTS);
+	if (stream->seg == NULL)
+		return false;
+	dsm_pin_mapping(stream->seg);
+
+	stream->shared = dsm_segment_address(stream->seg);
+	SpinLockInit(&stream->shared->mutex);
+	stream->shared->committed = false;
+	stream->shared->local_end = InvalidXLogRecPtr;
+	stream->shared->leader = MyProc;
+
+	mq = shm_mq_create((char *) stream->shared + STREAM_SHARED_SIZE,
+					   STREAM_QUEUE_SIZE);
+	shm_mq_set_sender(mq, MyProc);
+	stream->mqh = shm_mq_attach(mq, stream->seg, NULL);
+
+	memset(&worker, 0, sizeof(PGLogicalWorker));
+	worker.worker_type = PGLOGICAL_WORKER_STREAM;
+	worker.dboid = MyPGLogicalWorker->dboid;
+	worker.worker.stream.apply.subid = MyApplyWorker->subid;
+	worker.worker.stream.apply.sync_pending = false;
+	worker.worker.stream.handle = dsm_segment_handle(stream->seg);
+	worker.worker.stream.xid = stream->xid;
+
+	slot = pglogical_worker_register(&worker);
+
+	LWLockAcquire(PGLogicalCtx->lock, LW_SHARED);
+	stream->worker = pglogical_get_worker(slot);
+	stream->generation = stream->worker->generation;
+	LWLockRelease(PGLogicalCtx->lock);
+
+	return true;
+}
+
+static StreamXact *
+stream_begin(TransactionId xid)
+{
+	StreamXact	   *stream;
+	MemoryContext	oldctx;
+
+	oldctx = MemoryContextSwitchTo(TopMemoryContext);
+
+	stream = palloc0(sizeof(StreamXact));
+	stream->xid = xid;
+	stream->file = BufFileCreateTemp(true);
+
+	if (stream_start_helper(stream))
+		elog(DEBUG1, "applying streamed transaction %u in a helper", xid);
+	else
+		elog(DEBUG1, "applying streamed transaction %u once it commits", xid);
+
+	stream_xacts = lappend(stream_xacts, stream);
+
+	MemoryContextSwitchTo(oldctx);
+
+	/* The changes may need any relation we know of. */
+	pglogical_spool_foreach_metadata(stream_write_metadata, stream);
+
+	return stream;
+}
+
+static void
+stream_forget(StreamXact *stream)
+{
+	stream_release(stream);
+	if (stream->mqh != NULL)
+		shm_mq_detach(stream->mqh);
+	if (stream->seg != NULL)
+		dsm_detach(stream->seg);
+	if (stream->file != NULL)
+		BufFileClose(stream->file);
+
+	list_free_deep(stream->subxacts);
+	stream_xacts = list_delete_ptr(stream_xacts, stream);
+	if (stream_current == stream)
+		stream_current = NULL;
+
+	pfree(stream);
+}
+
+/*
+ * Handle STREAM START message.
+ *
+ * With pglogical.stream_apply_workers set, the provider sends transactions
+ * which outgrow its logical_decoding_work_mem before they commit, in blocks
+ * of changes between STREAM START and STREAM STOP which can come between
+ * other transactions and blocks of other streamed transactions. They end
+ * with STREAM COMMIT or STREAM ABORT.
+ */
+static void
+handle_stream_start(StringInfo s)
+{
+	TransactionId	xid;
+	bool			first;
+
+	errcallback_arg.action_name = "STREAM START";
+
+	if (in_remote_transaction)
+		elog(ERROR, "STREAM START message sent out of order");
+
+	xid = pglogical_read_stream_start(s, &first);
+
+	/* A helper could end up waiting for the locks of the group. */
+	if (group_xacts > 0)
+	{
+		apply_group_commit();
+		ProcessCompletedNotifies();
+	}
+
+	stream_current = stream_find(xid);
+
+	if (first)
+	{
+		if (stream_current != NULL)
+			elog(ERROR, "streamed transaction %u was already started", xid);
+		stream_current = stream_begin(xid);
+	}
+	else if (stream_current == NULL)
+		elog(ERROR, "STREAM START message for unknown transaction %u", xid);
+	else
+		stream_release(stream_current);
+}
+
+/*
+ * Pass a RELATION message on to every open streamed transaction, the changes
+ * any of them sends from now on may depend on it.
+ */
+static void
+stream_relation(StringInfo s)
+{
+	char	   *data = s->data + s->cursor - 1;
+	int			len = s->len - s->cursor + 1;
+	ListCell   *lc;
+
+	/* Unless it's one of them being replayed from its file. */
+	if (stream_replaying)
+		return;
+
+	foreach (lc, stream_xacts)
+		stream_write(lfirst(lc), data, len);
+}
+
+/*
+ * Remember where the changes of a subtransaction start in the file, so that
+ * they can be thrown away if it aborts.
+ */
+static void
+stream_file_subxact(StreamXact *stream, TransactionId subxid)
+{
+	StreamSubXact  *subxact;
+	ListCell	   *lc;
+	MemoryContext	oldctx;
+
+	if (subxid == stream->xid)
+		return;
+
+	foreach (lc, stream->subxacts)
+	{
+		if (((StreamSubXact *) lfirst(lc))->xid == subxid)
+			return;
+	}
+
+	oldctx = MemoryContextSwitchTo(TopMemoryContext);
+
+	subxact = palloc(sizeof(StreamSubXact));
+	subxact->xid = subxid;
+	subxact->nrecords = stream->nrecords;
+	BufFileTell(stream->file, &subxact->fileno, &subxact->offset);
+	stream->subxacts = lappend(stream->subxacts, subxact);
+
+	MemoryContextSwitchTo(oldctx);
+}
+
+/*
+ * Throw away the changes of an aborted subtransaction from the file,
+ * including those of the subtransactions which started after it.
+ */
+static void
+stream_file_abort_subxact(StreamXact *stream, TransactionId subxid)
+{
+	ListCell   *lc;
+
+	foreach (lc, stream->subxacts)
+	{
+		StreamSubXact  *subxact = lfirst(lc);
+		int				i = foreach_current_index(lc);
+
+		if (subxact->xid != subxid)
+			continue;
+
+		if (BufFileSeek(stream->file, subxact->fileno, subxact->offset,
+						SEEK_SET) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not seek in file of streamed transaction %u",
+							stream->xid)));
+
+		/* What follows is overwritten, only nrecords of it are read. */
+		stream->nrecords = subxact->nrecords;
+
+		for (; i < list_length(stream->subxacts); i++)
+			pfree(list_nth(stream->subxacts, i));
+		stream->subxacts = list_truncate(stream->subxacts,
+										 foreach_current_index(lc));
+
+		/* Later changes may need relations sent with the discarded ones. */
+		pglogical_spool_foreach_metadata(stream_write_metadata, stream);
+
+		return;
+	}
+}
+
+/*
+ * Handle a message between STREAM START and STREAM STOP.
+ */
+static void
+stream_handler(StringInfo s)
+{
+	StreamXact *stream = stream_current;
+	char		action = pq_getmsgbyte(s);
+	char	   *data = s->data + s->cursor - 1;
+	int			len = s->len - s->cursor + 1;
+
+	Assert(CurrentMemoryContext == MessageContext);
+
+	switch (action)
+	{
+		/* STREAM STOP */
+		case 'e':
+			/* The helper waits on the stream lock for the next block. */
+			if (stream->worker != NULL)
+			{
+				stream_lock(stream->xid, STREAM_LOCK_STREAM,
+							AccessExclusiveLock);
+				stream->locked = true;
+				stream_send(stream, data, len);
 			}
-			else
-			{
-				int c;
-				StringInfoData s;
+			stream_current = NULL;
+			break;
+		/* RELATION */
+		case 'R':
+			/* Passed on to the streamed transactions from there. */
+			handle_relation(s);
+			break;
+		/* STREAM SUBTRANSACTION */
+		case 'x':
+			stream_file_subxact(stream, pglogical_read_stream_subxact(s));
+			stream_send(stream, data, len);
+			break;
+		/* INSERT, INSERT BATCH, COMPRESSED, UPDATE, DELETE, QUEUED MESSAGE */
+		case 'I':
+		case 'M':
+		case 'Z':
+		case 'U':
+		case 'D':
+		case 'Q':
+			stream_write(stream, data, len);
+			break;
+		default:
+			elog(ERROR, "unexpected action of type %c in streamed transaction %u",
+				 action, stream->xid);
+	}
 
-				/*
-				 * We're using a StringInfo to wrap existing data here, as a
-				 * cursor. We init it manually to avoid a redundant allocation.
-				 */
-				memset(&s, 0, sizeof(StringInfoData));
-				s.data = copybuf;
-				s.len = r;
-				s.maxlen = -1;
-				s.cursor = 0;
+	Assert(CurrentMemoryContext == MessageContext);
 
-				c = pq_getmsgbyte(&s);
+	MemoryContextReset(MessageContext);
+}
 
-				if (c == 'w')
-				{
-					XLogRecPtr	start_lsn;
-					XLogRecPtr	end_lsn;
+/*
+ * Handle STREAM ABORT message, of the streamed transaction or of one of its
+ * subtransactions.
+ */
+static void
+handle_stream_abort(StringInfo s)
+{
+	char		   *data = s->data + s->cursor - 1;
+	int				len = s->len - s->cursor + 1;
+	TransactionId	xid;
+	TransactionId	subxid;
+	StreamXact	   *stream;
 
-					start_lsn = pq_getmsgint64(&s);
-					end_lsn = pq_getmsgint64(&s);
-					pq_getmsgint64(&s); /* sendTime */
+	errcallback_arg.action_name = "STREAM ABORT";
 
-					if (last_received < start_lsn)
-						last_received = start_lsn;
+	if (in_remote_transaction)
+		elog(ERROR, "STREAM ABORT message sent out of order");
 
-					if (last_received < end_lsn)
-						last_received = end_lsn;
+	xid = pglogical_read_stream_abort(s, &subxid);
 
-					replication_handler(&s);
-				}
-				else if (c == 'k')
-				{
-					XLogRecPtr endpos;
-					bool reply_requested;
+	/* Nothing of it reached us. */
+	stream = stream_find(xid);
+	if (stream == NULL)
+		return;
+
+	if (subxid == xid)
+		stream_release(stream);
+	stream_send(stream, data, len);
+	if (subxid != xid)
+		stream_file_abort_subxact(stream, subxid);
+
+	if (subxid == xid)
+	{
+		elog(DEBUG1, "streamed transaction %u aborted", xid);
+		stream_forget(stream);
+	}
+}
+
+/*
+ * Let the helper commit the streamed transaction and wait until it did.
+ * Returns false when the helper exited without committing, the transaction
+ * is then applied from the file.
+ *
+ * The commit has to advance our replication origin, and only one process
+ * can have it set up at a time, so we hand it over to the helper meanwhile.
+ */
+static bool
+stream_helper_commit(StreamXact *stream, char *data, int len,
+					 XLogRecPtr commit_lsn, XLogRecPtr end_lsn)
+{
+	RepOriginId		originid = replorigin_session_origin;
+	bool			committed = false;
+	XLogRecPtr		local_end = InvalidXLogRecPtr;
+
+	/* Committed remotely before this one and may hold locks it needs. */
+	if (group_xacts > 0)
+	{
+		apply_group_commit();
+		ProcessCompletedNotifies();
+	}
+
+	Assert(!IsTransactionState());
+
+	/* See stream_start_helper(). */
+	MyApplyWorker->stream_file_lsn = commit_lsn;
+
+	stream_release(stream);
+	replorigin_session_reset();
+	stream_send(stream, data, len);
+
+	/* The helper may not have started yet. */
+	while (stream->worker != NULL)
+	{
+		bool		locked;
+
+		SpinLockAcquire(&stream->shared->mutex);
+		locked = stream->shared->locked;
+		SpinLockRelease(&stream->shared->mutex);
+
+		if (locked)
+			break;
+
+		if (!stream_helper_wait(stream))
+		{
+			ereport(LOG,
+					(errmsg("helper applying streamed transaction %u exited, applying the transaction now",
+							stream->xid)));
+			stream_abandon(stream);
+		}
+	}
+
+	/* Wait on its transaction lock, in sight of the deadlock detector. */
+	if (stream->worker != NULL)
+	{
+		stream_lock(stream->xid, STREAM_LOCK_XACT, AccessShareLock);
+		stream_unlock(stream->xid, STREAM_LOCK_XACT, AccessShareLock);
+
+		SpinLockAcquire(&stream->shared->mutex);
+		committed = stream->shared->committed;
+		local_end = stream->shared->local_end;
+		SpinLockRelease(&stream->shared->mutex);
+	}
+
+	replorigin_session_setup(originid);
+
+	/*
+	 * The helper may have exited after it committed but before it told us,
+	 * the origin has then moved past the transaction already. Its commit
+	 * record is somewhere before the current insert position.
+	 */
+	if (!committed && replorigin_session_get_progress(false) >= end_lsn)
+	{
+		committed = true;
+		local_end = GetXLogInsertRecPtr();
+	}
+
+	if (!committed)
+	{
+		if (stream->worker != NULL)
+		{
+			ereport(LOG,
+					(errmsg("helper applying streamed transaction %u exited, applying the transaction now",
+							stream->xid)));
+			stream_abandon(stream);
+		}
+		return false;
+	}
+
+	elog(DEBUG1, "streamed transaction %u committed by its helper",
+		 stream->xid);
+
+	stream_forget(stream);
+
+	apply_track_commit(end_lsn, local_end);
+
+	/* It may have queued a table for synchronization, see handle_table_sync(). */
+	MyApplyWorker->sync_pending = true;
+	process_syncing_tables(end_lsn);
+
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	return true;
+}
+
+/*
+ * Apply the streamed transaction kept in a file now that it has committed,
+ * as if it was sent whole.
+ */
+static void
+stream_file_replay(StreamXact *stream, XLogRecPtr commit_lsn,
+				   XLogRecPtr end_lsn, TimestampTz commit_time)
+{
+	int			i;
+
+	/* See handle_begin(). */
+	xact_action_counter = 1;
+	replorigin_session_origin_timestamp = commit_time;
+	replorigin_session_origin_lsn = commit_lsn;
+	remote_xid = stream->xid;
+	remote_origin_id = InvalidRepOriginId;
+	remote_xact_changed = false;
+	remote_xact_ends_group = false;
+	apply_memory_reported = false;
+
+	in_remote_transaction = true;
+
+	pgstat_report_activity(STATE_RUNNING, NULL);
+
+	if (BufFileSeek(stream->file, 0, 0, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not seek in file of streamed transaction %u",
+						stream->xid)));
+
+	stream_replaying = true;
+
+	for (i = 0; i < stream->nrecords; i++)
+	{
+		StringInfoData	s;
+		int				len;
+
+		stream_file_read(stream, &len, sizeof(len));
+
+		/* Freed by replication_handler(). */
+		s.data = palloc(len);
+		s.len = len;
+		s.maxlen = len;
+		s.cursor = 0;
+		stream_file_read(stream, s.data, len);
+
+		replication_handler(&s);
+	}
 
-					endpos = pq_getmsgint64(&s);
-					/* timestamp = */ pq_getmsgint64(&s);
-					reply_requested = pq_getmsgbyte(&s);
+	stream_replaying = false;
 
-					send_feedback(applyconn, endpos,
-								  GetCurrentTimestamp(),
-								  reply_requested);
+	/* Back to the relations as they are now. */
+	pglogical_spool_foreach_metadata(stream_read_metadata, NULL);
 
-					if (last_received < endpos)
-						last_received = endpos;
-				}
-				/* other message types are purposefully ignored */
+	stream_forget(stream);
 
-				/* copybuf is malloc'd not palloc'd */
-				if (copybuf != NULL)
-				{
-					PQfreemem(copybuf);
-					copybuf = NULL;
-				}
-			}
+	apply_remote_commit(end_lsn, commit_time);
+}
 
-			/* We must not have fallen out of MessageContext by accident */
-			Assert(CurrentMemoryContext == MessageContext);
-		}
+/*
+ * Handle STREAM COMMIT message.
+ */
+static void
+handle_stream_commit(StringInfo s)
+{
+	char		   *data = s->data + s->cursor - 1;
+	int				len = s->len - s->cursor + 1;
+	TransactionId	xid;
+	XLogRecPtr		commit_lsn;
+	XLogRecPtr		end_lsn;
+	TimestampTz		commit_time;
+	StreamXact	   *stream;
 
-		/* confirm all writes at once */
-		send_feedback(applyconn, last_received, GetCurrentTimestamp(), false);
+	errcallback_arg.action_name = "STREAM COMMIT";
 
-		if (!in_remote_transaction)
-			process_syncing_tables(last_received);
-		
-		/* We must not have switched out of MessageContext by mistake */
-		Assert(CurrentMemoryContext == MessageContext);
+	if (in_remote_transaction)
+		elog(ERROR, "STREAM COMMIT message sent out of order");
 
-		/* Cleanup the memory. */
-		MemoryContextResetAndDeleteChildren(MessageContext);
+	xid = pglogical_read_stream_commit(s, &commit_lsn, &end_lsn,
+									   &commit_time);
 
-		/*
-		 * Only do a leak check if we're between txns; we don't want lots of
-		 * noise due to resources that only exist in a txn.
-		 */
-		if (!IsTransactionState())
-		{
-			VALGRIND_DO_ADDED_LEAK_CHECK;
-		}
-	}
+	stream = stream_find(xid);
+	if (stream == NULL)
+		elog(ERROR, "STREAM COMMIT message for unknown transaction %u", xid);
+
+	if (stream->worker == NULL ||
+		!stream_helper_commit(stream, data, len, commit_lsn, end_lsn))
+		stream_file_replay(stream, commit_lsn, end_lsn, commit_time);
 }
+#endif
 
 /*
  * Add context to the errors produced by pglogical_execute_sql_command().
@@ -1677,6 +4003,16 @@ process_syncing_tables(XLogRecPtr end_lsn)
 		MemoryContextSwitchTo(MessageContext);
 	}
 
+#if PG_VERSION_NUM >= 140000
+	/*
+	 * Helpers don't know where their transactions commit, so they can't tell
+	 * which of their changes the copy of a table will contain. Wait for them
+	 * before synchronizing anything.
+	 */
+	if (stream_helper_count() > 0)
+		return;
+#endif
+
 	/* Process currently pending sync tables. */
 	if (list_length(SyncingTables) > 0)
 	{
@@ -1871,25 +4207,13 @@ interval_to_timeoffset(const Interval *interval)
 	return span;
 }
 
-void
-pglogical_apply_main(Datum main_arg)
+/*
+ * Set up the session for applying changes and load the subscription.
+ */
+static void
+apply_worker_init(void)
 {
-	int				slot = DatumGetInt32(main_arg);
-	PGconn		   *streamConn;
-	RepOriginId		originid;
-	XLogRecPtr		origin_startpos;
 	MemoryContext	saved_ctx;
-	char		   *repsets;
-	char		   *origins;
-
-	/* Setup shmem. */
-	pglogical_worker_attach(slot, PGLOGICAL_WORKER_APPLY);
-	Assert(MyPGLogicalWorker->worker_type == PGLOGICAL_WORKER_APPLY);
-	MyApplyWorker = &MyPGLogicalWorker->worker.apply;
-
-	/* Attach to dsm segment. */
-	Assert(CurrentResourceOwner == NULL);
-	CurrentResourceOwner = ResourceOwnerCreate(NULL, "pglogical apply");
 
 	/* Load correct apply API. */
 	if (pglogical_use_spi)
@@ -1942,6 +4266,28 @@ pglogical_apply_main(Datum main_arg)
 	InitMultinodeExecutor(false);
 #endif
 	CommitTransactionCommand();
+}
+
+void
+pglogical_apply_main(Datum main_arg)
+{
+	int				slot = DatumGetInt32(main_arg);
+	PGconn		   *streamConn;
+	RepOriginId		originid;
+	XLogRecPtr		origin_startpos;
+	char		   *repsets;
+	char		   *origins;
+
+	/* Setup shmem. */
+	pglogical_worker_attach(slot, PGLOGICAL_WORKER_APPLY);
+	Assert(MyPGLogicalWorker->worker_type == PGLOGICAL_WORKER_APPLY);
+	MyApplyWorker = &MyPGLogicalWorker->worker.apply;
+
+	/* Attach to dsm segment. */
+	Assert(CurrentResourceOwner == NULL);
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "pglogical apply");
+
+	apply_worker_init();
 
 	elog(LOG, "starting apply for subscription %s", MySubscription->name);
 
@@ -1970,6 +4316,16 @@ pglogical_apply_main(Datum main_arg)
 	replorigin_session_origin = originid;
 	origin_startpos = replorigin_session_get_progress(false);
 
+	/*
+	 * Open the local spool if we spool the stream or if there is something
+	 * left to replay in it. What's in the spool was already confirmed to the
+	 * provider, so continue streaming after it.
+	 */
+	if (pglogical_spool_open(MySubscription->id, origin_startpos,
+							 pglogical_spool_stream) &&
+		origin_startpos < pglogical_spool_flushed_lsn())
+		origin_startpos = pglogical_spool_flushed_lsn();
+
 	/* Start the replication. */
 	streamConn = pglogical_connect_replica(MySubscription->origin_if->dsn,
 										   MySubscription->name, NULL);
@@ -1983,9 +4339,14 @@ pglogical_apply_main(Datum main_arg)
      */
 	pglogical_identify_system(streamConn, NULL, NULL, NULL, NULL);
 
+#if PG_VERSION_NUM >= 140000
+	apply_streaming = apply_stream_wanted();
+#endif
+
 	pglogical_start_replication(streamConn, MySubscription->slot_name,
 								origin_startpos, origins, repsets, NULL,
-								MySubscription->force_text_transfer);
+								MySubscription->force_text_transfer,
+								apply_streaming);
 	pfree(repsets);
 
 	CommitTransactionCommand();
@@ -2005,3 +4366,310 @@ pglogical_apply_main(Datum main_arg)
 	/* We should only get here if we received sigTERM */
 	proc_exit(0);
 }
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * Start a savepoint for the remote subtransaction unless it already has one,
+ * so that it can be rolled back on its own.
+ */
+static void
+stream_helper_subxact(TransactionId subxid)
+{
+	char		name[NAMEDATALEN];
+	int			i;
+
+	if (subxid == MyPGLogicalWorker->worker.stream.xid)
+		return;
+
+	for (i = 0; i < stream_nsubxids; i++)
+	{
+		if (stream_subxids[i] == subxid)
+			return;
+	}
+
+	if (stream_nsubxids >= stream_maxsubxids)
+	{
+		stream_maxsubxids = Max(64, stream_maxsubxids * 2);
+		if (stream_subxids == NULL)
+			stream_subxids = MemoryContextAlloc(TopMemoryContext,
+							stream_maxsubxids * sizeof(TransactionId));
+		else
+			stream_subxids = repalloc(stream_subxids,
+							stream_maxsubxids * sizeof(TransactionId));
+	}
+
+	multi_insert_finish();
+
+	snprintf(name, sizeof(name), "pglogical_stream_%u", subxid);
+	DefineSavepoint(name);
+	CommitTransactionCommand();
+	MemoryContextSwitchTo(MessageContext);
+
+	stream_subxids[stream_nsubxids++] = subxid;
+}
+
+/*
+ * Roll back the remote subtransaction, and those started after it.
+ */
+static void
+stream_helper_abort_subxact(TransactionId subxid)
+{
+	char		name[NAMEDATALEN];
+	int			i;
+
+	for (i = 0; i < stream_nsubxids; i++)
+	{
+		if (stream_subxids[i] == subxid)
+			break;
+	}
+
+	/* Nothing of it was applied. */
+	if (i == stream_nsubxids)
+		return;
+
+	/* Buffered rows must go with it. */
+	multi_insert_finish();
+
+	snprintf(name, sizeof(name), "pglogical_stream_%u", subxid);
+	RollbackToSavepoint(name);
+	CommitTransactionCommand();
+	MemoryContextSwitchTo(MessageContext);
+
+	stream_nsubxids = i;
+	command_counter_needed = true;
+}
+
+/*
+ * Commit the streamed transaction and let the apply worker know.
+ */
+static void
+stream_helper_finish(StringInfo s, StreamShared *shared,
+					 RepOriginId originid)
+{
+	XLogRecPtr		commit_lsn;
+	XLogRecPtr		end_lsn;
+	TimestampTz		commit_time;
+	XLogRecPtr		local_end;
+
+	(void) pglogical_read_stream_commit(s, &commit_lsn, &end_lsn,
+										&commit_time);
+
+	multi_insert_finish();
+
+	/* Deferred triggers must see the last change too. */
+	apply_command_counter_increment();
+
+	apply_api.on_commit();
+
+	/* The apply worker has let go of the origin, see stream_helper_commit(). */
+	replorigin_session_setup(originid);
+	replorigin_session_origin_lsn = end_lsn;
+	replorigin_session_origin_timestamp = commit_time;
+
+	StartTransactionCommand();
+	EndTransactionBlock(false);
+	CommitTransactionCommand();
+	local_end = XactLastCommitEnd;
+
+	replorigin_session_reset();
+	replorigin_session_origin = InvalidRepOriginId;
+
+	SpinLockAcquire(&shared->mutex);
+	shared->local_end = local_end;
+	shared->committed = true;
+	SpinLockRelease(&shared->mutex);
+
+	SetLatch(&shared->leader->procLatch);
+	stream_unlock(remote_xid, STREAM_LOCK_XACT, AccessExclusiveLock);
+
+	ProcessCompletedNotifies();
+
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+/*
+ * Apply one streamed transaction passed on by the apply worker, see
+ * handle_stream_start().
+ *
+ * The changes are applied into a transaction block which is kept open until
+ * the apply worker tells us that the transaction committed or aborted on the
+ * provider, with a savepoint for each remote subtransaction.
+ */
+void
+pglogical_stream_main(Datum main_arg)
+{
+	int				slot = DatumGetInt32(main_arg);
+	PGLogicalStreamWorker *stream;
+	dsm_segment	   *seg;
+	StreamShared   *shared;
+	shm_mq		   *mq;
+	shm_mq_handle  *mqh;
+	RepOriginId		originid;
+
+	/* Setup shmem. */
+	pglogical_worker_attach(slot, PGLOGICAL_WORKER_STREAM);
+	stream = &MyPGLogicalWorker->worker.stream;
+	MyApplyWorker = &stream->apply;
+
+	/* Attach to dsm segment. */
+	Assert(CurrentResourceOwner == NULL);
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "pglogical stream");
+
+	seg = dsm_attach(stream->handle);
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment of streamed transaction %u",
+						stream->xid)));
+	dsm_pin_mapping(seg);
+
+	shared = dsm_segment_address(seg);
+	mq = (shm_mq *) ((char *) shared + STREAM_SHARED_SIZE);
+	shm_mq_set_receiver(mq, MyProc);
+	mqh = shm_mq_attach(mq, seg, NULL);
+
+	apply_worker_init();
+
+	StartTransactionCommand();
+	QueueRelid = get_queue_table_oid();
+	originid = replorigin_by_name(MySubscription->slot_name, false);
+	CommitTransactionCommand();
+
+	/* The apply worker waits on it for the commit. */
+	stream_lock(stream->xid, STREAM_LOCK_XACT, AccessExclusiveLock);
+	SpinLockAcquire(&shared->mutex);
+	shared->locked = true;
+	SpinLockRelease(&shared->mutex);
+	SetLatch(&shared->leader->procLatch);
+
+	elog(DEBUG1, "applying streamed transaction %u for subscription %s",
+		 stream->xid, MySubscription->name);
+
+	/*
+	 * The apply worker has the origin set up until the transaction commits,
+	 * but what we write has to be marked as coming from it all along, so that
+	 * it isn't replicated back.
+	 */
+	replorigin_session_origin = originid;
+	remote_xid = stream->xid;
+
+	MessageContext = AllocSetContextCreate(TopMemoryContext,
+										   "MessageContext",
+										   ALLOCSET_DEFAULT_SIZES);
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	BeginTransactionBlock();
+	CommitTransactionCommand();
+	apply_api.on_begin();
+	MemoryContextSwitchTo(MessageContext);
+
+	in_remote_transaction = true;
+	pgstat_report_activity(STATE_RUNNING, NULL);
+
+	for (;;)
+	{
+		StringInfoData	s;
+		shm_mq_result	res;
+		Size			len;
+		void		   *data;
+		char			action;
+
+		res = shm_mq_receive(mqh, &len, &data, true);
+
+		if (res == SHM_MQ_WOULD_BLOCK)
+		{
+			int			rc;
+
+			rc = WaitLatch(&MyProc->procLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   1000L);
+
+			ResetLatch(&MyProc->procLatch);
+
+			/* emergency bailout if postmaster has died */
+			if (rc & WL_POSTMASTER_DEATH)
+				proc_exit(1);
+
+			CHECK_FOR_INTERRUPTS();
+
+			if (got_SIGTERM)
+			{
+				AbortOutOfAnyTransaction();
+				proc_exit(0);
+			}
+
+			continue;
+		}
+
+		if (res != SHM_MQ_SUCCESS)
+		{
+			bool		abandoned;
+
+			SpinLockAcquire(&shared->mutex);
+			abandoned = shared->abandoned;
+			SpinLockRelease(&shared->mutex);
+
+			/* The apply worker applies the transaction from its file. */
+			if (abandoned)
+			{
+				elog(DEBUG1, "streamed transaction %u left to the apply worker",
+					 stream->xid);
+				AbortOutOfAnyTransaction();
+				proc_exit(0);
+			}
+
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("apply worker passing on streamed transaction %u exited",
+							stream->xid)));
+		}
+
+		memset(&s, 0, sizeof(StringInfoData));
+		s.data = data;
+		s.len = len;
+		s.maxlen = -1;
+		s.cursor = 0;
+
+		action = pq_getmsgbyte(&s);
+
+		if (action == 'x')
+			stream_helper_subxact(pglogical_read_stream_subxact(&s));
+		else if (action == 'e')
+		{
+			/* Wait until the apply worker passes the next block on. */
+			stream_lock(stream->xid, STREAM_LOCK_STREAM, AccessShareLock);
+			stream_unlock(stream->xid, STREAM_LOCK_STREAM, AccessShareLock);
+		}
+		else if (action == 'a')
+		{
+			TransactionId	subxid;
+
+			(void) pglogical_read_stream_abort(&s, &subxid);
+
+			if (subxid == stream->xid)
+			{
+				elog(DEBUG1, "streamed transaction %u aborted", stream->xid);
+				AbortOutOfAnyTransaction();
+				proc_exit(0);
+			}
+
+			stream_helper_abort_subxact(subxid);
+		}
+		else if (action == 'c')
+		{
+			stream_helper_finish(&s, shared, originid);
+			proc_exit(0);
+		}
+		else
+		{
+			s.cursor = 0;
+			replication_handler(&s);
+			continue;
+		}
+
+		Assert(CurrentMemoryContext == MessageContext);
+		MemoryContextReset(MessageContext);
+	}
+}
+#endif
@@ -95,9 +95,15 @@ typedef struct ApplyMIState
 	HeapTuple		   *buffered_tuples;
 #endif
 	int					maxbuffered_tuples;
+	int					nalloced_tuples;
 	int					nbuffered_tuples;
+	Size				buffered_bytes;
 } ApplyMIState;
 
+/* Initial and maximum number of tuples buffered for single relation. */
+#define INITIAL_BUFFERED_TUPLES		64
+#define MAX_BUFFERED_TUPLES			10000
+
 
 #if PG_VERSION_NUM >= 120000
 #define TTS_TUP(slot) (((HeapTupleTableSlot *)slot)->tuple)
@@ -106,7 +112,10 @@ typedef struct ApplyMIState
 #endif
 
 
-static ApplyMIState *pglmistate = NULL;
+/* Multi insert states of all relations currently being batched. */
+static List *pglmistates = NIL;
+/* Size of the tuples buffered by all of them. */
+static Size	pglmi_buffered_bytes = 0;
 
 void
 pglogical_apply_heap_begin(void)
@@ -304,81 +313,27 @@ finish_apply_exec_state(ApplyExecState *aestate)
 }
 
 /*
- * Handle insert via low level api.
+ * Insert the remote tuple stored in aestate->slot, resolving the conflict with
+ * the existing tuple in 'localslot' first if conflicts_idx_id is valid.
+ *
+ * BEFORE ROW INSERT triggers must have been already fired by caller.
  */
-void
-pglogical_apply_heap_insert(PGLogicalRelation *rel, PGLogicalTupleData *newtup)
+static void
+apply_heap_insert_slot(PGLogicalRelation *rel, ApplyExecState *aestate,
+					   TupleTableSlot *localslot, Oid conflicts_idx_id,
+					   bool has_before_triggers)
 {
-	ApplyExecState	   *aestate;
-	Oid					conflicts_idx_id;
-	TupleTableSlot	   *localslot;
+	TupleTableSlot	   *slot = aestate->slot;
 	HeapTuple			remotetuple;
 	HeapTuple			applytuple;
 	PGLogicalConflictResolution resolution;
 	List			   *recheckIndexes = NIL;
-	MemoryContext		oldctx;
-	bool				has_before_triggers = false;
-
-	/* Initialize the executor state. */
-	aestate = init_apply_exec_state(rel);
-#if PG_VERSION_NUM >= 120000
-	localslot = table_slot_create(rel->rel, &aestate->estate->es_tupleTable);
-#else
-	localslot = ExecInitExtraTupleSlot(aestate->estate);
-	ExecSetSlotDescriptor(localslot, RelationGetDescr(rel->rel));
-#endif
-
-	ExecOpenIndices(aestate->resultRelInfo
-#if PG_VERSION_NUM >= 90500
-					, false
-#endif
-					);
-
-	/*
-	 * Check for existing tuple with same key in any unique index containing
-	 * only normal columns. This doesn't just check the replica identity index,
-	 * but it'll prefer it and use it first.
-	 */
-	conflicts_idx_id = pglogical_tuple_find_conflict(aestate->resultRelInfo,
-													 newtup,
-													 localslot);
-
-	/* Process and store remote tuple in the slot */
-	oldctx = MemoryContextSwitchTo(GetPerTupleMemoryContext(aestate->estate));
-	fill_missing_defaults(rel, aestate->estate, newtup);
-	remotetuple = heap_form_tuple(RelationGetDescr(rel->rel),
-								  newtup->values, newtup->nulls);
-	MemoryContextSwitchTo(oldctx);
-	ExecStoreHeapTuple(remotetuple, aestate->slot, true);
-
-	if (aestate->resultRelInfo->ri_TrigDesc &&
-		aestate->resultRelInfo->ri_TrigDesc->trig_insert_before_row)
-	{
-		has_before_triggers = true;
-
-#if PG_VERSION_NUM >= 120000
-		if (!ExecBRInsertTriggers(aestate->estate,
-								  aestate->resultRelInfo,
-								  aestate->slot))
-#else
-		aestate->slot = ExecBRInsertTriggers(aestate->estate,
-											 aestate->resultRelInfo,
-											 aestate->slot);
-
-		if (aestate->slot == NULL)		/* "do nothing" */
-#endif
-		{
-			finish_apply_exec_state(aestate);
-			return;
-		}
-
-	}
 
 	/* trigger might have changed tuple */
 #if PG_VERSION_NUM >= 120000
-	remotetuple = ExecFetchSlotHeapTuple(aestate->slot, true, NULL);
+	remotetuple = ExecFetchSlotHeapTuple(slot, true, NULL);
 #else
-	remotetuple = ExecMaterializeSlot(aestate->slot);
+	remotetuple = ExecMaterializeSlot(slot);
 #endif
 
 	/* Did we find matching key in any candidate-key index? */
@@ -412,7 +367,7 @@ pglogical_apply_heap_insert(PGLogicalRelation *rel, PGLogicalTupleData *newtup)
 #endif
 
 			if (applytuple != remotetuple)
-				ExecStoreHeapTuple(applytuple, aestate->slot, false);
+				ExecStoreHeapTuple(applytuple, slot, false);
 
 			if (aestate->resultRelInfo->ri_TrigDesc &&
 				aestate->resultRelInfo->ri_TrigDesc->trig_update_before_row)
@@ -423,58 +378,57 @@ pglogical_apply_heap_insert(PGLogicalRelation *rel, PGLogicalTupleData *newtup)
 										  aestate->resultRelInfo,
 										  &(TTS_TUP(localslot)->t_self),
 										  NULL,
-										  aestate->slot))
+										  slot))
 #else
-				aestate->slot = ExecBRUpdateTriggers(aestate->estate,
-													 &aestate->epqstate,
-													 aestate->resultRelInfo,
-													 &(TTS_TUP(localslot)->t_self),
-													 NULL,
-													 aestate->slot);
-
-				if (aestate->slot == NULL)		/* "do nothing" */
+				slot = ExecBRUpdateTriggers(aestate->estate,
+											&aestate->epqstate,
+											aestate->resultRelInfo,
+											&(TTS_TUP(localslot)->t_self),
+											NULL,
+											slot);
+
+				if (slot == NULL)		/* "do nothing" */
 #endif
-				{
-					finish_apply_exec_state(aestate);
 					return;
-				}
-
 			}
 
 			/* trigger might have changed tuple */
 #if PG_VERSION_NUM >= 120000
-			remotetuple = ExecFetchSlotHeapTuple(aestate->slot, true, NULL);
+			remotetuple = ExecFetchSlotHeapTuple(slot, true, NULL);
 #else
-			remotetuple = ExecMaterializeSlot(aestate->slot);
+			remotetuple = ExecMaterializeSlot(slot);
 #endif
 
 			/* Check the constraints of the tuple */
 			if (rel->rel->rd_att->constr)
-				ExecConstraints(aestate->resultRelInfo, aestate->slot,
+				ExecConstraints(aestate->resultRelInfo, slot,
 								aestate->estate);
 
 #if PG_VERSION_NUM >= 120000
 			simple_table_tuple_update(rel->rel,
 									  &(localslot->tts_tid),
-									  aestate->slot,
+									  slot,
 									  aestate->estate->es_snapshot,
 									  &update_indexes);
 			if (update_indexes)
 #else
 			simple_heap_update(rel->rel, &(TTS_TUP(localslot)->t_self),
-							   TTS_TUP(aestate->slot));
-			if (!HeapTupleIsHeapOnly(TTS_TUP(aestate->slot)))
+							   TTS_TUP(slot));
+			if (!HeapTupleIsHeapOnly(TTS_TUP(slot)))
 #endif
 				recheckIndexes = UserTableUpdateOpenIndexes(aestate->resultRelInfo,
 															aestate->estate,
-															aestate->slot,
+															slot,
 															true);
 
+			if (pglogical_keyless_tuple_hash)
+				pglogical_keyless_tuple_hash_add(rel->rel, slot);
+
 			/* AFTER ROW UPDATE Triggers */
 #if PG_VERSION_NUM >= 120000
 			ExecARUpdateTriggers(aestate->estate, aestate->resultRelInfo,
 								 &(TTS_TUP(localslot)->t_self),
-								 NULL, aestate->slot, recheckIndexes);
+								 NULL, slot, recheckIndexes);
 #else
 			ExecARUpdateTriggers(aestate->estate, aestate->resultRelInfo,
 								 &(TTS_TUP(localslot)->t_self),
@@ -486,32 +440,136 @@ pglogical_apply_heap_insert(PGLogicalRelation *rel, PGLogicalTupleData *newtup)
 	{
 		/* Check the constraints of the tuple */
 		if (rel->rel->rd_att->constr)
-			ExecConstraints(aestate->resultRelInfo, aestate->slot,
+			ExecConstraints(aestate->resultRelInfo, slot,
 							aestate->estate);
 
 #if PG_VERSION_NUM >= 120000
-		simple_table_tuple_insert(aestate->resultRelInfo->ri_RelationDesc, aestate->slot);
+		simple_table_tuple_insert(aestate->resultRelInfo->ri_RelationDesc, slot);
 #else
-		simple_heap_insert(rel->rel, TTS_TUP(aestate->slot));
+		simple_heap_insert(rel->rel, TTS_TUP(slot));
 #endif
-		UserTableUpdateOpenIndexes(aestate->resultRelInfo, aestate->estate, aestate->slot, false);
+		UserTableUpdateOpenIndexes(aestate->resultRelInfo, aestate->estate, slot, false);
+
+		if (pglogical_keyless_tuple_hash)
+			pglogical_keyless_tuple_hash_add(rel->rel, slot);
 
 		/* AFTER ROW INSERT Triggers */
 #if PG_VERSION_NUM >= 120000
 		ExecARInsertTriggers(aestate->estate, aestate->resultRelInfo,
-							 aestate->slot, recheckIndexes);
+							 slot, recheckIndexes);
 #else
 		ExecARInsertTriggers(aestate->estate, aestate->resultRelInfo,
 							 remotetuple, recheckIndexes);
 #endif
 	}
+}
 
-	finish_apply_exec_state(aestate);
+/*
+ * Handle insert via low level api.
+ */
+void
+pglogical_apply_heap_insert(PGLogicalRelation *rel, PGLogicalTupleData *newtup)
+{
+	ApplyExecState	   *aestate;
+	Oid					conflicts_idx_id;
+	TupleTableSlot	   *localslot;
+	HeapTuple			remotetuple;
+	MemoryContext		oldctx;
+	bool				has_before_triggers = false;
+
+	/* Initialize the executor state. */
+	aestate = init_apply_exec_state(rel);
+#if PG_VERSION_NUM >= 120000
+	localslot = table_slot_create(rel->rel, &aestate->estate->es_tupleTable);
+#else
+	localslot = ExecInitExtraTupleSlot(aestate->estate);
+	ExecSetSlotDescriptor(localslot, RelationGetDescr(rel->rel));
+#endif
+
+	ExecOpenIndices(aestate->resultRelInfo
+#if PG_VERSION_NUM >= 90500
+					, false
+#endif
+					);
+
+	/*
+	 * Check for existing tuple with same key in any unique index containing
+	 * only normal columns. This doesn't just check the replica identity index,
+	 * but it'll prefer it and use it first.
+	 */
+	conflicts_idx_id = pglogical_tuple_find_conflict(aestate->resultRelInfo,
+													 newtup,
+													 localslot);
+
+	/* Process and store remote tuple in the slot */
+	oldctx = MemoryContextSwitchTo(GetPerTupleMemoryContext(aestate->estate));
+	fill_missing_defaults(rel, aestate->estate, newtup);
+	remotetuple = heap_form_tuple(RelationGetDescr(rel->rel),
+								  newtup->values, newtup->nulls);
+	MemoryContextSwitchTo(oldctx);
+	ExecStoreHeapTuple(remotetuple, aestate->slot, true);
+
+	if (aestate->resultRelInfo->ri_TrigDesc &&
+		aestate->resultRelInfo->ri_TrigDesc->trig_insert_before_row)
+	{
+		has_before_triggers = true;
+
+#if PG_VERSION_NUM >= 120000
+		if (!ExecBRInsertTriggers(aestate->estate,
+								  aestate->resultRelInfo,
+								  aestate->slot))
+#else
+		aestate->slot = ExecBRInsertTriggers(aestate->estate,
+											 aestate->resultRelInfo,
+											 aestate->slot);
+
+		if (aestate->slot == NULL)		/* "do nothing" */
+#endif
+		{
+			finish_apply_exec_state(aestate);
+			return;
+		}
+
+	}
 
-	CommandCounterIncrement();
+	apply_heap_insert_slot(rel, aestate, localslot, conflicts_idx_id,
+						   has_before_triggers);
+
+	finish_apply_exec_state(aestate);
 }
 
 
+/*
+ * Get the attributes identifying the old tuple when the local table has no
+ * REPLICA IDENTITY index (returns NULL if it has one).
+ *
+ * If the remote table has a replica identity its columns are used, otherwise
+ * (REPLICA IDENTITY FULL) all the columns received in the old tuple.
+ */
+static bool *
+get_identity_matchatts(PGLogicalRelation *rel, PGLogicalTupleData *oldtup)
+{
+	TupleDesc	desc = RelationGetDescr(rel->rel);
+	bool	   *matchatts;
+	int			i;
+
+	if (OidIsValid(RelationGetReplicaIndex(rel->rel)))
+		return NULL;
+
+	matchatts = palloc0(desc->natts * sizeof(bool));
+	for (i = 0; i < rel->natts; i++)
+	{
+		int			attid = rel->attmap[i];
+
+		if (rel->hasidentity && !rel->attidentity[i])
+			continue;
+
+		matchatts[attid] = oldtup->changed[attid];
+	}
+
+	return matchatts;
+}
+
 /*
  * Handle update via low level api.
  */
@@ -538,8 +596,9 @@ pglogical_apply_heap_update(PGLogicalRelation *rel, PGLogicalTupleData *oldtup,
 #endif
 
 	/* Search for existing tuple with same key */
-	found = pglogical_tuple_find_replidx(aestate->resultRelInfo, oldtup, localslot,
-										 &replident_idx_id);
+	found = pglogical_tuple_find_replidx(aestate->resultRelInfo, oldtup,
+										 get_identity_matchatts(rel, oldtup),
+										 localslot, &replident_idx_id);
 
 	/*
 	 * Tuple found, update the local tuple.
@@ -669,6 +728,9 @@ pglogical_apply_heap_update(PGLogicalRelation *rel, PGLogicalTupleData *oldtup,
 															true);
 			}
 
+			if (pglogical_keyless_tuple_hash)
+				pglogical_keyless_tuple_hash_add(rel->rel, aestate->slot);
+
 			/* AFTER ROW UPDATE Triggers */
 #if PG_VERSION_NUM >= 120000
 			ExecARUpdateTriggers(aestate->estate, aestate->resultRelInfo,
@@ -700,8 +762,6 @@ pglogical_apply_heap_update(PGLogicalRelation *rel, PGLogicalTupleData *oldtup,
 
 	/* Cleanup. */
 	finish_apply_exec_state(aestate);
-
-	CommandCounterIncrement();
 }
 
 /*
@@ -724,8 +784,9 @@ pglogical_apply_heap_delete(PGLogicalRelation *rel, PGLogicalTupleData *oldtup)
 	ExecSetSlotDescriptor(localslot, RelationGetDescr(rel->rel));
 #endif
 
-	if (pglogical_tuple_find_replidx(aestate->resultRelInfo, oldtup, localslot,
-									 &replident_idx_id))
+	if (pglogical_tuple_find_replidx(aestate->resultRelInfo, oldtup,
+									 get_identity_matchatts(rel, oldtup),
+									 localslot, &replident_idx_id))
 	{
 		if (aestate->resultRelInfo->ri_TrigDesc &&
 			aestate->resultRelInfo->ri_TrigDesc->trig_delete_before_row)
@@ -766,45 +827,51 @@ pglogical_apply_heap_delete(PGLogicalRelation *rel, PGLogicalTupleData *oldtup)
 
 	/* Cleanup. */
 	finish_apply_exec_state(aestate);
-
-	CommandCounterIncrement();
 }
 
 
 bool
 pglogical_apply_heap_can_mi(PGLogicalRelation *rel)
 {
-	/* Multi insert is only supported when conflicts result in errors. */
-	return pglogical_conflict_resolver == PGLOGICAL_RESOLVE_ERROR;
+	/*
+	 * Conflicting rows are weeded out when the buffer is flushed, so any
+	 * conflict resolver can be used with multi insert.
+	 */
+	return true;
 }
 
 /*
  * MultiInsert initialization.
+ *
+ * Returns the existing state for the relation if there is one.
  */
-static void
+static ApplyMIState *
 pglogical_apply_heap_mi_start(PGLogicalRelation *rel)
 {
 	MemoryContext	oldctx;
+	ApplyMIState   *mistate;
 	ApplyExecState *aestate;
 	ResultRelInfo  *resultRelInfo;
 	TupleDesc		desc;
 	bool			volatile_defexprs = false;
+	ListCell	   *lc;
 
-	if (pglmistate && pglmistate->rel == rel)
-		return;
-
-	if (pglmistate && pglmistate->rel != rel)
-		pglogical_apply_heap_mi_finish(pglmistate->rel);
+	foreach (lc, pglmistates)
+	{
+		mistate = (ApplyMIState *) lfirst(lc);
+		if (mistate->rel == rel)
+			return mistate;
+	}
 
 	oldctx = MemoryContextSwitchTo(TopTransactionContext);
 
 	/* Initialize new MultiInsert state. */
-	pglmistate = palloc0(sizeof(ApplyMIState));
+	mistate = palloc0(sizeof(ApplyMIState));
 
-	pglmistate->rel = rel;
+	mistate->rel = rel;
 
 	/* Initialize the executor state. */
-	pglmistate->aestate = aestate = init_apply_exec_state(rel);
+	mistate->aestate = aestate = init_apply_exec_state(rel);
 	MemoryContextSwitchTo(TopTransactionContext);
 	resultRelInfo = aestate->resultRelInfo;
 
@@ -843,55 +910,164 @@ pglogical_apply_heap_mi_start(PGLogicalRelation *rel)
 
 	/*
 	 * Decide if to buffer tuples based on the collected information
-	 * about the table.
+	 * about the table. Otherwise the buffer is only limited by the
+	 * pglogical.batch_inserts_buffer_size, the tuple limit is just a
+	 * safety net.
 	 */
 	if ((resultRelInfo->ri_TrigDesc != NULL &&
 		 (resultRelInfo->ri_TrigDesc->trig_insert_before_row ||
 		  resultRelInfo->ri_TrigDesc->trig_insert_instead_row)) ||
 		volatile_defexprs)
 	{
-		pglmistate->maxbuffered_tuples = 1;
+		mistate->maxbuffered_tuples = 1;
 	}
 	else
 	{
-		pglmistate->maxbuffered_tuples = 1000;
+		mistate->maxbuffered_tuples = MAX_BUFFERED_TUPLES;
 	}
 
-	pglmistate->cid = GetCurrentCommandId(true);
-	pglmistate->bistate = GetBulkInsertState();
+	mistate->cid = GetCurrentCommandId(true);
+	mistate->bistate = GetBulkInsertState();
 
-	/* Make the space for buffer. */
+	/* Make the space for buffer, it's enlarged as needed. */
+	mistate->nalloced_tuples = Min(mistate->maxbuffered_tuples,
+								   INITIAL_BUFFERED_TUPLES);
 #if PG_VERSION_NUM >= 120000
-	pglmistate->buffered_tuples = palloc0(pglmistate->maxbuffered_tuples * sizeof(TupleTableSlot *));
+	mistate->buffered_tuples = palloc0(mistate->nalloced_tuples * sizeof(TupleTableSlot *));
 #else
-	pglmistate->buffered_tuples = palloc0(pglmistate->maxbuffered_tuples * sizeof(HeapTuple));
+	mistate->buffered_tuples = palloc0(mistate->nalloced_tuples * sizeof(HeapTuple));
 #endif
-	pglmistate->nbuffered_tuples = 0;
+	mistate->nbuffered_tuples = 0;
+	mistate->buffered_bytes = 0;
+
+	pglmistates = lappend(pglmistates, mistate);
 
 	MemoryContextSwitchTo(oldctx);
+
+	return mistate;
 }
 
-/* Write the buffered tuples. */
+/*
+ * Find buffered tuples that conflict with existing rows.
+ *
+ * Returns number of conflicting tuples, conflicts[i] is set to the oid of the
+ * conflicting index for each of them.
+ */
+static int
+pglogical_apply_heap_mi_conflicts(ApplyMIState *mistate, Oid *conflicts)
+{
+	ResultRelInfo  *resultRelInfo = mistate->aestate->resultRelInfo;
+	int				ntuples = mistate->nbuffered_tuples;
+	Datum		  **values = palloc(ntuples * sizeof(Datum *));
+	bool		  **nulls = palloc(ntuples * sizeof(bool *));
+	int				i;
+#if PG_VERSION_NUM < 120000
+	TupleDesc		desc = RelationGetDescr(mistate->rel->rel);
+#endif
+
+	for (i = 0; i < ntuples; i++)
+	{
+#if PG_VERSION_NUM >= 120000
+		TupleTableSlot *slot = mistate->buffered_tuples[i];
+
+		slot_getallattrs(slot);
+		values[i] = slot->tts_values;
+		nulls[i] = slot->tts_isnull;
+#else
+		values[i] = palloc(desc->natts * sizeof(Datum));
+		nulls[i] = palloc(desc->natts * sizeof(bool));
+		heap_deform_tuple(mistate->buffered_tuples[i], desc, values[i],
+						  nulls[i]);
+#endif
+	}
+
+	return pglogical_tuples_find_conflicts(resultRelInfo, ntuples, values,
+										   nulls, conflicts);
+}
+
+/*
+ * Apply buffered tuple which conflicts with an existing row using the
+ * single row insert path so that the conflict gets resolved and logged.
+ */
 static void
-pglogical_apply_heap_mi_flush(void)
+pglogical_apply_heap_mi_apply_conflict(ApplyMIState *mistate, int i,
+									   TupleTableSlot *localslot)
+{
+	ApplyExecState	   *aestate = mistate->aestate;
+	PGLogicalRelation  *rel = mistate->rel;
+	TupleDesc			desc = RelationGetDescr(rel->rel);
+	PGLogicalTupleData *tup = palloc(sizeof(PGLogicalTupleData));
+	Oid					conflicts_idx_id;
+
+#if PG_VERSION_NUM >= 120000
+	slot_getallattrs(mistate->buffered_tuples[i]);
+	memcpy(tup->values, mistate->buffered_tuples[i]->tts_values,
+		   desc->natts * sizeof(Datum));
+	memcpy(tup->nulls, mistate->buffered_tuples[i]->tts_isnull,
+		   desc->natts * sizeof(bool));
+	ExecCopySlot(aestate->slot, mistate->buffered_tuples[i]);
+#else
+	heap_deform_tuple(mistate->buffered_tuples[i], desc, tup->values,
+					  tup->nulls);
+	ExecStoreTuple(mistate->buffered_tuples[i], aestate->slot,
+				   InvalidBuffer, false);
+#endif
+
+	/*
+	 * Redo the lookup, this time locking the local tuple. It may be gone by
+	 * now, in which case this becomes plain insert.
+	 */
+	conflicts_idx_id = pglogical_tuple_find_conflict(aestate->resultRelInfo,
+													 tup, localslot);
+
+	apply_heap_insert_slot(rel, aestate, localslot, conflicts_idx_id,
+						   aestate->resultRelInfo->ri_TrigDesc &&
+						   aestate->resultRelInfo->ri_TrigDesc->trig_insert_before_row);
+
+	pfree(tup);
+}
+
+/*
+ * Multi insert 'ntuples' of the buffered tuples, update the indexes and run
+ * AFTER ROW INSERT triggers for them.
+ */
+static void
+pglogical_apply_heap_mi_insert(ApplyMIState *mistate,
+#if PG_VERSION_NUM >= 120000
+							   TupleTableSlot **insert_tuples,
+#else
+							   HeapTuple *insert_tuples,
+#endif
+							   int ninsert)
 {
 	MemoryContext	oldctx;
-	ResultRelInfo  *resultRelInfo;
+	ResultRelInfo  *resultRelInfo = mistate->aestate->resultRelInfo;
 	int				i;
 
-	if (!pglmistate || pglmistate->nbuffered_tuples == 0)
-		return;
-
-	oldctx = MemoryContextSwitchTo(GetPerTupleMemoryContext(pglmistate->aestate->estate));
-	heap_multi_insert(pglmistate->rel->rel,
-					  pglmistate->buffered_tuples,
-					  pglmistate->nbuffered_tuples,
-					  pglmistate->cid,
+	oldctx = MemoryContextSwitchTo(GetPerTupleMemoryContext(mistate->aestate->estate));
+	heap_multi_insert(mistate->rel->rel,
+					  insert_tuples,
+					  ninsert,
+					  mistate->cid,
 					  0, /* hi_options */
-					  pglmistate->bistate);
+					  mistate->bistate);
 	MemoryContextSwitchTo(oldctx);
 
-	resultRelInfo = pglmistate->aestate->resultRelInfo;
+	if (pglogical_keyless_tuple_hash)
+	{
+		for (i = 0; i < ninsert; i++)
+		{
+#if PG_VERSION_NUM >= 120000
+			pglogical_keyless_tuple_hash_add(mistate->rel->rel,
+											 insert_tuples[i]);
+#else
+			ExecStoreTuple(insert_tuples[i], mistate->aestate->slot,
+						   InvalidBuffer, false);
+			pglogical_keyless_tuple_hash_add(mistate->rel->rel,
+											 mistate->aestate->slot);
+#endif
+		}
+	}
 
 	/*
 	 * If there are any indexes, update them for all the inserted tuples, and
@@ -899,13 +1075,13 @@ pglogical_apply_heap_mi_flush(void)
 	 */
 	if (resultRelInfo->ri_NumIndices > 0)
 	{
-		for (i = 0; i < pglmistate->nbuffered_tuples; i++)
+		for (i = 0; i < ninsert; i++)
 		{
 			List	   *recheckIndexes = NIL;
 
 #if PG_VERSION_NUM < 120000
-			ExecStoreTuple(pglmistate->buffered_tuples[i],
-						   pglmistate->aestate->slot,
+			ExecStoreTuple(insert_tuples[i],
+						   mistate->aestate->slot,
 						   InvalidBuffer, false);
 #endif
 			recheckIndexes =
@@ -914,12 +1090,12 @@ pglogical_apply_heap_mi_flush(void)
 									  resultRelInfo,
 #endif
 #if PG_VERSION_NUM >= 120000
-									  pglmistate->buffered_tuples[i],
+									  insert_tuples[i],
 #else
-									  pglmistate->aestate->slot,
-									  &(pglmistate->buffered_tuples[i]->t_self),
+									  mistate->aestate->slot,
+									  &(insert_tuples[i]->t_self),
 #endif
-									  pglmistate->aestate->estate
+									  mistate->aestate->estate
 #if PG_VERSION_NUM >= 90500
 #if PG_VERSION_NUM >= 140000
 									  , false
@@ -927,8 +1103,8 @@ pglogical_apply_heap_mi_flush(void)
 									  , false, NULL, NIL
 #endif
 									 );
-			ExecARInsertTriggers(pglmistate->aestate->estate, resultRelInfo,
-								 pglmistate->buffered_tuples[i],
+			ExecARInsertTriggers(mistate->aestate->estate, resultRelInfo,
+								 insert_tuples[i],
 								 recheckIndexes);
 			list_free(recheckIndexes);
 		}
@@ -941,15 +1117,115 @@ pglogical_apply_heap_mi_flush(void)
 	else if (resultRelInfo->ri_TrigDesc != NULL &&
 			 resultRelInfo->ri_TrigDesc->trig_insert_after_row)
 	{
-		for (i = 0; i < pglmistate->nbuffered_tuples; i++)
+		for (i = 0; i < ninsert; i++)
 		{
-			ExecARInsertTriggers(pglmistate->aestate->estate, resultRelInfo,
-								 pglmistate->buffered_tuples[i],
+			ExecARInsertTriggers(mistate->aestate->estate, resultRelInfo,
+								 insert_tuples[i],
 								 NIL);
 		}
 	}
+}
+
+/*
+ * Write the buffered tuples when some of them conflict, either with existing
+ * rows or with earlier tuples of the buffer.
+ *
+ * Keeps the arrival order: the runs of tuples between the conflicting ones
+ * are multi inserted and each conflicting tuple is resolved using the single
+ * row path in between. The conflict may be with a row written just before,
+ * which has to be made visible for the resolution to update it.
+ */
+static void
+pglogical_apply_heap_mi_insert_conflicts(ApplyMIState *mistate,
+										 Oid *conflicts)
+{
+	MemoryContext	oldctx;
+	TupleTableSlot *localslot;
+	int				i;
+	int				start = 0;
+
+#if PG_VERSION_NUM >= 120000
+	localslot = table_slot_create(mistate->rel->rel, NULL);
+#else
+	localslot = MakeSingleTupleTableSlot(RelationGetDescr(mistate->rel->rel));
+#endif
+
+	for (i = 0; i < mistate->nbuffered_tuples; i++)
+	{
+		if (!OidIsValid(conflicts[i]))
+			continue;
+
+		if (i > start)
+			pglogical_apply_heap_mi_insert(mistate,
+										   mistate->buffered_tuples + start,
+										   i - start);
+
+		if (i > 0)
+		{
+			CommandCounterIncrement();
+			if (ActiveSnapshotSet())
+				UpdateActiveSnapshotCommandId();
+			mistate->cid = GetCurrentCommandId(true);
+		}
+
+		oldctx = MemoryContextSwitchTo(GetPerTupleMemoryContext(mistate->aestate->estate));
+		pglogical_apply_heap_mi_apply_conflict(mistate, i, localslot);
+		MemoryContextSwitchTo(oldctx);
 
-	pglmistate->nbuffered_tuples = 0;
+		start = i + 1;
+	}
+
+	if (start < mistate->nbuffered_tuples)
+		pglogical_apply_heap_mi_insert(mistate,
+									   mistate->buffered_tuples + start,
+									   mistate->nbuffered_tuples - start);
+
+	ExecDropSingleTupleTableSlot(localslot);
+}
+
+/* Write the buffered tuples. */
+static void
+pglogical_apply_heap_mi_flush(ApplyMIState *mistate)
+{
+	MemoryContext	oldctx;
+	int				nconflicts = 0;
+	Oid			   *conflicts = NULL;
+
+	if (mistate->nbuffered_tuples == 0)
+		return;
+
+	/*
+	 * When conflicts are resolved rather than raised as errors, check the
+	 * whole buffer against the unique indexes first, both for existing rows
+	 * and for duplicates within the buffer.
+	 */
+	if (pglogical_conflict_resolver != PGLOGICAL_RESOLVE_ERROR)
+	{
+		oldctx = MemoryContextSwitchTo(GetPerTupleMemoryContext(mistate->aestate->estate));
+		conflicts = palloc(mistate->nbuffered_tuples * sizeof(Oid));
+		nconflicts = pglogical_apply_heap_mi_conflicts(mistate, conflicts);
+		MemoryContextSwitchTo(oldctx);
+	}
+
+	if (nconflicts == 0)
+		pglogical_apply_heap_mi_insert(mistate, mistate->buffered_tuples,
+									   mistate->nbuffered_tuples);
+	else
+		pglogical_apply_heap_mi_insert_conflicts(mistate, conflicts);
+
+	mistate->nbuffered_tuples = 0;
+	pglmi_buffered_bytes -= mistate->buffered_bytes;
+	mistate->buffered_bytes = 0;
+}
+
+/* Write the buffered tuples of all relations. */
+static void
+pglogical_apply_heap_mi_flush_all(void)
+{
+	ListCell   *lc;
+
+	foreach (lc, pglmistates)
+		pglogical_apply_heap_mi_flush((ApplyMIState *) lfirst(lc));
 }
 
 /* Add tuple to the MultiInsert. */
@@ -958,22 +1234,26 @@ pglogical_apply_heap_mi_add_tuple(PGLogicalRelation *rel,
 								  PGLogicalTupleData *tup)
 {
 	MemoryContext	oldctx;
+	ApplyMIState   *mistate;
 	ApplyExecState *aestate;
 	HeapTuple		remotetuple;
 	TupleTableSlot *slot;
 
-	pglogical_apply_heap_mi_start(rel);
+	mistate = pglogical_apply_heap_mi_start(rel);
 
 	/*
-	 * If sufficient work is pending, process that first
+	 * If sufficient work is pending, process that first. The memory budget
+	 * is shared by all the relations being batched.
 	 */
-	if (pglmistate->nbuffered_tuples >= pglmistate->maxbuffered_tuples)
-		pglogical_apply_heap_mi_flush();
+	if (mistate->nbuffered_tuples >= mistate->maxbuffered_tuples)
+		pglogical_apply_heap_mi_flush(mistate);
+	else if (pglmi_buffered_bytes >= (Size) pglogical_batch_inserts_buffer_size * 1024L)
+		pglogical_apply_heap_mi_flush_all();
 
 	/* Process and store remote tuple in the slot */
-	aestate = pglmistate->aestate;
+	aestate = mistate->aestate;
 
-	if (pglmistate->nbuffered_tuples == 0)
+	if (mistate->nbuffered_tuples == 0)
 	{
 		/*
 		 * Reset the per-tuple exprcontext. We can only do this if the
@@ -982,6 +1262,17 @@ pglogical_apply_heap_mi_add_tuple(PGLogicalRelation *rel,
 		 */
 		ResetPerTupleExprContext(aestate->estate);
 	}
+	else if (mistate->nbuffered_tuples >= mistate->nalloced_tuples)
+	{
+		int		newsize = Min(mistate->nalloced_tuples * 2,
+							  mistate->maxbuffered_tuples);
+
+		mistate->buffered_tuples = repalloc(mistate->buffered_tuples,
+											newsize * sizeof(*mistate->buffered_tuples));
+		memset(mistate->buffered_tuples + mistate->nalloced_tuples, 0,
+			   (newsize - mistate->nalloced_tuples) * sizeof(*mistate->buffered_tuples));
+		mistate->nalloced_tuples = newsize;
+	}
 
 	oldctx = MemoryContextSwitchTo(GetPerTupleMemoryContext(aestate->estate));
 	fill_missing_defaults(rel, aestate->estate, tup);
@@ -997,8 +1288,8 @@ pglogical_apply_heap_mi_add_tuple(PGLogicalRelation *rel,
 	{
 #if PG_VERSION_NUM >= 120000
 		if (!ExecBRInsertTriggers(aestate->estate,
-								 aestate->resultRelInfo,
-								 slot))
+								  aestate->resultRelInfo,
+								  slot))
 #else
 		slot = ExecBRInsertTriggers(aestate->estate,
 									aestate->resultRelInfo,
@@ -1022,40 +1313,54 @@ pglogical_apply_heap_mi_add_tuple(PGLogicalRelation *rel,
 						aestate->estate);
 
 #if PG_VERSION_NUM >= 120000
-	if (pglmistate->buffered_tuples[pglmistate->nbuffered_tuples] == NULL)
-		pglmistate->buffered_tuples[pglmistate->nbuffered_tuples] = table_slot_create(rel->rel, NULL);
+	if (mistate->buffered_tuples[mistate->nbuffered_tuples] == NULL)
+		mistate->buffered_tuples[mistate->nbuffered_tuples] = table_slot_create(rel->rel, NULL);
 	else
-		ExecClearTuple(pglmistate->buffered_tuples[pglmistate->nbuffered_tuples]);
-	ExecCopySlot(pglmistate->buffered_tuples[pglmistate->nbuffered_tuples], slot);
+		ExecClearTuple(mistate->buffered_tuples[mistate->nbuffered_tuples]);
+	ExecCopySlot(mistate->buffered_tuples[mistate->nbuffered_tuples], slot);
 #else
-	pglmistate->buffered_tuples[pglmistate->nbuffered_tuples] = remotetuple;
+	mistate->buffered_tuples[mistate->nbuffered_tuples] = remotetuple;
 #endif
-	pglmistate->nbuffered_tuples++;
+	mistate->nbuffered_tuples++;
+	mistate->buffered_bytes += HEAPTUPLESIZE + remotetuple->t_len;
+	pglmi_buffered_bytes += HEAPTUPLESIZE + remotetuple->t_len;
 	MemoryContextSwitchTo(oldctx);
 }
 
 void
 pglogical_apply_heap_mi_finish(PGLogicalRelation *rel)
 {
-	if (!pglmistate)
-		return;
+	ApplyMIState   *mistate = NULL;
+	ListCell	   *lc;
+
+	foreach (lc, pglmistates)
+	{
+		if (((ApplyMIState *) lfirst(lc))->rel == rel)
+		{
+			mistate = (ApplyMIState *) lfirst(lc);
+			break;
+		}
+	}
 
-	Assert(pglmistate->rel == rel);
+	if (!mistate)
+		return;
 
-	pglogical_apply_heap_mi_flush();
+	pglogical_apply_heap_mi_flush(mistate);
 
-	FreeBulkInsertState(pglmistate->bistate);
+	FreeBulkInsertState(mistate->bistate);
 
-	finish_apply_exec_state(pglmistate->aestate);
+	finish_apply_exec_state(mistate->aestate);
 
 #if PG_VERSION_NUM >= 120000
-	for (int i = 0; i < pglmistate->maxbuffered_tuples; i++)
-		if (pglmistate->buffered_tuples[i])
-			ExecDropSingleTupleTableSlot(pglmistate->buffered_tuples[i]);
+	for (int i = 0; i < mistate->nalloced_tuples; i++)
+		if (mistate->buffered_tuples[i])
+			ExecDropSingleTupleTableSlot(mistate->buffered_tuples[i]);
 #endif
 
-	pfree(pglmistate->buffered_tuples);
-	pfree(pglmistate);
+	pglmistates = list_delete_ptr(pglmistates, mistate);
+	if (pglmistates == NIL)
+		pglmi_buffered_bytes = 0;
 
-	pglmistate = NULL;
+	pfree(mistate->buffered_tuples);
+	pfree(mistate);
 }
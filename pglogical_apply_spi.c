@@ -538,11 +538,13 @@ pglogical_proccess_copy(pglogical_copyState *pglcstate)
 void
 pglogical_apply_spi_mi_finish(PGLogicalRelation *rel)
 {
-	if (!pglcstate)
+	/*
+	 * Nothing to do if the COPY for this relation was already finished when
+	 * other relation's COPY was started.
+	 */
+	if (!pglcstate || pglcstate->rel != rel)
 		return;
 
-	Assert(pglcstate->rel == rel);
-
 	pglogical_proccess_copy(pglcstate);
 
 	if (pglcstate->copy_stmt)
@@ -0,0 +1,186 @@
+/*-------------------------------------------------------------------------
+ *
+ * pglogical_compress.c
+ *		pglogical compression of the replication stream
+ *
+ * The native protocol can carry INSERT BATCH messages compressed, using one
+ * of the methods the server was built with. pglz is always available (except
+ * on 9.4), LZ4 and zstd only when PostgreSQL was built with them.
+ *
+ * Copyright (c) 2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pglogical_compress.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#if PG_VERSION_NUM >= 90500
+#include "common/pg_lzcompress.h"
+#endif
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "pglogical_compress.h"
+
+/* Favour speed, the stream is compressed while it's being sent. */
+#define ZSTD_COMPRESSION_LEVEL	1
+
+/*
+ * Find compression method by name, returns PGLOGICAL_COMPRESSION_NONE if it's
+ * not known or not supported by this build.
+ */
+char
+pglogical_compression_by_name(const char *name)
+{
+#if PG_VERSION_NUM >= 90500
+	if (strcmp(name, "pglz") == 0)
+		return PGLOGICAL_COMPRESSION_PGLZ;
+#endif
+#ifdef USE_LZ4
+	if (strcmp(name, "lz4") == 0)
+		return PGLOGICAL_COMPRESSION_LZ4;
+#endif
+#ifdef USE_ZSTD
+	if (strcmp(name, "zstd") == 0)
+		return PGLOGICAL_COMPRESSION_ZSTD;
+#endif
+
+	return PGLOGICAL_COMPRESSION_NONE;
+}
+
+const char *
+pglogical_compression_name(char method)
+{
+	switch (method)
+	{
+		case PGLOGICAL_COMPRESSION_PGLZ:
+			return "pglz";
+		case PGLOGICAL_COMPRESSION_LZ4:
+			return "lz4";
+		case PGLOGICAL_COMPRESSION_ZSTD:
+			return "zstd";
+		default:
+			return "none";
+	}
+}
+
+/*
+ * Size of the buffer pglogical_compress() needs for len bytes of input.
+ */
+int
+pglogical_compress_bound(char method, int len)
+{
+	switch (method)
+	{
+#if PG_VERSION_NUM >= 90500
+		case PGLOGICAL_COMPRESSION_PGLZ:
+			return PGLZ_MAX_OUTPUT(len);
+#endif
+#ifdef USE_LZ4
+		case PGLOGICAL_COMPRESSION_LZ4:
+			return LZ4_compressBound(len);
+#endif
+#ifdef USE_ZSTD
+		case PGLOGICAL_COMPRESSION_ZSTD:
+			return ZSTD_compressBound(len);
+#endif
+		default:
+			elog(ERROR, "unsupported compression method '%c'", method);
+	}
+
+	return 0;					/* keep compiler quiet */
+}
+
+/*
+ * Compress len bytes of src into dst, which has room for dstlen bytes.
+ *
+ * Returns the compressed size, or -1 if the data did not compress well
+ * enough to be worth it.
+ */
+int
+pglogical_compress(char method, const char *src, int len, char *dst,
+				   int dstlen)
+{
+	int			clen;
+
+	switch (method)
+	{
+#if PG_VERSION_NUM >= 90500
+		case PGLOGICAL_COMPRESSION_PGLZ:
+			Assert(dstlen >= PGLZ_MAX_OUTPUT(len));
+			clen = pglz_compress(src, len, dst, PGLZ_strategy_default);
+			break;
+#endif
+#ifdef USE_LZ4
+		case PGLOGICAL_COMPRESSION_LZ4:
+			clen = LZ4_compress_default(src, dst, len, dstlen);
+			if (clen <= 0)
+				clen = -1;
+			break;
+#endif
+#ifdef USE_ZSTD
+		case PGLOGICAL_COMPRESSION_ZSTD:
+			{
+				size_t		res;
+
+				res = ZSTD_compress(dst, dstlen, src, len,
+									ZSTD_COMPRESSION_LEVEL);
+				clen = ZSTD_isError(res) ? -1 : (int) res;
+			}
+			break;
+#endif
+		default:
+			elog(ERROR, "unsupported compression method '%c'", method);
+			return -1;			/* keep compiler quiet */
+	}
+
+	if (clen >= len)
+		return -1;
+
+	return clen;
+}
+
+/*
+ * Decompress len bytes of src into dst, which must be rawlen bytes long.
+ *
+ * Returns false if the data is corrupted.
+ */
+bool
+pglogical_decompress(char method, const char *src, int len, char *dst,
+					 int rawlen)
+{
+	switch (method)
+	{
+#if PG_VERSION_NUM >= 90500
+		case PGLOGICAL_COMPRESSION_PGLZ:
+#if PG_VERSION_NUM >= 120000
+			return pglz_decompress(src, len, dst, rawlen, true) == rawlen;
+#else
+			return pglz_decompress(src, len, dst, rawlen) == rawlen;
+#endif
+#endif
+#ifdef USE_LZ4
+		case PGLOGICAL_COMPRESSION_LZ4:
+			return LZ4_decompress_safe(src, dst, len, rawlen) == rawlen;
+#endif
+#ifdef USE_ZSTD
+		case PGLOGICAL_COMPRESSION_ZSTD:
+			return ZSTD_decompress(dst, rawlen, src, len) == (size_t) rawlen;
+#endif
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("compression method '%c' is not supported by this build",
+							method)));
+	}
+
+	return false;				/* keep compiler quiet */
+}
@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * pglogical_compress.h
+ *		pglogical compression of the replication stream
+ *
+ * Copyright (c) 2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pglogical_compress.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PGLOGICAL_COMPRESS_H
+#define PGLOGICAL_COMPRESS_H
+
+/*
+ * Compression methods, as sent in the COMPRESSED message and used as values
+ * of pglogical.stream_compression.
+ */
+#define PGLOGICAL_COMPRESSION_NONE	'\0'
+#define PGLOGICAL_COMPRESSION_PGLZ	'p'
+#define PGLOGICAL_COMPRESSION_LZ4	'l'
+#define PGLOGICAL_COMPRESSION_ZSTD	'z'
+
+extern char pglogical_compression_by_name(const char *name);
+extern const char *pglogical_compression_name(char method);
+
+extern int pglogical_compress_bound(char method, int len);
+extern int pglogical_compress(char method, const char *src, int len,
+							  char *dst, int dstlen);
+extern bool pglogical_decompress(char method, const char *src, int len,
+								 char *dst, int rawlen);
+
+#endif /* PGLOGICAL_COMPRESS_H */
@@ -22,6 +22,7 @@
 #include "access/transam.h"
 #include "access/xact.h"
 
+#include "catalog/pg_am.h"
 #include "catalog/pg_type.h"
 
 #include "executor/executor.h"
@@ -36,7 +37,10 @@
 
 #include "utils/builtins.h"
 #include "utils/datetime.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
@@ -50,19 +54,174 @@
 
 int		pglogical_conflict_resolver = PGLOGICAL_RESOLVE_APPLY_REMOTE;
 int		pglogical_conflict_log_level = LOG;
+bool	pglogical_keyless_tuple_hash = false;
 
 static void tuple_to_stringinfo(StringInfo s, TupleDesc tupdesc,
 	HeapTuple tuple);
 
 /*
- * Setup a ScanKey for a search in the relation 'rel' for a tuple 'key' that
- * is setup to match 'rel' (*NOT* idxrel!).
- *
- * Returns whether any column in the passed tuple contains a NULL for an
- * indexed field.
+ * Cached information needed to search unique index of a relation for a
+ * tuple, resolved once so that per-row lookups only need to fill in the
+ * datum values.
  */
-static bool
-build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, PGLogicalTupleData *tup)
+typedef struct PGLogicalIndexKeyInfo
+{
+	Oid			indexoid;
+	int			nkeys;
+	AttrNumber	attnums[INDEX_MAX_KEYS];	/* Heap attribute numbers. */
+	Oid			collations[INDEX_MAX_KEYS];
+	FmgrInfo	eqfuncs[INDEX_MAX_KEYS];	/* Equality procs. */
+	StrategyNumber strategy;	/* Equality strategy of the index AM. */
+	bool		unique;
+} PGLogicalIndexKeyInfo;
+
+/*
+ * Functions used for comparing and hashing values of one attribute when
+ * matching whole tuples.
+ */
+typedef struct PGLogicalAttCompareInfo
+{
+	bool		isvalid;
+	FmgrInfo	eqfunc;
+	bool		hashable;
+	FmgrInfo	hashfunc;
+} PGLogicalAttCompareInfo;
+
+typedef struct PGLogicalRelIndexCacheEntry
+{
+	Oid			reloid;			/* Key, must be first. */
+	bool		isvalid;
+	Oid			replidxoid;		/* REPLICA IDENTITY index, if any. */
+
+	/*
+	 * Candidate-key indexes in the order they should be searched: the
+	 * REPLICA IDENTITY index first, then the unique indexes containing only
+	 * normal columns and no predicate.
+	 */
+	int			nindexes;
+	PGLogicalIndexKeyInfo *indexes;
+
+	/*
+	 * Indexes usable for finding a tuple when there is no REPLICA IDENTITY
+	 * index, most selective first, see lookup_index_cmp.
+	 */
+	int			nlookupindexes;
+	PGLogicalIndexKeyInfo *lookupindexes;
+
+	/* Per-attribute comparison info, filled lazily, see get_att_compare. */
+	int			natts;
+	PGLogicalAttCompareInfo *attcmp;
+} PGLogicalRelIndexCacheEntry;
+
+/*
+ * Per-transaction hash of the tuples of a table without usable index, used to
+ * avoid doing a sequential scan for each row looked up in the table.
+ */
+typedef struct PGLogicalKeylessRelEntry
+{
+	Oid			reloid;			/* Key, must be first. */
+	bool		isvalid;
+	int			natts;
+	bool	   *matchatts;		/* Attributes the tuples were hashed on. */
+	HTAB	   *tuples;
+	MemoryContext cxt;			/* Holds all of the above. */
+} PGLogicalKeylessRelEntry;
+
+typedef struct PGLogicalKeylessTupleEntry
+{
+	uint32		hash;			/* Key, must be first. */
+	List	   *tids;			/* ItemPointers of tuples with this hash. */
+} PGLogicalKeylessTupleEntry;
+
+/* Tuples of a multi-insert batch with the same hash of their index key. */
+typedef struct PGLogicalBatchKeyEntry
+{
+	uint32		hash;			/* Key, must be first. */
+	List	   *tuples;			/* Indexes of the tuples in the batch. */
+} PGLogicalBatchKeyEntry;
+
+static HTAB *KeylessTupleHash = NULL;
+static MemoryContext KeylessTupleHashContext = NULL;
+static bool keyless_xact_cb_installed = false;
+
+static HTAB *RelIndexCache = NULL;
+static uint32 RelIndexCacheInvalCount = 0;
+
+static void
+relindex_cache_invalidate_callback(Datum arg, Oid reloid)
+{
+	HASH_SEQ_STATUS status;
+	PGLogicalRelIndexCacheEntry *entry;
+
+	if (RelIndexCache == NULL)
+		return;
+
+	RelIndexCacheInvalCount++;
+
+	if (reloid != InvalidOid)
+	{
+		entry = hash_search(RelIndexCache, (void *) &reloid, HASH_FIND, NULL);
+		if (entry != NULL)
+			entry->isvalid = false;
+	}
+	else
+	{
+		/* Invalidate all cache entries */
+		hash_seq_init(&status, RelIndexCache);
+		while ((entry = (PGLogicalRelIndexCacheEntry *) hash_seq_search(&status)) != NULL)
+			entry->isvalid = false;
+	}
+
+	/* The tuple hashes are built using the cached info, so drop them too. */
+	if (KeylessTupleHash != NULL)
+	{
+		PGLogicalKeylessRelEntry *kentry;
+
+		hash_seq_init(&status, KeylessTupleHash);
+		while ((kentry = (PGLogicalKeylessRelEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (reloid == InvalidOid || kentry->reloid == reloid)
+				kentry->isvalid = false;
+		}
+	}
+}
+
+static void
+relindex_cache_init(void)
+{
+	HASHCTL		ctl;
+	int			hashflags;
+
+	/* Make sure we've initialized CacheMemoryContext. */
+	if (CacheMemoryContext == NULL)
+		CreateCacheMemoryContext();
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(PGLogicalRelIndexCacheEntry);
+	ctl.hcxt = CacheMemoryContext;
+	hashflags = HASH_ELEM | HASH_CONTEXT;
+#if PG_VERSION_NUM < 90500
+	ctl.hash = oid_hash;
+	hashflags |= HASH_FUNCTION;
+#else
+	hashflags |= HASH_BLOBS;
+#endif
+
+	RelIndexCache = hash_create("pglogical index lookup cache", 128, &ctl,
+								hashflags);
+
+	CacheRegisterRelcacheCallback(relindex_cache_invalidate_callback,
+								  (Datum) 0);
+}
+
+/*
+ * Resolve the equality procs and collations for the key columns of index
+ * 'idxrel' on 'rel'.
+ */
+static void
+fill_index_key_info(PGLogicalIndexKeyInfo *key, Relation rel,
+					Relation idxrel)
 {
 	int			attoff;
 	Datum		indclassDatum;
@@ -70,7 +229,6 @@ build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, PGLogicalTuple
 	bool		isnull;
 	oidvector  *opclass;
 	int2vector  *indkey;
-	bool		hasnulls = false;
 
 	indclassDatum = SysCacheGetAttr(INDEXRELID, idxrel->rd_indextuple,
 									Anum_pg_index_indclass, &isnull);
@@ -82,228 +240,1078 @@ build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, PGLogicalTuple
 	Assert(!isnull);
 	indkey = (int2vector *) DatumGetPointer(indkeyDatum);
 
-	/*
-	 * Examine each indexed attribute to ensure the passed tuple's matching
-	 * value isn't NULL and we have an equality operator for it.
-	 */
-	for (attoff = 0; attoff < IndexRelationGetNumberOfKeyAttributes(idxrel);
-		 attoff++)
+	key->indexoid = RelationGetRelid(idxrel);
+	key->nkeys = IndexRelationGetNumberOfKeyAttributes(idxrel);
+	key->unique = idxrel->rd_index->indisunique;
+
+	/* Hash opfamilies only have the equality strategy, with its own number. */
+	if (idxrel->rd_rel->relam == HASH_AM_OID)
+		key->strategy = HTEqualStrategyNumber;
+	else
+		key->strategy = BTEqualStrategyNumber;
+
+	/* Make sure we have an equality operator for each indexed attribute. */
+	for (attoff = 0; attoff < key->nkeys; attoff++)
 	{
 		Oid			operator;
 		Oid			opfamily;
-		RegProcedure regop;
-		int			pkattno = attoff + 1;
 		int			mainattno = indkey->values[attoff];
 		Oid			atttype = attnumTypeId(rel, mainattno);
 		Oid			optype = get_opclass_input_type(opclass->values[attoff]);
 
 		opfamily = get_opclass_family(opclass->values[attoff]);
 
-		operator = get_opfamily_member(opfamily, optype,
-									   optype,
-									   BTEqualStrategyNumber);
+		operator = get_opfamily_member(opfamily, optype,
+									   optype,
+									   key->strategy);
+
+		if (!OidIsValid(operator))
+			elog(ERROR,
+				 "could not lookup equality operator for type %u, optype %u in opfamily %u",
+				 atttype, optype, opfamily);
+
+		/* FIXME: convert type? */
+		key->attnums[attoff] = mainattno;
+		key->collations[attoff] = idxrel->rd_indcollation[attoff];
+		fmgr_info_cxt(get_opcode(operator), &key->eqfuncs[attoff],
+					  CacheMemoryContext);
+	}
+}
+
+/*
+ * Order the indexes usable for tuple lookup by how selective they are likely
+ * to be: unique indexes first, then the ones with more key columns.
+ */
+static int
+lookup_index_cmp(const void *a, const void *b)
+{
+	const PGLogicalIndexKeyInfo *ka = (const PGLogicalIndexKeyInfo *) a;
+	const PGLogicalIndexKeyInfo *kb = (const PGLogicalIndexKeyInfo *) b;
+
+	if (ka->unique != kb->unique)
+		return ka->unique ? -1 : 1;
+	if (ka->nkeys != kb->nkeys)
+		return kb->nkeys - ka->nkeys;
+	if (ka->indexoid != kb->indexoid)
+		return ka->indexoid < kb->indexoid ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Get the cached candidate-key indexes of the relation, (re)building the
+ * cache entry if needed.
+ */
+static PGLogicalRelIndexCacheEntry *
+get_relindex_cache_entry(Relation rel)
+{
+	Oid			reloid = RelationGetRelid(rel);
+	PGLogicalRelIndexCacheEntry *entry;
+	bool		found;
+	List	   *indexoids;
+	ListCell   *lc;
+	int			n;
+	int			nlookup;
+	uint32		invalcount;
+
+	if (RelIndexCache == NULL)
+		relindex_cache_init();
+
+	entry = hash_search(RelIndexCache, (void *) &reloid, HASH_ENTER, &found);
+
+	if (found && entry->isvalid)
+		return entry;
+
+	if (found)
+	{
+		if (entry->indexes)
+			pfree(entry->indexes);
+		if (entry->lookupindexes)
+			pfree(entry->lookupindexes);
+		if (entry->attcmp)
+			pfree(entry->attcmp);
+	}
+
+	entry->isvalid = false;
+	entry->nindexes = 0;
+	entry->indexes = NULL;
+	entry->nlookupindexes = 0;
+	entry->lookupindexes = NULL;
+	entry->natts = 0;
+	entry->attcmp = NULL;
+
+	/*
+	 * Opening the indexes can process invalidations. If any of them arrives
+	 * while we are building the entry, use it for this lookup only.
+	 */
+	invalcount = RelIndexCacheInvalCount;
+
+	entry->replidxoid = RelationGetReplicaIndex(rel);
+	indexoids = RelationGetIndexList(rel);
+
+	entry->indexes = MemoryContextAllocZero(CacheMemoryContext,
+											(list_length(indexoids) + 1) *
+											sizeof(PGLogicalIndexKeyInfo));
+	if (!OidIsValid(entry->replidxoid))
+		entry->lookupindexes = MemoryContextAllocZero(CacheMemoryContext,
+													  (list_length(indexoids) + 1) *
+													  sizeof(PGLogicalIndexKeyInfo));
+
+	n = 0;
+	nlookup = 0;
+	if (OidIsValid(entry->replidxoid))
+	{
+		Relation	idxrel = index_open(entry->replidxoid, AccessShareLock);
+
+		fill_index_key_info(&entry->indexes[n++], rel, idxrel);
+		index_close(idxrel, AccessShareLock);
+	}
+
+	foreach (lc, indexoids)
+	{
+		Oid			idxoid = lfirst_oid(lc);
+		Relation	idxrel;
+
+		/* No point re-scanning the replica identity index */
+		if (idxoid == entry->replidxoid)
+			continue;
+
+		idxrel = index_open(idxoid, AccessShareLock);
+
+		/*
+		 * Only unique indexes are of interest here, and we can't deal with
+		 * expression indexes so far.
+		 *
+		 * TODO: predicates should be handled better. There's no point
+		 * scanning an index where the predicates show it could never match
+		 * anyway, and it can produce false conflicts if the predicate
+		 * includes non-indexed columns. We could find a local tuple that
+		 * matches the predicate in the index, but there's only a true
+		 * conflict if the remote tuple also matches the predicate. If we
+		 * ignore the predicate we generate a false conflict. See RM#1839.
+		 *
+		 * For now we reject conflict resolution on indexes with predicates
+		 * entirely. If there's a conflict it'll be raised on apply with a
+		 * unique violation.
+		 */
+		if (idxrel->rd_index->indisunique &&
+			RelationGetIndexExpressions(idxrel) == NIL &&
+			RelationGetIndexPredicate(idxrel) == NIL)
+			fill_index_key_info(&entry->indexes[n++], rel, idxrel);
+
+		/*
+		 * Without REPLICA IDENTITY index any btree or hash index on plain
+		 * columns can be used to narrow down the search for the tuple.
+		 */
+		if (entry->lookupindexes &&
+			(idxrel->rd_rel->relam == BTREE_AM_OID ||
+			 idxrel->rd_rel->relam == HASH_AM_OID) &&
+			IndexIsValid(idxrel->rd_index) &&
+			RelationGetIndexExpressions(idxrel) == NIL &&
+			RelationGetIndexPredicate(idxrel) == NIL)
+			fill_index_key_info(&entry->lookupindexes[nlookup++], rel, idxrel);
+
+		index_close(idxrel, AccessShareLock);
+	}
+
+	list_free(indexoids);
+
+	if (nlookup > 1)
+		qsort(entry->lookupindexes, nlookup, sizeof(PGLogicalIndexKeyInfo),
+			  lookup_index_cmp);
+
+	entry->nindexes = n;
+	entry->nlookupindexes = nlookup;
+	entry->isvalid = (invalcount == RelIndexCacheInvalCount);
+
+	return entry;
+}
+
+/*
+ * Get the open index relation from relinfo, or open it if the caller hasn't
+ * opened the indexes.
+ */
+static Relation
+open_relinfo_index(ResultRelInfo *relinfo, Oid indexoid, bool *opened)
+{
+	int			i;
+
+	for (i = 0; i < relinfo->ri_NumIndices; i++)
+	{
+		if (RelationGetRelid(relinfo->ri_IndexRelationDescs[i]) == indexoid)
+		{
+			*opened = false;
+			return relinfo->ri_IndexRelationDescs[i];
+		}
+	}
+
+	*opened = true;
+	return index_open(indexoid, RowExclusiveLock);
+}
+
+/*
+ * Setup a ScanKey for a search in the index described by 'key' for a tuple
+ * given by 'values'/'nulls' that are setup to match the relation (*NOT* the
+ * index!).
+ *
+ * Returns whether any column in the passed tuple contains a NULL for an
+ * indexed field.
+ */
+static bool
+build_index_scan_key(ScanKey skey, PGLogicalIndexKeyInfo *key,
+					 Datum *values, bool *nulls)
+{
+	int			attoff;
+	bool		hasnulls = false;
+
+	for (attoff = 0; attoff < key->nkeys; attoff++)
+	{
+		int			mainattno = key->attnums[attoff];
+		int			flags = 0;
+
+		if (nulls[mainattno - 1])
+		{
+			hasnulls = true;
+			flags |= SK_ISNULL;
+		}
+
+		ScanKeyEntryInitializeWithInfo(&skey[attoff],
+									   flags,
+									   attoff + 1,
+									   key->strategy,
+									   InvalidOid,
+									   key->collations[attoff],
+									   &key->eqfuncs[attoff],
+									   values[mainattno - 1]);
+	}
+
+	return hasnulls;
+}
+
+/*
+ * Get the functions for comparing and hashing values of attribute 'attno'
+ * (1-based) of the relation.
+ */
+static PGLogicalAttCompareInfo *
+get_att_compare(PGLogicalRelIndexCacheEntry *entry, Relation rel, int attno)
+{
+	PGLogicalAttCompareInfo *cmp;
+
+	if (entry->attcmp == NULL)
+	{
+		entry->natts = RelationGetDescr(rel)->natts;
+		entry->attcmp = MemoryContextAllocZero(CacheMemoryContext,
+											   entry->natts *
+											   sizeof(PGLogicalAttCompareInfo));
+	}
+
+	Assert(attno > 0 && attno <= entry->natts);
+	cmp = &entry->attcmp[attno - 1];
+
+	if (!cmp->isvalid)
+	{
+		Form_pg_attribute att = TupleDescAttr(RelationGetDescr(rel), attno - 1);
+		TypeCacheEntry *typentry;
+
+		typentry = lookup_type_cache(att->atttypid,
+									 TYPECACHE_EQ_OPR_FINFO |
+									 TYPECACHE_HASH_PROC_FINFO);
+
+		if (!OidIsValid(typentry->eq_opr_finfo.fn_oid))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify an equality operator for type %s",
+							format_type_be(att->atttypid)),
+					 errdetail("Column \"%s\" of table \"%s\" is used to find the row to update or delete because the table has no REPLICA IDENTITY index.",
+							   NameStr(att->attname),
+							   RelationGetRelationName(rel))));
+
+		fmgr_info_copy(&cmp->eqfunc, &typentry->eq_opr_finfo,
+					   CacheMemoryContext);
+
+		cmp->hashable = OidIsValid(typentry->hash_proc_finfo.fn_oid);
+		if (cmp->hashable)
+			fmgr_info_copy(&cmp->hashfunc, &typentry->hash_proc_finfo,
+						   CacheMemoryContext);
+
+		cmp->isvalid = true;
+	}
+
+	return cmp;
+}
+
+/*
+ * Check if the local tuple in 'slot' has the same values as the remote
+ * 'tuple' in all the attributes flagged in 'matchatts'.
+ */
+static bool
+tuple_matches(PGLogicalRelIndexCacheEntry *entry, Relation rel,
+			  TupleTableSlot *slot, PGLogicalTupleData *tuple,
+			  bool *matchatts)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	int			i;
+
+	slot_getallattrs(slot);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		PGLogicalAttCompareInfo *cmp;
+
+		if (!matchatts[i])
+			continue;
+
+		if (slot->tts_isnull[i] || tuple->nulls[i])
+		{
+			if (slot->tts_isnull[i] && tuple->nulls[i])
+				continue;
+			return false;
+		}
+
+		cmp = get_att_compare(entry, rel, i + 1);
+
+		if (!DatumGetBool(FunctionCall2Coll(&cmp->eqfunc,
+											TupleDescAttr(desc, i)->attcollation,
+											slot->tts_values[i],
+											tuple->values[i])))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Lock the tuple found by one of the searches below.
+ *
+ * Returns false if the tuple was concurrently updated and the search has to
+ * be retried.
+ */
+static bool
+lock_found_tuple(Relation rel, LockTupleMode lockmode, TupleTableSlot *slot)
+{
+#if PG_VERSION_NUM >= 120000
+	TM_FailureData tmfd;
+	TM_Result res;
+#else
+	Buffer buf;
+	HeapUpdateFailureData hufd;
+	HTSU_Result res;
+	HeapTupleData locktup;
+
+	ItemPointerCopy(&slot->tts_tuple->t_self, &locktup.t_self);
+#endif
+
+	PushActiveSnapshot(GetLatestSnapshot());
+
+#if PG_VERSION_NUM >= 120000
+	res = table_tuple_lock(rel, &(slot->tts_tid), GetLatestSnapshot(),
+						   slot,
+						   GetCurrentCommandId(false),
+						   lockmode,
+						   LockWaitBlock,
+						   0 /* don't follow updates */ ,
+						   &tmfd);
+#else
+	res = heap_lock_tuple(rel, &locktup, GetCurrentCommandId(false),
+						  lockmode,
+						  false /* wait */,
+						  false /* don't follow updates */,
+						  &buf, &hufd);
+	/* the tuple slot already has the buffer pinned */
+	ReleaseBuffer(buf);
+#endif
+
+	PopActiveSnapshot();
+
+	switch (res)
+	{
+#if PG_VERSION_NUM >= 120000
+		case TM_Ok:
+#else
+		case HeapTupleMayBeUpdated:
+#endif
+			/* lock was successfully acquired */
+			break;
+#if PG_VERSION_NUM >= 120000
+		case TM_Updated:
+#else
+		case HeapTupleUpdated:
+#endif
+			/*
+			 * We lost a race between when we looked up the tuple and
+			 * checked for concurrent modifying txns and when we tried to
+			 * lock the matched tuple.
+			 *
+			 * XXX: Improve handling here.
+			 */
+			ereport(LOG,
+					(errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
+					 errmsg("concurrent update, retrying")));
+			return false;
+		default:
+			elog(ERROR, "unexpected HTSU_Result after locking: %u", res);
+			break;
+	}
+
+	return true;
+}
+
+/*
+ * Search the index 'idxrel' for a tuple identified by 'skey' in 'rel'.
+ *
+ * If 'matchatts' is given, the index is not unique or does not cover the
+ * whole identity of the tuple, so the tuples found are rechecked against
+ * 'tuple' and the first matching one is used.
+ *
+ * If a matching tuple is found lock it with lockmode, fill the slot with its
+ * contents and return true, false is returned otherwise.
+ */
+static bool
+find_index_tuple(ScanKey skey, Relation rel, Relation idxrel,
+				 LockTupleMode lockmode, TupleTableSlot *slot,
+				 PGLogicalRelIndexCacheEntry *entry,
+				 PGLogicalTupleData *tuple, bool *matchatts)
+{
+#if PG_VERSION_NUM < 120000
+	HeapTuple	scantuple;
+#endif
+	bool		found;
+	IndexScanDesc scan;
+	SnapshotData snap;
+	TransactionId xwait;
+
+	/*
+	 * We need SnapshotDirty because we're doing uniqueness lookups that must
+	 * consider rows added/updated by concurrent transactions, just like a
+	 * normal UNIQUE check does.
+	 */
+	InitDirtySnapshot(snap);
+	scan = index_beginscan(rel, idxrel, &snap,
+						   IndexRelationGetNumberOfKeyAttributes(idxrel),
+						   0);
+
+retry:
+	found = false;
+
+	index_rescan(scan, skey, IndexRelationGetNumberOfKeyAttributes(idxrel),
+				 NULL, 0);
+
+#if PG_VERSION_NUM >= 120000
+	while (index_getnext_slot(scan, ForwardScanDirection, slot))
+#else
+	while ((scantuple = index_getnext(scan, ForwardScanDirection)) != NULL)
+#endif
+	{
+#if PG_VERSION_NUM < 120000
+		ExecStoreTuple(scantuple, slot, InvalidBuffer, false);
+#endif
+		if (matchatts && !tuple_matches(entry, rel, slot, tuple, matchatts))
+			continue;
+
+		found = true;
+		ExecMaterializeSlot(slot);
+
+		/*
+		 * Did any concurrent txn affect the tuple? (See
+		 * HeapTupleSatisfiesDirty for how we get this).
+		 */
+		xwait = TransactionIdIsValid(snap.xmin) ?
+			snap.xmin : snap.xmax;
+
+		if (TransactionIdIsValid(xwait))
+		{
+			/* Wait for the specified transaction to commit or abort */
+			XactLockTableWait(xwait, NULL, NULL, XLTW_None);
+			goto retry;
+		}
+
+		break;
+	}
+
+	/* Matching tuple found, no concurrent txns modifying it */
+	if (found && !lock_found_tuple(rel, lockmode, slot))
+		goto retry;
+
+	index_endscan(scan);
+
+	return found;
+}
+
+/*
+ * Find the tuple matching 'tuple' on 'matchatts' by scanning the whole
+ * relation.
+ */
+static bool
+find_seqscan_tuple(PGLogicalRelIndexCacheEntry *entry, Relation rel,
+				   PGLogicalTupleData *tuple, bool *matchatts,
+				   LockTupleMode lockmode, TupleTableSlot *slot)
+{
+#if PG_VERSION_NUM >= 120000
+	TableScanDesc scan;
+#else
+	HeapScanDesc scan;
+	HeapTuple	scantuple;
+#endif
+	bool		found;
+	SnapshotData snap;
+	TransactionId xwait;
+
+	/* See find_index_tuple for why we need SnapshotDirty. */
+	InitDirtySnapshot(snap);
+
+retry:
+	found = false;
+
+	scan = table_beginscan(rel, &snap, 0, NULL);
+
+#if PG_VERSION_NUM >= 120000
+	while (table_scan_getnextslot(scan, ForwardScanDirection, slot))
+#else
+	while ((scantuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+#endif
+	{
+#if PG_VERSION_NUM < 120000
+		ExecStoreTuple(scantuple, slot, InvalidBuffer, false);
+#endif
+		if (!tuple_matches(entry, rel, slot, tuple, matchatts))
+			continue;
+
+		found = true;
+		ExecMaterializeSlot(slot);
+
+		xwait = TransactionIdIsValid(snap.xmin) ?
+			snap.xmin : snap.xmax;
+
+		if (TransactionIdIsValid(xwait))
+		{
+			table_endscan(scan);
+			XactLockTableWait(xwait, NULL, NULL, XLTW_None);
+			goto retry;
+		}
+
+		break;
+	}
+
+	table_endscan(scan);
+
+	if (found && !lock_found_tuple(rel, lockmode, slot))
+		goto retry;
+
+	return found;
+}
+
+static void
+keyless_tuple_hash_xact_callback(XactEvent event, void *arg)
+{
+	/* The memory goes away together with TopTransactionContext. */
+	KeylessTupleHash = NULL;
+	KeylessTupleHashContext = NULL;
+}
+
+/*
+ * Hash the values of 'matchatts' attributes of a tuple. Attributes of types
+ * without hash support are skipped, the equality recheck sorts them out.
+ */
+static uint32
+hash_tuple_values(PGLogicalRelIndexCacheEntry *entry, Relation rel,
+				  Datum *values, bool *nulls, bool *matchatts)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	uint32		hash = 0;
+	int			i;
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		PGLogicalAttCompareInfo *cmp;
+
+		if (!matchatts[i])
+			continue;
+
+		/* rotate hashkey left 1 bit at each step */
+		hash = (hash << 1) | ((hash & 0x80000000) ? 1 : 0);
+
+		if (nulls[i])
+			continue;
+
+		cmp = get_att_compare(entry, rel, i + 1);
+		if (!cmp->hashable)
+			continue;
+
+		hash ^= DatumGetUInt32(FunctionCall1Coll(&cmp->hashfunc,
+												 TupleDescAttr(desc, i)->attcollation,
+												 values[i]));
+	}
+
+	return hash;
+}
+
+/* Remember the tuple with the given hash of its values. */
+static void
+keyless_hash_add_tid(PGLogicalKeylessRelEntry *kentry, uint32 hash,
+					 ItemPointer tid)
+{
+	PGLogicalKeylessTupleEntry *tentry;
+	MemoryContext oldctx;
+	ItemPointer	copy;
+	bool		found;
+
+	tentry = hash_search(kentry->tuples, (void *) &hash, HASH_ENTER, &found);
+	if (!found)
+		tentry->tids = NIL;
+
+	oldctx = MemoryContextSwitchTo(kentry->cxt);
+	copy = palloc(sizeof(ItemPointerData));
+	ItemPointerCopy(tid, copy);
+	tentry->tids = lappend(tentry->tids, copy);
+	MemoryContextSwitchTo(oldctx);
+}
+
+/*
+ * (Re)build the tuple hash of the relation by scanning all of it.
+ */
+static void
+keyless_build_tuple_hash(PGLogicalKeylessRelEntry *kentry,
+						 PGLogicalRelIndexCacheEntry *entry, Relation rel,
+						 bool *matchatts)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	MemoryContext oldctx;
+	HASHCTL		ctl;
+	int			hashflags;
+#if PG_VERSION_NUM >= 120000
+	TableScanDesc scan;
+	TupleTableSlot *slot;
+#else
+	HeapScanDesc scan;
+	HeapTuple	scantuple;
+	Datum	   *values;
+	bool	   *nulls;
+#endif
+	SnapshotData snap;
+
+	if (kentry->cxt == NULL)
+		kentry->cxt = AllocSetContextCreate(KeylessTupleHashContext,
+											"pglogical keyless relation tuples",
+											ALLOCSET_DEFAULT_SIZES);
+	else
+		MemoryContextReset(kentry->cxt);
+
+	oldctx = MemoryContextSwitchTo(kentry->cxt);
+
+	kentry->natts = desc->natts;
+	kentry->matchatts = palloc(desc->natts * sizeof(bool));
+	memcpy(kentry->matchatts, matchatts, desc->natts * sizeof(bool));
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(uint32);
+	ctl.entrysize = sizeof(PGLogicalKeylessTupleEntry);
+	ctl.hcxt = kentry->cxt;
+	hashflags = HASH_ELEM | HASH_CONTEXT;
+#if PG_VERSION_NUM < 90500
+	ctl.hash = tag_hash;
+	hashflags |= HASH_FUNCTION;
+#else
+	hashflags |= HASH_BLOBS;
+#endif
+	kentry->tuples = hash_create("pglogical keyless tuples", 1024, &ctl,
+								 hashflags);
+
+	MemoryContextSwitchTo(oldctx);
+
+	/*
+	 * Include tuples of in-progress transactions too, the lookup checks them
+	 * the same way the sequential scan would.
+	 */
+	InitDirtySnapshot(snap);
+	scan = table_beginscan(rel, &snap, 0, NULL);
+#if PG_VERSION_NUM >= 120000
+	slot = table_slot_create(rel, NULL);
+	while (table_scan_getnextslot(scan, ForwardScanDirection, slot))
+#else
+	values = palloc(desc->natts * sizeof(Datum));
+	nulls = palloc(desc->natts * sizeof(bool));
+	while ((scantuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+#endif
+	{
+		uint32		hash;
+
+#if PG_VERSION_NUM >= 120000
+		slot_getallattrs(slot);
+		hash = hash_tuple_values(entry, rel, slot->tts_values,
+								 slot->tts_isnull, matchatts);
+		keyless_hash_add_tid(kentry, hash, &slot->tts_tid);
+#else
+		heap_deform_tuple(scantuple, desc, values, nulls);
+		hash = hash_tuple_values(entry, rel, values, nulls, matchatts);
+		keyless_hash_add_tid(kentry, hash, &scantuple->t_self);
+#endif
+
+		CHECK_FOR_INTERRUPTS();
+	}
+	table_endscan(scan);
+#if PG_VERSION_NUM >= 120000
+	ExecDropSingleTupleTableSlot(slot);
+#else
+	pfree(values);
+	pfree(nulls);
+#endif
 
-		if (!OidIsValid(operator))
-			elog(ERROR,
-				 "could not lookup equality operator for type %u, optype %u in opfamily %u",
-				 atttype, optype, opfamily);
+	kentry->isvalid = true;
+}
 
-		regop = get_opcode(operator);
+/*
+ * Add a tuple written by apply to the tuple hash of the relation, if there is
+ * one, so that it can be found by the following changes of the transaction
+ * without rebuilding the hash.
+ */
+void
+pglogical_keyless_tuple_hash_add(Relation rel, TupleTableSlot *slot)
+{
+	Oid			reloid = RelationGetRelid(rel);
+	PGLogicalKeylessRelEntry *kentry;
+	PGLogicalRelIndexCacheEntry *entry;
+	uint32		hash;
 
-		/* FIXME: convert type? */
-		ScanKeyInit(&skey[attoff],
-					pkattno,
-					BTEqualStrategyNumber,
-					regop,
-					tup->values[mainattno - 1]);
+	if (KeylessTupleHash == NULL)
+		return;
 
-		skey[attoff].sk_collation = idxrel->rd_indcollation[attoff];
+	kentry = hash_search(KeylessTupleHash, (void *) &reloid, HASH_FIND, NULL);
+	if (kentry == NULL || !kentry->isvalid)
+		return;
 
-		if (tup->nulls[mainattno - 1])
-		{
-			hasnulls = true;
-			skey[attoff].sk_flags |= SK_ISNULL;
-		}
-	}
+	entry = get_relindex_cache_entry(rel);
 
-	return hasnulls;
+	slot_getallattrs(slot);
+	hash = hash_tuple_values(entry, rel, slot->tts_values, slot->tts_isnull,
+							 kentry->matchatts);
+#if PG_VERSION_NUM >= 120000
+	keyless_hash_add_tid(kentry, hash, &slot->tts_tid);
+#else
+	keyless_hash_add_tid(kentry, hash, &slot->tts_tuple->t_self);
+#endif
 }
 
 /*
- * Search the index 'idxrel' for a tuple identified by 'skey' in 'rel'.
+ * Look up the tuple matching 'tuple' on 'matchatts' in the per-transaction
+ * tuple hash of the relation, building the hash if needed.
  *
- * If a matching tuple is found lock it with lockmode, fill the slot with its
- * contents and return true, false is returned otherwise.
+ * The tuples written by apply are added to the hash as they are written, see
+ * pglogical_keyless_tuple_hash_add(). Tuples written by anything else since
+ * the hash was built are not in it though, so when nothing is found, fall back
+ * to the sequential scan, which is what would have been done without the
+ * hash anyway.
  */
 static bool
-find_index_tuple(ScanKey skey, Relation rel, Relation idxrel,
-				 LockTupleMode lockmode, TupleTableSlot *slot)
+find_hashed_tuple(PGLogicalRelIndexCacheEntry *entry, Relation rel,
+				  PGLogicalTupleData *tuple, bool *matchatts,
+				  LockTupleMode lockmode, TupleTableSlot *slot)
 {
-#if PG_VERSION_NUM < 120000
-	HeapTuple	scantuple;
-#endif
-	bool		found;
-	IndexScanDesc scan;
+	Oid			reloid = RelationGetRelid(rel);
+	TupleDesc	desc = RelationGetDescr(rel);
+	PGLogicalKeylessRelEntry *kentry;
+	PGLogicalKeylessTupleEntry *tentry;
 	SnapshotData snap;
 	TransactionId xwait;
+	uint32		hash;
+	bool		found;
+	bool		rebuilt = false;
+	ListCell   *lc;
+
+	if (!keyless_xact_cb_installed)
+	{
+		RegisterXactCallback(keyless_tuple_hash_xact_callback, NULL);
+		keyless_xact_cb_installed = true;
+	}
+
+	if (KeylessTupleHash == NULL)
+	{
+		HASHCTL		ctl;
+		int			hashflags;
+
+		KeylessTupleHashContext =
+			AllocSetContextCreate(TopTransactionContext,
+								  "pglogical keyless tuple hash",
+								  ALLOCSET_DEFAULT_SIZES);
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(PGLogicalKeylessRelEntry);
+		ctl.hcxt = KeylessTupleHashContext;
+		hashflags = HASH_ELEM | HASH_CONTEXT;
+#if PG_VERSION_NUM < 90500
+		ctl.hash = oid_hash;
+		hashflags |= HASH_FUNCTION;
+#else
+		hashflags |= HASH_BLOBS;
+#endif
+		KeylessTupleHash = hash_create("pglogical keyless relations", 16,
+									   &ctl, hashflags);
+	}
+
+	kentry = hash_search(KeylessTupleHash, (void *) &reloid, HASH_ENTER,
+						 &found);
+	if (!found)
+	{
+		kentry->isvalid = false;
+		kentry->natts = 0;
+		kentry->matchatts = NULL;
+		kentry->tuples = NULL;
+		kentry->cxt = NULL;
+	}
+
+	if (!kentry->isvalid || kentry->natts != desc->natts ||
+		memcmp(kentry->matchatts, matchatts, desc->natts * sizeof(bool)) != 0)
+	{
+		keyless_build_tuple_hash(kentry, entry, rel, matchatts);
+		rebuilt = true;
+	}
+
+	hash = hash_tuple_values(entry, rel, tuple->values, tuple->nulls,
+							 matchatts);
 
-	/*
-	 * We need SnapshotDirty because we're doing uniqueness lookups that must
-	 * consider rows added/updated by concurrent transactions, just like a
-	 * normal UNIQUE check does.
-	 */
 	InitDirtySnapshot(snap);
-	scan = index_beginscan(rel, idxrel, &snap,
-						   IndexRelationGetNumberOfKeyAttributes(idxrel),
-						   0);
 
 retry:
 	found = false;
 
-	index_rescan(scan, skey, IndexRelationGetNumberOfKeyAttributes(idxrel),
-				 NULL, 0);
-
-#if PG_VERSION_NUM >= 120000
-	if (index_getnext_slot(scan, ForwardScanDirection, slot))
-#else
-	if ((scantuple = index_getnext(scan, ForwardScanDirection)) != NULL)
-#endif
+	tentry = hash_search(kentry->tuples, (void *) &hash, HASH_FIND, NULL);
+	if (tentry != NULL)
 	{
-		found = true;
+		foreach (lc, tentry->tids)
+		{
+			ItemPointer	tid = (ItemPointer) lfirst(lc);
 #if PG_VERSION_NUM < 120000
-		ExecStoreTuple(scantuple, slot, InvalidBuffer, false);
+			HeapTupleData fetchtup;
+			Buffer		buf;
+
+			fetchtup.t_self = *tid;
+			if (!heap_fetch(rel, &snap, &fetchtup, &buf, false, NULL))
+				continue;
+			ExecStoreTuple(&fetchtup, slot, buf, false);
+			ReleaseBuffer(buf);
+#else
+			if (!table_tuple_fetch_row_version(rel, tid, &snap, slot))
+				continue;
 #endif
-		ExecMaterializeSlot(slot);
 
-		/*
-		 * Did any concurrent txn affect the tuple? (See
-		 * HeapTupleSatisfiesDirty for how we get this).
-		 */
-		xwait = TransactionIdIsValid(snap.xmin) ?
-			snap.xmin : snap.xmax;
+			if (!tuple_matches(entry, rel, slot, tuple, matchatts))
+				continue;
 
-		if (TransactionIdIsValid(xwait))
-		{
-			/* Wait for the specified transaction to commit or abort */
-			XactLockTableWait(xwait, NULL, NULL, XLTW_None);
-			goto retry;
+			found = true;
+			ExecMaterializeSlot(slot);
+
+			xwait = TransactionIdIsValid(snap.xmin) ?
+				snap.xmin : snap.xmax;
+
+			if (TransactionIdIsValid(xwait))
+			{
+				XactLockTableWait(xwait, NULL, NULL, XLTW_None);
+				goto retry;
+			}
+
+			break;
 		}
 	}
 
-	/* Matching tuple found, no concurrent txns modifying it */
-	if (found)
+	if (found && !lock_found_tuple(rel, lockmode, slot))
 	{
-#if PG_VERSION_NUM >= 120000
-		TM_FailureData tmfd;
-		TM_Result res;
-#else
-		Buffer buf;
-		HeapUpdateFailureData hufd;
-		HTSU_Result res;
-		HeapTupleData locktup;
+		/*
+		 * The tuple was concurrently updated and the new version is not in
+		 * the hash, let the sequential scan find it.
+		 */
+		kentry->isvalid = false;
+		return find_seqscan_tuple(entry, rel, tuple, matchatts, lockmode,
+								  slot);
+	}
 
-		ItemPointerCopy(&slot->tts_tuple->t_self, &locktup.t_self);
-#endif
+	if (!found && !rebuilt)
+		return find_seqscan_tuple(entry, rel, tuple, matchatts, lockmode,
+								  slot);
 
-		PushActiveSnapshot(GetLatestSnapshot());
+	return found;
+}
 
-#if PG_VERSION_NUM >= 120000
-		res = table_tuple_lock(rel, &(slot->tts_tid), GetLatestSnapshot(),
-							   slot,
-							   GetCurrentCommandId(false),
-							   lockmode,
-							   LockWaitBlock,
-							   0 /* don't follow updates */ ,
-							   &tmfd);
-#else
-		res = heap_lock_tuple(rel, &locktup, GetCurrentCommandId(false),
-							  lockmode,
-							  false /* wait */,
-							  false /* don't follow updates */,
-							  &buf, &hufd);
-		/* the tuple slot already has the buffer pinned */
-		ReleaseBuffer(buf);
-#endif
+/*
+ * Find the tuple when the relation has no REPLICA IDENTITY index.
+ *
+ * The tuple is identified by the values of the 'matchatts' attributes. Use
+ * the most selective index covering only such attributes to narrow down the
+ * search if there is one, otherwise scan the whole relation (or look the
+ * tuple up in the per-transaction tuple hash if enabled).
+ */
+static bool
+find_identity_tuple(ResultRelInfo *relinfo, PGLogicalRelIndexCacheEntry *entry,
+					PGLogicalTupleData *tuple, bool *matchatts,
+					TupleTableSlot *oldslot, Oid *idxrelid)
+{
+	Relation	rel = relinfo->ri_RelationDesc;
+	TupleDesc	desc = RelationGetDescr(rel);
+	int			i;
+	bool		hasmatchatts = false;
+
+	for (i = 0; i < desc->natts; i++)
+		hasmatchatts |= matchatts[i];
+
+	if (!hasmatchatts)
+		ereport(ERROR,
+				(errmsg("could not identify the row in table %s with oid %u as no columns of the old row were received",
+						RelationGetRelationName(rel), RelationGetRelid(rel))));
 
-		PopActiveSnapshot();
+	for (i = 0; i < entry->nlookupindexes; i++)
+	{
+		PGLogicalIndexKeyInfo *key = &entry->lookupindexes[i];
+		ScanKeyData	index_key[INDEX_MAX_KEYS];
+		Relation	idxrel;
+		bool		opened;
+		bool		found;
+		int			attoff;
 
-		switch (res)
+		for (attoff = 0; attoff < key->nkeys; attoff++)
 		{
-#if PG_VERSION_NUM >= 120000
-			case TM_Ok:
-#else
-			case HeapTupleMayBeUpdated:
-#endif
-				/* lock was successfully acquired */
-				break;
-#if PG_VERSION_NUM >= 120000
-			case TM_Updated:
-#else
-			case HeapTupleUpdated:
-#endif
-				/*
-				 * We lost a race between when we looked up the tuple and
-				 * checked for concurrent modifying txns and when we tried to
-				 * lock the matched tuple.
-				 *
-				 * XXX: Improve handling here.
-				 */
-				ereport(LOG,
-						(errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
-						 errmsg("concurrent update, retrying")));
-				goto retry;
-			default:
-				elog(ERROR, "unexpected HTSU_Result after locking: %u", res);
+			int			attno = key->attnums[attoff];
+
+			if (!matchatts[attno - 1] || tuple->nulls[attno - 1])
 				break;
 		}
+		if (attoff < key->nkeys)
+			continue;
+
+		build_index_scan_key(index_key, key, tuple->values, tuple->nulls);
+
+		*idxrelid = key->indexoid;
+		idxrel = open_relinfo_index(relinfo, key->indexoid, &opened);
+
+		found = find_index_tuple(index_key, rel, idxrel, LockTupleExclusive,
+								 oldslot, entry, tuple, matchatts);
+
+		if (opened)
+			index_close(idxrel, NoLock);
+
+		return found;
 	}
 
-	index_endscan(scan);
+	*idxrelid = InvalidOid;
 
-	return found;
+	if (pglogical_keyless_tuple_hash)
+		return find_hashed_tuple(entry, rel, tuple, matchatts,
+								 LockTupleExclusive, oldslot);
+
+	return find_seqscan_tuple(entry, rel, tuple, matchatts,
+							  LockTupleExclusive, oldslot);
 }
 
 /*
  * Find tuple using REPLICA IDENTITY index and output it in 'oldslot'
  * if found.
  *
+ * If the relation has no REPLICA IDENTITY index and 'matchatts' is given,
+ * find the tuple with all the flagged attributes equal to 'tuple' instead.
+ * Otherwise error out.
+ *
  * The index oid is also output.
  */
 bool
 pglogical_tuple_find_replidx(ResultRelInfo *relinfo, PGLogicalTupleData *tuple,
-							 TupleTableSlot *oldslot, Oid *idxrelid)
+							 bool *matchatts, TupleTableSlot *oldslot,
+							 Oid *idxrelid)
 {
-	Oid				idxoid;
+	PGLogicalRelIndexCacheEntry *entry;
 	Relation		idxrel;
 	ScanKeyData		index_key[INDEX_MAX_KEYS];
 	bool			found;
+	bool			opened;
 
-	/* Open REPLICA IDENTITY index.*/
-	idxoid = RelationGetReplicaIndex(relinfo->ri_RelationDesc);
-	if (!OidIsValid(idxoid))
+	entry = get_relindex_cache_entry(relinfo->ri_RelationDesc);
+	if (!OidIsValid(entry->replidxoid))
 	{
+		if (matchatts != NULL)
+			return find_identity_tuple(relinfo, entry, tuple, matchatts,
+									   oldslot, idxrelid);
+
 		ereport(ERROR,
 				(errmsg("could not find REPLICA IDENTITY index for table %s with oid %u",
 						get_rel_name(RelationGetRelid(relinfo->ri_RelationDesc)),
 						RelationGetRelid(relinfo->ri_RelationDesc)),
 				 errhint("The REPLICA IDENTITY index is usually the PRIMARY KEY. See the PostgreSQL docs for ALTER TABLE ... REPLICA IDENTITY")));
 	}
-	*idxrelid = idxoid;
-	idxrel = index_open(idxoid, RowExclusiveLock);
+	*idxrelid = entry->replidxoid;
+	idxrel = open_relinfo_index(relinfo, entry->replidxoid, &opened);
 
 	/* Build scan key for just opened index*/
-	build_index_scan_key(index_key, relinfo->ri_RelationDesc, idxrel, tuple);
+	build_index_scan_key(index_key, &entry->indexes[0], tuple->values,
+						 tuple->nulls);
 
 	/* Try to find the row and store any matching row in 'oldslot'. */
 	found = find_index_tuple(index_key, relinfo->ri_RelationDesc, idxrel,
-							 LockTupleExclusive, oldslot);
+							 LockTupleExclusive, oldslot, NULL, NULL, NULL);
 
 	/* Don't release lock until commit. */
-	index_close(idxrel, NoLock);
+	if (opened)
+		index_close(idxrel, NoLock);
 
 	return found;
 }
 
+/*
+ * Maximum number of heap blocks prefetched for one tuple, there can be more
+ * index entries for the same key if it was updated many times.
+ */
+#define MAX_PREFETCH_BLOCKS		8
+
+/*
+ * Issue prefetch requests for the heap blocks that the REPLICA IDENTITY index
+ * points to for 'tuple', so that a later pglogical_tuple_find_replidx() of the
+ * same tuple doesn't have to wait for them to be read.
+ *
+ * The index itself is searched synchronously, its upper levels are normally
+ * cached anyway. Nothing is locked and the tuples are not checked, this is
+ * only a hint.
+ */
+void
+pglogical_tuple_prefetch_replidx(Relation rel, PGLogicalTupleData *tuple)
+{
+#ifdef USE_PREFETCH
+	PGLogicalRelIndexCacheEntry *entry;
+	PGLogicalIndexKeyInfo *key;
+	ScanKeyData		index_key[INDEX_MAX_KEYS];
+	SnapshotData	snap;
+	Relation		idxrel;
+	IndexScanDesc	scan;
+	ItemPointer		tid;
+	BlockNumber		lastblock = InvalidBlockNumber;
+	int				nblocks = 0;
+
+	entry = get_relindex_cache_entry(rel);
+	if (!OidIsValid(entry->replidxoid))
+		return;
+
+	key = &entry->indexes[0];
+	if (build_index_scan_key(index_key, key, tuple->values, tuple->nulls))
+		return;
+
+	idxrel = index_open(entry->replidxoid, RowExclusiveLock);
+
+	InitDirtySnapshot(snap);
+	scan = index_beginscan(rel, idxrel, &snap, key->nkeys, 0);
+	index_rescan(scan, index_key, key->nkeys, NULL, 0);
+
+	while (nblocks < MAX_PREFETCH_BLOCKS &&
+		   (tid = index_getnext_tid(scan, ForwardScanDirection)) != NULL)
+	{
+		BlockNumber	block = ItemPointerGetBlockNumber(tid);
+
+		if (block == lastblock)
+			continue;
+
+		PrefetchBuffer(rel, MAIN_FORKNUM, block);
+		lastblock = block;
+		nblocks++;
+	}
+
+	index_endscan(scan);
+	index_close(idxrel, NoLock);
+#endif
+}
+
 /*
  * Find the tuple in a table using any index and returns the conflicting
  * index's oid, if any conflict found.
@@ -324,104 +1332,279 @@ Oid
 pglogical_tuple_find_conflict(ResultRelInfo *relinfo, PGLogicalTupleData *tuple,
 							  TupleTableSlot *outslot)
 {
-	Oid				conflict_idx = InvalidOid;
+	PGLogicalRelIndexCacheEntry *entry;
 	ScanKeyData		index_key[INDEX_MAX_KEYS];
 	int				i;
-	ItemPointerData	conflicting_tid;
-	Oid				replidxoid;
-	bool			found = false;
-
-	ItemPointerSetInvalid(&conflicting_tid);
 
-	/*
-	 * Check the replica identity index with a SnapshotDirty scan first, like
-	 * pglogical_tuple_find_replidx, but without ERRORing if we don't find
-	 * a replica identity index.
-	 */
-	replidxoid = RelationGetReplicaIndex(relinfo->ri_RelationDesc);
-	if (OidIsValid(replidxoid))
-	{
-		ScanKeyData	index_key[INDEX_MAX_KEYS];
-		Relation	idxrel = index_open(replidxoid, RowExclusiveLock);
-		build_index_scan_key(index_key, relinfo->ri_RelationDesc, idxrel, tuple);
-		found = find_index_tuple(index_key, relinfo->ri_RelationDesc, idxrel,
-							 LockTupleExclusive, outslot);
-		index_close(idxrel, NoLock);
-		if (found)
-			return replidxoid;
-	}
+	entry = get_relindex_cache_entry(relinfo->ri_RelationDesc);
 
 	/*
-	 * Do a SnapshotDirty search for conflicting tuples. If any is found
-	 * store it in outslot and return the oid of the matching index. We
-	 * don't continue scanning for matches in other indexes, so we won't
-	 * notice if the tuple conflicts with another index, and it'll
-	 * raise a unique violation on apply instead.
+	 * Do a SnapshotDirty search for conflicting tuples, checking the replica
+	 * identity index first, if there is one. If any is found store it in
+	 * outslot and return the oid of the matching index. We don't continue
+	 * scanning for matches in other indexes, so we won't notice if the tuple
+	 * conflicts with another index, and it'll raise a unique violation on
+	 * apply instead.
 	 *
 	 * We could carry on here even if (found) and look for secondary conflicts,
 	 * but all we'd be able to do would be ERROR here instead of later. The
 	 * rest of the time we'd just pay a useless performance cost for extra
 	 * index scans.
 	 */
-	for (i = 0; i < relinfo->ri_NumIndices; i++)
+	for (i = 0; i < entry->nindexes; i++)
 	{
-		IndexInfo  *ii = relinfo->ri_IndexRelationInfo[i];
+		PGLogicalIndexKeyInfo *key = &entry->indexes[i];
 		Relation	idxrel;
+		bool		opened;
+		bool		found;
 
-		/*
-		 * Only unique indexes are of interest here, and we can't deal with
-		 * expression indexes so far.
-		 */
-		if (!ii->ii_Unique || ii->ii_Expressions != NIL)
+		if (build_index_scan_key(index_key, key, tuple->values, tuple->nulls))
 			continue;
 
-		/*
-		 * TODO: predicates should be handled better. There's no point scanning
-		 * an index where the predicates show it could never match anyway, and
-		 * it can produce false conflicts if the predicate includes non-indexed
-		 * columns. We could find a local tuple that matches the predicate in
-		 * the index, but there's only a true conflict if the remote tuple also
-		 * matches the predicate. If we ignore the predicate we generate a false
-		 * conflict. See RM#1839.
-		 *
-		 * For now we reject conflict resolution on indexes with predicates
-		 * entirely. If there's a conflict it'll be raised on apply with a
-		 * unique violation.
-		 */
-		if (ii->ii_Predicate != NIL)
-			continue;
+		idxrel = open_relinfo_index(relinfo, key->indexoid, &opened);
 
-		idxrel = relinfo->ri_IndexRelationDescs[i];
+		/* Try to find conflicting row and store in 'outslot' */
+		found = find_index_tuple(index_key, relinfo->ri_RelationDesc,
+								 idxrel, LockTupleExclusive, outslot,
+								 NULL, NULL, NULL);
 
-		/* No point re-scanning the replica identity index */
-		if (RelationGetRelid(idxrel) == replidxoid)
+		if (opened)
+			index_close(idxrel, NoLock);
+
+		if (found)
+			return key->indexoid;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return InvalidOid;
+}
+
+/*
+ * Probe one unique index for all the not-yet-conflicting tuples of a batch.
+ *
+ * The scan is started once and only rescanned for each tuple, which is what
+ * makes this cheaper than running pglogical_tuple_find_conflict() per row.
+ * Found tuples are not locked, the caller is expected to redo the lookup for
+ * the conflicting rows using the normal single row path.
+ */
+static int
+find_index_conflicts(Relation rel, Relation idxrel, PGLogicalIndexKeyInfo *key,
+					 int ntuples, Datum **values, bool **nulls, Oid *conflicts)
+{
+	ScanKeyData		index_key[INDEX_MAX_KEYS];
+	SnapshotData	snap;
+	IndexScanDesc	scan;
+	TransactionId	xwait;
+	int				nconflicts = 0;
+	int				i;
+#if PG_VERSION_NUM >= 120000
+	TupleTableSlot *slot = table_slot_create(rel, NULL);
+#endif
+
+	InitDirtySnapshot(snap);
+	scan = index_beginscan(rel, idxrel, &snap, key->nkeys, 0);
+
+	for (i = 0; i < ntuples; i++)
+	{
+		bool	found;
+
+		if (OidIsValid(conflicts[i]))
 			continue;
 
-		if (build_index_scan_key(index_key, relinfo->ri_RelationDesc,
-								 idxrel, tuple))
+		/* NULLs can't conflict in a unique index. */
+		if (build_index_scan_key(index_key, key, values[i], nulls[i]))
 			continue;
 
-		/* Try to find conflicting row and store in 'outslot' */
-		found = find_index_tuple(index_key, relinfo->ri_RelationDesc,
-								 idxrel, LockTupleExclusive, outslot);
+retry:
+		index_rescan(scan, index_key, key->nkeys, NULL, 0);
+#if PG_VERSION_NUM >= 120000
+		found = index_getnext_slot(scan, ForwardScanDirection, slot);
+#else
+		found = index_getnext(scan, ForwardScanDirection) != NULL;
+#endif
 
 		if (found)
 		{
+			/* Wait for any concurrent txn touching the tuple, see above. */
+			xwait = TransactionIdIsValid(snap.xmin) ?
+				snap.xmin : snap.xmax;
+
+			if (TransactionIdIsValid(xwait))
+			{
+				XactLockTableWait(xwait, NULL, NULL, XLTW_None);
+				goto retry;
+			}
+
+			conflicts[i] = key->indexoid;
+			nconflicts++;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	index_endscan(scan);
 #if PG_VERSION_NUM >= 120000
-			ItemPointerCopy(&outslot->tts_tid, &conflicting_tid);
+	ExecDropSingleTupleTableSlot(slot);
+#endif
+
+	return nconflicts;
+}
+
+/*
+ * Find the tuples of a batch which conflict with earlier tuples of the same
+ * batch in one unique index.
+ *
+ * None of the batch is in the index yet, so this can't be found by probing
+ * it. The keys are hashed with the hash functions of the column types, where
+ * those agree with the index on equality, and compared using the index
+ * equality functions. conflicts[i] is set for the later tuple of each
+ * duplicate pair, unless already set.
+ */
+static int
+find_batch_conflicts(PGLogicalRelIndexCacheEntry *entry, Relation rel,
+					 PGLogicalIndexKeyInfo *key, int ntuples, Datum **values,
+					 bool **nulls, Oid *conflicts)
+{
+	HASHCTL		ctl;
+	int			hashflags;
+	HTAB	   *keys;
+	int			nconflicts = 0;
+	int			i;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(uint32);
+	ctl.entrysize = sizeof(PGLogicalBatchKeyEntry);
+	ctl.hcxt = CurrentMemoryContext;
+	hashflags = HASH_ELEM | HASH_CONTEXT;
+#if PG_VERSION_NUM < 90500
+	ctl.hash = tag_hash;
+	hashflags |= HASH_FUNCTION;
 #else
-			ItemPointerCopy(&outslot->tts_tuple->t_self, &conflicting_tid);
+	hashflags |= HASH_BLOBS;
 #endif
-			conflict_idx = RelationGetRelid(idxrel);
-			break;
+	keys = hash_create("pglogical batch keys", ntuples, &ctl, hashflags);
+
+	for (i = 0; i < ntuples; i++)
+	{
+		PGLogicalBatchKeyEntry *kentry;
+		uint32		hash = 0;
+		bool		hasnulls = false;
+		bool		found;
+		int			attoff;
+		ListCell   *lc;
+
+		for (attoff = 0; attoff < key->nkeys; attoff++)
+		{
+			AttrNumber	attno = key->attnums[attoff];
+			PGLogicalAttCompareInfo *cmp;
+
+			/* NULLs can't conflict in a unique index. */
+			if (nulls[i][attno - 1])
+			{
+				hasnulls = true;
+				break;
+			}
+
+			/* rotate hashkey left 1 bit at each step */
+			hash = (hash << 1) | ((hash & 0x80000000) ? 1 : 0);
+
+			cmp = get_att_compare(entry, rel, attno);
+			if (!cmp->hashable ||
+				cmp->eqfunc.fn_oid != key->eqfuncs[attoff].fn_oid)
+				continue;
+
+			hash ^= DatumGetUInt32(FunctionCall1Coll(&cmp->hashfunc,
+													 key->collations[attoff],
+													 values[i][attno - 1]));
+		}
+
+		if (hasnulls)
+			continue;
+
+		kentry = hash_search(keys, (void *) &hash, HASH_ENTER, &found);
+		if (!found)
+			kentry->tuples = NIL;
+
+		if (!OidIsValid(conflicts[i]))
+		{
+			foreach (lc, kentry->tuples)
+			{
+				int			j = lfirst_int(lc);
+				bool		equal = true;
+
+				for (attoff = 0; attoff < key->nkeys && equal; attoff++)
+				{
+					AttrNumber	attno = key->attnums[attoff];
+
+					equal = DatumGetBool(FunctionCall2Coll(&key->eqfuncs[attoff],
+														   key->collations[attoff],
+														   values[i][attno - 1],
+														   values[j][attno - 1]));
+				}
+
+				if (equal)
+				{
+					conflicts[i] = key->indexoid;
+					nconflicts++;
+					break;
+				}
+			}
 		}
 
+		kentry->tuples = lappend_int(kentry->tuples, i);
+
 		CHECK_FOR_INTERRUPTS();
 	}
 
-	return conflict_idx;
+	hash_destroy(keys);
+
+	return nconflicts;
 }
 
+/*
+ * Batch variant of pglogical_tuple_find_conflict() used by multi-insert.
+ *
+ * Checks 'ntuples' tuples given as arrays of values/nulls (in the local
+ * relation's attribute order) against the same candidate-key indexes as
+ * pglogical_tuple_find_conflict(), replica identity index first, both for
+ * existing rows and for earlier tuples of the batch. conflicts[i] is set to
+ * the oid of the first index a match was found in, or InvalidOid. Returns the
+ * number of conflicting tuples.
+ */
+int
+pglogical_tuples_find_conflicts(ResultRelInfo *relinfo, int ntuples,
+								Datum **values, bool **nulls, Oid *conflicts)
+{
+	Relation	rel = relinfo->ri_RelationDesc;
+	PGLogicalRelIndexCacheEntry *entry;
+	int			nconflicts = 0;
+	int			i;
+
+	for (i = 0; i < ntuples; i++)
+		conflicts[i] = InvalidOid;
+
+	entry = get_relindex_cache_entry(rel);
+
+	for (i = 0; i < entry->nindexes && nconflicts < ntuples; i++)
+	{
+		PGLogicalIndexKeyInfo *key = &entry->indexes[i];
+		bool		opened;
+		Relation	idxrel = open_relinfo_index(relinfo, key->indexoid,
+												&opened);
+
+		nconflicts += find_index_conflicts(rel, idxrel, key, ntuples, values,
+										   nulls, conflicts);
+		if (nconflicts < ntuples)
+			nconflicts += find_batch_conflicts(entry, rel, key, ntuples,
+											   values, nulls, conflicts);
+
+		if (opened)
+			index_close(idxrel, NoLock);
+	}
+
+	return nconflicts;
+}
 
 /*
  * Resolve conflict based on commit timestamp.
@@ -39,6 +39,7 @@ typedef enum
 
 extern int pglogical_conflict_resolver;
 extern int pglogical_conflict_log_level;
+extern bool pglogical_keyless_tuple_hash;
 
 typedef enum PGLogicalConflictType
 {
@@ -50,13 +51,24 @@ typedef enum PGLogicalConflictType
 
 extern bool pglogical_tuple_find_replidx(ResultRelInfo *relinfo,
 										 PGLogicalTupleData *tuple,
+										 bool *matchatts,
 										 TupleTableSlot *oldslot,
 										 Oid *idxrelid);
 
+extern void pglogical_tuple_prefetch_replidx(Relation rel,
+											 PGLogicalTupleData *tuple);
+
+extern void pglogical_keyless_tuple_hash_add(Relation rel,
+											 TupleTableSlot *slot);
+
 extern Oid pglogical_tuple_find_conflict(ResultRelInfo *relinfo,
 										 PGLogicalTupleData *tuple,
 										 TupleTableSlot *oldslot);
 
+extern int pglogical_tuples_find_conflicts(ResultRelInfo *relinfo,
+										   int ntuples, Datum **values,
+										   bool **nulls, Oid *conflicts);
+
 extern bool get_tuple_origin(HeapTuple local_tuple, TransactionId *xmin,
 							 RepOriginId *local_origin, TimestampTz *local_ts);
 
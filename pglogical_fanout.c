@@ -0,0 +1,536 @@
+/*-------------------------------------------------------------------------
+ *
+ * pglogical_fanout.c
+ *		pglogical cache of encoded transactions shared between walsenders
+ *
+ * Subscribers replicating the same replication sets with the same protocol
+ * options get the very same messages for every transaction. When enabled,
+ * the first walsender to send a transaction records the encoded messages in
+ * a file named after the options and the commit LSN of the transaction, and
+ * the other walsenders send the recorded messages instead of filtering and
+ * encoding each change again. The WAL is still decoded by every walsender,
+ * only the work of the output plugin is shared.
+ *
+ * Relation metadata depends on what was sent to the client before, so the
+ * metadata of every relation in the transaction is recorded, and the reader
+ * sends only what its client doesn't know yet. Transactions which change the
+ * catalogs are never recorded since the metadata may change in the middle of
+ * them.
+ *
+ * A file is removed once all active pglogical slots of the database have
+ * confirmed the transaction. Files are not fsynced, a file damaged by a
+ * crash is removed when it is found to be invalid.
+ *
+ * Copyright (c) 2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pglogical_fanout.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "miscadmin.h"
+
+#if PG_VERSION_NUM >= 90500
+#include "port/pg_crc32c.h"
+#endif
+
+#include "replication/slot.h"
+
+#include "storage/fd.h"
+#include "storage/lwlock.h"
+#include "storage/spin.h"
+
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include "pglogical_fanout.h"
+#include "pglogical.h"
+
+#define FANOUT_DIR				"pg_logical/pglogical_fanout"
+#define FANOUT_MAGIC			0x504C4646
+#define FANOUT_WRITE_BUFFER		(64 * 1024)
+#define FANOUT_CLEANUP_INTERVAL	10000	/* ms */
+
+typedef struct FanoutFileHeader
+{
+	uint32		magic;
+	uint32		paramslen;		/* Length of the options that follow. */
+} FanoutFileHeader;
+
+typedef struct FanoutRecordHeader
+{
+	uint32		len;			/* Length of the message, 0 at the end. */
+	Oid			relid;			/* Relation of a metadata message. */
+	pg_crc32c	crc;			/* CRC of the above and the message. */
+} FanoutRecordHeader;
+
+bool	pglogical_fanout_cache = false;
+
+static char			fanout_dir[MAXPGPATH];
+static char		   *fanout_params = NULL;
+static uint32		fanout_paramslen = 0;
+static pg_crc32c	fanout_hash;
+static MemoryContext FanoutContext = NULL;
+
+/* Writer state. */
+static int			write_fd = -1;
+static char			write_path[MAXPGPATH];
+static char			write_final_path[MAXPGPATH];
+static StringInfoData write_buf;
+static List		   *write_relids = NIL;
+
+/* Reader state. */
+static int			read_fd = -1;
+static char			read_path[MAXPGPATH];
+static StringInfoData read_buf;
+
+static TimestampTz	last_cleanup = 0;
+
+static pg_crc32c
+fanout_record_crc(FanoutRecordHeader *hdr, const char *data)
+{
+	pg_crc32c	crc;
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, hdr, offsetof(FanoutRecordHeader, crc));
+	COMP_CRC32C(crc, data, hdr->len);
+	FIN_CRC32C(crc);
+
+	return crc;
+}
+
+/*
+ * Set up the cache for the output plugin with the given options.
+ *
+ * The options must describe everything that affects the messages sent, only
+ * walsenders with equal options share the recorded transactions.
+ */
+void
+pglogical_fanout_init(const char *params)
+{
+	if (mkdir(FANOUT_DIR, S_IRWXU) != 0 && errno != EEXIST)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m",
+						FANOUT_DIR)));
+
+	snprintf(fanout_dir, MAXPGPATH, "%s/%u", FANOUT_DIR, MyDatabaseId);
+	if (mkdir(fanout_dir, S_IRWXU) != 0 && errno != EEXIST)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m",
+						fanout_dir)));
+
+	/*
+	 * The buffers outlive the transaction the output plugin starts up in,
+	 * and a backend decoding through the SQL interface starts up for every
+	 * call.
+	 */
+	if (FanoutContext == NULL)
+	{
+		MemoryContext oldctx;
+
+		FanoutContext = AllocSetContextCreate(TopMemoryContext,
+											  "pglogical fanout",
+											  ALLOCSET_DEFAULT_SIZES);
+
+		oldctx = MemoryContextSwitchTo(TopMemoryContext);
+		initStringInfo(&write_buf);
+		initStringInfo(&read_buf);
+		MemoryContextSwitchTo(oldctx);
+	}
+
+	if (fanout_params != NULL)
+		pfree(fanout_params);
+	fanout_params = MemoryContextStrdup(TopMemoryContext, params);
+	fanout_paramslen = strlen(params);
+
+	INIT_CRC32C(fanout_hash);
+	COMP_CRC32C(fanout_hash, fanout_params, fanout_paramslen);
+	FIN_CRC32C(fanout_hash);
+}
+
+static void
+fanout_write_discard(void)
+{
+	if (write_fd >= 0)
+	{
+		close(write_fd);
+		write_fd = -1;
+		if (unlink(write_path) != 0 && errno != ENOENT)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m",
+							write_path)));
+	}
+	resetStringInfo(&write_buf);
+}
+
+static void
+fanout_write_flush(void)
+{
+	if (write_fd < 0 || write_buf.len == 0)
+		return;
+
+	errno = 0;
+	if (write(write_fd, write_buf.data, write_buf.len) != write_buf.len)
+	{
+		/* if write didn't set errno, assume problem is no disk space */
+		if (errno == 0)
+			errno = ENOSPC;
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not write fan-out cache file \"%s\": %m",
+						write_path)));
+		fanout_write_discard();
+		return;
+	}
+
+	resetStringInfo(&write_buf);
+}
+
+static void
+fanout_read_close(void)
+{
+	if (read_fd >= 0)
+	{
+		close(read_fd);
+		read_fd = -1;
+	}
+}
+
+/*
+ * A recorded transaction that can't be read is removed so that the next
+ * attempt decodes the transaction instead.
+ */
+static void
+fanout_read_invalid(void)
+{
+	fanout_read_close();
+
+	if (unlink(read_path) != 0 && errno != ENOENT)
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not remove file \"%s\": %m", read_path)));
+
+	ereport(ERROR,
+			(errcode(ERRCODE_DATA_CORRUPTED),
+			 errmsg("invalid record in fan-out cache file \"%s\", removed it",
+					read_path)));
+}
+
+/*
+ * Open the recorded transaction for reading.
+ *
+ * Returns false if it was recorded with different options, which can only
+ * happen on hash collision.
+ */
+static bool
+fanout_read_open(int fd)
+{
+	FanoutFileHeader hdr;
+
+	read_fd = fd;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		hdr.magic != FANOUT_MAGIC)
+		fanout_read_invalid();
+
+	if (hdr.paramslen != fanout_paramslen)
+	{
+		fanout_read_close();
+		return false;
+	}
+
+	resetStringInfo(&read_buf);
+	enlargeStringInfo(&read_buf, hdr.paramslen);
+	if (read(fd, read_buf.data, hdr.paramslen) != hdr.paramslen)
+		fanout_read_invalid();
+
+	if (memcmp(read_buf.data, fanout_params, fanout_paramslen) != 0)
+	{
+		fanout_read_close();
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Decide what to do with the transaction that is about to be sent.
+ *
+ * If it was recorded already it's opened for reading, otherwise we start
+ * recording it.
+ */
+PGLogicalFanoutMode
+pglogical_fanout_start(XLogRecPtr final_lsn, TransactionId xid)
+{
+	int			fd;
+
+	/* Whatever wasn't finished was interrupted by an error. */
+	fanout_write_discard();
+	fanout_read_close();
+
+	snprintf(read_path, MAXPGPATH, "%s/%08X-%08X%08X-%u", fanout_dir,
+			 fanout_hash, (uint32) (final_lsn >> 32), (uint32) final_lsn,
+			 xid);
+
+	fd = open(read_path, O_RDONLY | PG_BINARY, 0);
+	if (fd >= 0)
+		return fanout_read_open(fd) ? FANOUT_REPLAY : FANOUT_NONE;
+	else if (errno != ENOENT)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not open fan-out cache file \"%s\": %m",
+						read_path)));
+		return FANOUT_NONE;
+	}
+
+	strlcpy(write_final_path, read_path, MAXPGPATH);
+	snprintf(write_path, MAXPGPATH, "%s.%d.tmp", write_final_path, MyProcPid);
+
+	write_fd = open(write_path, O_CREAT | O_TRUNC | O_WRONLY | PG_BINARY,
+					S_IRUSR | S_IWUSR);
+	if (write_fd < 0)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not create fan-out cache file \"%s\": %m",
+						write_path)));
+		return FANOUT_NONE;
+	}
+
+	MemoryContextReset(FanoutContext);
+	write_relids = NIL;
+
+	{
+		FanoutFileHeader hdr;
+
+		hdr.magic = FANOUT_MAGIC;
+		hdr.paramslen = fanout_paramslen;
+		appendBinaryStringInfo(&write_buf, (char *) &hdr, sizeof(hdr));
+		appendBinaryStringInfo(&write_buf, fanout_params, fanout_paramslen);
+	}
+
+	return FANOUT_RECORD;
+}
+
+/*
+ * Does the metadata of the relation still have to be recorded for the
+ * current transaction?
+ */
+bool
+pglogical_fanout_need_rel(Oid relid)
+{
+	return !list_member_oid(write_relids, relid);
+}
+
+/*
+ * Record a message of the current transaction. Relation metadata messages
+ * are recorded with the relation they describe.
+ */
+void
+pglogical_fanout_record(const char *data, int len, Oid relid)
+{
+	FanoutRecordHeader hdr;
+
+	if (write_fd < 0)
+		return;
+
+	if (OidIsValid(relid))
+	{
+		MemoryContext oldctx = MemoryContextSwitchTo(FanoutContext);
+
+		write_relids = lappend_oid(write_relids, relid);
+		MemoryContextSwitchTo(oldctx);
+	}
+
+	hdr.len = len;
+	hdr.relid = relid;
+	hdr.crc = fanout_record_crc(&hdr, data);
+
+	appendBinaryStringInfo(&write_buf, (char *) &hdr, sizeof(hdr));
+	appendBinaryStringInfo(&write_buf, data, len);
+
+	if (write_buf.len >= FANOUT_WRITE_BUFFER)
+		fanout_write_flush();
+}
+
+/*
+ * Finish recording the transaction and make it available to others.
+ */
+void
+pglogical_fanout_finish(void)
+{
+	FanoutRecordHeader hdr;
+
+	if (write_fd < 0)
+		return;
+
+	/* End marker. */
+	hdr.len = 0;
+	hdr.relid = InvalidOid;
+	hdr.crc = fanout_record_crc(&hdr, NULL);
+	appendBinaryStringInfo(&write_buf, (char *) &hdr, sizeof(hdr));
+
+	fanout_write_flush();
+	if (write_fd < 0)
+		return;
+
+	if (close(write_fd) != 0)
+	{
+		write_fd = -1;
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not close fan-out cache file \"%s\": %m",
+						write_path)));
+		unlink(write_path);
+		return;
+	}
+	write_fd = -1;
+
+	/* Somebody else may have recorded the same meanwhile, that's fine. */
+	if (rename(write_path, write_final_path) != 0)
+	{
+		ereport(DEBUG1,
+				(errcode_for_file_access(),
+				 errmsg("could not rename file \"%s\" to \"%s\": %m",
+						write_path, write_final_path)));
+		unlink(write_path);
+	}
+}
+
+/*
+ * Read next message of the recorded transaction.
+ *
+ * Returns false at the end of the transaction. The message is valid until
+ * the next call.
+ */
+bool
+pglogical_fanout_read(char **data, int *len, Oid *relid)
+{
+	FanoutRecordHeader hdr;
+	int			r;
+
+	Assert(read_fd >= 0);
+
+	r = read(read_fd, &hdr, sizeof(hdr));
+	if (r < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read fan-out cache file \"%s\": %m",
+						read_path)));
+	else if (r != sizeof(hdr) || hdr.len > MaxAllocSize - 1)
+		fanout_read_invalid();
+
+	resetStringInfo(&read_buf);
+	enlargeStringInfo(&read_buf, hdr.len);
+
+	r = read(read_fd, read_buf.data, hdr.len);
+	if (r < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read fan-out cache file \"%s\": %m",
+						read_path)));
+	else if (r != hdr.len)
+		fanout_read_invalid();
+
+	read_buf.len = hdr.len;
+	read_buf.data[read_buf.len] = '\0';
+
+	if (!EQ_CRC32C(fanout_record_crc(&hdr, read_buf.data), hdr.crc))
+		fanout_read_invalid();
+
+	if (hdr.len == 0)
+	{
+		fanout_read_close();
+		return false;
+	}
+
+	*data = read_buf.data;
+	*len = hdr.len;
+	*relid = hdr.relid;
+
+	return true;
+}
+
+/*
+ * Remove the recorded transactions which all active pglogical slots of the
+ * database have confirmed already.
+ *
+ * Inactive slots don't hold the files back, their walsender will decode the
+ * transactions itself when it comes back.
+ */
+void
+pglogical_fanout_cleanup(void)
+{
+	XLogRecPtr	min_lsn = InvalidXLogRecPtr;
+	TimestampTz	now = GetCurrentTimestamp();
+	DIR		   *dir;
+	struct dirent *de;
+	int			i;
+
+	if (!TimestampDifferenceExceeds(last_cleanup, now,
+									FANOUT_CLEANUP_INTERVAL))
+		return;
+	last_cleanup = now;
+
+	LWLockAcquire(ReplicationSlotControlLock, LW_SHARED);
+	for (i = 0; i < max_replication_slots; i++)
+	{
+		ReplicationSlot *s = &ReplicationSlotCtl->replication_slots[i];
+		XLogRecPtr	confirmed_flush;
+		bool		active;
+
+		if (!s->in_use || s->data.database != MyDatabaseId ||
+			strcmp(NameStr(s->data.plugin), "pglogical_output") != 0)
+			continue;
+
+		SpinLockAcquire(&s->mutex);
+#if PG_VERSION_NUM >= 90600
+		active = s->active_pid != 0;
+#else
+		active = s->active;
+#endif
+		confirmed_flush = s->data.confirmed_flush;
+		SpinLockRelease(&s->mutex);
+
+		if (active &&
+			(min_lsn == InvalidXLogRecPtr || confirmed_flush < min_lsn))
+			min_lsn = confirmed_flush;
+	}
+	LWLockRelease(ReplicationSlotControlLock);
+
+	if (min_lsn == InvalidXLogRecPtr)
+		return;
+
+	dir = AllocateDir(fanout_dir);
+	while ((de = ReadDir(dir, fanout_dir)) != NULL)
+	{
+		uint32		hash;
+		uint32		hi;
+		uint32		lo;
+		char		path[MAXPGPATH];
+
+		if (sscanf(de->d_name, "%08X-%08X%08X-", &hash, &hi, &lo) != 3)
+			continue;
+
+		if ((((uint64) hi) << 32 | lo) >= min_lsn)
+			continue;
+
+		snprintf(path, MAXPGPATH, "%s/%s", fanout_dir, de->d_name);
+		if (unlink(path) != 0 && errno != ENOENT)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m", path)));
+	}
+	FreeDir(dir);
+}
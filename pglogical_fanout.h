@@ -0,0 +1,37 @@
+/*-------------------------------------------------------------------------
+ *
+ * pglogical_fanout.h
+ *		pglogical cache of encoded transactions shared between walsenders
+ *
+ * Copyright (c) 2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pglogical_fanout.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PGLOGICAL_FANOUT_H
+#define PGLOGICAL_FANOUT_H
+
+#include "access/xlogdefs.h"
+
+extern bool pglogical_fanout_cache;
+
+/* What the output plugin does with the current transaction. */
+typedef enum PGLogicalFanoutMode
+{
+	FANOUT_NONE,				/* Not cached, decode as usual. */
+	FANOUT_RECORD,				/* Decode and record the messages. */
+	FANOUT_REPLAY				/* Send the recorded messages instead. */
+} PGLogicalFanoutMode;
+
+extern void pglogical_fanout_init(const char *params);
+extern PGLogicalFanoutMode pglogical_fanout_start(XLogRecPtr final_lsn,
+												  TransactionId xid);
+extern bool pglogical_fanout_need_rel(Oid relid);
+extern void pglogical_fanout_record(const char *data, int len, Oid relid);
+extern void pglogical_fanout_finish(void);
+extern bool pglogical_fanout_read(char **data, int *len, Oid *relid);
+extern void pglogical_fanout_cleanup(void);
+
+#endif /* PGLOGICAL_FANOUT_H */
@@ -77,6 +77,7 @@
 #include "pglogical_relcache.h"
 #include "pglogical_repset.h"
 #include "pglogical_rpc.h"
+#include "pglogical_spool.h"
 #include "pglogical_sync.h"
 #include "pglogical_worker.h"
 
@@ -105,6 +106,8 @@ PG_FUNCTION_INFO_V1(pglogical_alter_subscription_resynchronize_table);
 
 PG_FUNCTION_INFO_V1(pglogical_show_subscription_table);
 PG_FUNCTION_INFO_V1(pglogical_show_subscription_status);
+PG_FUNCTION_INFO_V1(pglogical_show_subscription_receive_queue);
+PG_FUNCTION_INFO_V1(pglogical_show_subscription_compression);
 
 PG_FUNCTION_INFO_V1(pglogical_wait_for_subscription_sync_complete);
 PG_FUNCTION_INFO_V1(pglogical_wait_for_table_sync_complete);
@@ -635,6 +638,9 @@ pglogical_drop_subscription(PG_FUNCTION_ARGS)
 
 		/* Drop the origin tracking locally. */
 		replorigin_drop_by_name(sub->slot_name, true, false);
+
+		/* And whatever was spooled locally but not applied. */
+		pglogical_spool_drop(sub->id);
 	}
 
 	PG_RETURN_BOOL(sub != NULL);
@@ -1161,6 +1167,192 @@ pglogical_show_subscription_status(PG_FUNCTION_ARGS)
 	PG_RETURN_VOID();
 }
 
+/*
+ * Show how much data the apply workers have received but not applied yet.
+ */
+Datum
+pglogical_show_subscription_receive_queue(PG_FUNCTION_ARGS)
+{
+	List			   *subscriptions;
+	ListCell		   *lc;
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	PGLogicalLocalNode *node;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	node = check_local_node(false);
+
+	if (PG_ARGISNULL(0))
+	{
+		subscriptions = get_node_subscriptions(node->node->id, false);
+	}
+	else
+	{
+		PGLogicalSubscription  *sub;
+		sub = get_subscription_by_name(NameStr(*PG_GETARG_NAME(0)), false);
+		subscriptions = list_make1(sub);
+	}
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	foreach (lc, subscriptions)
+	{
+		PGLogicalSubscription  *sub = lfirst(lc);
+		PGLogicalWorker		   *apply;
+		Datum	values[3];
+		bool	nulls[3];
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = CStringGetTextDatum(sub->name);
+
+		/*
+		 * The counters are updated by the apply worker without locking, we
+		 * only lock to make sure the worker does not go away while reading.
+		 */
+		LWLockAcquire(PGLogicalCtx->lock, LW_SHARED);
+		apply = pglogical_apply_find(MyDatabaseId, sub->id);
+		if (pglogical_worker_running(apply))
+		{
+			values[1] = Int32GetDatum(apply->worker.apply.recvq_messages);
+			values[2] = Int64GetDatum(apply->worker.apply.recvq_bytes);
+		}
+		else
+		{
+			nulls[1] = true;
+			nulls[2] = true;
+		}
+		LWLockRelease(PGLogicalCtx->lock);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Show how well the data received by the apply workers compressed.
+ */
+Datum
+pglogical_show_subscription_compression(PG_FUNCTION_ARGS)
+{
+	List			   *subscriptions;
+	ListCell		   *lc;
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	PGLogicalLocalNode *node;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	node = check_local_node(false);
+
+	if (PG_ARGISNULL(0))
+	{
+		subscriptions = get_node_subscriptions(node->node->id, false);
+	}
+	else
+	{
+		PGLogicalSubscription  *sub;
+		sub = get_subscription_by_name(NameStr(*PG_GETARG_NAME(0)), false);
+		subscriptions = list_make1(sub);
+	}
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	foreach (lc, subscriptions)
+	{
+		PGLogicalSubscription  *sub = lfirst(lc);
+		PGLogicalWorker		   *apply;
+		Datum	values[4];
+		bool	nulls[4];
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = CStringGetTextDatum(sub->name);
+
+		/*
+		 * The counters are updated by the apply worker without locking, we
+		 * only lock to make sure the worker does not go away while reading.
+		 */
+		LWLockAcquire(PGLogicalCtx->lock, LW_SHARED);
+		apply = pglogical_apply_find(MyDatabaseId, sub->id);
+		if (pglogical_worker_running(apply))
+		{
+			values[1] = Int64GetDatum(apply->worker.apply.compressed_bytes);
+			values[2] = Int64GetDatum(apply->worker.apply.decompressed_bytes);
+			values[3] = Float8GetDatum(apply->worker.apply.decompress_time);
+		}
+		else
+		{
+			nulls[1] = true;
+			nulls[2] = true;
+			nulls[3] = true;
+		}
+		LWLockRelease(PGLogicalCtx->lock);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	PG_RETURN_VOID();
+}
+
 /*
  * Create new replication set.
  */
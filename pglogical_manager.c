@@ -12,6 +12,8 @@
  */
 #include "postgres.h"
 
+#include "libpq-fe.h"
+
 #include "miscadmin.h"
 
 #include "access/xact.h"
@@ -19,7 +21,12 @@
 #include "commands/dbcommands.h"
 #include "commands/extension.h"
 
+#include "libpq/pqformat.h"
+
+#include "replication/origin.h"
+
 #include "storage/ipc.h"
+#include "storage/latch.h"
 #include "storage/proc.h"
 
 #include "utils/memutils.h"
@@ -29,6 +36,9 @@
 #include "pgstat.h"
 
 #include "pglogical_node.h"
+#include "pglogical_proto_native.h"
+#include "pglogical_repset.h"
+#include "pglogical_sync.h"
 #include "pglogical_worker.h"
 #include "pglogical.h"
 
@@ -36,8 +46,585 @@
 #define MAX_SLEEP 180000L
 #define MIN_SLEEP 5000L
 
+#define PARKED_START_ATTEMPTS 3
+#define PARKED_STOP_TIMEOUT 10000L
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * A subscription whose apply worker exited because it was idle, see
+ * pglogical.apply_idle_timeout. The manager streams from its provider itself,
+ * with one wait for the sockets of all of them, answers keepalives and skips
+ * transactions which contain no changes for us. The first change makes it
+ * start the apply worker again, which streams from the replication origin
+ * position, so nothing the manager received has to be handed over.
+ */
+typedef struct ParkedSubscription
+{
+	Oid			subid;
+	char	   *name;
+	PGconn	   *conn;		/* NULL until the apply worker has exited. */
+	char	   *settings;	/* What the stream was started with. */
+	XLogRecPtr	confirmed;	/* What can be confirmed to the provider. */
+	XLogRecPtr	reported;	/* What was confirmed already. */
+	bool		in_xact;	/* Inside a transaction, no changes so far. */
+	int			failed_starts;	/* Attempts to start streaming that failed. */
+	bool		seen;		/* Still enabled, see manage_apply_workers. */
+	bool		wake;		/* Changes arrived, start the apply worker. */
+} ParkedSubscription;
+
+static List *parked = NIL;
+#endif
+
 void pglogical_manager_main(Datum main_arg);
 
+#if PG_VERSION_NUM >= 100000
+static ParkedSubscription *
+parked_find(Oid subid)
+{
+	ListCell   *lc;
+
+	foreach (lc, parked)
+	{
+		ParkedSubscription *ps = (ParkedSubscription *) lfirst(lc);
+
+		if (ps->subid == subid)
+			return ps;
+	}
+
+	return NULL;
+}
+
+static ParkedSubscription *
+parked_add(PGLogicalSubscription *sub)
+{
+	MemoryContext		oldctx;
+	ParkedSubscription *ps;
+
+	oldctx = MemoryContextSwitchTo(TopMemoryContext);
+	ps = palloc0(sizeof(ParkedSubscription));
+	ps->subid = sub->id;
+	ps->name = pstrdup(sub->name);
+	parked = lappend(parked, ps);
+	MemoryContextSwitchTo(oldctx);
+
+	return ps;
+}
+
+/*
+ * End the stream and wait until the provider says it's done with it.
+ *
+ * The walsender releases the replication slot before it answers, so the apply
+ * worker started next doesn't fail because the slot is still active. Closing
+ * the connection would leave it to the walsender to notice and exit at its
+ * own pace. Gives up after PARKED_STOP_TIMEOUT, the apply worker is restarted
+ * as after any other failure if it finds the slot active then.
+ */
+static void
+parked_stop(ParkedSubscription *ps)
+{
+	TimestampTz	end;
+	bool		copying = true;
+
+	if (PQputCopyEnd(ps->conn, NULL) <= 0 || PQflush(ps->conn) != 0)
+		return;
+
+	end = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+									  PARKED_STOP_TIMEOUT);
+
+	for (;;)
+	{
+		TimestampTz	now;
+		long		secs;
+		int			usecs;
+		int			rc;
+
+		/* Skip what the provider sent before it saw the end of the stream. */
+		if (copying)
+		{
+			char	   *buf;
+			int			r;
+
+			r = PQgetCopyData(ps->conn, &buf, 1);
+			if (r > 0)
+			{
+				PQfreemem(buf);
+				continue;
+			}
+			else if (r == -2)
+				return;
+			else if (r == -1)
+				copying = false;
+		}
+
+		if (!copying && !PQisBusy(ps->conn))
+		{
+			PGresult   *res = PQgetResult(ps->conn);
+
+			if (res == NULL)
+				return;
+			PQclear(res);
+			continue;
+		}
+
+		now = GetCurrentTimestamp();
+		if (now >= end)
+		{
+			elog(LOG, "provider of idle subscription \"%s\" did not end the stream in time",
+				 ps->name);
+			return;
+		}
+
+		TimestampDifference(now, end, &secs, &usecs);
+		rc = WaitLatchOrSocket(NULL,
+							   WL_SOCKET_READABLE | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+							   PQsocket(ps->conn), secs * 1000L + usecs / 1000,
+							   PG_WAIT_EXTENSION);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		if ((rc & WL_SOCKET_READABLE) && !PQconsumeInput(ps->conn))
+			return;
+	}
+}
+
+/*
+ * Stop streaming for the subscription, so that its apply worker gets started
+ * again.
+ */
+static void
+parked_forget(ParkedSubscription *ps)
+{
+	if (ps->conn != NULL)
+	{
+		parked_stop(ps);
+		PQfinish(ps->conn);
+	}
+
+	parked = list_delete_ptr(parked, ps);
+
+	pfree(ps->name);
+	if (ps->settings)
+		pfree(ps->settings);
+	pfree(ps);
+}
+
+/*
+ * Everything the provider filters the stream by. Must be inside transaction.
+ */
+static char *
+parked_settings(PGLogicalSubscription *sub)
+{
+	return psprintf("%s %s %s", sub->origin_if->dsn,
+					stringlist_to_identifierstr(sub->replication_sets),
+					stringlist_to_identifierstr(sub->forward_origins));
+}
+
+/*
+ * Can the manager keep streaming instead of the apply worker? Not when a
+ * table has to be synchronized, which is done by the apply worker, nor when
+ * the subscription was changed in a way which would change what the provider
+ * sends.
+ */
+static bool
+parked_valid(ParkedSubscription *ps, PGLogicalSubscription *sub)
+{
+	PGLogicalSyncStatus *sync;
+
+	sync = get_subscription_sync_status(sub->id, true);
+	if (sync == NULL || sync->status != SYNC_STATUS_READY)
+		return false;
+
+	if (list_length(get_unsynced_tables(sub->id)) > 0)
+		return false;
+
+	return ps->settings == NULL || strcmp(ps->settings, parked_settings(sub)) == 0;
+}
+
+/*
+ * Start streaming where the apply worker has left off.
+ *
+ * Must be inside transaction. The attempt runs in a subtransaction, so that
+ * an error leaves the transaction usable. Returns false if that failed.
+ */
+static bool
+parked_start(ParkedSubscription *ps, PGLogicalSubscription *sub)
+{
+	MemoryContext	oldctx = CurrentMemoryContext;
+	ResourceOwner	oldowner = CurrentResourceOwner;
+	RepOriginId		originid;
+	XLogRecPtr		startpos;
+	char		   *repsets;
+	char		   *origins;
+	bool			started = true;
+
+	originid = replorigin_by_name(sub->slot_name, true);
+	if (originid == InvalidRepOriginId)
+		return false;
+	startpos = replorigin_get_progress(originid, false);
+
+	repsets = stringlist_to_identifierstr(sub->replication_sets);
+	origins = stringlist_to_identifierstr(sub->forward_origins);
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldctx);
+
+	PG_TRY();
+	{
+		char	   *command;
+		PGresult   *res;
+
+		ps->conn = pglogical_connect_replica(sub->origin_if->dsn, sub->name,
+											 "idle");
+		pglogical_identify_system(ps->conn, NULL, NULL, NULL, NULL);
+
+		/* The apply worker's variant of this is FATAL on failure. */
+		command = pglogical_start_replication_command(sub->slot_name,
+													  startpos, origins,
+													  repsets, NULL,
+													  sub->force_text_transfer,
+													  false);
+		res = PQexec(ps->conn, command);
+		if (PQresultStatus(res) != PGRES_COPY_BOTH)
+		{
+			char	   *msg = pstrdup(PQresultErrorMessage(res));
+
+			PQclear(res);
+			elog(ERROR, "could not send replication command \"%s\": %s",
+				 command, msg);
+		}
+		PQclear(res);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldctx);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldctx);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldctx);
+		CurrentResourceOwner = oldowner;
+
+		if (ps->conn != NULL)
+		{
+			PQfinish(ps->conn);
+			ps->conn = NULL;
+		}
+
+		elog(LOG, "could not stream idle subscription \"%s\": %s",
+			 sub->name, edata->message);
+		FreeErrorData(edata);
+		started = false;
+	}
+	PG_END_TRY();
+
+	if (!started)
+		return false;
+
+	oldctx = MemoryContextSwitchTo(TopMemoryContext);
+	ps->settings = parked_settings(sub);
+	MemoryContextSwitchTo(oldctx);
+
+	ps->confirmed = startpos;
+	ps->reported = InvalidXLogRecPtr;
+	ps->in_xact = false;
+	ps->failed_starts = 0;
+
+	elog(DEBUG1, "streaming idle subscription \"%s\" from %X/%X in the manager",
+		 sub->name, (uint32) (startpos >> 32), (uint32) startpos);
+
+	return true;
+}
+
+/*
+ * Hand idle subscriptions from their apply workers to the manager. Returns
+ * true if the subscription is parked and must not get an apply worker.
+ */
+static bool
+manage_parked(PGLogicalSubscription *sub, PGLogicalWorker *apply,
+			  TimestampTz now)
+{
+	ParkedSubscription *ps = parked_find(sub->id);
+
+	if (pglogical_worker_running(apply))
+	{
+		PGLogicalApplyWorker *worker = &apply->worker.apply;
+
+		/* The worker has decided it's not idle after all, see apply_park(). */
+		if (ps != NULL && !worker->park_requested)
+		{
+			parked_forget(ps);
+			return false;
+		}
+
+		if (ps == NULL && pglogical_apply_idle_timeout > 0 &&
+			worker->last_active != 0 &&
+			TimestampDifferenceExceeds(worker->last_active, now,
+									   pglogical_apply_idle_timeout))
+		{
+			LWLockAcquire(PGLogicalCtx->lock, LW_EXCLUSIVE);
+			if (pglogical_worker_running(apply))
+			{
+				worker->park_requested = true;
+				SetLatch(&apply->proc->procLatch);
+			}
+			LWLockRelease(PGLogicalCtx->lock);
+
+			ps = parked_add(sub);
+		}
+
+		if (ps != NULL)
+			ps->seen = true;
+
+		return false;
+	}
+
+	if (ps == NULL)
+		return false;
+
+	/* A crashed worker is handled as usual. */
+	if (apply != NULL || !parked_valid(ps, sub))
+	{
+		parked_forget(ps);
+		return false;
+	}
+
+	/*
+	 * The walsender of the apply worker which has just exited may not have
+	 * released the replication slot yet, so try again a few times before
+	 * starting the apply worker instead.
+	 */
+	if (ps->conn == NULL && !parked_start(ps, sub) &&
+		++ps->failed_starts >= PARKED_START_ATTEMPTS)
+	{
+		elog(LOG, "starting the apply worker of idle subscription \"%s\"",
+			 sub->name);
+		parked_forget(ps);
+		return false;
+	}
+
+	ps->seen = true;
+
+	return true;
+}
+
+/*
+ * Confirm what the provider doesn't have to send us again.
+ */
+static bool
+parked_feedback(ParkedSubscription *ps, bool force)
+{
+	StringInfoData	reply;
+	bool			sent;
+
+	if (!force && ps->confirmed == ps->reported)
+		return true;
+
+	initStringInfo(&reply);
+	pq_sendbyte(&reply, 'r');
+	pq_sendint64(&reply, ps->confirmed);		/* write */
+	pq_sendint64(&reply, ps->confirmed);		/* flush */
+	pq_sendint64(&reply, ps->confirmed);		/* apply */
+	pq_sendint64(&reply, GetCurrentTimestamp());	/* sendTime */
+	pq_sendbyte(&reply, false);					/* replyRequested */
+
+	sent = PQputCopyData(ps->conn, reply.data, reply.len) > 0 &&
+		PQflush(ps->conn) == 0;
+	pfree(reply.data);
+
+	if (sent)
+		ps->reported = ps->confirmed;
+
+	return sent;
+}
+
+/*
+ * Process what arrived for the parked subscription. Returns true when the
+ * apply worker has to be started, because of a change or because streaming
+ * failed.
+ */
+static bool
+parked_receive(ParkedSubscription *ps)
+{
+	for (;;)
+	{
+		char	   *buf;
+		int			r;
+		char		c;
+		StringInfoData s;
+
+		r = PQgetCopyData(ps->conn, &buf, 1);
+		if (r == 0)
+			return false;
+		else if (r < 0)
+		{
+			elog(LOG, "stream of idle subscription \"%s\" ended: %s",
+				 ps->name, PQerrorMessage(ps->conn));
+			return true;
+		}
+
+		memset(&s, 0, sizeof(StringInfoData));
+		s.data = buf;
+		s.len = r;
+		s.maxlen = -1;
+
+		c = pq_getmsgbyte(&s);
+		if (c == 'w')
+		{
+			XLogRecPtr	commit_lsn;
+			XLogRecPtr	end_lsn;
+			TimestampTz	committime;
+
+			pq_getmsgint64(&s); /* start_lsn */
+			pq_getmsgint64(&s); /* end_lsn */
+			pq_getmsgint64(&s); /* sendTime */
+
+			switch (pq_getmsgbyte(&s))
+			{
+				/* STARTUP and ORIGIN come with any transaction */
+				case 'S':
+				case 'O':
+					break;
+				case 'B':
+					ps->in_xact = true;
+					break;
+				case 'C':
+					pglogical_read_commit(&s, &commit_lsn, &end_lsn,
+										  &committime);
+					ps->in_xact = false;
+					if (ps->confirmed < end_lsn)
+						ps->confirmed = end_lsn;
+					break;
+				default:
+					PQfreemem(buf);
+					elog(DEBUG1, "changes arrived for idle subscription \"%s\"",
+						 ps->name);
+					return true;
+			}
+		}
+		else if (c == 'k')
+		{
+			XLogRecPtr	endpos;
+			bool		reply_requested;
+
+			endpos = pq_getmsgint64(&s);
+			pq_getmsgint64(&s); /* sendTime */
+			reply_requested = pq_getmsgbyte(&s);
+
+			/* Everything the provider sent before was an empty transaction. */
+			if (!ps->in_xact && ps->confirmed < endpos)
+				ps->confirmed = endpos;
+
+			if (reply_requested && !parked_feedback(ps, true))
+			{
+				PQfreemem(buf);
+				return true;
+			}
+		}
+
+		PQfreemem(buf);
+	}
+}
+
+/*
+ * Wait for the latch, the timeout or changes for any parked subscription,
+ * whose streams are processed meanwhile. Returns the WL_ flags of the events
+ * which ended the wait, 0 when an apply worker has to be started.
+ */
+static int
+parked_wait(long timeout)
+{
+	WaitEventSet   *set;
+	WaitEvent	   *events;
+	int				nevents = list_length(parked) + 2;
+	TimestampTz		end;
+	List		   *woken = NIL;
+	ListCell	   *lc;
+	int				rc = 0;
+
+	set = CreateWaitEventSet(CurrentMemoryContext, nevents);
+	AddWaitEventToSet(set, WL_LATCH_SET, PGINVALID_SOCKET, &MyProc->procLatch,
+					  NULL);
+	AddWaitEventToSet(set, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+	foreach (lc, parked)
+	{
+		ParkedSubscription *ps = (ParkedSubscription *) lfirst(lc);
+
+		if (ps->conn == NULL)
+			continue;
+
+		AddWaitEventToSet(set, WL_SOCKET_READABLE, PQsocket(ps->conn), NULL,
+						  ps);
+
+		/* What libpq has read already doesn't make the socket readable. */
+		if (parked_receive(ps))
+		{
+			ps->wake = true;
+			woken = lappend(woken, ps);
+		}
+	}
+
+	events = palloc(sizeof(WaitEvent) * nevents);
+	end = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeout);
+
+	while (rc == 0 && woken == NIL)
+	{
+		long		secs;
+		int			usecs;
+		int			n;
+		int			i;
+
+		TimestampDifference(GetCurrentTimestamp(), end, &secs, &usecs);
+		n = WaitEventSetWait(set, secs * 1000L + usecs / 1000, events, nevents,
+							 PG_WAIT_EXTENSION);
+		if (n == 0)
+			rc |= WL_TIMEOUT;
+
+		for (i = 0; i < n; i++)
+		{
+			ParkedSubscription *ps = (ParkedSubscription *) events[i].user_data;
+
+			if (events[i].events & WL_LATCH_SET)
+				rc |= WL_LATCH_SET;
+			else if (events[i].events & WL_POSTMASTER_DEATH)
+				rc |= WL_POSTMASTER_DEATH;
+			else if ((events[i].events & WL_SOCKET_READABLE) && !ps->wake &&
+					 (!PQconsumeInput(ps->conn) || parked_receive(ps)))
+			{
+				ps->wake = true;
+				woken = lappend(woken, ps);
+			}
+		}
+
+		foreach (lc, parked)
+		{
+			ParkedSubscription *ps = (ParkedSubscription *) lfirst(lc);
+
+			if (ps->conn != NULL && !ps->wake && !parked_feedback(ps, false))
+			{
+				ps->wake = true;
+				woken = lappend(woken, ps);
+			}
+		}
+	}
+
+	FreeWaitEventSet(set);
+	pfree(events);
+
+	foreach (lc, woken)
+		parked_forget((ParkedSubscription *) lfirst(lc));
+	list_free(woken);
+
+	return rc;
+}
+#endif
+
 /*
  * Manage the apply workers - start new ones, kill old ones.
  */
@@ -51,6 +638,13 @@ manage_apply_workers(void)
 	ListCell   *slc,
 			   *wlc;
 	bool		ret = true;
+#if PG_VERSION_NUM >= 100000
+	TimestampTz	now = GetCurrentTimestamp();
+	List	   *gone = NIL;
+
+	foreach (slc, parked)
+		((ParkedSubscription *) lfirst(slc))->seen = false;
+#endif
 
 	/* Get list of existing workers. */
 	LWLockAcquire(PGLogicalCtx->lock, LW_EXCLUSIVE);
@@ -119,6 +713,17 @@ manage_apply_workers(void)
 		if (!wlc)
 			apply = NULL;
 
+#if PG_VERSION_NUM >= 100000
+		/* Skip if the manager streams for the idle subscription. */
+		if (manage_parked(sub, apply, now))
+		{
+			/* Try again soon if it couldn't start streaming. */
+			if (parked_find(sub->id)->conn == NULL)
+				ret = false;
+			continue;
+		}
+#endif
+
 		/* Skip if the worker was alrady registered. */
 		if (pglogical_worker_running(apply))
 			continue;
@@ -149,10 +754,25 @@ manage_apply_workers(void)
 		subs_to_start = lappend(subs_to_start, sub);
 	}
 
+#if PG_VERSION_NUM >= 100000
+	/* Stop streaming for subscriptions which were disabled or dropped. */
+	foreach (slc, parked)
+	{
+		ParkedSubscription *ps = (ParkedSubscription *) lfirst(slc);
+
+		if (!ps->seen)
+			gone = lappend(gone, ps);
+	}
+	foreach (slc, gone)
+		parked_forget((ParkedSubscription *) lfirst(slc));
+	list_free(gone);
+#endif
+
 	foreach (slc, subs_to_start)
 	{
 		PGLogicalSubscription  *sub = (PGLogicalSubscription *) lfirst(slc);
 		PGLogicalWorker			apply;
+		PGLogicalWorker		   *crashed;
 
 		memset(&apply, 0, sizeof(PGLogicalWorker));
 		apply.worker_type = PGLOGICAL_WORKER_APPLY;
@@ -161,6 +781,14 @@ manage_apply_workers(void)
 		apply.worker.apply.sync_pending = true;
 		apply.worker.apply.replay_stop_lsn = InvalidXLogRecPtr;
 
+		/* Keep what the crashed worker knew about its helpers. */
+		LWLockAcquire(PGLogicalCtx->lock, LW_SHARED);
+		crashed = pglogical_apply_find(MyPGLogicalWorker->dboid, sub->id);
+		if (crashed != NULL && crashed->crashed_at != 0)
+			apply.worker.apply.stream_file_lsn =
+				crashed->worker.apply.stream_file_lsn;
+		LWLockRelease(PGLogicalCtx->lock);
+
 		pglogical_worker_register(&apply);
 	}
 
@@ -234,6 +862,11 @@ pglogical_manager_main(Datum main_arg)
 		else
 			sleep_timer = Max(sleep_timer / 2, MIN_SLEEP);
 
+#if PG_VERSION_NUM >= 100000
+		if (parked != NIL)
+			rc = parked_wait(processed_all ? sleep_timer : MIN_SLEEP);
+		else
+#endif
 		rc = WaitLatch(&MyProc->procLatch,
 					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
 					   processed_all ? sleep_timer : MIN_SLEEP);
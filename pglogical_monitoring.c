@@ -13,20 +13,51 @@
 #include "postgres.h"
 
 #include "fmgr.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 
 #include "replication/slot.h"
 
+#include "utils/builtins.h"
+#include "utils/guc.h"
 #include "utils/pg_lsn.h"
 
 #include "storage/ipc.h"
 #include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
 
 #include "pgstat.h"
 
+#include "pglogical_output_plugin.h"
 #include "pglogical.h"
 
+/*
+ * Output plugin statistics of one process, published by the process at the
+ * end of every transaction it decodes.
+ */
+typedef struct PGLogicalOutputStatsSlot
+{
+	slock_t		mutex;
+	pid_t		pid;			/* 0 if the slot is free */
+	NameData	slot_name;
+	PGLogicalOutputStats stats;
+} PGLogicalOutputStatsSlot;
+
+typedef struct PGLogicalOutputStatsCtl
+{
+	slock_t		mutex;			/* Protects pid of all slots. */
+	int			nslots;
+	PGLogicalOutputStatsSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} PGLogicalOutputStatsCtl;
+
+static PGLogicalOutputStatsCtl *OutputStatsCtl = NULL;
+static PGLogicalOutputStatsSlot *MyOutputStatsSlot = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
 PG_FUNCTION_INFO_V1(pglogical_wait_slot_confirm_lsn);
+PG_FUNCTION_INFO_V1(pglogical_show_output_stats);
 
 /*
  * Wait for the confirmed_flush_lsn of the specified slot, or all logical slots
@@ -113,3 +144,212 @@ pglogical_wait_slot_confirm_lsn(PG_FUNCTION_ARGS)
 
 	PG_RETURN_VOID();
 }
+
+static int
+output_stats_nslots(void)
+{
+	/*
+	 * This is kludge for Windows (Postgres does not define the GUC variable
+	 * as PGDLLIMPORT)
+	 */
+	return atoi(GetConfigOptionByName("max_wal_senders", NULL, false));
+}
+
+static Size
+output_stats_shmem_size(int nslots)
+{
+	return offsetof(PGLogicalOutputStatsCtl, slots) +
+		sizeof(PGLogicalOutputStatsSlot) * nslots;
+}
+
+static void
+output_stats_shmem_startup(void)
+{
+	bool		found;
+	int			nslots;
+	int			i;
+
+	if (prev_shmem_startup_hook != NULL)
+		prev_shmem_startup_hook();
+
+	nslots = output_stats_nslots();
+
+	OutputStatsCtl = ShmemInitStruct("pglogical_output_stats",
+									 output_stats_shmem_size(nslots), &found);
+
+	if (!found)
+	{
+		SpinLockInit(&OutputStatsCtl->mutex);
+		OutputStatsCtl->nslots = nslots;
+		for (i = 0; i < nslots; i++)
+		{
+			PGLogicalOutputStatsSlot *slot = &OutputStatsCtl->slots[i];
+
+			SpinLockInit(&slot->mutex);
+			slot->pid = 0;
+		}
+	}
+}
+
+/*
+ * Request shmem for the output plugin statistics, one slot per walsender.
+ */
+void
+pglogical_output_stats_shmem_init(void)
+{
+	Assert(process_shared_preload_libraries_in_progress);
+
+	RequestAddinShmemSpace(output_stats_shmem_size(output_stats_nslots()));
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = output_stats_shmem_startup;
+}
+
+static void
+output_stats_release(int code, Datum arg)
+{
+	SpinLockAcquire(&OutputStatsCtl->mutex);
+	MyOutputStatsSlot->pid = 0;
+	SpinLockRelease(&OutputStatsCtl->mutex);
+	MyOutputStatsSlot = NULL;
+}
+
+/*
+ * Publish the output plugin statistics of this process.
+ *
+ * The slot is taken on first use and kept until the process exits. When
+ * all slots are in use, which can happen when changes are also decoded
+ * using the SQL interface, the statistics are not published.
+ */
+void
+pglogical_output_stats_report(const char *slot_name,
+							  PGLogicalOutputStats *stats)
+{
+	PGLogicalOutputStatsSlot *slot;
+
+	/* Not loaded through shared_preload_libraries. */
+	if (OutputStatsCtl == NULL)
+		return;
+
+	if (MyOutputStatsSlot == NULL)
+	{
+		int			i;
+
+		SpinLockAcquire(&OutputStatsCtl->mutex);
+		for (i = 0; i < OutputStatsCtl->nslots; i++)
+		{
+			if (OutputStatsCtl->slots[i].pid == 0)
+			{
+				MyOutputStatsSlot = &OutputStatsCtl->slots[i];
+				MyOutputStatsSlot->pid = MyProcPid;
+				break;
+			}
+		}
+		SpinLockRelease(&OutputStatsCtl->mutex);
+
+		if (MyOutputStatsSlot == NULL)
+			return;
+
+		before_shmem_exit(output_stats_release, (Datum) 0);
+	}
+
+	slot = MyOutputStatsSlot;
+	SpinLockAcquire(&slot->mutex);
+	namestrcpy(&slot->slot_name, slot_name);
+	memcpy(&slot->stats, stats, sizeof(PGLogicalOutputStats));
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * Show the output plugin statistics of all processes decoding changes.
+ */
+Datum
+pglogical_show_output_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	int					i;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	for (i = 0; OutputStatsCtl != NULL && i < OutputStatsCtl->nslots; i++)
+	{
+		PGLogicalOutputStatsSlot *slot = &OutputStatsCtl->slots[i];
+		PGLogicalOutputStats stats;
+		NameData	slot_name;
+		pid_t		pid;
+		Datum		values[24];
+		bool		nulls[24];
+		int			col = 0;
+
+		SpinLockAcquire(&slot->mutex);
+		pid = slot->pid;
+		slot_name = slot->slot_name;
+		stats = slot->stats;
+		SpinLockRelease(&slot->mutex);
+
+		if (pid == 0)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[col++] = Int32GetDatum(pid);
+		values[col++] = CStringGetTextDatum(NameStr(slot_name));
+		values[col++] = Int64GetDatum(stats.changes);
+		values[col++] = Int64GetDatum(stats.filtered_origin);
+		values[col++] = Int64GetDatum(stats.filtered_table);
+		values[col++] = Int64GetDatum(stats.filtered_action);
+		values[col++] = Int64GetDatum(stats.filtered_row);
+		values[col++] = Int64GetDatum(stats.sent_insert);
+		values[col++] = Int64GetDatum(stats.sent_update);
+		values[col++] = Int64GetDatum(stats.sent_delete);
+		values[col++] = Int64GetDatum(stats.bytes_relation);
+		values[col++] = Int64GetDatum(stats.bytes_insert);
+		values[col++] = Int64GetDatum(stats.bytes_update);
+		values[col++] = Int64GetDatum(stats.bytes_delete);
+		values[col++] = Int64GetDatum(stats.bytes_other);
+		values[col++] = Int64GetDatum(stats.relmeta_hits);
+		values[col++] = Int64GetDatum(stats.relmeta_misses);
+		values[col++] = Int64GetDatum(stats.relmeta_invalidations);
+		values[col++] = Float8GetDatum(stats.filter_time);
+		values[col++] = Float8GetDatum(stats.encode_time);
+		values[col++] = Int64GetDatum(stats.compressed_batches);
+		values[col++] = Int64GetDatum(stats.compress_raw_bytes);
+		values[col++] = Int64GetDatum(stats.compressed_bytes);
+		values[col++] = Float8GetDatum(stats.compress_time);
+		Assert(col == lengthof(values));
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	PG_RETURN_VOID();
+}
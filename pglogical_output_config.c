@@ -22,6 +22,7 @@
 #include "miscadmin.h"
 
 #include "pglogical.h"
+#include "pglogical_compress.h"
 #include "pglogical_output_config.h"
 #include "pglogical_output_proto.h"
 #include "pglogical_repset.h"
@@ -45,6 +46,7 @@ static Datum get_param(List *options, const char *name, bool missing_ok,
 static bool parse_param_bool(DefElem *elem);
 static uint32 parse_param_uint32(DefElem *elem);
 static int32 parse_param_int32(DefElem *elem);
+static List *parse_table_list(char *rawstring);
 
 static void
 process_parameters_v1(List *options, PGLogicalOutputData *data);
@@ -70,7 +72,10 @@ enum {
 	PARAM_PGLOGICAL_REPLICATE_ONLY_TABLE,
 	PARAM_HOOKS_SETUP_FUNCTION,
 	PARAM_PG_VERSION,
-	PARAM_NO_TXINFO
+	PARAM_NO_TXINFO,
+	PARAM_PGLOGICAL_STREAMING,
+	PARAM_PGLOGICAL_COMPRESSION,
+	PARAM_PGLOGICAL_CHANGED_COLUMNS_ONLY
 } OutputPluginParamKey;
 
 typedef struct {
@@ -100,6 +105,9 @@ static OutputPluginParam param_lookup[] = {
 	{"hooks.setup_function", PARAM_HOOKS_SETUP_FUNCTION},
 	{"pg_version", PARAM_PG_VERSION},
 	{"no_txinfo", PARAM_NO_TXINFO},
+	{"pglogical.streaming", PARAM_PGLOGICAL_STREAMING},
+	{"pglogical.compression", PARAM_PGLOGICAL_COMPRESSION},
+	{"pglogical.changed_columns_only", PARAM_PGLOGICAL_CHANGED_COLUMNS_ONLY},
 	{NULL, PARAM_UNRECOGNISED}
 };
 
@@ -229,21 +237,15 @@ process_parameters_v1(List *options, PGLogicalOutputData *data)
 			case PARAM_PGLOGICAL_FORWARD_ORIGINS:
 				{
 					List		   *forward_origin_names;
-					ListCell	   *lc;
 					val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_STRING);
 
+					/*
+					 * Either "all" or names of replication origins, which are
+					 * resolved once the plugin has started.
+					 */
 					if (!SplitIdentifierString(DatumGetCString(val), ',', &forward_origin_names))
 						elog(ERROR, "Could not parse forward origin name list %s", DatumGetCString(val));
 
-					foreach (lc, forward_origin_names)
-					{
-						char	   *origin_name = (char *) lfirst(lc);
-
-						if (strcmp(origin_name, REPLICATION_ORIGIN_ALL) != 0)
-							elog(ERROR, "Only \"%s\" is allowed in forward origin name list at the moment, found \"%s\"",
-								 REPLICATION_ORIGIN_ALL, origin_name);
-					}
-
 					data->forward_origins = forward_origin_names;
 					break;
 				}
@@ -264,24 +266,38 @@ process_parameters_v1(List *options, PGLogicalOutputData *data)
 				}
 
 			case PARAM_PGLOGICAL_REPLICATE_ONLY_TABLE:
-				{
-					List *replicate_only_table;
-
-					val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_STRING);
-
-					if (!SplitIdentifierString(strVal(elem->arg), '.', &replicate_only_table))
-						elog(ERROR, "Could not parse replicate_only_table %s", strVal(elem->arg));
+				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_STRING);
 
-					data->replicate_only_table = makeRangeVar(pstrdup(linitial(replicate_only_table)),
-															  pstrdup(lsecond(replicate_only_table)), -1);
-					break;
-				}
+				/*
+				 * The tables are looked up when first needed, see
+				 * pglogical_change_filter().
+				 */
+				data->replicate_only_tables =
+					parse_table_list(DatumGetCString(val));
+				data->replicate_only_relids =
+					palloc(sizeof(Oid) * list_length(data->replicate_only_tables));
+				break;
 
 			case PARAM_NO_TXINFO:
 				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_BOOL);
 				data->client_no_txinfo = DatumGetBool(val);
 				break;
 
+			case PARAM_PGLOGICAL_STREAMING:
+				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_BOOL);
+				data->client_streaming = DatumGetBool(val);
+				break;
+
+			case PARAM_PGLOGICAL_COMPRESSION:
+				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_STRING);
+				data->client_compression = DatumGetCString(val);
+				break;
+
+			case PARAM_PGLOGICAL_CHANGED_COLUMNS_ONLY:
+				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_BOOL);
+				data->client_changed_columns_only = DatumGetBool(val);
+				break;
+
 			/* Backwards compat. */
 			case PARAM_HOOKS_SETUP_FUNCTION:
 				break;
@@ -450,6 +466,45 @@ parse_param_int32(DefElem *elem)
 	return (int32) res;
 }
 
+/*
+ * Parse comma separated list of schema qualified table names into a list
+ * of RangeVars.
+ */
+static List *
+parse_table_list(char *rawstring)
+{
+	List	   *tables = NIL;
+	char	   *name = rawstring;
+	bool		inquote = false;
+	bool		done = false;
+	char	   *p;
+
+	for (p = rawstring; !done; p++)
+	{
+		List	   *qualified_name;
+
+		if (*p == '"')
+			inquote = !inquote;
+
+		if (*p != '\0' && (*p != ',' || inquote))
+			continue;
+
+		done = *p == '\0';
+		*p = '\0';
+
+		if (!SplitIdentifierString(name, '.', &qualified_name) ||
+			list_length(qualified_name) != 2)
+			elog(ERROR, "Could not parse replicate_only_table %s", name);
+
+		tables = lappend(tables,
+						 makeRangeVar(pstrdup(linitial(qualified_name)),
+									  pstrdup(lsecond(qualified_name)), -1));
+		name = p + 1;
+	}
+
+	return tables;
+}
+
 static List*
 add_startup_msg_s(List *l, char *key, char *val)
 {
@@ -491,8 +546,8 @@ prepare_startup_message(PGLogicalOutputData *data)
 {
 	List *l = NIL;
 
-	l = add_startup_msg_s(l, "max_proto_version", "1");
-	l = add_startup_msg_s(l, "min_proto_version", "1");
+	l = add_startup_msg_i(l, "max_proto_version", PGLOGICAL_PROTO_VERSION_NUM);
+	l = add_startup_msg_i(l, "min_proto_version", PGLOGICAL_PROTO_MIN_VERSION_NUM);
 
 	/* We don't support understand column types yet */
 	l = add_startup_msg_b(l, "coltypes", false);
@@ -509,6 +564,18 @@ prepare_startup_message(PGLogicalOutputData *data)
 	l = add_startup_msg_b(l, "forward_changeset_origins",
 			data->forward_changeset_origins);
 
+	l = add_startup_msg_b(l, "streaming", data->streaming);
+
+	l = add_startup_msg_b(l, "insert_batch", data->batch != NULL);
+
+	l = add_startup_msg_b(l, "compact_tuples", data->compact_tuples);
+
+	l = add_startup_msg_b(l, "changed_columns_only",
+						  data->changed_columns_only);
+
+	l = add_startup_msg_s(l, "compression",
+						  (char *) pglogical_compression_name(data->compression));
+
 	l = add_startup_msg_i(l, "walsender_pid", MyProcPid);
 
 	/* and ourselves */
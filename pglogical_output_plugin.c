@@ -18,14 +18,23 @@
 #include <dirent.h>
 
 #include "mb/pg_wchar.h"
+#include "portability/instr_time.h"
 #include "replication/logical.h"
 
+#include "access/sysattr.h"
 #include "access/xact.h"
+#if PG_VERSION_NUM >= 130000
+#include "access/detoast.h"
+#else
+#include "access/tuptoaster.h"
+#endif
 #include "executor/executor.h"
 #include "catalog/namespace.h"
 #include "storage/fd.h"
 #include "storage/lmgr.h"
 #include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/datum.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/snapmgr.h"
@@ -33,8 +42,10 @@
 
 #include "pglogical_output_plugin.h"
 #include "pglogical.h"
+#include "pglogical_compress.h"
 #include "pglogical_output_config.h"
 #include "pglogical_executor.h"
+#include "pglogical_fanout.h"
 #include "pglogical_node.h"
 #include "pglogical_output_proto.h"
 #include "pglogical_queue.h"
@@ -62,11 +73,45 @@ static bool pg_decode_origin_filter(LogicalDecodingContext *ctx,
 						RepOriginId origin_id);
 #endif
 
+#if PG_VERSION_NUM >= 90600
+static void pg_decode_message(LogicalDecodingContext *ctx,
+				  ReorderBufferTXN *txn, XLogRecPtr lsn, bool transactional,
+				  const char *prefix, Size sz, const char *message);
+#endif
+
+#if PG_VERSION_NUM >= 140000
+static void pg_decode_stream_start(LogicalDecodingContext *ctx,
+					   ReorderBufferTXN *txn);
+static void pg_decode_stream_stop(LogicalDecodingContext *ctx,
+					  ReorderBufferTXN *txn);
+static void pg_decode_stream_abort(LogicalDecodingContext *ctx,
+					   ReorderBufferTXN *txn, XLogRecPtr abort_lsn);
+static void pg_decode_stream_commit(LogicalDecodingContext *ctx,
+						ReorderBufferTXN *txn, XLogRecPtr commit_lsn);
+#endif
+
 static void send_startup_message(LogicalDecodingContext *ctx,
 		PGLogicalOutputData *data, bool last_message);
 
 static bool startup_message_sent = false;
 
+/* Limits of a single INSERT BATCH message. */
+#define BATCH_MAX_ROWS 1000
+#define BATCH_MAX_SIZE (1024 * 1024)
+
+static void batch_add(PGLogicalInsertBatch *batch, Relation relation,
+					  HeapTuple tuple, Bitmapset *att_list);
+static void batch_flush(LogicalDecodingContext *ctx,
+						PGLogicalOutputData *data);
+
+static char *fanout_params(PGLogicalOutputData *data);
+static void fanout_replay(LogicalDecodingContext *ctx,
+						  PGLogicalOutputData *data);
+static void output_write(LogicalDecodingContext *ctx,
+						 PGLogicalOutputData *data, bool last_write,
+						 Oid relid, uint64 *bytes);
+static void output_stats_report(PGLogicalOutputData *data);
+
 typedef struct PGLRelMetaCacheEntry
 {
 	Oid relid;
@@ -80,13 +125,21 @@ typedef struct PGLRelMetaCacheEntry
 static HTAB *RelMetaCache = NULL;
 static MemoryContext RelMetaCacheContext = NULL;
 static int InvalidRelMetaCacheCnt = 0;
+static uint64 RelMetaCacheInvalidations = 0;
 
 static void relmetacache_init(MemoryContext decoding_context);
 static PGLRelMetaCacheEntry *relmetacache_get_relation(PGLogicalOutputData *data,
 													   Relation rel);
+static PGLRelMetaCacheEntry *relmetacache_get_relid(Oid relid);
 static void relmetacache_flush(void);
 static void relmetacache_prune(void);
 
+/* Are replicate_only_relids up to date? */
+static bool ReplicateOnlyTablesValid = false;
+static bool ReplicateOnlyCallbackRegistered = false;
+
+static void replicate_only_invalidation_cb(Datum arg, Oid relid);
+
 static void pglReorderBufferCleanSerializedTXNs(const char *slotname);
 
 /* specify output plugin callbacks */
@@ -103,6 +156,18 @@ _PG_output_plugin_init(OutputPluginCallbacks *cb)
 	cb->filter_by_origin_cb = pg_decode_origin_filter;
 #endif
 	cb->shutdown_cb = pg_decode_shutdown;
+#if PG_VERSION_NUM >= 90600
+	cb->message_cb = pg_decode_message;
+#endif
+
+#if PG_VERSION_NUM >= 140000
+	cb->stream_start_cb = pg_decode_stream_start;
+	cb->stream_stop_cb = pg_decode_stream_stop;
+	cb->stream_abort_cb = pg_decode_stream_abort;
+	cb->stream_commit_cb = pg_decode_stream_commit;
+	cb->stream_change_cb = pg_decode_change;
+	cb->stream_message_cb = pg_decode_message;
+#endif
 }
 
 static bool
@@ -176,10 +241,16 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt,
 										  ALLOCSET_DEFAULT_SIZES);
 	data->allow_internal_basetypes = false;
 	data->allow_binary_basetypes = false;
-
+	data->streaming = false;
+	data->stream_subxid = InvalidTransactionId;
 
 	ctx->output_plugin_private = data;
 
+#if PG_VERSION_NUM >= 140000
+	/* Only stream in-progress transactions when the client asks for it. */
+	ctx->streaming = false;
+#endif
+
 	/*
 	 * This is replication start and not slot initialization.
 	 *
@@ -286,6 +357,10 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt,
 				elog(WARNING, "no_txinfo option ignored for protocols other than json");
 				data->client_no_txinfo = false;
 			}
+
+			/* Tuples use the compact format since protocol version 3. */
+			data->compact_tuples = data->client_max_proto_version >= 3;
+			data->changed_columns_only = data->client_changed_columns_only;
 			MemoryContextSwitchTo(oldctx);
 		}
 		else
@@ -367,6 +442,105 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt,
 		else
 			data->forward_changeset_origins = true;
 
+#ifdef HAVE_REPLICATION_ORIGINS
+		/*
+		 * Look up the origins to forward now, the origin filter runs for
+		 * every change and can't access the catalogs.
+		 */
+		{
+			ListCell   *lc;
+
+			oldctx = MemoryContextSwitchTo(ctx->context);
+			foreach (lc, data->forward_origins)
+			{
+				char	   *origin_name = (char *) lfirst(lc);
+				RepOriginId	origin_id;
+
+				if (strcmp(origin_name, REPLICATION_ORIGIN_ALL) == 0)
+				{
+					data->forward_all_origins = true;
+					continue;
+				}
+
+				origin_id = replorigin_by_name(origin_name, true);
+				if (origin_id == InvalidRepOriginId)
+					ereport(WARNING,
+							(errcode(ERRCODE_UNDEFINED_OBJECT),
+							 errmsg("replication origin \"%s\" in forward origin name list does not exist",
+									origin_name),
+							 errdetail("Changes from this origin will not be forwarded until the client reconnects.")));
+				else
+					data->forward_origin_ids =
+						lappend_int(data->forward_origin_ids, origin_id);
+			}
+			MemoryContextSwitchTo(oldctx);
+		}
+#endif
+
+#if PG_VERSION_NUM >= 140000
+		/*
+		 * Large transactions are streamed before they commit if the client
+		 * can apply them that way, otherwise they are decoded to disk once
+		 * they exceed logical_decoding_work_mem and sent on commit.
+		 */
+		if (data->client_streaming && data->api->write_stream_start != NULL)
+			data->streaming = true;
+		ctx->streaming = data->streaming;
+#endif
+
+		/*
+		 * Consecutive INSERTs into the same table are sent together if the
+		 * client understands protocol version 2.
+		 */
+		if (data->client_max_proto_version >= 2 &&
+			data->api->write_insert_batch != NULL)
+		{
+			data->batch = MemoryContextAllocZero(ctx->context,
+												 sizeof(PGLogicalInsertBatch));
+			data->batch->context =
+				AllocSetContextCreate(ctx->context,
+									  "pglogical output batch context",
+									  ALLOCSET_DEFAULT_SIZES);
+
+			/*
+			 * Batches are compressed if the client asks for it. Every client
+			 * which knows about compression can decompress pglz, so use that
+			 * when the requested method is not available here.
+			 */
+			if (data->client_compression != NULL &&
+				data->api->write_compressed != NULL)
+			{
+				data->compression =
+					pglogical_compression_by_name(data->client_compression);
+				if (data->compression == PGLOGICAL_COMPRESSION_NONE)
+					data->compression =
+						pglogical_compression_by_name("pglz");
+			}
+		}
+
+		/*
+		 * Transactions are shared with the other walsenders which send the
+		 * same messages, if enabled.
+		 */
+		if (pglogical_fanout_cache)
+		{
+			pglogical_fanout_init(fanout_params(data));
+			data->fanout = true;
+		}
+
+		/*
+		 * The tables we replicate only are looked up by name again whenever
+		 * a relation changes, it may have been created or renamed.
+		 */
+		ReplicateOnlyTablesValid = false;
+		if (data->replicate_only_tables != NIL &&
+			!ReplicateOnlyCallbackRegistered)
+		{
+			CacheRegisterRelcacheCallback(replicate_only_invalidation_cb,
+										  (Datum) 0);
+			ReplicateOnlyCallbackRegistered = true;
+		}
+
 		if (started_tx)
 			CommitTransactionCommand();
 
@@ -398,6 +572,21 @@ pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 	if (!startup_message_sent)
 		send_startup_message(ctx, data, false /* can't be last message */);
 
+	/*
+	 * Transactions which change the catalogs may change the relation
+	 * metadata as they go, those are never shared.
+	 */
+	data->fanout_mode = FANOUT_NONE;
+	if (data->fanout && !rbtxn_has_catalog_changes(txn))
+		data->fanout_mode = pglogical_fanout_start(txn->final_lsn, txn->xid);
+
+	/* The recorded transaction is sent on commit. */
+	if (data->fanout_mode == FANOUT_REPLAY)
+	{
+		MemoryContextSwitchTo(old_ctx);
+		return;
+	}
+
 #ifdef HAVE_REPLICATION_ORIGINS
 	/* If the record didn't originate locally, send origin info */
 	send_replication_origin &= txn->origin_id != InvalidRepOriginId;
@@ -412,7 +601,7 @@ pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 		char *origin;
 
 		/* Message boundary */
-		OutputPluginWrite(ctx, false);
+		output_write(ctx, data, false, InvalidOid, &data->stats.bytes_other);
 		OutputPluginPrepareWrite(ctx, true);
 
 		/*
@@ -430,7 +619,7 @@ pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 	}
 #endif
 
-	OutputPluginWrite(ctx, true);
+	output_write(ctx, data, true, InvalidOid, &data->stats.bytes_other);
 
 	Assert(CurrentMemoryContext == data->context);
 	MemoryContextSwitchTo(old_ctx);
@@ -448,9 +637,27 @@ pg_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 
 	old_ctx = MemoryContextSwitchTo(data->context);
 
-	OutputPluginPrepareWrite(ctx, true);
-	data->api->write_commit(ctx->out, data, txn, commit_lsn);
-	OutputPluginWrite(ctx, true);
+	if (data->fanout_mode == FANOUT_REPLAY)
+		fanout_replay(ctx, data);
+	else
+	{
+		batch_flush(ctx, data);
+
+		OutputPluginPrepareWrite(ctx, true);
+		data->api->write_commit(ctx->out, data, txn, commit_lsn);
+		output_write(ctx, data, true, InvalidOid, &data->stats.bytes_other);
+
+		if (data->fanout_mode == FANOUT_RECORD)
+			pglogical_fanout_finish();
+	}
+
+	if (data->fanout)
+	{
+		data->fanout_mode = FANOUT_NONE;
+		pglogical_fanout_cleanup();
+	}
+
+	output_stats_report(data);
 
 	/*
 	 * Now is a good time to get rid of invalidated relation
@@ -466,6 +673,41 @@ pg_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	VALGRIND_DO_ADDED_LEAK_CHECK;
 }
 
+/*
+ * Is the queued message replicated to our replication sets?
+ */
+static bool
+queued_message_replicated(PGLogicalOutputData *data, QueuedMessage *q)
+{
+	ListCell   *qlc;
+
+	/*
+	 * No replication set means global message, those are always
+	 * replicated.
+	 */
+	if (q->replication_sets == NULL)
+		return true;
+
+	foreach (qlc, q->replication_sets)
+	{
+		char	   *queue_set = (char *) lfirst(qlc);
+		ListCell   *plc;
+
+		foreach (plc, data->replication_sets)
+		{
+			PGLogicalRepSet	   *rs = lfirst(plc);
+
+			/* TODO: this is somewhat ugly. */
+			if (strcmp(queue_set, rs->name) == 0 &&
+				(q->message_type != QUEUE_COMMAND_TYPE_TRUNCATE ||
+				 rs->replicate_truncate))
+				return true;
+		}
+	}
+
+	return false;
+}
+
 static bool
 pglogical_change_filter(PGLogicalOutputData *data, Relation relation,
 						ReorderBufferChange *change, Bitmapset **att_list)
@@ -473,16 +715,39 @@ pglogical_change_filter(PGLogicalOutputData *data, Relation relation,
 	PGLogicalTableRepInfo *tblinfo;
 	ListCell	   *lc;
 
-	if (data->replicate_only_table)
+	if (data->replicate_only_tables != NIL)
 	{
 		/*
-		 * Special case - we are catching up just one table.
-		 * TODO: performance
+		 * Special case - we are catching up just some tables, which were
+		 * looked up once, so that this is just an oid comparison.
 		 */
-		return strcmp(RelationGetRelationName(relation),
-					  data->replicate_only_table->relname) == 0 &&
-			RelationGetNamespace(relation) ==
-				get_namespace_oid(data->replicate_only_table->schemaname, true);
+		int			ntables = list_length(data->replicate_only_tables);
+		int			i;
+
+		if (!ReplicateOnlyTablesValid)
+		{
+			/* Invalidations arriving during the lookup make us retry. */
+			ReplicateOnlyTablesValid = true;
+			i = 0;
+			foreach (lc, data->replicate_only_tables)
+			{
+				RangeVar   *rv = lfirst(lc);
+				Oid			nspid;
+
+				nspid = get_namespace_oid(rv->schemaname, true);
+				data->replicate_only_relids[i++] = OidIsValid(nspid) ?
+					get_relname_relid(rv->relname, nspid) : InvalidOid;
+			}
+		}
+
+		for (i = 0; i < ntables; i++)
+		{
+			if (data->replicate_only_relids[i] == RelationGetRelid(relation))
+				return true;
+		}
+
+		data->stats.filtered_table++;
+		return false;
 	}
 	else if (RelationGetRelid(relation) == get_queue_table_oid())
 	{
@@ -491,37 +756,16 @@ pglogical_change_filter(PGLogicalOutputData *data, Relation relation,
 		{
 			HeapTuple		tup = &change->data.tp.newtuple->tuple;
 			QueuedMessage  *q;
-			ListCell	   *qlc;
 
-			LockRelation(relation, AccessShareLock);
-			q = queued_message_from_tuple(tup);
-			UnlockRelation(relation, AccessShareLock);
+			/* Only the replication sets are needed here. */
+			q = queued_message_from_tuple(tup, RelationGetDescr(relation),
+										  false);
 
-			/*
-			 * No replication set means global message, those are always
-			 * replicated.
-			 */
-			if (q->replication_sets == NULL)
+			if (queued_message_replicated(data, q))
 				return true;
-
-			foreach (qlc, q->replication_sets)
-			{
-				char	   *queue_set = (char *) lfirst(qlc);
-				ListCell   *plc;
-
-				foreach (plc, data->replication_sets)
-				{
-					PGLogicalRepSet	   *rs = lfirst(plc);
-
-					/* TODO: this is somewhat ugly. */
-					if (strcmp(queue_set, rs->name) == 0 &&
-						(q->message_type != QUEUE_COMMAND_TYPE_TRUNCATE ||
-						 rs->replicate_truncate))
-						return true;
-				}
-			}
 		}
 
+		data->stats.filtered_table++;
 		return false;
 	}
 	else if (RelationGetRelid(relation) == get_replication_set_rel_oid())
@@ -536,6 +780,8 @@ pglogical_change_filter(PGLogicalOutputData *data, Relation relation,
 		PGLogicalRepSet	   *replicated_set;
 		ListCell		   *plc;
 
+		data->stats.filtered_table++;
+
 		if (change->action == REORDER_BUFFER_CHANGE_UPDATE)
 			 tup = &change->data.tp.newtuple->tuple;
 		else if (change->action == REORDER_BUFFER_CHANGE_DELETE)
@@ -577,20 +823,36 @@ pglogical_change_filter(PGLogicalOutputData *data, Relation relation,
 	tblinfo = get_table_replication_info(data->local_node_id, relation,
 										 data->replication_sets);
 
+	if (!tblinfo->replicate_insert && !tblinfo->replicate_update &&
+		!tblinfo->replicate_delete)
+	{
+		data->stats.filtered_table++;
+		return false;
+	}
+
 	/* First try filter out by change type. */
 	switch (change->action)
 	{
 		case REORDER_BUFFER_CHANGE_INSERT:
 			if (!tblinfo->replicate_insert)
+			{
+				data->stats.filtered_action++;
 				return false;
+			}
 			break;
 		case REORDER_BUFFER_CHANGE_UPDATE:
 			if (!tblinfo->replicate_update)
+			{
+				data->stats.filtered_action++;
 				return false;
+			}
 			break;
 		case REORDER_BUFFER_CHANGE_DELETE:
 			if (!tblinfo->replicate_delete)
+			{
+				data->stats.filtered_action++;
 				return false;
+			}
 			break;
 		default:
 			elog(ERROR, "Unhandled reorder buffer change type %d",
@@ -637,11 +899,11 @@ pglogical_change_filter(PGLogicalOutputData *data, Relation relation,
 			res = ExecEvalExpr(exprstate, econtext, &isnull, NULL);
 
 			/* NULL is same as false for our use. */
-			if (isnull)
-				return false;
-
-			if (!DatumGetBool(res))
+			if (isnull || !DatumGetBool(res))
+			{
+				data->stats.filtered_row++;
 				return false;
+			}
 		}
 
 		ExecDropSingleTupleTableSlot(econtext->ecxt_scantuple);
@@ -663,44 +925,133 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	PGLogicalOutputData *data = ctx->output_plugin_private;
 	MemoryContext	old;
 	Bitmapset	   *att_list = NULL;
+	PGLRelMetaCacheEntry *cached_relmeta = NULL;
+	instr_time		start;
+	instr_time		filtered;
+	instr_time		duration;
+
+	data->stats.changes++;
+
+	/*
+	 * The recorded transaction is sent instead, but changes of replication
+	 * sets still have to update our cached copy of them.
+	 */
+	if (data->fanout_mode == FANOUT_REPLAY)
+	{
+		if (RelationGetRelid(relation) == get_replication_set_rel_oid())
+		{
+			old = MemoryContextSwitchTo(data->context);
+			pglogical_change_filter(data, relation, change, &att_list);
+			MemoryContextSwitchTo(old);
+			MemoryContextReset(data->context);
+		}
+		return;
+	}
 
 	/* Avoid leaking memory by using and resetting our own context */
 	old = MemoryContextSwitchTo(data->context);
 
 	/* First check the table filter */
+	INSTR_TIME_SET_CURRENT(start);
 	if (!pglogical_change_filter(data, relation, change, &att_list))
+	{
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, start);
+		data->stats.filter_time += INSTR_TIME_GET_MILLISEC(duration);
+
+		MemoryContextSwitchTo(old);
+		MemoryContextReset(data->context);
 		return;
+	}
+	INSTR_TIME_SET_CURRENT(filtered);
+	duration = filtered;
+	INSTR_TIME_SUBTRACT(duration, start);
+	data->stats.filter_time += INSTR_TIME_GET_MILLISEC(duration);
+
+	if (data->api->write_rel != NULL)
+		cached_relmeta = relmetacache_get_relation(data, relation);
+
+	/*
+	 * Pending INSERTs go out before anything else is sent, the batch only
+	 * grows while more rows for the same table follow.
+	 */
+	if (data->batch != NULL && data->batch->nrows > 0 &&
+		(change->action != REORDER_BUFFER_CHANGE_INSERT ||
+		 data->batch->relid != RelationGetRelid(relation) ||
+		 !bms_equal(data->batch->att_list, att_list) ||
+		 (cached_relmeta != NULL && !cached_relmeta->is_cached) ||
+		 (TransactionIdIsValid(data->stream_subxid) &&
+		  change->txn->xid != data->stream_subxid)))
+		batch_flush(ctx, data);
 
 	/*
 	 * If the protocol wants to write relation information and the client
 	 * isn't known to have metadata cached for this relation already,
 	 * send relation metadata.
-	 *
-	 * TODO: track hit/miss stats
 	 */
-	if (data->api->write_rel != NULL)
+	if (cached_relmeta != NULL && cached_relmeta->is_cached)
+		data->stats.relmeta_hits++;
+
+	if (cached_relmeta != NULL && !cached_relmeta->is_cached)
 	{
-		PGLRelMetaCacheEntry *cached_relmeta;
-		cached_relmeta = relmetacache_get_relation(data, relation);
+		data->stats.relmeta_misses++;
+		OutputPluginPrepareWrite(ctx, false);
+		data->api->write_rel(ctx->out, data, relation, att_list);
+		output_write(ctx, data, false, RelationGetRelid(relation),
+					 &data->stats.bytes_relation);
+		cached_relmeta->is_cached = true;
+	}
+	else if (cached_relmeta != NULL && data->fanout_mode == FANOUT_RECORD &&
+			 pglogical_fanout_need_rel(RelationGetRelid(relation)))
+	{
+		StringInfoData	buf;
 
-		if (!cached_relmeta->is_cached)
-		{
-			OutputPluginPrepareWrite(ctx, false);
-			data->api->write_rel(ctx->out, data, relation, att_list);
-			OutputPluginWrite(ctx, false);
-			cached_relmeta->is_cached = true;
-		}
+		/*
+		 * Those replaying the transaction may not have sent the metadata
+		 * yet, so record it even though our client has it.
+		 */
+		initStringInfo(&buf);
+		data->api->write_rel(&buf, data, relation, att_list);
+		pglogical_fanout_record(buf.data, buf.len,
+								RelationGetRelid(relation));
+	}
+
+	/*
+	 * Changes of a streamed transaction can come from any of its
+	 * subtransactions, tell the client which one when that changes.
+	 */
+	if (TransactionIdIsValid(data->stream_subxid) &&
+		change->txn->xid != data->stream_subxid)
+	{
+		OutputPluginPrepareWrite(ctx, true);
+		data->api->write_stream_subxact(ctx->out, data, change->txn->xid);
+		OutputPluginWrite(ctx, true);
+		data->stream_subxid = change->txn->xid;
 	}
 
 	/* Send the data */
 	switch (change->action)
 	{
 		case REORDER_BUFFER_CHANGE_INSERT:
+			/* The queue table has its own handling on the other side. */
+			if (data->batch != NULL &&
+				RelationGetRelid(relation) != get_queue_table_oid())
+			{
+				batch_add(data->batch, relation,
+						  &change->data.tp.newtuple->tuple, att_list);
+				if (data->batch->nrows >= BATCH_MAX_ROWS ||
+					data->batch->size >= BATCH_MAX_SIZE)
+					batch_flush(ctx, data);
+				break;
+			}
+
 			OutputPluginPrepareWrite(ctx, true);
 			data->api->write_insert(ctx->out, data, relation,
 									&change->data.tp.newtuple->tuple,
 									att_list);
-			OutputPluginWrite(ctx, true);
+			output_write(ctx, data, true, InvalidOid,
+						 &data->stats.bytes_insert);
+			data->stats.sent_insert++;
 			break;
 		case REORDER_BUFFER_CHANGE_UPDATE:
 			{
@@ -711,7 +1062,9 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 				data->api->write_update(ctx->out, data, relation, oldtuple,
 										&change->data.tp.newtuple->tuple,
 										att_list);
-				OutputPluginWrite(ctx, true);
+				output_write(ctx, data, true, InvalidOid,
+							 &data->stats.bytes_update);
+				data->stats.sent_update++;
 				break;
 			}
 		case REORDER_BUFFER_CHANGE_DELETE:
@@ -721,7 +1074,9 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 				data->api->write_delete(ctx->out, data, relation,
 										&change->data.tp.oldtuple->tuple,
 										att_list);
-				OutputPluginWrite(ctx, true);
+				output_write(ctx, data, true, InvalidOid,
+							 &data->stats.bytes_delete);
+				data->stats.sent_delete++;
 			}
 			else
 				elog(DEBUG1, "didn't send DELETE change because of missing oldtuple");
@@ -730,11 +1085,356 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 			Assert(false);
 	}
 
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, filtered);
+	data->stats.encode_time += INSTR_TIME_GET_MILLISEC(duration);
+
+	/* Cleanup */
+	Assert(CurrentMemoryContext == data->context);
+	MemoryContextSwitchTo(old);
+	MemoryContextReset(data->context);
+}
+
+#if PG_VERSION_NUM >= 90600
+/*
+ * Send message queued by queue_message() as logical decoding message instead
+ * of row of the queue table, see pglogical.queue_messages.
+ */
+static void
+pg_decode_message(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+				  XLogRecPtr lsn, bool transactional, const char *prefix,
+				  Size sz, const char *message)
+{
+	PGLogicalOutputData *data = ctx->output_plugin_private;
+	MemoryContext	old;
+	QueuedMessage  *q;
+
+	/* Messages of other extensions and non-transactional ones are not ours. */
+	if (!transactional || strcmp(prefix, PGLOGICAL_QUEUE_MESSAGE_PREFIX) != 0)
+		return;
+
+	if (data->fanout_mode == FANOUT_REPLAY)
+		return;
+
+	data->stats.changes++;
+
+	/*
+	 * Catch-up streams of table sync only get the synced tables, the queued
+	 * commands are applied by the main apply worker.
+	 */
+	if (data->replicate_only_tables != NIL)
+	{
+		data->stats.filtered_table++;
+		return;
+	}
+
+	old = MemoryContextSwitchTo(data->context);
+
+	/* Only the replication sets are needed here. */
+	q = queued_message_from_logical_message(message, sz, false);
+	if (!queued_message_replicated(data, q))
+	{
+		data->stats.filtered_table++;
+		MemoryContextSwitchTo(old);
+		MemoryContextReset(data->context);
+		return;
+	}
+
+	if (data->api->write_queued_message == NULL ||
+		data->client_max_proto_version < 3)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("client does not support queued messages sent as logical decoding messages"),
+				 errhint("Disable pglogical.queue_messages until all subscribers are upgraded.")));
+
+	batch_flush(ctx, data);
+
+	/*
+	 * Only the toplevel transaction is known here, the message is attributed
+	 * to it even when written by one of its subtransactions.
+	 */
+	if (TransactionIdIsValid(data->stream_subxid) &&
+		txn->xid != data->stream_subxid)
+	{
+		OutputPluginPrepareWrite(ctx, true);
+		data->api->write_stream_subxact(ctx->out, data, txn->xid);
+		OutputPluginWrite(ctx, true);
+		data->stream_subxid = txn->xid;
+	}
+
+	OutputPluginPrepareWrite(ctx, true);
+	data->api->write_queued_message(ctx->out, data, message, sz);
+	output_write(ctx, data, true, InvalidOid, &data->stats.bytes_other);
+
 	/* Cleanup */
 	Assert(CurrentMemoryContext == data->context);
 	MemoryContextSwitchTo(old);
 	MemoryContextReset(data->context);
 }
+#endif
+
+/*
+ * Remember an INSERT to be sent as part of the next INSERT BATCH.
+ *
+ * The row is deformed and its values copied into the batch context since the
+ * change is freed once the callback returns.
+ */
+static void
+batch_add(PGLogicalInsertBatch *batch, Relation relation, HeapTuple tuple,
+		  Bitmapset *att_list)
+{
+	MemoryContext	old;
+	TupleDesc		desc;
+	Datum		   *values;
+	bool		   *isnull;
+	int				i;
+
+	old = MemoryContextSwitchTo(batch->context);
+
+	if (batch->nrows == 0)
+	{
+		batch->relid = RelationGetRelid(relation);
+		batch->desc = CreateTupleDescCopy(RelationGetDescr(relation));
+		batch->att_list = bms_copy(att_list);
+		batch->size = 0;
+	}
+	desc = batch->desc;
+
+	if (batch->nrows >= batch->maxrows)
+	{
+		int		maxrows = Max(batch->maxrows * 2, 16);
+
+		if (batch->values == NULL)
+		{
+			batch->values = palloc(maxrows * desc->natts * sizeof(Datum));
+			batch->isnull = palloc(maxrows * desc->natts * sizeof(bool));
+		}
+		else
+		{
+			batch->values = repalloc(batch->values,
+									 maxrows * desc->natts * sizeof(Datum));
+			batch->isnull = repalloc(batch->isnull,
+									 maxrows * desc->natts * sizeof(bool));
+		}
+		batch->maxrows = maxrows;
+	}
+
+	values = &batch->values[batch->nrows * desc->natts];
+	isnull = &batch->isnull[batch->nrows * desc->natts];
+
+	heap_deform_tuple(tuple, desc, values, isnull);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(desc,i);
+
+		if (isnull[i] || att->attbyval)
+			continue;
+
+		/* send indirect datums inline */
+		if (att->attlen == -1 && VARATT_IS_EXTERNAL_INDIRECT(values[i]))
+		{
+			struct varatt_indirect redirect;
+
+			VARATT_EXTERNAL_GET_POINTER(redirect, DatumGetPointer(values[i]));
+			values[i] = PointerGetDatum(redirect.pointer);
+		}
+
+		values[i] = datumCopy(values[i], false, att->attlen);
+	}
+
+	batch->size += tuple->t_len;
+	batch->nrows++;
+
+	MemoryContextSwitchTo(old);
+}
+
+/*
+ * Send the pending INSERTs, if any, as one INSERT BATCH message.
+ */
+static void
+batch_flush(LogicalDecodingContext *ctx, PGLogicalOutputData *data)
+{
+	PGLogicalInsertBatch *batch = data->batch;
+
+	if (batch == NULL || batch->nrows == 0)
+		return;
+
+	OutputPluginPrepareWrite(ctx, false);
+	if (data->compression != PGLOGICAL_COMPRESSION_NONE)
+	{
+		StringInfoData	msg;
+		int				headerlen = ctx->out->len;
+		instr_time		start;
+		instr_time		duration;
+
+		initStringInfo(&msg);
+		data->api->write_insert_batch(&msg, data, batch);
+
+		INSTR_TIME_SET_CURRENT(start);
+		if (data->api->write_compressed(ctx->out, data, msg.data, msg.len))
+		{
+			INSTR_TIME_SET_CURRENT(duration);
+			INSTR_TIME_SUBTRACT(duration, start);
+
+			data->stats.compressed_batches++;
+			data->stats.compress_raw_bytes += msg.len;
+			data->stats.compressed_bytes += ctx->out->len - headerlen;
+			data->stats.compress_time += INSTR_TIME_GET_MILLISEC(duration);
+		}
+		else
+			appendBinaryStringInfo(ctx->out, msg.data, msg.len);
+
+		pfree(msg.data);
+	}
+	else
+		data->api->write_insert_batch(ctx->out, data, batch);
+	output_write(ctx, data, false, InvalidOid, &data->stats.bytes_insert);
+	data->stats.sent_insert += batch->nrows;
+
+	batch->nrows = 0;
+	batch->maxrows = 0;
+	batch->values = NULL;
+	batch->isnull = NULL;
+	batch->desc = NULL;
+	batch->att_list = NULL;
+	MemoryContextReset(batch->context);
+}
+
+/*
+ * Write the prepared message, recording it in the fan-out cache if the
+ * transaction is being recorded, and count its size in *bytes.
+ *
+ * The relid is set for relation metadata messages so that those replaying
+ * the transaction can skip the ones their client has already.
+ */
+static void
+output_write(LogicalDecodingContext *ctx, PGLogicalOutputData *data,
+			 bool last_write, Oid relid, uint64 *bytes)
+{
+	*bytes += ctx->out->len - data->write_header_len;
+
+	if (data->fanout_mode == FANOUT_RECORD)
+		pglogical_fanout_record(ctx->out->data + data->write_header_len,
+								ctx->out->len - data->write_header_len,
+								relid);
+
+	OutputPluginWrite(ctx, last_write);
+}
+
+/*
+ * Send the messages of the transaction recorded by another walsender.
+ */
+static void
+fanout_replay(LogicalDecodingContext *ctx, PGLogicalOutputData *data)
+{
+	char	   *msg;
+	int			len;
+	Oid			relid;
+
+	while (pglogical_fanout_read(&msg, &len, &relid))
+	{
+		if (OidIsValid(relid))
+		{
+			PGLRelMetaCacheEntry *cached_relmeta;
+
+			cached_relmeta = relmetacache_get_relid(relid);
+			if (cached_relmeta->is_cached)
+				continue;
+			cached_relmeta->is_cached = true;
+		}
+
+		OutputPluginPrepareWrite(ctx, true);
+		appendBinaryStringInfo(ctx->out, msg, len);
+		OutputPluginWrite(ctx, true);
+
+		/* Rows of INSERT BATCH messages are not counted here. */
+		switch (msg[0])
+		{
+			case 'R':
+				data->stats.bytes_relation += len;
+				break;
+			case 'I':
+				data->stats.sent_insert++;
+				/* fallthrough */
+			case 'M':
+			case 'Z':
+				data->stats.bytes_insert += len;
+				break;
+			case 'U':
+				data->stats.sent_update++;
+				data->stats.bytes_update += len;
+				break;
+			case 'D':
+				data->stats.sent_delete++;
+				data->stats.bytes_delete += len;
+				break;
+			default:
+				data->stats.bytes_other += len;
+				break;
+		}
+	}
+}
+
+/*
+ * Publish our statistics in shared memory.
+ */
+static void
+output_stats_report(PGLogicalOutputData *data)
+{
+	data->stats.relmeta_invalidations = RelMetaCacheInvalidations;
+	pglogical_output_stats_report(NameStr(MyReplicationSlot->data.name),
+								  &data->stats);
+}
+
+/*
+ * Describe everything which affects the messages we send for a transaction.
+ *
+ * Walsenders with the same description send the same messages, so they can
+ * share them through the fan-out cache.
+ */
+static char *
+fanout_params(PGLogicalOutputData *data)
+{
+	StringInfoData	params;
+	ListCell	   *lc;
+
+	initStringInfo(&params);
+
+	appendStringInfo(&params, "proto=%s;compact=%d;batch=%d;compression=%d;"
+					 "changed=%d;internal=%d;binary=%d;origins=%d;"
+					 "encoding=%d;notxinfo=%d",
+					 data->client_protocol_format == NULL ? "native" :
+					 data->client_protocol_format,
+					 data->compact_tuples, data->batch != NULL,
+					 (int) data->compression, data->changed_columns_only,
+					 data->allow_internal_basetypes,
+					 data->allow_binary_basetypes,
+					 data->forward_changeset_origins,
+					 data->field_datum_encoding, data->client_no_txinfo);
+
+	appendStringInfoString(&params, ";forward_origins=");
+	foreach (lc, data->forward_origins)
+		appendStringInfo(&params, "%s,", (char *) lfirst(lc));
+
+	appendStringInfoString(&params, ";replication_sets=");
+	foreach (lc, data->replication_sets)
+	{
+		PGLogicalRepSet *rs = lfirst(lc);
+
+		appendStringInfo(&params, "%s,", rs->name);
+	}
+
+	appendStringInfoString(&params, ";only_tables=");
+	foreach (lc, data->replicate_only_tables)
+	{
+		RangeVar   *rv = lfirst(lc);
+
+		appendStringInfo(&params, "%s.%s,", rv->schemaname, rv->relname);
+	}
+
+	return params.data;
+}
 
 #ifdef HAVE_REPLICATION_ORIGINS
 /*
@@ -751,18 +1451,129 @@ pg_decode_origin_filter(LogicalDecodingContext *ctx,
 	    /* Never filter out locally originated tx's */
 	    ret = false;
 
+	else if (data->forward_all_origins)
+		ret = false;
+
 	else
 		/*
-		 * Otherwise, ignore the origin passed in txnfilter_args->origin_id,
-		 * and just forward all or nothing based on the configuration option
-		 * 'forward_origins'.
+		 * Otherwise forward only the origins listed in 'forward_origins',
+		 * filtering here means the other transactions are never
+		 * reassembled.
 		 */
-		ret = list_length(data->forward_origins) == 0;
+		ret = !list_member_int(data->forward_origin_ids, origin_id);
+
+	if (ret)
+		data->stats.filtered_origin++;
 
 	return ret;
 }
 #endif
 
+#if PG_VERSION_NUM >= 140000
+/*
+ * STREAM START callback
+ *
+ * Starts a chunk of changes of a transaction which is still in progress;
+ * the changes are sent through the usual change callback until STREAM STOP.
+ */
+static void
+pg_decode_stream_start(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	PGLogicalOutputData *data = ctx->output_plugin_private;
+	MemoryContext old_ctx;
+
+	old_ctx = MemoryContextSwitchTo(data->context);
+
+	if (!startup_message_sent)
+		send_startup_message(ctx, data, false /* can't be last message */);
+
+	OutputPluginPrepareWrite(ctx, true);
+	data->api->write_stream_start(ctx->out, data, txn->xid,
+								  !rbtxn_is_streamed(txn));
+	OutputPluginWrite(ctx, true);
+
+	data->stream_subxid = txn->xid;
+
+	Assert(CurrentMemoryContext == data->context);
+	MemoryContextSwitchTo(old_ctx);
+	MemoryContextReset(data->context);
+}
+
+/*
+ * STREAM STOP callback
+ */
+static void
+pg_decode_stream_stop(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	PGLogicalOutputData *data = ctx->output_plugin_private;
+	MemoryContext old_ctx;
+
+	old_ctx = MemoryContextSwitchTo(data->context);
+
+	batch_flush(ctx, data);
+
+	OutputPluginPrepareWrite(ctx, true);
+	data->api->write_stream_stop(ctx->out, data);
+	OutputPluginWrite(ctx, true);
+
+	data->stream_subxid = InvalidTransactionId;
+
+	Assert(CurrentMemoryContext == data->context);
+	MemoryContextSwitchTo(old_ctx);
+	MemoryContextReset(data->context);
+}
+
+/*
+ * STREAM ABORT callback
+ *
+ * Called for the whole streamed transaction as well as for its aborted
+ * subtransactions.
+ */
+static void
+pg_decode_stream_abort(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+					   XLogRecPtr abort_lsn)
+{
+	PGLogicalOutputData *data = ctx->output_plugin_private;
+	ReorderBufferTXN *toptxn = txn->toptxn ? txn->toptxn : txn;
+	MemoryContext old_ctx;
+
+	old_ctx = MemoryContextSwitchTo(data->context);
+
+	OutputPluginPrepareWrite(ctx, true);
+	data->api->write_stream_abort(ctx->out, data, toptxn->xid, txn->xid);
+	OutputPluginWrite(ctx, true);
+
+	Assert(CurrentMemoryContext == data->context);
+	MemoryContextSwitchTo(old_ctx);
+	MemoryContextReset(data->context);
+}
+
+/*
+ * STREAM COMMIT callback
+ */
+static void
+pg_decode_stream_commit(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+						XLogRecPtr commit_lsn)
+{
+	PGLogicalOutputData *data = ctx->output_plugin_private;
+	MemoryContext old_ctx;
+
+	old_ctx = MemoryContextSwitchTo(data->context);
+
+	OutputPluginPrepareWrite(ctx, true);
+	data->api->write_stream_commit(ctx->out, data, txn, commit_lsn);
+	OutputPluginWrite(ctx, true);
+
+	output_stats_report(data);
+
+	relmetacache_prune();
+
+	Assert(CurrentMemoryContext == data->context);
+	MemoryContextSwitchTo(old_ctx);
+	MemoryContextReset(data->context);
+}
+#endif
+
 static void
 send_startup_message(LogicalDecodingContext *ctx,
 		PGLogicalOutputData *data, bool last_message)
@@ -781,6 +1592,7 @@ send_startup_message(LogicalDecodingContext *ctx,
 	 */
 
 	OutputPluginPrepareWrite(ctx, last_message);
+	data->write_header_len = ctx->out->len;
 	data->api->write_startup_message(ctx->out, msg);
 	OutputPluginWrite(ctx, last_message);
 
@@ -807,6 +1619,16 @@ pg_decode_shutdown(LogicalDecodingContext * ctx)
 }
 
 
+/*
+ * Any relation may have been created or renamed to one of those we
+ * replicate only, so look them up again.
+ */
+static void
+replicate_only_invalidation_cb(Datum arg, Oid relid)
+{
+	ReplicateOnlyTablesValid = false;
+}
+
 /*
  * Relation metadata invalidation, for when a relcache invalidation
  * means that we need to resend table metadata to the client.
@@ -836,6 +1658,7 @@ relmetacache_invalidation_cb(Datum arg, Oid relid)
 	{
 		hentry->is_valid = false;
 		InvalidRelMetaCacheCnt++;
+		RelMetaCacheInvalidations++;
 	}
 }
 
@@ -853,6 +1676,7 @@ relmetacache_init(MemoryContext decoding_context)
 	int		hash_flags;
 
 	InvalidRelMetaCacheCnt = 0;
+	RelMetaCacheInvalidations = 0;
 
 	if (RelMetaCache == NULL)
 	{
@@ -902,6 +1726,15 @@ relmetacache_init(MemoryContext decoding_context)
 static PGLRelMetaCacheEntry *
 relmetacache_get_relation(struct PGLogicalOutputData *data,
 						  Relation rel)
+{
+	return relmetacache_get_relid(RelationGetRelid(rel));
+}
+
+/*
+ * Same as relmetacache_get_relation(), by relation oid.
+ */
+static PGLRelMetaCacheEntry *
+relmetacache_get_relid(Oid relid)
 {
 	struct PGLRelMetaCacheEntry *hentry;
 	bool found;
@@ -910,14 +1743,14 @@ relmetacache_get_relation(struct PGLogicalOutputData *data,
 	/* Find cached function info, creating if not found */
 	old_mctx = MemoryContextSwitchTo(RelMetaCacheContext);
 	hentry = (struct PGLRelMetaCacheEntry*) hash_search(RelMetaCache,
-										 (void *)(&RelationGetRelid(rel)),
+										 (void *)(&relid),
 										 HASH_ENTER, &found);
 	(void) MemoryContextSwitchTo(old_mctx);
 
 	/* If not found or not valid, it can't be cached. */
 	if (!found || !hentry->is_valid)
 	{
-		Assert(hentry->relid = RelationGetRelid(rel));
+		Assert(hentry->relid = relid);
 		hentry->is_cached = false;
 		/* Only used for lazy purging of invalidations */
 		hentry->is_valid = true;
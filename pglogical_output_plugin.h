@@ -13,12 +13,63 @@
 #ifndef PG_LOGICAL_OUTPUT_PLUGIN_H
 #define PG_LOGICAL_OUTPUT_PLUGIN_H
 
+#include "access/tupdesc.h"
+
+#include "nodes/bitmapset.h"
 #include "nodes/pg_list.h"
 #include "nodes/primnodes.h"
 
 /* summon cross-PG-version compatibility voodoo */
 #include "pglogical_compat.h"
 
+/*
+ * Consecutive INSERTs into one relation, sent as a single INSERT BATCH
+ * message with protocol version 2. The rows are deformed and copied since
+ * the changes are gone by the time the batch is sent.
+ */
+typedef struct PGLogicalInsertBatch
+{
+	MemoryContext context;		/* Everything below lives here. */
+	Oid			relid;
+	TupleDesc	desc;
+	Bitmapset  *att_list;
+	int			nrows;
+	int			maxrows;
+	Size		size;			/* Approximate size of the row data. */
+	Datum	   *values;			/* nrows * desc->natts */
+	bool	   *isnull;
+} PGLogicalInsertBatch;
+
+/*
+ * Counters of the output plugin, see pglogical.output_stats.
+ */
+typedef struct PGLogicalOutputStats
+{
+	uint64		changes;			/* Changes decoded. */
+	/* Changes filtered out, by reason. */
+	uint64		filtered_origin;
+	uint64		filtered_table;		/* Table not in replication sets. */
+	uint64		filtered_action;	/* Action not replicated. */
+	uint64		filtered_row;
+	uint64		sent_insert;		/* Rows sent, including batched ones. */
+	uint64		sent_update;
+	uint64		sent_delete;
+	uint64		bytes_relation;		/* Bytes sent per message type. */
+	uint64		bytes_insert;		/* Includes INSERT BATCH. */
+	uint64		bytes_update;
+	uint64		bytes_delete;
+	uint64		bytes_other;		/* BEGIN, COMMIT, ORIGIN. */
+	uint64		relmeta_hits;
+	uint64		relmeta_misses;
+	uint64		relmeta_invalidations;
+	double		filter_time;		/* In milliseconds. */
+	double		encode_time;		/* In milliseconds. */
+	uint64		compressed_batches;
+	uint64		compress_raw_bytes;
+	uint64		compressed_bytes;
+	double		compress_time;		/* In milliseconds. */
+} PGLogicalOutputStats;
+
 /* typedef appears in pglogical_output_plugin.h */
 typedef struct PGLogicalOutputData
 {
@@ -33,6 +84,11 @@ typedef struct PGLogicalOutputData
 	bool		allow_internal_basetypes;
 	bool		allow_binary_basetypes;
 	bool		forward_changeset_origins;
+	bool		streaming;
+	char		compression;	/* Compression of INSERT BATCH, if any. */
+	bool		compact_tuples;	/* Protocol version 3 tuple format. */
+	bool		changed_columns_only;	/* Leave unchanged columns out of
+										 * UPDATEs when possible. */
 	int			field_datum_encoding;
 
 	/*
@@ -64,12 +120,38 @@ typedef struct PGLogicalOutputData
 	bool		client_binary_intdatetimes_set;
 	bool		client_binary_intdatetimes;
 	bool		client_no_txinfo;
+	bool		client_streaming;
+	const char *client_compression;
+	bool		client_changed_columns_only;
 
 	/* List of origin names */
     List	   *forward_origins;
+	/* Same resolved at startup, unless "all" origins are forwarded */
+	bool		forward_all_origins;
+	List	   *forward_origin_ids;
 	/* List of PGLogicalRepSet */
 	List	   *replication_sets;
-	RangeVar   *replicate_only_table;
+	/* List of RangeVar, and the same resolved to oids when valid */
+	List	   *replicate_only_tables;
+	Oid		   *replicate_only_relids;
+
+	/* Subtransaction of the last streamed change. */
+	TransactionId stream_subxid;
+
+	/* Fan-out cache enabled, and what we do with the current transaction. */
+	bool		fanout;
+	int			fanout_mode;	/* PGLogicalFanoutMode */
+	/* Length of the walsender header in front of each message. */
+	int			write_header_len;
+
+	/* INSERTs not sent yet, NULL unless protocol version 2 is used. */
+	PGLogicalInsertBatch *batch;
+
+	/* Published at the end of every transaction. */
+	PGLogicalOutputStats stats;
 } PGLogicalOutputData;
 
+extern void pglogical_output_stats_report(const char *slot_name,
+										  PGLogicalOutputStats *stats);
+
 #endif /* PG_LOGICAL_OUTPUT_PLUGIN_H */
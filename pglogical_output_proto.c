@@ -33,6 +33,14 @@ pglogical_init_api(PGLogicalProtoType typ)
 		res->write_update = pglogical_json_write_update;
 		res->write_delete = pglogical_json_write_delete;
 		res->write_startup_message = json_write_startup_message;
+		res->write_insert_batch = NULL;
+		res->write_compressed = NULL;
+		res->write_queued_message = NULL;
+		res->write_stream_start = NULL;
+		res->write_stream_stop = NULL;
+		res->write_stream_subxact = NULL;
+		res->write_stream_abort = NULL;
+		res->write_stream_commit = NULL;
 	}
 	else
 	{
@@ -44,6 +52,14 @@ pglogical_init_api(PGLogicalProtoType typ)
 		res->write_update = pglogical_write_update;
 		res->write_delete = pglogical_write_delete;
 		res->write_startup_message = write_startup_message;
+		res->write_insert_batch = pglogical_write_insert_batch;
+		res->write_compressed = pglogical_write_compressed;
+		res->write_queued_message = pglogical_write_queued_message;
+		res->write_stream_start = pglogical_write_stream_start;
+		res->write_stream_stop = pglogical_write_stream_stop;
+		res->write_stream_subxact = pglogical_write_stream_subxact;
+		res->write_stream_abort = pglogical_write_stream_abort;
+		res->write_stream_commit = pglogical_write_stream_commit;
 	}
 
 	return res;
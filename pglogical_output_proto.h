@@ -27,7 +27,7 @@
  * have backwards compatibility for. We negotiate protocol versions during the
  * startup handshake. See the protocol documentation for details.
  */
-#define PGLOGICAL_PROTO_VERSION_NUM 1
+#define PGLOGICAL_PROTO_VERSION_NUM 3
 #define PGLOGICAL_PROTO_MIN_VERSION_NUM 1
 
 /*
@@ -78,8 +78,34 @@ typedef void (*pglogical_write_delete_fn) (StringInfo out, PGLogicalOutputData *
 										   Relation rel, HeapTuple oldtuple,
 										   Bitmapset *att_list);
 
+typedef void (*pglogical_write_insert_batch_fn) (StringInfo out,
+							PGLogicalOutputData * data,
+							PGLogicalInsertBatch *batch);
+
+typedef bool (*pglogical_write_compressed_fn) (StringInfo out,
+							PGLogicalOutputData * data, const char *msg,
+							int len);
+
+typedef void (*pglogical_write_queued_message_fn) (StringInfo out,
+							PGLogicalOutputData * data, const char *message,
+							Size sz);
+
 typedef void (*write_startup_message_fn) (StringInfo out, List *msg);
 
+typedef void (*pglogical_write_stream_start_fn) (StringInfo out,
+							PGLogicalOutputData * data, TransactionId xid,
+							bool first);
+typedef void (*pglogical_write_stream_stop_fn) (StringInfo out,
+							PGLogicalOutputData * data);
+typedef void (*pglogical_write_stream_subxact_fn) (StringInfo out,
+							PGLogicalOutputData * data, TransactionId subxid);
+typedef void (*pglogical_write_stream_abort_fn) (StringInfo out,
+							PGLogicalOutputData * data, TransactionId xid,
+							TransactionId subxid);
+typedef void (*pglogical_write_stream_commit_fn) (StringInfo out,
+							PGLogicalOutputData * data, ReorderBufferTXN *txn,
+							XLogRecPtr commit_lsn);
+
 typedef struct PGLogicalProtoAPI
 {
 	pglogical_write_rel_fn write_rel;
@@ -90,6 +116,20 @@ typedef struct PGLogicalProtoAPI
 	pglogical_write_update_fn write_update;
 	pglogical_write_delete_fn write_delete;
 	write_startup_message_fn write_startup_message;
+
+	/* Batches of INSERTs of protocol version 2 and their compression, optional. */
+	pglogical_write_insert_batch_fn write_insert_batch;
+	pglogical_write_compressed_fn write_compressed;
+
+	/* Queued messages sent as logical decoding messages, optional. */
+	pglogical_write_queued_message_fn write_queued_message;
+
+	/* Streaming of in-progress transactions, optional. */
+	pglogical_write_stream_start_fn write_stream_start;
+	pglogical_write_stream_stop_fn write_stream_stop;
+	pglogical_write_stream_subxact_fn write_stream_subxact;
+	pglogical_write_stream_abort_fn write_stream_abort;
+	pglogical_write_stream_commit_fn write_stream_commit;
 } PGLogicalProtoAPI;
 
 extern PGLogicalProtoAPI *pglogical_init_api(PGLogicalProtoType typ);
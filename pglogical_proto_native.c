@@ -22,30 +22,63 @@
 #include "libpq/pqformat.h"
 #include "nodes/parsenodes.h"
 #include "replication/reorderbuffer.h"
+#include "utils/datum.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
 
+#include "pglogical_compress.h"
 #include "pglogical_output_plugin.h"
 #include "pglogical_output_proto.h"
 #include "pglogical_proto_native.h"
 
 #define IS_REPLICA_IDENTITY 1
+/* Representation of the column values follows the column flags. */
+#define HAS_TRANSFER_KIND 2
 
-static void pglogical_write_attrs(StringInfo out, Relation rel,
-								  Bitmapset *att_list);
+/* STREAM START of the first chunk of the transaction. */
+#define STREAM_FLAG_FIRST 1
+
+/* Messages shorter than this are not worth compressing. */
+#define COMPRESS_MIN_SIZE 256
+
+static void pglogical_write_attrs(StringInfo out, PGLogicalOutputData *data,
+								  Relation rel, Bitmapset *att_list);
 static void pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 								  Relation rel, HeapTuple tuple,
-								  Bitmapset *att_list);
+								  Bitmapset *att_list, bool *unchanged);
+static void pglogical_write_compact_tuple(StringInfo out,
+										  PGLogicalOutputData *data,
+										  Relation rel, HeapTuple tuple,
+										  Bitmapset *att_list,
+										  bool *unchanged);
+static bool *unchanged_columns(Relation rel, HeapTuple oldtuple,
+							   HeapTuple newtuple);
 static char decide_datum_transfer(Form_pg_attribute att,
 								  Form_pg_type typclass,
 								  bool allow_internal_basetypes,
 								  bool allow_binary_basetypes);
+static char decide_column_transfer(PGLogicalOutputData *data,
+								   Form_pg_attribute att,
+								   Form_pg_type typclass);
+static void pglogical_send_varint(StringInfo out, uint32 value);
+static void pglogical_write_batch_column(StringInfo out,
+										 PGLogicalOutputData *data,
+										 PGLogicalInsertBatch *batch,
+										 int attno);
 
 static void pglogical_read_attrs(StringInfo in, char ***attrnames,
-								  int *nattrnames);
+								  bool **attidentity, char **attkind,
+								  int16 **attlen, int *nattrnames);
 static void pglogical_read_tuple(StringInfo in, PGLogicalRelation *rel,
 					  PGLogicalTupleData *tuple);
+static void pglogical_read_compact_tuple(StringInfo in,
+										 PGLogicalRelation *rel,
+										 PGLogicalTupleData *tuple);
+static uint32 pglogical_get_varint(StringInfo in);
+static Datum pglogical_read_datum(StringInfo in, char kind, int len,
+								  Form_pg_attribute att);
 
 /*
  * Write functions
@@ -88,16 +121,20 @@ pglogical_write_rel(StringInfo out, PGLogicalOutputData *data, Relation rel,
 	pq_sendbytes(out, relname, relnamelen);
 
 	/* send the attribute info */
-	pglogical_write_attrs(out, rel, att_list);
+	pglogical_write_attrs(out, data, rel, att_list);
 
 	pfree(nspname);
 }
 
 /*
  * Write relation attributes to the outputstream.
+ *
+ * With compact tuples the representation of the values of each column is
+ * sent here once, so that the tuples don't have to repeat it.
  */
 static void
-pglogical_write_attrs(StringInfo out, Relation rel, Bitmapset *att_list)
+pglogical_write_attrs(StringInfo out, PGLogicalOutputData *data, Relation rel,
+					  Bitmapset *att_list)
 {
 	TupleDesc	desc;
 	int			i;
@@ -144,10 +181,31 @@ pglogical_write_attrs(StringInfo out, Relation rel, Bitmapset *att_list)
 		if (bms_is_member(att->attnum - FirstLowInvalidHeapAttributeNumber,
 						  idattrs))
 			flags |= IS_REPLICA_IDENTITY;
+		if (data->compact_tuples)
+			flags |= HAS_TRANSFER_KIND;
 
 		pq_sendbyte(out, 'C');		/* column definition follows */
 		pq_sendbyte(out, flags);
 
+		if (data->compact_tuples)
+		{
+			HeapTuple	typtup;
+			char		kind;
+
+			typtup = SearchSysCache1(TYPEOID,
+									 ObjectIdGetDatum(att->atttypid));
+			if (!HeapTupleIsValid(typtup))
+				elog(ERROR, "cache lookup failed for type %u",
+					 att->atttypid);
+			kind = decide_column_transfer(data, att,
+										  (Form_pg_type) GETSTRUCT(typtup));
+			ReleaseSysCache(typtup);
+
+			pq_sendbyte(out, kind);
+			if (kind == 'f')
+				pq_sendint(out, att->attlen, 2);
+		}
+
 		pq_sendbyte(out, 'N');		/* column name block follows */
 		attname = NameStr(att->attname);
 		len = strlen(attname) + 1;
@@ -224,6 +282,107 @@ pglogical_write_origin(StringInfo out, const char *origin,
 	pq_sendbytes(out, origin, len);
 }
 
+/*
+ * Write STREAM START to the output stream.
+ *
+ * The changes of an in-progress transaction that follow, until STREAM STOP,
+ * belong to the transaction xid. The flags tell whether it's the first chunk
+ * of the transaction.
+ */
+void
+pglogical_write_stream_start(StringInfo out, PGLogicalOutputData *data,
+							 TransactionId xid, bool first)
+{
+	uint8	flags = 0;
+
+	if (first)
+		flags |= STREAM_FLAG_FIRST;
+
+	pq_sendbyte(out, 's');		/* STREAM START */
+
+	/* send the flags field its self */
+	pq_sendbyte(out, flags);
+
+	/* fixed fields */
+	pq_sendint(out, xid, 4);
+}
+
+/*
+ * Write STREAM STOP to the output stream.
+ */
+void
+pglogical_write_stream_stop(StringInfo out, PGLogicalOutputData *data)
+{
+	uint8	flags = 0;
+
+	pq_sendbyte(out, 'e');		/* STREAM STOP */
+
+	/* send the flags field its self */
+	pq_sendbyte(out, flags);
+}
+
+/*
+ * Write STREAM SUBTRANSACTION to the output stream.
+ *
+ * The streamed changes that follow belong to the (sub)transaction subxid.
+ */
+void
+pglogical_write_stream_subxact(StringInfo out, PGLogicalOutputData *data,
+							   TransactionId subxid)
+{
+	uint8	flags = 0;
+
+	pq_sendbyte(out, 'x');		/* STREAM SUBTRANSACTION */
+
+	/* send the flags field its self */
+	pq_sendbyte(out, flags);
+
+	/* fixed fields */
+	pq_sendint(out, subxid, 4);
+}
+
+/*
+ * Write STREAM ABORT to the output stream.
+ *
+ * The subxid is the same as xid when the whole transaction was aborted.
+ */
+void
+pglogical_write_stream_abort(StringInfo out, PGLogicalOutputData *data,
+							 TransactionId xid, TransactionId subxid)
+{
+	uint8	flags = 0;
+
+	pq_sendbyte(out, 'a');		/* STREAM ABORT */
+
+	/* send the flags field its self */
+	pq_sendbyte(out, flags);
+
+	/* fixed fields */
+	pq_sendint(out, xid, 4);
+	pq_sendint(out, subxid, 4);
+}
+
+/*
+ * Write STREAM COMMIT to the output stream.
+ */
+void
+pglogical_write_stream_commit(StringInfo out, PGLogicalOutputData *data,
+							  ReorderBufferTXN *txn, XLogRecPtr commit_lsn)
+{
+	uint8	flags = 0;
+
+	pq_sendbyte(out, 'c');		/* STREAM COMMIT */
+
+	/* send the flags field */
+	pq_sendbyte(out, flags);
+
+	/* send fixed fields */
+	pq_sendint(out, txn->xid, 4);
+	pq_sendint64(out, commit_lsn);
+	pq_sendint64(out, txn->end_lsn);
+	pq_sendint64(out, txn->commit_time);
+}
+
 /*
  * Write INSERT to the output stream.
  */
@@ -243,7 +402,7 @@ pglogical_write_insert(StringInfo out, PGLogicalOutputData *data,
 	pq_sendint(out, RelationGetRelid(rel), 4);
 
 	pq_sendbyte(out, 'N');		/* new tuple follows */
-	pglogical_write_tuple(out, data, rel, newtuple, att_list);
+	pglogical_write_tuple(out, data, rel, newtuple, att_list, NULL);
 }
 
 /*
@@ -255,6 +414,7 @@ pglogical_write_update(StringInfo out, PGLogicalOutputData *data,
 						Bitmapset *att_list)
 {
 	uint8 flags = 0;
+	bool *unchanged = NULL;
 
 	pq_sendbyte(out, 'U');		/* action UPDATE */
 
@@ -277,11 +437,22 @@ pglogical_write_update(StringInfo out, PGLogicalOutputData *data,
 	if (oldtuple != NULL)
 	{
 		pq_sendbyte(out, 'K');	/* old key follows */
-		pglogical_write_tuple(out, data, rel, oldtuple, att_list);
+		pglogical_write_tuple(out, data, rel, oldtuple, att_list, NULL);
 	}
 
+	/*
+	 * When the old tuple is complete the apply side finds the row with it,
+	 * so the columns which didn't change can be left out of the new one.
+	 */
+	if (data->changed_columns_only && oldtuple != NULL &&
+		rel->rd_rel->relreplident == REPLICA_IDENTITY_FULL)
+		unchanged = unchanged_columns(rel, oldtuple, newtuple);
+
 	pq_sendbyte(out, 'N');		/* new tuple follows */
-	pglogical_write_tuple(out, data, rel, newtuple, att_list);
+	pglogical_write_tuple(out, data, rel, newtuple, att_list, unchanged);
+
+	if (unchanged != NULL)
+		pfree(unchanged);
 }
 
 /*
@@ -308,7 +479,129 @@ pglogical_write_delete(StringInfo out, PGLogicalOutputData *data,
 	 * See notes on update for details
 	 */
 	pq_sendbyte(out, 'K');	/* old key follows */
-	pglogical_write_tuple(out, data, rel, oldtuple, att_list);
+	pglogical_write_tuple(out, data, rel, oldtuple, att_list, NULL);
+}
+
+/*
+ * Write INSERT BATCH to the output stream.
+ *
+ * The rows are sent column by column so that the fixed length values of a
+ * column follow each other without per-value headers.
+ */
+void
+pglogical_write_insert_batch(StringInfo out, PGLogicalOutputData *data,
+							 PGLogicalInsertBatch *batch)
+{
+	uint8		flags = 0;
+	TupleDesc	desc = batch->desc;
+	int			i;
+	uint16		nliveatts = 0;
+
+	pq_sendbyte(out, 'M');		/* action INSERT BATCH */
+
+	/* send the flags field */
+	pq_sendbyte(out, flags);
+
+	/* use Oid as relation identifier */
+	pq_sendint(out, batch->relid, 4);
+	pq_sendint(out, batch->nrows, 4);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(desc,i);
+
+		if (att->attisdropped)
+			continue;
+		if (batch->att_list &&
+			!bms_is_member(att->attnum - FirstLowInvalidHeapAttributeNumber,
+						   batch->att_list))
+			continue;
+		nliveatts++;
+	}
+	pq_sendint(out, nliveatts, 2);
+
+	enlargeStringInfo(out, batch->size + nliveatts * (1 + 4 + 4));
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(desc,i);
+
+		/* skip dropped columns */
+		if (att->attisdropped)
+			continue;
+		if (batch->att_list &&
+			!bms_is_member(att->attnum - FirstLowInvalidHeapAttributeNumber,
+						   batch->att_list))
+			continue;
+
+		pglogical_write_batch_column(out, data, batch, i);
+	}
+}
+
+/*
+ * Write COMPRESSED message wrapping the given message to the output stream.
+ *
+ * Returns false without writing anything if the message doesn't compress
+ * well, it should be sent as it is then.
+ */
+bool
+pglogical_write_compressed(StringInfo out, PGLogicalOutputData *data,
+						   const char *msg, int len)
+{
+	uint8		flags = 0;
+	int			bound;
+	int			clen;
+	int			start = out->len;
+
+	if (data->compression == PGLOGICAL_COMPRESSION_NONE ||
+		len < COMPRESS_MIN_SIZE)
+		return false;
+
+	pq_sendbyte(out, 'Z');		/* action COMPRESSED */
+
+	/* send the flags field */
+	pq_sendbyte(out, flags);
+
+	pq_sendbyte(out, data->compression);
+	pq_sendint(out, len, 4);	/* uncompressed length */
+
+	bound = pglogical_compress_bound(data->compression, len);
+	enlargeStringInfo(out, bound);
+	clen = pglogical_compress(data->compression, msg, len,
+							  out->data + out->len, bound);
+	if (clen < 0)
+	{
+		/* Forget the header. */
+		out->len = start;
+		out->data[out->len] = '\0';
+		return false;
+	}
+
+	out->len += clen;
+	out->data[out->len] = '\0';
+
+	return true;
+}
+
+/*
+ * Write QUEUED MESSAGE to the output stream.
+ *
+ * The content is the logical decoding message written by queue_message(),
+ * it's passed through unchanged.
+ */
+void
+pglogical_write_queued_message(StringInfo out, PGLogicalOutputData *data,
+							   const char *message, Size sz)
+{
+	uint8		flags = 0;
+
+	pq_sendbyte(out, 'Q');		/* action QUEUED MESSAGE */
+
+	/* send the flags field */
+	pq_sendbyte(out, flags);
+
+	pq_sendint(out, sz, 4);
+	pq_sendbytes(out, message, sz);
 }
 
 /*
@@ -334,10 +627,13 @@ write_startup_message(StringInfo out, List *msg)
 
 /*
  * Write a tuple to the outputstream, in the most efficient format possible.
+ *
+ * Columns for which unchanged is set, if given, are sent as unchanged.
  */
 static void
 pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
-					  Relation rel, HeapTuple tuple, Bitmapset *att_list)
+					  Relation rel, HeapTuple tuple, Bitmapset *att_list,
+					  bool *unchanged)
 {
 	TupleDesc	desc;
 	Datum		values[MaxTupleAttributeNumber];
@@ -345,6 +641,13 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 	int			i;
 	uint16		nliveatts = 0;
 
+	if (data->compact_tuples)
+	{
+		pglogical_write_compact_tuple(out, data, rel, tuple, att_list,
+									  unchanged);
+		return;
+	}
+
 	desc = RelationGetDescr(rel);
 
 	pq_sendbyte(out, 'T');			/* sending TUPLE */
@@ -394,9 +697,11 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 			pq_sendbyte(out, 'n');	/* null column */
 			continue;
 		}
-		else if (att->attlen == -1 && VARATT_IS_EXTERNAL_ONDISK(values[i]))
+		else if ((att->attlen == -1 &&
+				  VARATT_IS_EXTERNAL_ONDISK(values[i])) ||
+				 (unchanged != NULL && unchanged[i]))
 		{
-			pq_sendbyte(out, 'u');	/* unchanged toast column */
+			pq_sendbyte(out, 'u');	/* unchanged column */
 			continue;
 		}
 
@@ -495,69 +800,445 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 }
 
 /*
- * Make the executive decision about which protocol to use.
+ * Write a tuple in the compact format used since protocol version 3.
+ *
+ * The representation of each column is known from the RELATION message, so
+ * only a null bitmap and a bitmap of unchanged toasted columns precede the
+ * values. Fixed length values in internal format are sent without a length,
+ * all other lengths and the attribute count are variable length integers.
  */
-static char
-decide_datum_transfer(Form_pg_attribute att, Form_pg_type typclass,
-					  bool allow_internal_basetypes,
-					  bool allow_binary_basetypes)
+static void
+pglogical_write_compact_tuple(StringInfo out, PGLogicalOutputData *data,
+							  Relation rel, HeapTuple tuple,
+							  Bitmapset *att_list, bool *unchanged)
 {
-	/*
-	 * Use the binary protocol, if allowed, for builtin & plain datatypes.
-	 */
-	if (allow_internal_basetypes &&
-		typclass->typtype == 'b' &&
-		att->atttypid < FirstNormalObjectId &&
-		typclass->typelem == InvalidOid)
+	TupleDesc	desc;
+	Datum		values[MaxTupleAttributeNumber];
+	bool		isnull[MaxTupleAttributeNumber];
+	int			i;
+	int			nliveatts = 0;
+	int			nbytes;
+	int			bitmap;
+	int			attno;
+
+	desc = RelationGetDescr(rel);
+
+	pq_sendbyte(out, 'V');			/* sending COMPACT TUPLE */
+
+	for (i = 0; i < desc->natts; i++)
 	{
-		return 'i';
+		Form_pg_attribute att = TupleDescAttr(desc,i);
+
+		if (att->attisdropped)
+			continue;
+		if (att_list &&
+			!bms_is_member(att->attnum - FirstLowInvalidHeapAttributeNumber,
+						   att_list))
+			continue;
+		nliveatts++;
 	}
+	pglogical_send_varint(out, nliveatts);
+
+	nbytes = (nliveatts + 7) / 8;
+
+	/* try to allocate enough memory from the get go */
+	enlargeStringInfo(out, tuple->t_len + 2 * nbytes + nliveatts * 5);
+
 	/*
-	 * Use send/recv, if allowed, if the type is plain or builtin.
-	 *
-	 * XXX: we can't use send/recv for array or composite types for now due to
-	 * the embedded oids.
+	 * Both bitmaps are filled in as the columns are written, by offset as
+	 * the buffer may move.
 	 */
-	else if (allow_binary_basetypes &&
-			 OidIsValid(typclass->typreceive) &&
-			 (att->atttypid < FirstNormalObjectId || typclass->typtype != 'c') &&
-			 (att->atttypid < FirstNormalObjectId || typclass->typelem == InvalidOid))
+	bitmap = out->len;
+	memset(out->data + bitmap, 0, 2 * nbytes);
+	out->len += 2 * nbytes;
+	out->data[out->len] = '\0';
+
+	heap_deform_tuple(tuple, desc, values, isnull);
+
+	attno = 0;
+	for (i = 0; i < desc->natts; i++)
 	{
-		return 'b';
-	}
+		HeapTuple	typtup;
+		Form_pg_type typclass;
+		Form_pg_attribute att = TupleDescAttr(desc,i);
+		char		kind;
+		int			pos;
 
-	return 't';
-}
+		/* skip dropped columns */
+		if (att->attisdropped)
+			continue;
+		if (att_list &&
+			!bms_is_member(att->attnum - FirstLowInvalidHeapAttributeNumber,
+						   att_list))
+			continue;
 
+		pos = attno++;
 
-/*
- * Read functions.
- */
+		if (isnull[i])
+		{
+			out->data[bitmap + pos / 8] |= 1 << (pos % 8);
+			continue;
+		}
+		else if ((att->attlen == -1 &&
+				  VARATT_IS_EXTERNAL_ONDISK(values[i])) ||
+				 (unchanged != NULL && unchanged[i]))
+		{
+			out->data[bitmap + nbytes + pos / 8] |= 1 << (pos % 8);
+			continue;
+		}
 
-/*
- * Read transaction BEGIN from the stream.
- */
-void
-pglogical_read_begin(StringInfo in, XLogRecPtr *remote_lsn,
-					  TimestampTz *committime, TransactionId *remote_xid)
-{
-	/* read flags */
-	uint8	flags = pq_getmsgbyte(in);
-	Assert(flags == 0);
-	(void) flags; /* unused */
+		typtup = SearchSysCache1(TYPEOID, ObjectIdGetDatum(att->atttypid));
+		if (!HeapTupleIsValid(typtup))
+			elog(ERROR, "cache lookup failed for type %u", att->atttypid);
+		typclass = (Form_pg_type) GETSTRUCT(typtup);
 
-	/* read fields */
-	*remote_lsn = pq_getmsgint64(in);
-	Assert(*remote_lsn != InvalidXLogRecPtr);
-	*committime = pq_getmsgint64(in);
-	*remote_xid = pq_getmsgint(in, 4);
-}
+		kind = decide_column_transfer(data, att, typclass);
 
-/*
- * Read transaction COMMIT from the stream.
- */
-void
-pglogical_read_commit(StringInfo in, XLogRecPtr *commit_lsn,
+		switch (kind)
+		{
+			case 'f':
+				enlargeStringInfo(out, att->attlen);
+				if (att->attbyval)
+					store_att_byval(out->data + out->len, values[i],
+									att->attlen);
+				else
+					memcpy(out->data + out->len, DatumGetPointer(values[i]),
+						   att->attlen);
+				out->len += att->attlen;
+				out->data[out->len] = '\0';
+				break;
+
+			case 'i':
+				{
+					char *val = DatumGetPointer(values[i]);
+
+					/* send indirect datums inline */
+					if (VARATT_IS_EXTERNAL_INDIRECT(values[i]))
+					{
+						struct varatt_indirect redirect;
+						VARATT_EXTERNAL_GET_POINTER(redirect, val);
+						val = (char *) redirect.pointer;
+					}
+
+					Assert(!VARATT_IS_EXTERNAL(val));
+
+					pglogical_send_varint(out, VARSIZE_ANY(val));
+					appendBinaryStringInfo(out, val, VARSIZE_ANY(val));
+				}
+				break;
+
+			case 'b':
+				{
+					bytea	   *outputbytes;
+					int			len;
+
+					outputbytes = OidSendFunctionCall(typclass->typsend,
+													  values[i]);
+
+					len = VARSIZE(outputbytes) - VARHDRSZ;
+					pglogical_send_varint(out, len);
+					pq_sendbytes(out, VARDATA(outputbytes), len);
+					pfree(outputbytes);
+				}
+				break;
+
+			default:
+				{
+					char   	   *outputstr;
+					int			len;
+
+					outputstr =	OidOutputFunctionCall(typclass->typoutput,
+													  values[i]);
+					len = strlen(outputstr) + 1;
+					pglogical_send_varint(out, len);
+					appendBinaryStringInfo(out, outputstr, len);
+					pfree(outputstr);
+				}
+		}
+
+		ReleaseSysCache(typtup);
+	}
+}
+
+/*
+ * Find the columns whose value is the same in the old and new tuple.
+ *
+ * Values are compared in their binary representation, so equal values
+ * stored differently are taken as changed, which is always safe.
+ */
+static bool *
+unchanged_columns(Relation rel, HeapTuple oldtuple, HeapTuple newtuple)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	Datum	   *oldvalues = palloc(desc->natts * sizeof(Datum));
+	bool	   *oldnulls = palloc(desc->natts * sizeof(bool));
+	Datum	   *newvalues = palloc(desc->natts * sizeof(Datum));
+	bool	   *newnulls = palloc(desc->natts * sizeof(bool));
+	bool	   *unchanged = palloc0(desc->natts * sizeof(bool));
+	int			i;
+
+	heap_deform_tuple(oldtuple, desc, oldvalues, oldnulls);
+	heap_deform_tuple(newtuple, desc, newvalues, newnulls);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(desc,i);
+
+		if (att->attisdropped)
+			continue;
+
+		if (oldnulls[i] || newnulls[i])
+			unchanged[i] = oldnulls[i] && newnulls[i];
+		else if (att->attlen == -1 &&
+				 (VARATT_IS_EXTERNAL(oldvalues[i]) ||
+				  VARATT_IS_EXTERNAL(newvalues[i])))
+			unchanged[i] = false;
+		else
+			unchanged[i] = datumIsEqual(oldvalues[i], newvalues[i],
+										att->attbyval, att->attlen);
+	}
+
+	pfree(oldvalues);
+	pfree(oldnulls);
+	pfree(newvalues);
+	pfree(newnulls);
+
+	return unchanged;
+}
+
+/*
+ * Write all values of one column of INSERT BATCH.
+ *
+ * The column is prefixed by its representation and the length of its data.
+ * Fixed length values in internal format ('f') are preceded by a null bitmap,
+ * everything else by the length of each value, -1 for NULL and -2 for an
+ * unchanged toasted value.
+ */
+static void
+pglogical_write_batch_column(StringInfo out, PGLogicalOutputData *data,
+							 PGLogicalInsertBatch *batch, int attno)
+{
+	TupleDesc	desc = batch->desc;
+	Form_pg_attribute att = TupleDescAttr(desc, attno);
+	HeapTuple	typtup;
+	Form_pg_type typclass;
+	char		kind;
+	StringInfoData buf;
+	int			row;
+
+	typtup = SearchSysCache1(TYPEOID, ObjectIdGetDatum(att->atttypid));
+	if (!HeapTupleIsValid(typtup))
+		elog(ERROR, "cache lookup failed for type %u", att->atttypid);
+	typclass = (Form_pg_type) GETSTRUCT(typtup);
+
+	kind = decide_column_transfer(data, att, typclass);
+
+	initStringInfo(&buf);
+
+	if (kind == 'f')
+	{
+		int			nbytes = (batch->nrows + 7) / 8;
+		char	   *nulls;
+
+		pq_sendint(&buf, att->attlen, 4); /* length of each value */
+
+		enlargeStringInfo(&buf, nbytes);
+		nulls = buf.data + buf.len;
+		memset(nulls, 0, nbytes);
+		buf.len += nbytes;
+
+		for (row = 0; row < batch->nrows; row++)
+		{
+			if (batch->isnull[row * desc->natts + attno])
+				buf.data[buf.len - nbytes + row / 8] |= 1 << (row % 8);
+		}
+
+		enlargeStringInfo(&buf, batch->nrows * att->attlen);
+		for (row = 0; row < batch->nrows; row++)
+		{
+			Datum		value = batch->values[row * desc->natts + attno];
+
+			if (batch->isnull[row * desc->natts + attno])
+				continue;
+
+			if (att->attbyval)
+				store_att_byval(buf.data + buf.len, value, att->attlen);
+			else
+				memcpy(buf.data + buf.len, DatumGetPointer(value),
+					   att->attlen);
+			buf.len += att->attlen;
+		}
+		buf.data[buf.len] = '\0';
+	}
+	else
+	{
+		for (row = 0; row < batch->nrows; row++)
+		{
+			Datum		value = batch->values[row * desc->natts + attno];
+
+			if (batch->isnull[row * desc->natts + attno])
+			{
+				pq_sendint(&buf, -1, 4);	/* null value */
+				continue;
+			}
+			else if (att->attlen == -1 && VARATT_IS_EXTERNAL_ONDISK(value))
+			{
+				pq_sendint(&buf, -2, 4);	/* unchanged toast value */
+				continue;
+			}
+
+			switch (kind)
+			{
+				case 'i':
+					{
+						/* indirect datums were flattened by the batch */
+						char	   *val = DatumGetPointer(value);
+
+						Assert(!VARATT_IS_EXTERNAL(val));
+
+						pq_sendint(&buf, VARSIZE_ANY(val), 4);
+						appendBinaryStringInfo(&buf, val, VARSIZE_ANY(val));
+					}
+					break;
+				case 'b':
+					{
+						bytea	   *outputbytes;
+						int			len;
+
+						outputbytes = OidSendFunctionCall(typclass->typsend,
+														  value);
+						len = VARSIZE(outputbytes) - VARHDRSZ;
+						pq_sendint(&buf, len, 4);
+						pq_sendbytes(&buf, VARDATA(outputbytes), len);
+						pfree(outputbytes);
+					}
+					break;
+				default:
+					{
+						char	   *outputstr;
+						int			len;
+
+						outputstr = OidOutputFunctionCall(typclass->typoutput,
+														  value);
+						len = strlen(outputstr) + 1;
+						pq_sendint(&buf, len, 4);
+						appendBinaryStringInfo(&buf, outputstr, len);
+						pfree(outputstr);
+					}
+			}
+		}
+	}
+
+	ReleaseSysCache(typtup);
+
+	pq_sendbyte(out, kind);
+	pq_sendint(out, buf.len, 4);
+	appendBinaryStringInfo(out, buf.data, buf.len);
+	pfree(buf.data);
+}
+
+/*
+ * Make the executive decision about which protocol to use.
+ */
+static char
+decide_datum_transfer(Form_pg_attribute att, Form_pg_type typclass,
+					  bool allow_internal_basetypes,
+					  bool allow_binary_basetypes)
+{
+	/*
+	 * Use the binary protocol, if allowed, for builtin & plain datatypes.
+	 */
+	if (allow_internal_basetypes &&
+		typclass->typtype == 'b' &&
+		att->atttypid < FirstNormalObjectId &&
+		typclass->typelem == InvalidOid)
+	{
+		return 'i';
+	}
+	/*
+	 * Use send/recv, if allowed, if the type is plain or builtin.
+	 *
+	 * XXX: we can't use send/recv for array or composite types for now due to
+	 * the embedded oids.
+	 */
+	else if (allow_binary_basetypes &&
+			 OidIsValid(typclass->typreceive) &&
+			 (att->atttypid < FirstNormalObjectId || typclass->typtype != 'c') &&
+			 (att->atttypid < FirstNormalObjectId || typclass->typelem == InvalidOid))
+	{
+		return 'b';
+	}
+
+	return 't';
+}
+
+/*
+ * Decide the representation of all values of a column.
+ *
+ * Like decide_datum_transfer(), except that fixed length values in internal
+ * format are told apart as 'f', they don't need a length on the wire.
+ */
+static char
+decide_column_transfer(PGLogicalOutputData *data, Form_pg_attribute att,
+					   Form_pg_type typclass)
+{
+	char		kind;
+
+	kind = decide_datum_transfer(att, typclass,
+								 data->allow_internal_basetypes,
+								 data->allow_binary_basetypes);
+	if (kind == 'i' && att->attlen > 0)
+		kind = 'f';
+	else if (kind == 'i' && att->attlen != -1)
+		elog(ERROR, "unsupported tuple type");
+
+	return kind;
+}
+
+/*
+ * Write a variable length integer, 7 bits per byte with the high bit set on
+ * all but the last byte.
+ */
+static void
+pglogical_send_varint(StringInfo out, uint32 value)
+{
+	while (value >= 0x80)
+	{
+		pq_sendbyte(out, (value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	pq_sendbyte(out, value);
+}
+
+
+/*
+ * Read functions.
+ */
+
+/*
+ * Read transaction BEGIN from the stream.
+ */
+void
+pglogical_read_begin(StringInfo in, XLogRecPtr *remote_lsn,
+					  TimestampTz *committime, TransactionId *remote_xid)
+{
+	/* read flags */
+	uint8	flags = pq_getmsgbyte(in);
+	Assert(flags == 0);
+	(void) flags; /* unused */
+
+	/* read fields */
+	*remote_lsn = pq_getmsgint64(in);
+	Assert(*remote_lsn != InvalidXLogRecPtr);
+	*committime = pq_getmsgint64(in);
+	*remote_xid = pq_getmsgint(in, 4);
+}
+
+/*
+ * Read transaction COMMIT from the stream.
+ */
+void
+pglogical_read_commit(StringInfo in, XLogRecPtr *commit_lsn,
 					   XLogRecPtr *end_lsn, TimestampTz *committime)
 {
 	/* read flags */
@@ -594,6 +1275,71 @@ pglogical_read_origin(StringInfo in, XLogRecPtr *origin_lsn)
 }
 
 
+/*
+ * Read STREAM START from the stream.
+ */
+TransactionId
+pglogical_read_stream_start(StringInfo in, bool *first)
+{
+	uint8	flags = pq_getmsgbyte(in);
+
+	*first = (flags & STREAM_FLAG_FIRST) != 0;
+
+	return pq_getmsgint(in, 4);
+}
+
+/*
+ * Read STREAM SUBTRANSACTION from the stream.
+ */
+TransactionId
+pglogical_read_stream_subxact(StringInfo in)
+{
+	uint8	flags = pq_getmsgbyte(in);
+	Assert(flags == 0);
+	(void) flags; /* unused */
+
+	return pq_getmsgint(in, 4);
+}
+
+/*
+ * Read STREAM ABORT from the stream.
+ */
+TransactionId
+pglogical_read_stream_abort(StringInfo in, TransactionId *subxid)
+{
+	uint8			flags = pq_getmsgbyte(in);
+	TransactionId	xid;
+
+	Assert(flags == 0);
+	(void) flags; /* unused */
+
+	xid = pq_getmsgint(in, 4);
+	*subxid = pq_getmsgint(in, 4);
+
+	return xid;
+}
+
+/*
+ * Read STREAM COMMIT from the stream.
+ */
+TransactionId
+pglogical_read_stream_commit(StringInfo in, XLogRecPtr *commit_lsn,
+							 XLogRecPtr *end_lsn, TimestampTz *committime)
+{
+	uint8			flags = pq_getmsgbyte(in);
+	TransactionId	xid;
+
+	Assert(flags == 0);
+	(void) flags; /* unused */
+
+	xid = pq_getmsgint(in, 4);
+	*commit_lsn = pq_getmsgint64(in);
+	*end_lsn = pq_getmsgint64(in);
+	*committime = pq_getmsgint64(in);
+
+	return xid;
+}
+
 /*
  * Read INSERT from stream.
  *
@@ -711,6 +1457,190 @@ pglogical_read_delete(StringInfo in, LOCKMODE lockmode,
 }
 
 
+/*
+ * Read INSERT BATCH from stream.
+ *
+ * Only the column headers are read here, the rows are then fetched one by
+ * one using pglogical_read_batch_tuple().
+ */
+PGLogicalRelation *
+pglogical_read_insert_batch(StringInfo in, LOCKMODE lockmode,
+							PGLogicalBatchReader *batch)
+{
+	Oid			relid;
+	uint8		flags;
+	int			natts;
+	int			i;
+	PGLogicalRelation *rel;
+
+	/* read the flags */
+	flags = pq_getmsgbyte(in);
+	Assert(flags == 0);
+	(void) flags; /* unused */
+
+	/* read the relation id */
+	relid = pq_getmsgint(in, 4);
+
+	batch->nrows = pq_getmsgint(in, 4);
+	batch->row = 0;
+	natts = pq_getmsgint(in, 2);
+
+	rel = pglogical_relation_open(relid, lockmode);
+
+	if (rel->natts != natts)
+		elog(ERROR, "tuple natts mismatch between remote relation metadata cache (natts=%u) and remote batch data (natts=%u)", rel->natts, natts);
+
+	batch->natts = natts;
+	batch->columns = palloc(natts * sizeof(PGLogicalBatchColumn));
+
+	for (i = 0; i < natts; i++)
+	{
+		PGLogicalBatchColumn *col = &batch->columns[i];
+		int			len;
+
+		col->kind = pq_getmsgbyte(in);
+		len = pq_getmsgint(in, 4);
+
+		/* StringInfo pointing into the bigger buffer */
+		col->data.data = (char *) pq_getmsgbytes(in, len);
+		col->data.len = len;
+		col->data.maxlen = len;
+		col->data.cursor = 0;
+
+		if (col->kind == 'f')
+		{
+			col->attlen = pq_getmsgint(&col->data, 4);
+			col->nulls = pq_getmsgbytes(&col->data, (batch->nrows + 7) / 8);
+		}
+		else if (col->kind != 'i' && col->kind != 'b' && col->kind != 't')
+			elog(ERROR, "unknown data representation type '%c'", col->kind);
+	}
+
+	return rel;
+}
+
+/*
+ * Read the next row of INSERT BATCH.
+ *
+ * The returned tuple is converted to the local relation tuple format.
+ */
+void
+pglogical_read_batch_tuple(PGLogicalBatchReader *batch,
+						   PGLogicalRelation *rel, PGLogicalTupleData *tuple)
+{
+	int			i;
+	int			row = batch->row++;
+	TupleDesc	desc = RelationGetDescr(rel->rel);
+
+	Assert(row < batch->nrows);
+
+	memset(tuple->nulls, 1, sizeof(tuple->nulls));
+	memset(tuple->changed, 0, sizeof(tuple->changed));
+
+	for (i = 0; i < batch->natts; i++)
+	{
+		PGLogicalBatchColumn *col = &batch->columns[i];
+		int			attid = rel->attmap[i];
+		Form_pg_attribute att = TupleDescAttr(desc,attid);
+		int			len;
+
+		if (col->kind == 'f')
+		{
+			tuple->changed[attid] = true;
+
+			if (col->nulls[row / 8] & (1 << (row % 8)))
+			{
+				tuple->values[attid] = 0xdeadbeef;
+				continue;
+			}
+
+			tuple->nulls[attid] = false;
+			tuple->values[attid] = pglogical_read_datum(&col->data, 'i',
+														col->attlen, att);
+			continue;
+		}
+
+		len = pq_getmsgint(&col->data, 4);
+		if (len == -1)
+		{
+			/* already marked as null */
+			tuple->values[attid] = 0xdeadbeef;
+			tuple->changed[attid] = true;
+		}
+		else if (len == -2)
+		{
+			/* unchanged column */
+			tuple->values[attid] = 0xfbadbeef;
+		}
+		else
+		{
+			tuple->nulls[attid] = false;
+			tuple->changed[attid] = true;
+			tuple->values[attid] = pglogical_read_datum(&col->data, col->kind,
+														len, att);
+		}
+	}
+}
+
+/*
+ * Read COMPRESSED from stream.
+ *
+ * The wrapped message is decompressed into out, palloc'd in the current
+ * memory context.
+ */
+void
+pglogical_read_compressed(StringInfo in, StringInfo out)
+{
+	uint8		flags;
+	char		method;
+	int			rawlen;
+	int			len;
+
+	/* read the flags */
+	flags = pq_getmsgbyte(in);
+	Assert(flags == 0);
+	(void) flags; /* unused */
+
+	method = pq_getmsgbyte(in);
+	rawlen = pq_getmsgint(in, 4);
+	len = in->len - in->cursor;
+
+	if (rawlen < 0 || rawlen > MaxAllocSize - 1)
+		elog(ERROR, "invalid uncompressed length %d", rawlen);
+
+	initStringInfo(out);
+	enlargeStringInfo(out, rawlen);
+
+	if (!pglogical_decompress(method, pq_getmsgbytes(in, len), len,
+							  out->data, rawlen))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("compressed %s data is corrupt",
+						pglogical_compression_name(method))));
+
+	out->len = rawlen;
+	out->data[out->len] = '\0';
+}
+
+/*
+ * Read QUEUED MESSAGE from stream.
+ *
+ * Returns pointer to the message content inside the input buffer.
+ */
+const char *
+pglogical_read_queued_message(StringInfo in, int *len)
+{
+	uint8		flags;
+
+	/* read the flags */
+	flags = pq_getmsgbyte(in);
+	Assert(flags == 0);
+	(void) flags; /* unused */
+
+	*len = pq_getmsgint(in, 4);
+	return pq_getmsgbytes(in, *len);
+}
+
 /*
  * Read tuple in remote format from stream.
  *
@@ -726,6 +1656,11 @@ pglogical_read_tuple(StringInfo in, PGLogicalRelation *rel,
 	TupleDesc	desc;
 
 	action = pq_getmsgbyte(in);
+	if (action == 'V')
+	{
+		pglogical_read_compact_tuple(in, rel, tuple);
+		return;
+	}
 	if (action != 'T')
 		elog(ERROR, "expected TUPLE, got %c", action);
 
@@ -744,7 +1679,6 @@ pglogical_read_tuple(StringInfo in, PGLogicalRelation *rel,
 		int			attid = rel->attmap[i];
 		Form_pg_attribute att = TupleDescAttr(desc,attid);
 		char		kind = pq_getmsgbyte(in);
-		const char *data;
 		int			len;
 
 		switch (kind)
@@ -758,69 +1692,167 @@ pglogical_read_tuple(StringInfo in, PGLogicalRelation *rel,
 				tuple->values[attid] = 0xfbadbeef; /* make bad usage more obvious */
 				break;
 			case 'i': /* internal binary format */
+			case 'b': /* binary send/recv format */
+			case 't': /* text format */
 				tuple->nulls[attid] = false;
 				tuple->changed[attid] = true;
 
 				len = pq_getmsgint(in, 4); /* read length */
-				data = pq_getmsgbytes(in, len);
-
-				/* and data */
-				if (att->attbyval)
-					tuple->values[attid] = fetch_att(data, true, len);
-				else
-					tuple->values[attid] = PointerGetDatum(data);
+				tuple->values[attid] = pglogical_read_datum(in, kind, len, att);
 				break;
-			case 'b': /* binary send/recv format */
-				{
-					Oid typreceive;
-					Oid typioparam;
-					StringInfoData buf;
-
-					tuple->nulls[attid] = false;
-					tuple->changed[attid] = true;
-
-					len = pq_getmsgint(in, 4); /* read length */
-
-					getTypeBinaryInputInfo(att->atttypid,
-										   &typreceive, &typioparam);
-
-					/* create StringInfo pointing into the bigger buffer */
-					initStringInfo(&buf);
-					/* and data */
-					buf.data = (char *) pq_getmsgbytes(in, len);
-					buf.len = len;
-					tuple->values[attid] = OidReceiveFunctionCall(
-						typreceive, &buf, typioparam, att->atttypmod);
-
-					if (buf.len != buf.cursor)
-						ereport(ERROR,
-								(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
-								 errmsg("incorrect binary data format")));
-					break;
-				}
-			case 't': /* text format */
-				{
-					Oid typinput;
-					Oid typioparam;
+			default:
+				elog(ERROR, "unknown data representation type '%c'", kind);
+		}
+	}
+}
 
-					tuple->nulls[attid] = false;
-					tuple->changed[attid] = true;
+/*
+ * Read tuple in the compact format, see pglogical_write_compact_tuple().
+ */
+static void
+pglogical_read_compact_tuple(StringInfo in, PGLogicalRelation *rel,
+							 PGLogicalTupleData *tuple)
+{
+	int			i;
+	int			natts;
+	const char *nulls;
+	const char *unchanged;
+	TupleDesc	desc;
 
-					len = pq_getmsgint(in, 4); /* read length */
+	if (rel->attkind == NULL)
+		elog(ERROR, "got compact tuple for remote relation %u without column representations",
+			 rel->remoteid);
 
-					getTypeInputInfo(att->atttypid, &typinput, &typioparam);
-					/* and data */
-					data = (char *) pq_getmsgbytes(in, len);
-					tuple->values[attid] = OidInputFunctionCall(
-						typinput, (char *) data, typioparam, att->atttypmod);
-				}
-				break;
-			default:
-				elog(ERROR, "unknown data representation type '%c'", kind);
+	memset(tuple->nulls, 1, sizeof(tuple->nulls));
+	memset(tuple->changed, 0, sizeof(tuple->changed));
+
+	natts = pglogical_get_varint(in);
+	if (rel->natts != natts)
+		elog(ERROR, "tuple natts mismatch between remote relation metadata cache (natts=%u) and remote tuple data (natts=%u)", rel->natts, natts);
+
+	nulls = pq_getmsgbytes(in, (natts + 7) / 8);
+	unchanged = pq_getmsgbytes(in, (natts + 7) / 8);
+
+	desc = RelationGetDescr(rel->rel);
+
+	/* Read the data */
+	for (i = 0; i < natts; i++)
+	{
+		int			attid = rel->attmap[i];
+		Form_pg_attribute att = TupleDescAttr(desc,attid);
+		char		kind = rel->attkind[i];
+		int			len;
+
+		if (nulls[i / 8] & (1 << (i % 8)))
+		{
+			/* already marked as null */
+			tuple->values[attid] = 0xdeadbeef;
+			tuple->changed[attid] = true;
+			continue;
 		}
+		else if (unchanged[i / 8] & (1 << (i % 8)))
+		{
+			tuple->values[attid] = 0xfbadbeef; /* make bad usage more obvious */
+			continue;
+		}
+
+		tuple->nulls[attid] = false;
+		tuple->changed[attid] = true;
+
+		if (kind == 'f')
+		{
+			kind = 'i';
+			len = rel->attlen[i];
+		}
+		else
+			len = pglogical_get_varint(in);
+
+		tuple->values[attid] = pglogical_read_datum(in, kind, len, att);
 	}
 }
 
+/*
+ * Read a variable length integer written by pglogical_send_varint().
+ */
+static uint32
+pglogical_get_varint(StringInfo in)
+{
+	uint32		value = 0;
+	int			shift;
+
+	for (shift = 0; shift < 32; shift += 7)
+	{
+		uint8		b = pq_getmsgbyte(in);
+
+		value |= (uint32) (b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			return value;
+	}
+
+	elog(ERROR, "invalid variable length integer in tuple data");
+	return 0;					/* keep compiler quiet */
+}
+
+/*
+ * Read a non-null column value of len bytes in the given representation.
+ *
+ * Values in internal format point into the input buffer.
+ */
+static Datum
+pglogical_read_datum(StringInfo in, char kind, int len, Form_pg_attribute att)
+{
+	const char *data;
+
+	switch (kind)
+	{
+		case 'i': /* internal binary format */
+			data = pq_getmsgbytes(in, len);
+
+			if (att->attbyval)
+				return fetch_att(data, true, len);
+			return PointerGetDatum(data);
+		case 'b': /* binary send/recv format */
+			{
+				Oid typreceive;
+				Oid typioparam;
+				Datum value;
+				StringInfoData buf;
+
+				getTypeBinaryInputInfo(att->atttypid,
+									   &typreceive, &typioparam);
+
+				/* create StringInfo pointing into the bigger buffer */
+				initStringInfo(&buf);
+				/* and data */
+				buf.data = (char *) pq_getmsgbytes(in, len);
+				buf.len = len;
+				value = OidReceiveFunctionCall(typreceive, &buf, typioparam,
+											   att->atttypmod);
+
+				if (buf.len != buf.cursor)
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+							 errmsg("incorrect binary data format")));
+				return value;
+			}
+		case 't': /* text format */
+			{
+				Oid typinput;
+				Oid typioparam;
+
+				getTypeInputInfo(att->atttypid, &typinput, &typioparam);
+				/* and data */
+				data = pq_getmsgbytes(in, len);
+				return OidInputFunctionCall(typinput, (char *) data,
+											typioparam, att->atttypmod);
+			}
+		default:
+			elog(ERROR, "unknown data representation type '%c'", kind);
+	}
+
+	return (Datum) 0;			/* keep compiler quiet */
+}
+
 /*
  * Read schema.relation from stream and return as PGLogicalRelation opened in
  * lockmode.
@@ -835,6 +1867,9 @@ pglogical_read_rel(StringInfo in)
 	char	   *relname;
 	int			natts;
 	char	  **attrnames;
+	bool	   *attidentity;
+	char	   *attkind;
+	int16	   *attlen;
 
 	/* read the flags */
 	flags = pq_getmsgbyte(in);
@@ -851,9 +1886,11 @@ pglogical_read_rel(StringInfo in)
 	relname = (char *) pq_getmsgbytes(in, len);
 
 	/* Get attribute description */
-	pglogical_read_attrs(in, &attrnames, &natts);
+	pglogical_read_attrs(in, &attrnames, &attidentity, &attkind, &attlen,
+						 &natts);
 
-	pglogical_relation_cache_update(relid, schemaname, relname, natts, attrnames);
+	pglogical_relation_cache_update(relid, schemaname, relname, natts,
+									attrnames, attidentity, attkind, attlen);
 
 	return relid;
 }
@@ -861,14 +1898,19 @@ pglogical_read_rel(StringInfo in)
 /*
  * Read relation attributes from the outputstream.
  *
- * TODO handle flags.
+ * The column representations are only sent along with compact tuples,
+ * attkind and attlen are set to NULL otherwise.
  */
 static void
-pglogical_read_attrs(StringInfo in, char ***attrnames, int *nattrnames)
+pglogical_read_attrs(StringInfo in, char ***attrnames, bool **attidentity,
+					 char **attkind, int16 **attlen, int *nattrnames)
 {
 	int			i;
 	uint16		nattrs;
 	char	  **attrs;
+	bool	   *identity;
+	char	   *kinds = NULL;
+	int16	   *lens = NULL;
 	char		blocktype;
 
 	blocktype = pq_getmsgbyte(in);
@@ -877,17 +1919,36 @@ pglogical_read_attrs(StringInfo in, char ***attrnames, int *nattrnames)
 
 	nattrs = pq_getmsgint(in, 2);
 	attrs = palloc(nattrs * sizeof(char *));
+	identity = palloc(nattrs * sizeof(bool));
 
 	/* read the attributes */
 	for (i = 0; i < nattrs; i++)
 	{
 		uint16			len;
+		uint8			flags;
 
 		blocktype = pq_getmsgbyte(in);		/* column definition follows */
 		if (blocktype != 'C')
 			elog(ERROR, "expected COLUMN, got %c", blocktype);
-		/* read flags (we ignore them so far) */
-		(void) pq_getmsgbyte(in);
+		/* read flags */
+		flags = pq_getmsgbyte(in);
+		identity[i] = (flags & IS_REPLICA_IDENTITY) != 0;
+
+		if (flags & HAS_TRANSFER_KIND)
+		{
+			if (kinds == NULL)
+			{
+				kinds = palloc0(nattrs * sizeof(char));
+				lens = palloc0(nattrs * sizeof(int16));
+			}
+
+			kinds[i] = pq_getmsgbyte(in);
+			if (kinds[i] == 'f')
+				lens[i] = pq_getmsgint(in, 2);
+			else if (kinds[i] != 'i' && kinds[i] != 'b' && kinds[i] != 't')
+				elog(ERROR, "unknown data representation type '%c'",
+					 kinds[i]);
+		}
 
 		blocktype = pq_getmsgbyte(in);		/* column name block follows */
 		if (blocktype != 'N')
@@ -900,5 +1961,8 @@ pglogical_read_attrs(StringInfo in, char ***attrnames, int *nattrnames)
 	}
 
 	*attrnames = attrs;
+	*attidentity = identity;
+	*attkind = kinds;
+	*attlen = lens;
 	*nattrnames = nattrs;
 }
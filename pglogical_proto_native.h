@@ -28,6 +28,27 @@ typedef struct PGLogicalTupleData
 	bool	changed[MaxTupleAttributeNumber];
 } PGLogicalTupleData;
 
+/*
+ * Column of INSERT BATCH being read row by row. Fixed length values in
+ * internal format ('f') come with a null bitmap and follow each other,
+ * others have a length before each value.
+ */
+typedef struct PGLogicalBatchColumn
+{
+	char		kind;
+	int			attlen;			/* 'f' only */
+	const char *nulls;			/* 'f' only */
+	StringInfoData data;
+} PGLogicalBatchColumn;
+
+typedef struct PGLogicalBatchReader
+{
+	int			nrows;
+	int			row;			/* Next row to read. */
+	int			natts;
+	PGLogicalBatchColumn *columns;
+} PGLogicalBatchReader;
+
 extern void pglogical_write_rel(StringInfo out, PGLogicalOutputData *data,
 		Relation rel, Bitmapset *att_list);
 extern void pglogical_write_begin(StringInfo out, PGLogicalOutputData *data,
@@ -43,13 +64,37 @@ extern void pglogical_write_update(StringInfo out, PGLogicalOutputData *data,
 		Bitmapset *att_list);
 extern void pglogical_write_delete(StringInfo out, PGLogicalOutputData *data,
 		Relation rel, HeapTuple oldtuple, Bitmapset *att_list);
+extern void pglogical_write_insert_batch(StringInfo out,
+		PGLogicalOutputData *data, PGLogicalInsertBatch *batch);
+extern bool pglogical_write_compressed(StringInfo out,
+		PGLogicalOutputData *data, const char *msg, int len);
+extern void pglogical_write_queued_message(StringInfo out,
+		PGLogicalOutputData *data, const char *message, Size sz);
 extern void write_startup_message(StringInfo out, List *msg);
+extern void pglogical_write_stream_start(StringInfo out,
+		PGLogicalOutputData *data, TransactionId xid, bool first);
+extern void pglogical_write_stream_stop(StringInfo out,
+		PGLogicalOutputData *data);
+extern void pglogical_write_stream_subxact(StringInfo out,
+		PGLogicalOutputData *data, TransactionId subxid);
+extern void pglogical_write_stream_abort(StringInfo out,
+		PGLogicalOutputData *data, TransactionId xid, TransactionId subxid);
+extern void pglogical_write_stream_commit(StringInfo out,
+		PGLogicalOutputData *data, ReorderBufferTXN *txn,
+		XLogRecPtr commit_lsn);
 
 extern void pglogical_read_begin(StringInfo in, XLogRecPtr *remote_lsn,
 					  TimestampTz *committime, TransactionId *remote_xid);
 extern void pglogical_read_commit(StringInfo in, XLogRecPtr *commit_lsn,
 					   XLogRecPtr *end_lsn, TimestampTz *committime);
 extern char *pglogical_read_origin(StringInfo in, XLogRecPtr *origin_lsn);
+extern TransactionId pglogical_read_stream_start(StringInfo in, bool *first);
+extern TransactionId pglogical_read_stream_subxact(StringInfo in);
+extern TransactionId pglogical_read_stream_abort(StringInfo in,
+					   TransactionId *subxid);
+extern TransactionId pglogical_read_stream_commit(StringInfo in,
+					   XLogRecPtr *commit_lsn, XLogRecPtr *end_lsn,
+					   TimestampTz *committime);
 extern uint32 pglogical_read_rel(StringInfo in);
 extern PGLogicalRelation *pglogical_read_insert(StringInfo in, LOCKMODE lockmode,
 					   PGLogicalTupleData *newtup);
@@ -57,4 +102,10 @@ extern PGLogicalRelation *pglogical_read_update(StringInfo in, LOCKMODE lockmode
 					   PGLogicalTupleData *oldtup, PGLogicalTupleData *newtup);
 extern PGLogicalRelation *pglogical_read_delete(StringInfo in, LOCKMODE lockmode,
 												 PGLogicalTupleData *oldtup);
+extern PGLogicalRelation *pglogical_read_insert_batch(StringInfo in,
+					   LOCKMODE lockmode, PGLogicalBatchReader *batch);
+extern void pglogical_read_batch_tuple(PGLogicalBatchReader *batch,
+					   PGLogicalRelation *rel, PGLogicalTupleData *tuple);
+extern void pglogical_read_compressed(StringInfo in, StringInfo out);
+extern const char *pglogical_read_queued_message(StringInfo in, int *len);
 #endif /* PG_LOGICAL_PROTO_NATIVE_H */
@@ -32,10 +32,16 @@
 
 #include "miscadmin.h"
 
+#include "libpq/pqformat.h"
+
 #include "nodes/makefuncs.h"
 
 #include "parser/parse_func.h"
 
+#if PG_VERSION_NUM >= 90600
+#include "replication/message.h"
+#endif
+
 #include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
@@ -66,19 +72,28 @@ typedef struct QueueTuple
 /*	json		message;*/
 } QueueTuple;
 
+bool		pglogical_queue_messages = false;
+
+static void queue_insert(List *replication_sets, const char *role,
+						 char message_type, const char *message,
+						 TimestampTz ts);
+static void queue_log_message(List *replication_sets, const char *role,
+							  char message_type, const char *message,
+							  TimestampTz ts);
+static char *parse_logical_message(const char *data, Size len,
+								   QueuedMessage *res);
+
 /*
- * Add tuple to the queue table.
+ * Queue message for the subscribers.
+ *
+ * The message is either added to the queue table or, when
+ * pglogical.queue_messages is enabled, written to WAL as transactional
+ * logical decoding message.
  */
 void
 queue_message(List *replication_sets, Oid roleoid, char message_type,
 			  char *message)
 {
-	RangeVar   *rv;
-	Relation	rel;
-	TupleDesc	tupDesc;
-	HeapTuple	tup;
-	Datum		values[Natts_queue];
-	bool		nulls[Natts_queue];
 	const char *role;
 	TimestampTz ts = GetCurrentTimestamp();
 
@@ -88,6 +103,47 @@ queue_message(List *replication_sets, Oid roleoid, char message_type,
 #endif
 							 );
 
+	if (pglogical_queue_messages)
+		queue_log_message(replication_sets, role, message_type, message, ts);
+	else
+		queue_insert(replication_sets, role, message_type, message, ts);
+}
+
+/*
+ * Queue again the message received from the provider as logical decoding
+ * message, so that it reaches our own subscribers too, same as the rows
+ * inserted into the queue table do.
+ */
+void
+queue_forward_logical_message(const char *data, Size len)
+{
+	QueuedMessage	q;
+	char		   *message;
+
+	message = parse_logical_message(data, len, &q);
+
+	if (pglogical_queue_messages)
+		queue_log_message(q.replication_sets, q.role, q.message_type,
+						  message, q.queued_at);
+	else
+		queue_insert(q.replication_sets, q.role, q.message_type, message,
+					 q.queued_at);
+}
+
+/*
+ * Add tuple to the queue table.
+ */
+static void
+queue_insert(List *replication_sets, const char *role, char message_type,
+			 const char *message, TimestampTz ts)
+{
+	RangeVar   *rv;
+	Relation	rel;
+	TupleDesc	tupDesc;
+	HeapTuple	tup;
+	Datum		values[Natts_queue];
+	bool		nulls[Natts_queue];
+
 	rv = makeRangeVar(EXTENSION_NAME, CATALOG_QUEUE, -1);
 	rel = table_openrv(rv, RowExclusiveLock);
 	tupDesc = RelationGetDescr(rel);
@@ -117,27 +173,109 @@ queue_message(List *replication_sets, Oid roleoid, char message_type,
 	table_close(rel, NoLock);
 }
 
+/*
+ * Write the message to WAL as logical decoding message.
+ *
+ * The content has the same fields as the queue table, the replication set
+ * count is -1 when there are no replication sets.
+ */
+static void
+queue_log_message(List *replication_sets, const char *role,
+				  char message_type, const char *message, TimestampTz ts)
+{
+#if PG_VERSION_NUM >= 90600
+	StringInfoData	buf;
+	ListCell	   *lc;
+
+	initStringInfo(&buf);
+	pq_sendbyte(&buf, message_type);
+	pq_sendint64(&buf, ts);
+	pq_sendstring(&buf, role);
+	if (replication_sets)
+	{
+		pq_sendint(&buf, list_length(replication_sets), 4);
+		foreach (lc, replication_sets)
+			pq_sendstring(&buf, (char *) lfirst(lc));
+	}
+	else
+		pq_sendint(&buf, -1, 4);
+	pq_sendstring(&buf, message);
+
+	LogLogicalMessage(PGLOGICAL_QUEUE_MESSAGE_PREFIX, buf.data, buf.len, true);
+
+	pfree(buf.data);
+#else
+	elog(ERROR, "pglogical.queue_messages requires PostgreSQL 9.6 or newer");
+#endif
+}
+
+/*
+ * Parse the content of logical decoding message written by
+ * queue_log_message(), returns the json text of the message.
+ */
+static char *
+parse_logical_message(const char *data, Size len, QueuedMessage *res)
+{
+	StringInfoData	buf;
+	int				nsets;
+
+	/* The message is only read, the cast is safe. */
+	buf.data = (char *) data;
+	buf.len = len;
+	buf.maxlen = len;
+	buf.cursor = 0;
+
+	res->message_type = pq_getmsgbyte(&buf);
+	res->queued_at = pq_getmsgint64(&buf);
+	res->role = pstrdup(pq_getmsgstring(&buf));
+	res->replication_sets = NIL;
+	nsets = pq_getmsgint(&buf, 4);
+	while (nsets-- > 0)
+		res->replication_sets = lappend(res->replication_sets,
+										pstrdup(pq_getmsgstring(&buf)));
+	res->message = NULL;
+
+	return pstrdup(pq_getmsgstring(&buf));
+}
+
+/*
+ * Parse logical decoding message written by queue_message() into palloc'd
+ * QueuedMessage struct, same as queued_message_from_tuple() does for the
+ * queue table.
+ */
+QueuedMessage *
+queued_message_from_logical_message(const char *data, Size len,
+									bool parse_message)
+{
+	QueuedMessage  *res;
+	char		   *message;
+
+	res = (QueuedMessage *) palloc(sizeof(QueuedMessage));
+	message = parse_logical_message(data, len, res);
+
+	if (parse_message)
+		res->message = DatumGetJsonb(
+			DirectFunctionCall1(jsonb_in, CStringGetDatum(message)));
+
+	return res;
+}
+
 
 /*
  * Parse the tuple from the queue table into palloc'd QueuedMessage struct.
  *
- * The caller must have the queue table locked in at least AccessShare mode.
+ * The tuple descriptor is the one of the queue table, which the caller
+ * already has open. Parsing the json message is only worth it when the
+ * message is going to be executed, otherwise the message is left NULL.
  */
 QueuedMessage *
-queued_message_from_tuple(HeapTuple queue_tup)
+queued_message_from_tuple(HeapTuple queue_tup, TupleDesc tupDesc,
+						  bool parse_message)
 {
-	RangeVar   *rv;
-	Relation	rel;
-	TupleDesc	tupDesc;
 	bool		isnull;
 	Datum		d;
 	QueuedMessage *res;
 
-	/* Open relation to get the tuple descriptor. */
-	rv = makeRangeVar(EXTENSION_NAME, CATALOG_QUEUE, -1);
-	rel = table_openrv(rv, NoLock);
-	tupDesc = RelationGetDescr(rel);
-
 	res = (QueuedMessage *) palloc(sizeof(QueuedMessage));
 
 	d = fastgetattr(queue_tup, Anum_queue_queued_at, tupDesc, &isnull);
@@ -158,14 +296,16 @@ queued_message_from_tuple(HeapTuple queue_tup)
 	Assert(!isnull);
 	res->message_type = DatumGetChar(d);
 
-	d = fastgetattr(queue_tup, Anum_queue_message, tupDesc, &isnull);
-	Assert(!isnull);
-	/* Parse the json inside the message into Jsonb object. */
-	res->message = DatumGetJsonb(
-		DirectFunctionCall1(jsonb_in, DirectFunctionCall1(json_out, d)));
-
-	/* Close the relation. */
-	table_close(rel, NoLock);
+	res->message = NULL;
+	if (parse_message)
+	{
+		d = fastgetattr(queue_tup, Anum_queue_message, tupDesc, &isnull);
+		Assert(!isnull);
+		/* Parse the json text inside the message into Jsonb object. */
+		res->message = DatumGetJsonb(
+			DirectFunctionCall1(jsonb_in,
+								CStringGetDatum(TextDatumGetCString(d))));
+	}
 
 	return res;
 }
@@ -20,6 +20,9 @@
 #define QUEUE_COMMAND_TYPE_TABLESYNC	'A'
 #define QUEUE_COMMAND_TYPE_SEQUENCE		'S'
 
+/* Prefix of the logical decoding messages used instead of the queue table. */
+#define PGLOGICAL_QUEUE_MESSAGE_PREFIX	"pglogical"
+
 typedef struct QueuedMessage
 {
 	TimestampTz	queued_at;
@@ -29,10 +32,18 @@ typedef struct QueuedMessage
 	Jsonb	   *message;
 } QueuedMessage;
 
+extern bool pglogical_queue_messages;
+
 extern void queue_message(List *replication_sets, Oid roleoid,
 						  char message_type, char *message);
-
-extern QueuedMessage *queued_message_from_tuple(HeapTuple queue_tup);
+extern void queue_forward_logical_message(const char *data, Size len);
+
+extern QueuedMessage *queued_message_from_tuple(HeapTuple queue_tup,
+												TupleDesc tupDesc,
+												bool parse_message);
+extern QueuedMessage *queued_message_from_logical_message(const char *data,
+														  Size len,
+														  bool parse_message);
 
 extern Oid get_queue_table_oid(void);
 
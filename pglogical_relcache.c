@@ -31,6 +31,8 @@
 #define PGLOGICALRELATIONHASH_INITIAL_SIZE 128
 static HTAB *PGLogicalRelationHash = NULL;
 
+uint32 pglogical_relcache_generation = 0;
+
 
 static void pglogical_relcache_init(void);
 static int tupdesc_get_att_by_name(TupleDesc desc, const char *attname);
@@ -54,6 +56,15 @@ relcache_free_entry(PGLogicalRelation *entry)
 	if (entry->attmap)
 		pfree(entry->attmap);
 
+	if (entry->attidentity)
+		pfree(entry->attidentity);
+
+	if (entry->attkind)
+	{
+		pfree(entry->attkind);
+		pfree(entry->attlen);
+	}
+
 	entry->natts = 0;
 	entry->reloid = InvalidOid;
 	entry->rel = NULL;
@@ -124,7 +135,9 @@ pglogical_relation_open(uint32 remoteid, LOCKMODE lockmode)
 
 void
 pglogical_relation_cache_update(uint32 remoteid, char *schemaname,
-								 char *relname, int natts, char **attnames)
+								 char *relname, int natts, char **attnames,
+								 bool *attidentity, char *attkind,
+								 int16 *attlen)
 {
 	MemoryContext		oldcontext;
 	PGLogicalRelation  *entry;
@@ -142,6 +155,12 @@ pglogical_relation_cache_update(uint32 remoteid, char *schemaname,
 
 	if (found)
 		relcache_free_entry(entry);
+	else
+	{
+		entry->mi_threshold = 0;
+		entry->mi_runs = 0;
+		entry->mi_hits = 0;
+	}
 
 	/* Make cached copy of the data */
 	oldcontext = MemoryContextSwitchTo(CacheMemoryContext);
@@ -152,11 +171,28 @@ pglogical_relation_cache_update(uint32 remoteid, char *schemaname,
 	for (i = 0; i < natts; i++)
 		entry->attnames[i] = pstrdup(attnames[i]);
 	entry->attmap = palloc(natts * sizeof(int));
+	entry->attidentity = palloc(natts * sizeof(bool));
+	entry->hasidentity = false;
+	for (i = 0; i < natts; i++)
+	{
+		entry->attidentity[i] = attidentity[i];
+		entry->hasidentity |= attidentity[i];
+	}
+	entry->attkind = NULL;
+	entry->attlen = NULL;
+	if (attkind != NULL)
+	{
+		entry->attkind = palloc(natts * sizeof(char));
+		memcpy(entry->attkind, attkind, natts * sizeof(char));
+		entry->attlen = palloc(natts * sizeof(int16));
+		memcpy(entry->attlen, attlen, natts * sizeof(int16));
+	}
 	MemoryContextSwitchTo(oldcontext);
 
 	/* XXX Should we validate the relation against local schema here? */
 
 	entry->reloid = InvalidOid;
+	pglogical_relcache_generation++;
 }
 
 void
@@ -178,6 +214,12 @@ pglogical_relation_cache_updater(PGLogicalRemoteRel *remoterel)
 
 	if (found)
 		relcache_free_entry(entry);
+	else
+	{
+		entry->mi_threshold = 0;
+		entry->mi_runs = 0;
+		entry->mi_hits = 0;
+	}
 
 	/* Make cached copy of the data */
 	oldcontext = MemoryContextSwitchTo(CacheMemoryContext);
@@ -188,11 +230,16 @@ pglogical_relation_cache_updater(PGLogicalRemoteRel *remoterel)
 	for (i = 0; i < remoterel->natts; i++)
 		entry->attnames[i] = pstrdup(remoterel->attnames[i]);
 	entry->attmap = palloc(remoterel->natts * sizeof(int));
+	entry->attidentity = NULL;
+	entry->hasidentity = false;
+	entry->attkind = NULL;
+	entry->attlen = NULL;
 	MemoryContextSwitchTo(oldcontext);
 
 	/* XXX Should we validate the relation against local schema here? */
 
 	entry->reloid = InvalidOid;
+	pglogical_relcache_generation++;
 }
 
 void
@@ -211,6 +258,8 @@ pglogical_relcache_invalidate_callback(Datum arg, Oid reloid)
 	if (PGLogicalRelationHash == NULL)
 		return;
 
+	pglogical_relcache_generation++;
+
 	if (reloid != InvalidOid)
 	{
 		HASH_SEQ_STATUS status;
@@ -35,6 +35,12 @@ typedef struct PGLogicalRelation
 	char	   *relname;
 	int			natts;
 	char	  **attnames;
+	bool	   *attidentity;	/* Is the attribute part of the remote
+								 * replica identity? NULL if unknown. */
+	bool		hasidentity;	/* Any of the above set? */
+	char	   *attkind;		/* Representation of the values in compact
+								 * tuples, NULL if not sent. */
+	int16	   *attlen;			/* Length of the 'f' kind values. */
 
 	/* Mapping to local relation, filled as needed. */
 	Oid			reloid;
@@ -43,11 +49,21 @@ typedef struct PGLogicalRelation
 
 	/* Additional cache, only valid as long as relation mapping is. */
 	bool		hasTriggers;
+
+	/*
+	 * Number of inserts after which apply switches to multi-insert, and the
+	 * runs of inserts it's based on. Kept across RELATION messages.
+	 */
+	int			mi_threshold;
+	int			mi_runs;
+	int			mi_hits;
 } PGLogicalRelation;
 
 extern void pglogical_relation_cache_update(uint32 remoteid,
 											 char *schemaname, char *relname,
-											 int natts, char **attnames);
+											 int natts, char **attnames,
+											 bool *attidentity, char *attkind,
+											 int16 *attlen);
 extern void pglogical_relation_cache_updater(PGLogicalRemoteRel *remoterel);
 
 extern PGLogicalRelation *pglogical_relation_open(uint32 remoteid,
@@ -58,4 +74,7 @@ extern void pglogical_relation_invalidate_cb(Datum arg, Oid reloid);
 
 struct PGLogicalTupleData;
 
+/* Changes whenever the mapping of a relation to the local one may change. */
+extern uint32 pglogical_relcache_generation;
+
 #endif /* PGLOGICAL_RELCACHE_H */
@@ -0,0 +1,794 @@
+/*-------------------------------------------------------------------------
+ *
+ * pglogical_spool.c
+ *		pglogical local spool of the replication stream
+ *
+ * When enabled, the apply worker writes the messages it receives from the
+ * provider into a local spool first and confirms them to the provider as
+ * flushed once they are safely on disk, so that the provider can release its
+ * WAL without waiting for the apply to catch up. The apply then reads the
+ * messages back from the spool at its own pace.
+ *
+ * The spool is a directory of segment files, each holding a sequence of
+ * checksummed records. Every record carries one protocol message together
+ * with the commit LSN of the transaction it belongs to. The apply progress
+ * within the spool is not tracked separately, it's derived from the
+ * replication origin of the subscription: after restart, transactions which
+ * committed before the origin position are skipped. A segment can be removed
+ * once everything in it was applied and the apply was flushed locally.
+ *
+ * Relation metadata messages are sent by the provider only once per
+ * connection, so those seen so far are repeated at the beginning of each new
+ * segment, and are never skipped on replay.
+ *
+ * Copyright (c) 2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pglogical_spool.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "miscadmin.h"
+
+#if PG_VERSION_NUM >= 90500
+#include "port/pg_crc32c.h"
+#endif
+
+#include "replication/origin.h"
+
+#include "storage/fd.h"
+
+#include "utils/memutils.h"
+
+#include "pglogical_spool.h"
+#include "pglogical.h"
+
+#define SPOOL_DIR				"pg_logical/pglogical_spool"
+#define SPOOL_SEGMENT_SIZE		(16 * 1024 * 1024)
+
+/* Record is relation metadata which has to be replayed always. */
+#define SPOOL_RECORD_METADATA	0x01
+
+typedef struct SpoolRecordHeader
+{
+	uint32		len;		/* Length of the message. */
+	uint32		flags;
+	XLogRecPtr	xact_lsn;	/* Commit LSN of the transaction the message
+							 * belongs to, invalid outside transaction. */
+	XLogRecPtr	end_lsn;	/* End LSN of the transaction, for COMMIT. */
+	pg_crc32c	crc;		/* CRC of the above and the message. */
+} SpoolRecordHeader;
+
+typedef struct SpoolSegment
+{
+	uint64		segno;
+	XLogRecPtr	end_lsn;	/* End of the last transaction in segment. */
+} SpoolSegment;
+
+typedef struct SpoolMetadata
+{
+	uint32		key;
+	int			len;
+	char	   *data;
+} SpoolMetadata;
+
+bool	pglogical_spool_stream = false;
+
+static bool			spool_is_open = false;
+static bool			spool_is_writing = false;
+static char			spool_dir[MAXPGPATH];
+static List		   *spool_segments = NIL;	/* Oldest first. */
+static List		   *spool_metadata = NIL;
+
+/* Writer state. */
+static int			write_fd = -1;
+static uint64		write_segno = 0;
+static off_t		write_offset = 0;
+static bool			write_dirty = false;
+static bool			write_dir_dirty = false;
+static XLogRecPtr	written_lsn = InvalidXLogRecPtr;
+static XLogRecPtr	flushed_lsn = InvalidXLogRecPtr;
+
+/* Reader state. */
+static int			read_fd = -1;
+static uint64		read_segno = 0;
+static StringInfoData read_buf;
+
+/* Segments older than this were written before restart ... */
+static uint64		replay_end_segno = 0;
+/* ... and transactions committed before this in them were applied already. */
+static XLogRecPtr	replay_skip_lsn = InvalidXLogRecPtr;
+
+static void
+spool_segment_path(char *path, uint64 segno)
+{
+	snprintf(path, MAXPGPATH, "%s/%08X%08X", spool_dir,
+			 (uint32) (segno >> 32), (uint32) segno);
+}
+
+static SpoolSegment *
+spool_find_segment(uint64 segno)
+{
+	ListCell   *lc;
+
+	foreach (lc, spool_segments)
+	{
+		SpoolSegment   *seg = lfirst(lc);
+
+		if (seg->segno >= segno)
+			return seg;
+	}
+
+	return NULL;
+}
+
+static int
+segno_cmp(const void *a, const void *b)
+{
+	uint64	sa = *(const uint64 *) a;
+	uint64	sb = *(const uint64 *) b;
+
+	if (sa < sb)
+		return -1;
+	if (sa > sb)
+		return 1;
+	return 0;
+}
+
+static pg_crc32c
+spool_record_crc(SpoolRecordHeader *hdr, const char *data)
+{
+	pg_crc32c	crc;
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, hdr, offsetof(SpoolRecordHeader, crc));
+	COMP_CRC32C(crc, data, hdr->len);
+	FIN_CRC32C(crc);
+
+	return crc;
+}
+
+/*
+ * Read next record from the spool file.
+ *
+ * Returns false at end of file. Torn or corrupted record is an error when
+ * strict is true, otherwise it's treated as end of file.
+ */
+static bool
+spool_read_record(int fd, const char *path, SpoolRecordHeader *hdr,
+				  StringInfo buf, bool strict)
+{
+	int		r;
+
+	r = read(fd, hdr, sizeof(SpoolRecordHeader));
+	if (r == 0)
+		return false;
+	else if (r < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read spool file \"%s\": %m", path)));
+	else if (r != sizeof(SpoolRecordHeader))
+		goto torn;
+
+	if (hdr->len > MaxAllocSize - 1)
+		goto torn;
+
+	resetStringInfo(buf);
+	enlargeStringInfo(buf, hdr->len);
+
+	r = read(fd, buf->data, hdr->len);
+	if (r < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read spool file \"%s\": %m", path)));
+	else if (r != hdr->len)
+		goto torn;
+
+	buf->len = hdr->len;
+	buf->data[buf->len] = '\0';
+
+	if (!EQ_CRC32C(spool_record_crc(hdr, buf->data), hdr->crc))
+		goto torn;
+
+	return true;
+
+torn:
+	if (strict)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid record in spool file \"%s\"", path)));
+
+	return false;
+}
+
+/*
+ * Check the segment read after restart and cut off anything after the last
+ * complete transaction, which will be streamed again by the provider.
+ *
+ * Returns false if nothing is left in the segment.
+ */
+static bool
+spool_recover_segment(SpoolSegment *seg, bool last, StringInfo buf)
+{
+	char				path[MAXPGPATH];
+	int					fd;
+	SpoolRecordHeader	hdr;
+	off_t				offset = 0;
+	off_t				valid_end = 0;
+	struct stat			st;
+
+	spool_segment_path(path, seg->segno);
+
+	fd = open(path, O_RDWR | PG_BINARY, 0);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open spool file \"%s\": %m", path)));
+
+	while (spool_read_record(fd, path, &hdr, buf, false))
+	{
+		offset += sizeof(SpoolRecordHeader) + hdr.len;
+
+		if (hdr.end_lsn != InvalidXLogRecPtr)
+			seg->end_lsn = hdr.end_lsn;
+
+		if (hdr.xact_lsn == InvalidXLogRecPtr ||
+			hdr.end_lsn != InvalidXLogRecPtr)
+			valid_end = offset;
+	}
+
+	if (fstat(fd, &st) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not stat spool file \"%s\": %m", path)));
+
+	if (st.st_size != valid_end)
+	{
+		/* Only the segment being written when we stopped can be partial. */
+		if (!last)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid record in spool file \"%s\"", path)));
+
+		if (ftruncate(fd, valid_end) != 0 || pg_fsync(fd) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not truncate spool file \"%s\": %m",
+							path)));
+	}
+
+	close(fd);
+
+	if (valid_end == 0)
+	{
+		if (unlink(path) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not remove spool file \"%s\": %m", path)));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Open the spool of the subscription.
+ *
+ * Whatever is left in the spool from before is validated and will be
+ * returned by pglogical_spool_read(), skipping the transactions which
+ * committed before applied_lsn. When write is true new messages can be
+ * appended.
+ *
+ * Returns false if there is nothing to read and we are not writing, in
+ * which case the spool is not used.
+ */
+bool
+pglogical_spool_open(Oid subid, XLogRecPtr applied_lsn, bool write)
+{
+	DIR			   *dir;
+	struct dirent  *de;
+	uint64		   *segnos;
+	int				nsegnos = 0;
+	int				maxsegnos = 16;
+	int				i;
+	MemoryContext	oldctx;
+
+	Assert(!spool_is_open);
+
+	snprintf(spool_dir, MAXPGPATH, "%s/%u-%u", SPOOL_DIR, MyDatabaseId,
+			 subid);
+
+	if (write)
+	{
+		if (mkdir(SPOOL_DIR, S_IRWXU) != 0 && errno != EEXIST)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not create directory \"%s\": %m",
+							SPOOL_DIR)));
+		if (mkdir(spool_dir, S_IRWXU) != 0 && errno != EEXIST)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not create directory \"%s\": %m",
+							spool_dir)));
+		fsync_fname(SPOOL_DIR, true);
+	}
+	else
+	{
+		struct stat		st;
+
+		if (stat(spool_dir, &st) != 0)
+		{
+			if (errno == ENOENT)
+				return false;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not stat directory \"%s\": %m",
+							spool_dir)));
+		}
+	}
+
+	segnos = palloc(maxsegnos * sizeof(uint64));
+	dir = AllocateDir(spool_dir);
+	while ((de = ReadDir(dir, spool_dir)) != NULL)
+	{
+		uint32		hi;
+		uint32		lo;
+
+		if (strlen(de->d_name) != 16 ||
+			strspn(de->d_name, "0123456789ABCDEF") != 16 ||
+			sscanf(de->d_name, "%08X%08X", &hi, &lo) != 2)
+			continue;
+
+		if (nsegnos == maxsegnos)
+		{
+			maxsegnos *= 2;
+			segnos = repalloc(segnos, maxsegnos * sizeof(uint64));
+		}
+		segnos[nsegnos++] = ((uint64) hi << 32) | lo;
+	}
+	FreeDir(dir);
+
+	qsort(segnos, nsegnos, sizeof(uint64), segno_cmp);
+
+	oldctx = MemoryContextSwitchTo(TopMemoryContext);
+
+	initStringInfo(&read_buf);
+
+	for (i = 0; i < nsegnos; i++)
+	{
+		SpoolSegment   *seg = palloc(sizeof(SpoolSegment));
+
+		seg->segno = segnos[i];
+		seg->end_lsn = InvalidXLogRecPtr;
+
+		if (!spool_recover_segment(seg, i == nsegnos - 1, &read_buf))
+		{
+			pfree(seg);
+			continue;
+		}
+
+		spool_segments = lappend(spool_segments, seg);
+		if (seg->end_lsn > written_lsn)
+			written_lsn = seg->end_lsn;
+	}
+
+	MemoryContextSwitchTo(oldctx);
+
+	flushed_lsn = written_lsn;
+	write_segno = nsegnos > 0 ? segnos[nsegnos - 1] + 1 : 0;
+	read_segno = spool_segments ?
+		((SpoolSegment *) linitial(spool_segments))->segno : write_segno;
+	replay_end_segno = write_segno;
+	replay_skip_lsn = applied_lsn;
+
+	pfree(segnos);
+
+	if (!write && spool_segments == NIL)
+	{
+		if (rmdir(spool_dir) != 0)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not remove directory \"%s\": %m",
+							spool_dir)));
+		return false;
+	}
+
+	if (spool_segments != NIL)
+		elog(LOG, "replaying %d spool segments of subscription %u up to %X/%X",
+			 list_length(spool_segments), subid,
+			 (uint32) (written_lsn >> 32), (uint32) written_lsn);
+
+	spool_is_open = true;
+	spool_is_writing = write;
+
+	return true;
+}
+
+/*
+ * Is there a spool in use by this process?
+ */
+bool
+pglogical_spool_active(void)
+{
+	return spool_is_open;
+}
+
+/*
+ * Are received messages being written into the spool?
+ */
+bool
+pglogical_spool_writing(void)
+{
+	return spool_is_open && spool_is_writing;
+}
+
+static void
+spool_write_record(const char *data, int len, uint32 flags,
+				   XLogRecPtr xact_lsn, XLogRecPtr end_lsn);
+
+/*
+ * Create next segment for writing.
+ */
+static void
+spool_start_segment(void)
+{
+	char			path[MAXPGPATH];
+	SpoolSegment   *seg;
+	MemoryContext	oldctx;
+	ListCell	   *lc;
+
+	Assert(write_fd < 0);
+
+	spool_segment_path(path, write_segno);
+	write_fd = open(path, O_RDWR | O_CREAT | O_EXCL | PG_BINARY,
+					S_IRUSR | S_IWUSR);
+	if (write_fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create spool file \"%s\": %m", path)));
+
+	write_offset = 0;
+	write_dir_dirty = true;
+
+	oldctx = MemoryContextSwitchTo(TopMemoryContext);
+	seg = palloc(sizeof(SpoolSegment));
+	seg->segno = write_segno;
+	seg->end_lsn = InvalidXLogRecPtr;
+	spool_segments = lappend(spool_segments, seg);
+	MemoryContextSwitchTo(oldctx);
+
+	/* Make the segment self-contained for replay. */
+	foreach (lc, spool_metadata)
+	{
+		SpoolMetadata  *meta = lfirst(lc);
+
+		spool_write_record(meta->data, meta->len, SPOOL_RECORD_METADATA,
+						   InvalidXLogRecPtr, InvalidXLogRecPtr);
+	}
+}
+
+/*
+ * Flush the segment being written and close it, next write will start a new
+ * one.
+ */
+static void
+spool_finish_segment(void)
+{
+	pglogical_spool_flush();
+
+	close(write_fd);
+	write_fd = -1;
+	write_segno++;
+}
+
+static void
+spool_write_record(const char *data, int len, uint32 flags,
+				   XLogRecPtr xact_lsn, XLogRecPtr end_lsn)
+{
+	SpoolRecordHeader	hdr;
+
+	if (write_fd < 0)
+		spool_start_segment();
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.len = len;
+	hdr.flags = flags;
+	hdr.xact_lsn = xact_lsn;
+	hdr.end_lsn = end_lsn;
+	hdr.crc = spool_record_crc(&hdr, data);
+
+	errno = 0;
+	if (write(write_fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		write(write_fd, data, len) != len)
+	{
+		char	path[MAXPGPATH];
+
+		/* if write didn't set errno, assume problem is no disk space */
+		if (errno == 0)
+			errno = ENOSPC;
+		spool_segment_path(path, write_segno);
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to spool file \"%s\": %m", path)));
+	}
+
+	write_offset += sizeof(hdr) + len;
+	write_dirty = true;
+
+	if (end_lsn != InvalidXLogRecPtr)
+	{
+		SpoolSegment   *seg = llast(spool_segments);
+
+		Assert(seg->segno == write_segno);
+		seg->end_lsn = end_lsn;
+		written_lsn = end_lsn;
+	}
+}
+
+/*
+ * Append message to the spool.
+ *
+ * xact_lsn is the commit LSN of the transaction the message belongs to, or
+ * InvalidXLogRecPtr for messages sent outside of transaction, end_lsn is the
+ * end LSN of the transaction for its COMMIT message.
+ */
+void
+pglogical_spool_write(const char *data, int len, XLogRecPtr xact_lsn,
+					  XLogRecPtr end_lsn)
+{
+	Assert(spool_is_writing);
+
+	spool_write_record(data, len, 0, xact_lsn, end_lsn);
+
+	/* Only switch segments between transactions. */
+	if ((xact_lsn == InvalidXLogRecPtr || end_lsn != InvalidXLogRecPtr) &&
+		write_offset >= SPOOL_SEGMENT_SIZE)
+		spool_finish_segment();
+}
+
+/*
+ * Remember relation metadata message to be repeated at the start of every
+ * new segment, replacing the previous message with the same key.
+ *
+ * This can be called before the spool is opened for messages which were
+ * applied directly, so that the spool can be started in the middle of the
+ * stream.
+ */
+void
+pglogical_spool_remember_metadata(uint32 key, const char *data, int len)
+{
+	SpoolMetadata  *meta = NULL;
+	ListCell	   *lc;
+	MemoryContext	oldctx;
+
+	oldctx = MemoryContextSwitchTo(TopMemoryContext);
+
+	foreach (lc, spool_metadata)
+	{
+		SpoolMetadata  *m = lfirst(lc);
+
+		if (m->key == key)
+		{
+			meta = m;
+			pfree(meta->data);
+			break;
+		}
+	}
+
+	if (meta == NULL)
+	{
+		meta = palloc(sizeof(SpoolMetadata));
+		meta->key = key;
+		spool_metadata = lappend(spool_metadata, meta);
+	}
+
+	meta->len = len;
+	meta->data = palloc(len);
+	memcpy(meta->data, data, len);
+
+	MemoryContextSwitchTo(oldctx);
+}
+
+/*
+ * Call cb for every remembered relation metadata message, oldest first.
+ */
+void
+pglogical_spool_foreach_metadata(pglogical_spool_metadata_cb cb, void *arg)
+{
+	ListCell	   *lc;
+
+	foreach (lc, spool_metadata)
+	{
+		SpoolMetadata  *meta = lfirst(lc);
+
+		cb(meta->data, meta->len, arg);
+	}
+}
+
+/*
+ * Append relation metadata message to the spool.
+ */
+void
+pglogical_spool_write_metadata(uint32 key, const char *data, int len,
+							   XLogRecPtr xact_lsn)
+{
+	Assert(spool_is_writing);
+
+	pglogical_spool_remember_metadata(key, data, len);
+
+	spool_write_record(data, len, SPOOL_RECORD_METADATA, xact_lsn,
+					   InvalidXLogRecPtr);
+}
+
+/*
+ * Make everything written so far durable.
+ */
+void
+pglogical_spool_flush(void)
+{
+	if (write_fd >= 0 && write_dirty)
+	{
+		if (pg_fsync(write_fd) != 0)
+		{
+			char	path[MAXPGPATH];
+
+			spool_segment_path(path, write_segno);
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not fsync spool file \"%s\": %m", path)));
+		}
+	}
+
+	if (write_dir_dirty)
+		fsync_fname(spool_dir, true);
+
+	write_dirty = false;
+	write_dir_dirty = false;
+	flushed_lsn = written_lsn;
+}
+
+/*
+ * End LSN of the last transaction which is durably spooled.
+ */
+XLogRecPtr
+pglogical_spool_flushed_lsn(void)
+{
+	return flushed_lsn;
+}
+
+/*
+ * Get next message from the spool.
+ *
+ * Returns the length of the message, or 0 if there is none. The buffer is
+ * valid until the next call.
+ */
+int
+pglogical_spool_read(char **buffer)
+{
+	SpoolRecordHeader	hdr;
+	char				path[MAXPGPATH];
+
+	if (!spool_is_open)
+		return 0;
+
+	for (;;)
+	{
+		if (read_fd < 0)
+		{
+			SpoolSegment   *seg = spool_find_segment(read_segno);
+
+			if (seg == NULL)
+				return 0;
+
+			read_segno = seg->segno;
+			spool_segment_path(path, read_segno);
+			read_fd = open(path, O_RDONLY | PG_BINARY, 0);
+			if (read_fd < 0)
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not open spool file \"%s\": %m",
+								path)));
+		}
+		else
+			spool_segment_path(path, read_segno);
+
+		if (!spool_read_record(read_fd, path, &hdr, &read_buf, true))
+		{
+			/* Still being written? */
+			if (read_segno >= write_segno)
+				return 0;
+
+			close(read_fd);
+			read_fd = -1;
+			read_segno++;
+			continue;
+		}
+
+		if (read_segno < replay_end_segno &&
+			!(hdr.flags & SPOOL_RECORD_METADATA) &&
+			hdr.xact_lsn < replay_skip_lsn)
+			continue;
+
+		*buffer = read_buf.data;
+		return hdr.len;
+	}
+}
+
+/*
+ * Remove the segments which were read and whose transactions were applied
+ * and flushed locally.
+ *
+ * When we are not writing into the spool anymore and it was all applied, the
+ * spool is removed altogether.
+ */
+void
+pglogical_spool_cleanup(void)
+{
+	XLogRecPtr		applied_lsn;
+
+	if (!spool_is_open)
+		return;
+
+	if (spool_segments == NIL ||
+		((SpoolSegment *) linitial(spool_segments))->segno >= read_segno)
+		return;
+
+	applied_lsn = replorigin_session_get_progress(true);
+
+	while (spool_segments != NIL)
+	{
+		SpoolSegment   *seg = linitial(spool_segments);
+		char			path[MAXPGPATH];
+
+		if (seg->segno >= read_segno || seg->end_lsn > applied_lsn)
+			break;
+
+		spool_segment_path(path, seg->segno);
+		if (unlink(path) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not remove spool file \"%s\": %m", path)));
+
+		spool_segments = list_delete_first(spool_segments);
+		pfree(seg);
+	}
+
+	if (!spool_is_writing && spool_segments == NIL)
+	{
+		if (rmdir(spool_dir) != 0)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not remove directory \"%s\": %m",
+							spool_dir)));
+
+		elog(LOG, "finished replaying spool \"%s\"", spool_dir);
+		spool_is_open = false;
+	}
+}
+
+/*
+ * Remove the spool of a dropped subscription.
+ */
+void
+pglogical_spool_drop(Oid subid)
+{
+	char		path[MAXPGPATH];
+	struct stat	st;
+
+	snprintf(path, MAXPGPATH, "%s/%u-%u", SPOOL_DIR, MyDatabaseId, subid);
+
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+	{
+		if (!rmtree(path, true))
+			ereport(WARNING,
+					(errmsg("could not remove spool directory \"%s\"",
+							path)));
+	}
+}
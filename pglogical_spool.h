@@ -0,0 +1,44 @@
+/*-------------------------------------------------------------------------
+ *
+ * pglogical_spool.h
+ *		pglogical local spool of the replication stream
+ *
+ * Copyright (c) 2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pglogical_spool.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PGLOGICAL_SPOOL_H
+#define PGLOGICAL_SPOOL_H
+
+#include "access/xlogdefs.h"
+
+extern bool pglogical_spool_stream;
+
+typedef void (*pglogical_spool_metadata_cb) (const char *data, int len,
+											 void *arg);
+
+extern bool pglogical_spool_open(Oid subid, XLogRecPtr applied_lsn,
+								 bool write);
+extern bool pglogical_spool_active(void);
+extern bool pglogical_spool_writing(void);
+
+extern void pglogical_spool_write(const char *data, int len,
+								  XLogRecPtr xact_lsn, XLogRecPtr end_lsn);
+extern void pglogical_spool_remember_metadata(uint32 key, const char *data,
+											  int len);
+extern void pglogical_spool_foreach_metadata(pglogical_spool_metadata_cb cb,
+											 void *arg);
+extern void pglogical_spool_write_metadata(uint32 key, const char *data,
+										   int len, XLogRecPtr xact_lsn);
+extern void pglogical_spool_flush(void);
+extern XLogRecPtr pglogical_spool_flushed_lsn(void);
+
+extern int pglogical_spool_read(char **buffer);
+extern void pglogical_spool_cleanup(void);
+
+extern void pglogical_spool_drop(Oid subid);
+
+#endif /* PGLOGICAL_SPOOL_H */
@@ -1295,7 +1295,7 @@ pglogical_sync_main(Datum main_arg)
 
 	pglogical_start_replication(streamConn, MySubscription->slot_name,
 								status_lsn, "all", NULL, tablename,
-								MySubscription->force_text_transfer);
+								MySubscription->force_text_transfer, false);
 
 	/* Leave it to standard apply code to do the replication. */
 	apply_work(streamConn);
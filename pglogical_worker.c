@@ -163,6 +163,15 @@ pglogical_worker_register(PGLogicalWorker *worker)
 				 shorten_hash(NameStr(worker->worker.sync.relname), NAMEDATALEN - 37),
 				 worker->dboid, worker->worker.sync.apply.subid);
 	}
+	else if (worker->worker_type == PGLOGICAL_WORKER_STREAM)
+	{
+		snprintf(bgw.bgw_function_name, BGW_MAXLEN,
+				 "pglogical_stream_main");
+		snprintf(bgw.bgw_name, BGW_MAXLEN,
+				 "pglogical stream %u:%u:%u", worker->dboid,
+				 worker->worker.stream.apply.subid,
+				 worker->worker.stream.xid);
+	}
 	else
 	{
 		snprintf(bgw.bgw_function_name, BGW_MAXLEN,
@@ -428,6 +437,17 @@ pglogical_worker_detach(bool crash)
 	}
 	else
 	{
+		/* An idle apply worker is replaced by the manager, wake it up. */
+		if (MyPGLogicalWorker->worker_type == PGLOGICAL_WORKER_APPLY &&
+			MyPGLogicalWorker->worker.apply.park_requested)
+		{
+			PGLogicalWorker *manager;
+
+			manager = pglogical_manager_find(MyPGLogicalWorker->dboid);
+			if (pglogical_worker_running(manager))
+				SetLatch(&manager->proc->procLatch);
+		}
+
 		/* Worker has finished work, clean up its state from shmem. */
 		MyPGLogicalWorker->worker_type = PGLOGICAL_WORKER_NONE;
 		MyPGLogicalWorker->dboid = InvalidOid;
@@ -743,6 +763,7 @@ pglogical_worker_type_name(PGLogicalWorkerType type)
 		case PGLOGICAL_WORKER_MANAGER: return "manager";
 		case PGLOGICAL_WORKER_APPLY: return "apply";
 		case PGLOGICAL_WORKER_SYNC: return "sync";
+		case PGLOGICAL_WORKER_STREAM: return "stream";
 		default: Assert(false); return NULL;
 	}
 }
@@ -13,6 +13,7 @@
 #ifndef PGLOGICAL_WORKER_H
 #define PGLOGICAL_WORKER_H
 
+#include "storage/dsm.h"
 #include "storage/lock.h"
 
 #include "pglogical.h"
@@ -21,8 +22,10 @@ typedef enum {
 	PGLOGICAL_WORKER_NONE,		/* Unused slot. */
 	PGLOGICAL_WORKER_MANAGER,	/* Manager. */
 	PGLOGICAL_WORKER_APPLY,		/* Apply. */
-	PGLOGICAL_WORKER_SYNC		/* Special type of Apply that synchronizes
+	PGLOGICAL_WORKER_SYNC,		/* Special type of Apply that synchronizes
 								 * one table. */
+	PGLOGICAL_WORKER_STREAM		/* Helper of Apply that applies one streamed
+								 * transaction. */
 } PGLogicalWorkerType;
 
 typedef struct PGLogicalApplyWorker
@@ -30,6 +33,15 @@ typedef struct PGLogicalApplyWorker
 	Oid			subid;				/* Subscription id for apply worker. */
 	bool		sync_pending;		/* Is there new synchronization info pending?. */
 	XLogRecPtr	replay_stop_lsn;	/* Replay should stop here if defined. */
+	int			recvq_messages;		/* Messages received but not applied. */
+	int64		recvq_bytes;		/* Size of the above. */
+	int64		compressed_bytes;	/* Compressed data received. */
+	int64		decompressed_bytes;	/* Size of the above decompressed. */
+	double		decompress_time;	/* Time spent decompressing, in ms. */
+	TimestampTz	last_active;		/* Last time data was received. */
+	bool		park_requested;		/* Should the worker exit while idle? */
+	XLogRecPtr	stream_file_lsn;	/* Don't use helpers until applied up to
+									 * here. */
 } PGLogicalApplyWorker;
 
 typedef struct PGLogicalSyncWorker
@@ -39,6 +51,13 @@ typedef struct PGLogicalSyncWorker
 	NameData	relname;	/* Name of the table to copy if any. */
 } PGLogicalSyncWorker;
 
+typedef struct PGLogicalStreamWorker
+{
+	PGLogicalApplyWorker	apply; /* Apply worker info, must be first. */
+	dsm_handle	handle;		/* Segment with the queue from the apply worker. */
+	TransactionId xid;		/* Remote transaction being applied. */
+} PGLogicalStreamWorker;
+
 typedef struct PGLogicalWorker {
 	PGLogicalWorkerType	worker_type;
 
@@ -59,6 +78,7 @@ typedef struct PGLogicalWorker {
 	{
 		PGLogicalApplyWorker apply;
 		PGLogicalSyncWorker sync;
+		PGLogicalStreamWorker stream;
 	} worker;
 
 } PGLogicalWorker;
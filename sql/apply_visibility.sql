@@ -0,0 +1,73 @@
+-- changes applied in one transaction must see the earlier ones they depend on
+SELECT * FROM pglogical_regress_variables()
+\gset
+
+\c :provider_dsn
+SELECT pglogical.replicate_ddl_command($$
+	CREATE TABLE public.vis_a (
+		id integer PRIMARY KEY,
+		data text
+	);
+	CREATE TABLE public.vis_b (
+		id integer PRIMARY KEY,
+		a_count integer
+	);
+$$);
+
+SELECT * FROM pglogical.replication_set_add_table('default', 'vis_a');
+SELECT * FROM pglogical.replication_set_add_table('default', 'vis_b');
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+CREATE FUNCTION vis_b_count_fn() RETURNS trigger LANGUAGE plpgsql AS $$
+BEGIN
+	NEW.a_count := (SELECT count(*) FROM public.vis_a);
+	RETURN NEW;
+END;
+$$;
+
+CREATE TRIGGER vis_b_count_trg BEFORE INSERT ON vis_b
+FOR EACH ROW EXECUTE PROCEDURE vis_b_count_fn();
+ALTER TABLE vis_b ENABLE REPLICA TRIGGER vis_b_count_trg;
+
+\c :provider_dsn
+-- the same row changed repeatedly, interleaved with another table
+BEGIN;
+INSERT INTO vis_a VALUES (1, 'one');
+INSERT INTO vis_b VALUES (1, 0);
+UPDATE vis_a SET data = 'one updated' WHERE id = 1;
+UPDATE vis_a SET data = data || ' twice' WHERE id = 1;
+INSERT INTO vis_a VALUES (2, 'two');
+DELETE FROM vis_a WHERE id = 2;
+INSERT INTO vis_a VALUES (2, 'two again');
+COMMIT;
+
+-- rows batched by multi-insert, changed later in the same transaction
+BEGIN;
+INSERT INTO vis_a SELECT i, 'batch' FROM generate_series(10, 1009) i;
+UPDATE vis_a SET data = 'batch updated' WHERE id IN (10, 500, 1009);
+DELETE FROM vis_a WHERE id BETWEEN 600 AND 699;
+INSERT INTO vis_a SELECT i, 'batch' FROM generate_series(2000, 2099) i;
+INSERT INTO vis_b VALUES (2, 0);
+COMMIT;
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+SELECT * FROM vis_a WHERE id < 10 ORDER BY id;
+SELECT data, count(*) FROM vis_a WHERE id >= 10 GROUP BY data ORDER BY data;
+-- the trigger must see the rows inserted before it in the same transaction
+SELECT * FROM vis_b ORDER BY id;
+
+DROP TRIGGER vis_b_count_trg ON vis_b;
+DROP FUNCTION vis_b_count_fn();
+
+\c :provider_dsn
+\set VERBOSITY terse
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.vis_a CASCADE;
+$$);
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.vis_b CASCADE;
+$$);
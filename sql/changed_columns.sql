@@ -0,0 +1,91 @@
+-- updates carrying only the changed columns
+SELECT * FROM pglogical_regress_variables()
+\gset
+
+\c :subscriber_dsn
+ALTER SYSTEM SET pglogical.changed_columns_only = on;
+SELECT pg_reload_conf();
+
+-- reconnect so that the apply worker asks for it
+SELECT pglogical.alter_subscription_disable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF (SELECT count(1) FROM pg_replication_slots WHERE active = false) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_enable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF (SELECT count(1) FROM pg_replication_slots WHERE active = true) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+SELECT pglogical.replicate_ddl_command($$
+	CREATE TABLE public.changed_full (
+		id integer PRIMARY KEY,
+		counter integer,
+		note text,
+		doc text
+	);
+	ALTER TABLE public.changed_full REPLICA IDENTITY FULL;
+	CREATE TABLE public.changed_key (
+		id integer PRIMARY KEY,
+		counter integer,
+		note text
+	);
+$$);
+
+SELECT * FROM pglogical.replication_set_add_table('default', 'changed_full');
+SELECT * FROM pglogical.replication_set_add_table('default', 'changed_key');
+
+INSERT INTO changed_full VALUES (1, 0, 'one', repeat('x', 100)), (2, 0, NULL, 'two');
+INSERT INTO changed_key VALUES (1, 0, 'one');
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+-- local changes of columns the provider doesn't touch
+\c :subscriber_dsn
+UPDATE changed_full SET note = 'local' WHERE id = 1;
+UPDATE changed_key SET note = 'local' WHERE id = 1;
+
+\c :provider_dsn
+UPDATE changed_full SET counter = counter + 1;
+UPDATE changed_full SET note = 'two' WHERE id = 2;
+UPDATE changed_key SET counter = counter + 1;
+UPDATE changed_key SET id = 10 WHERE id = 1;
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+-- the columns left out of the updates keep their local values
+SELECT id, counter, note, length(doc) FROM changed_full ORDER BY id;
+-- other tables get the whole row
+SELECT * FROM changed_key ORDER BY id;
+
+ALTER SYSTEM RESET pglogical.changed_columns_only;
+SELECT pg_reload_conf();
+
+\c :provider_dsn
+\set VERBOSITY terse
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.changed_full CASCADE;
+$$);
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.changed_key CASCADE;
+$$);
@@ -0,0 +1,97 @@
+-- compressed batches of inserted rows
+SELECT * FROM pglogical_regress_variables()
+\gset
+
+\c :subscriber_dsn
+ALTER SYSTEM SET pglogical.stream_compression = 'pglz';
+SELECT pg_reload_conf();
+
+-- reconnect so that the apply worker asks for compression
+SELECT pglogical.alter_subscription_disable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF (SELECT count(1) FROM pg_replication_slots WHERE active = false) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_enable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF (SELECT count(1) FROM pg_replication_slots WHERE active = true) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+SELECT pglogical.replicate_ddl_command($$
+	CREATE TABLE public.compress_text (
+		id integer PRIMARY KEY,
+		data text
+	);
+	CREATE TABLE public.compress_json (
+		id integer PRIMARY KEY,
+		doc jsonb
+	);
+$$);
+
+SELECT * FROM pglogical.replication_set_add_table('default', 'compress_text');
+SELECT * FROM pglogical.replication_set_add_table('default', 'compress_json');
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+BEGIN;
+INSERT INTO compress_text
+	SELECT i, repeat('lorem ipsum dolor sit amet ', 10) || i
+	FROM generate_series(1, 5000) i;
+INSERT INTO compress_json
+	SELECT i, jsonb_build_object('id', i, 'name', 'customer ' || (i % 100),
+								 'tags', jsonb_build_array('red', 'green', 'blue'),
+								 'active', i % 2 = 0)
+	FROM generate_series(1, 5000) i;
+COMMIT;
+
+-- a batch too small to be compressed
+INSERT INTO compress_text VALUES (0, 'small');
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+SELECT count(*), sum(length(data)) FROM compress_text;
+SELECT count(*), count(DISTINCT doc->>'name'), sum((doc->>'id')::integer) FROM compress_json;
+SELECT id, length(data), right(data, 6) FROM compress_text WHERE id < 2 ORDER BY id;
+SELECT * FROM compress_json WHERE id = 1;
+
+SELECT compressed_bytes > 0 AS compressed,
+	decompressed_bytes > 2 * compressed_bytes AS ratio_over_2
+FROM pglogical.show_subscription_compression('test_subscription');
+
+ALTER SYSTEM RESET pglogical.stream_compression;
+SELECT pg_reload_conf();
+
+\c :provider_dsn
+-- statistics of the walsender which sent the batches
+SELECT bool_or(compressed_batches > 0) AS compressed,
+	bool_or(sent_insert >= 10001) AS inserts_sent,
+	bool_or(relmeta_misses > 0 AND bytes_relation > 0) AS relations_sent
+FROM pglogical.output_stats;
+
+\set VERBOSITY terse
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.compress_text CASCADE;
+$$);
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.compress_json CASCADE;
+$$);
@@ -48,8 +48,76 @@ SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
 
 SELECT * FROM secondary_unique_pred ORDER BY a;
 
+\c :provider_dsn
+-- Conflicts in the middle of a batch of inserts must be resolved while the
+-- rest of the batch is still inserted.
+SELECT pglogical.replicate_ddl_command($$
+CREATE TABLE public.batch_conflict (
+    a integer PRIMARY KEY,
+    b text NOT NULL
+);
+$$);
+
+SELECT * FROM pglogical.replication_set_add_table('default', 'batch_conflict');
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+
+INSERT INTO batch_conflict VALUES (3, 'local'), (12, 'local');
+
+\c :provider_dsn
+
+INSERT INTO batch_conflict SELECT i, 'remote' FROM generate_series(1, 20) i;
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+
+SELECT b, count(*) FROM batch_conflict GROUP BY b ORDER BY b;
+SELECT * FROM batch_conflict WHERE a IN (3, 12) ORDER BY a;
+
+\c :provider_dsn
+-- Two rows of one batch with the same key in a unique index which only
+-- exists on the subscriber: the later one is resolved as a conflict with the
+-- earlier one, and the rows after it are still applied in order.
+SELECT pglogical.replicate_ddl_command($$
+CREATE TABLE public.batch_dup (
+    a integer PRIMARY KEY,
+    b integer NOT NULL
+);
+$$);
+
+SELECT * FROM pglogical.replication_set_add_table('default', 'batch_dup');
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+
+CREATE UNIQUE INDEX batch_dup_b_key ON batch_dup (b);
+
+\c :provider_dsn
+
+INSERT INTO batch_dup
+	SELECT i, CASE WHEN i = 15 THEN 5 ELSE i END FROM generate_series(1, 20) i;
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+
+SELECT count(*) FROM batch_dup;
+SELECT * FROM batch_dup WHERE b = 5 OR a BETWEEN 14 AND 16 ORDER BY a;
+
 \c :provider_dsn
 \set VERBOSITY terse
 SELECT pglogical.replicate_ddl_command($$
 	DROP TABLE public.secondary_unique_pred CASCADE;
 $$);
+
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.batch_conflict CASCADE;
+$$);
+
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.batch_dup CASCADE;
+$$);
@@ -0,0 +1,135 @@
+-- transactions shared between clients with equal options, pglogical.fanout_cache
+SELECT * FROM pglogical_regress_variables()
+\gset
+
+-- Stop the walsender of the subscription, it would remove the recorded
+-- transactions once it has confirmed them.
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_disable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF NOT EXISTS (SELECT 1 FROM pg_replication_slots WHERE database = current_database() AND active) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+ALTER SYSTEM SET pglogical.fanout_cache = on;
+SELECT pg_reload_conf();
+
+-- reconnect so that decoding in this backend sees the setting
+\c :provider_dsn
+
+CREATE TABLE public.fanout_tbl (id integer PRIMARY KEY, data text);
+SELECT * FROM pglogical.create_replication_set('fanout');
+SELECT * FROM pglogical.replication_set_add_table('fanout', 'fanout_tbl');
+
+CREATE FUNCTION fanout_changes(slot_name name, OUT n bigint, OUT data bytea)
+RETURNS SETOF record LANGUAGE sql AS $$
+	SELECT row_number() OVER (), data
+	FROM pg_logical_slot_get_binary_changes($1, NULL, NULL,
+		'min_proto_version', '1', 'max_proto_version', '1',
+		'startup_params_format', '1',
+		'pglogical.replication_set_names', 'fanout');
+$$;
+
+CREATE FUNCTION fanout_files(xid bigint) RETURNS bigint LANGUAGE sql AS $$
+	SELECT count(*) FROM pg_ls_dir('pg_logical/pglogical_fanout/' ||
+		(SELECT oid FROM pg_database WHERE datname = current_database())) f
+	WHERE f LIKE '%-' || $1;
+$$;
+
+-- changes of temporary tables are not decoded
+CREATE TEMP TABLE fanout_out (slot integer, n bigint, data bytea);
+
+SELECT 'init' FROM pg_create_logical_replication_slot('fanout_slot1', 'pglogical_output');
+SELECT 'init' FROM pg_create_logical_replication_slot('fanout_slot2', 'pglogical_output');
+
+BEGIN;
+INSERT INTO fanout_tbl VALUES (1, 'one'), (2, 'two');
+SELECT txid_current() AS xid_a
+\gset
+COMMIT;
+
+BEGIN;
+INSERT INTO fanout_tbl VALUES (3, 'three');
+SELECT txid_current() AS xid_b
+\gset
+COMMIT;
+
+-- the first client records the transactions
+INSERT INTO fanout_out SELECT 1, * FROM fanout_changes('fanout_slot1');
+SELECT changes, sent_insert, relmeta_misses
+FROM pglogical.output_stats WHERE pid = pg_backend_pid();
+SELECT fanout_files(:xid_a), fanout_files(:xid_b);
+
+-- the second one sends them without decoding the changes
+INSERT INTO fanout_out SELECT 2, * FROM fanout_changes('fanout_slot2');
+SELECT changes, sent_insert, relmeta_misses
+FROM pglogical.output_stats WHERE pid = pg_backend_pid();
+
+-- both send the relation metadata once, before the first change
+SELECT slot, string_agg(chr(get_byte(data, 0)), '' ORDER BY n) AS messages
+FROM fanout_out GROUP BY slot ORDER BY slot;
+SELECT count(*) AS differing
+FROM (SELECT n, data FROM fanout_out WHERE slot = 1) o1
+	FULL JOIN (SELECT n, data FROM fanout_out WHERE slot = 2) o2 USING (n)
+WHERE o1.data IS DISTINCT FROM o2.data;
+
+TRUNCATE fanout_out;
+
+-- transactions changing the catalogs are not recorded
+BEGIN;
+ALTER TABLE fanout_tbl ADD COLUMN extra text;
+INSERT INTO fanout_tbl VALUES (4, 'four', 'extra');
+SELECT txid_current() AS xid_c
+\gset
+COMMIT;
+
+BEGIN;
+INSERT INTO fanout_tbl VALUES (5, 'five', 'extra');
+SELECT txid_current() AS xid_d
+\gset
+COMMIT;
+
+INSERT INTO fanout_out SELECT 1, * FROM fanout_changes('fanout_slot1');
+SELECT fanout_files(:xid_c), fanout_files(:xid_d);
+INSERT INTO fanout_out SELECT 2, * FROM fanout_changes('fanout_slot2');
+
+SELECT slot, count(*) FILTER (WHERE get_byte(data, 0) = ascii('I')) AS inserts
+FROM fanout_out GROUP BY slot ORDER BY slot;
+SELECT count(*) AS differing
+FROM (SELECT n, data FROM fanout_out WHERE slot = 1) o1
+	FULL JOIN (SELECT n, data FROM fanout_out WHERE slot = 2) o2 USING (n)
+WHERE o1.data IS DISTINCT FROM o2.data;
+
+SELECT pg_drop_replication_slot('fanout_slot1');
+SELECT pg_drop_replication_slot('fanout_slot2');
+
+DROP FUNCTION fanout_changes(name);
+DROP FUNCTION fanout_files(bigint);
+SELECT * FROM pglogical.drop_replication_set('fanout');
+DROP TABLE public.fanout_tbl;
+
+ALTER SYSTEM RESET pglogical.fanout_cache;
+SELECT pg_reload_conf();
+
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_enable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF EXISTS (SELECT 1 FROM pg_replication_slots WHERE database = current_database() AND active) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
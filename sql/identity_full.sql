@@ -0,0 +1,183 @@
+-- test REPLICA IDENTITY FULL tables without PRIMARY KEY
+SELECT * FROM pglogical_regress_variables()
+\gset
+
+\c :provider_dsn
+SELECT pglogical.replicate_ddl_command($$
+	CREATE TABLE public.full_idx (
+		a integer NOT NULL,
+		b text,
+		c integer
+	);
+	CREATE INDEX full_idx_a_idx ON public.full_idx (a);
+	ALTER TABLE public.full_idx REPLICA IDENTITY FULL;
+
+	CREATE TABLE public.full_noidx (
+		a integer,
+		b text
+	);
+	ALTER TABLE public.full_noidx REPLICA IDENTITY FULL;
+$$);
+
+SELECT * FROM pglogical.replication_set_add_table('default', 'full_idx');
+SELECT * FROM pglogical.replication_set_add_table('default', 'full_noidx');
+
+INSERT INTO full_idx SELECT i % 5, 'row' || i, i FROM generate_series(1, 20) i;
+INSERT INTO full_noidx VALUES (1, 'one'), (2, 'two'), (2, 'two'), (3, NULL), (NULL, 'null');
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+-- rows sharing the indexed value must be told apart by the other columns
+UPDATE full_idx SET b = 'updated' WHERE c IN (3, 8);
+DELETE FROM full_idx WHERE c = 13;
+
+-- found by sequential scan, NULLs must match NULLs
+UPDATE full_noidx SET b = 'three' WHERE a = 3;
+UPDATE full_noidx SET a = 0 WHERE a IS NULL;
+
+-- only one of the duplicate rows must be deleted
+DELETE FROM full_noidx WHERE ctid = (SELECT ctid FROM full_noidx WHERE a = 2 LIMIT 1);
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+SELECT count(*) FROM full_idx;
+SELECT * FROM full_idx WHERE a = 3 ORDER BY c;
+SELECT * FROM full_noidx ORDER BY a;
+
+-- keyless table with only a hash index, found through that index
+\c :provider_dsn
+SET client_min_messages = 'error';
+SELECT pglogical.replicate_ddl_command($$
+	CREATE TABLE public.full_hashidx (
+		a integer,
+		b text
+	);
+	CREATE INDEX full_hashidx_a_idx ON public.full_hashidx USING hash (a);
+	ALTER TABLE public.full_hashidx REPLICA IDENTITY FULL;
+$$);
+RESET client_min_messages;
+
+SELECT * FROM pglogical.replication_set_add_table('default', 'full_hashidx');
+
+INSERT INTO full_hashidx VALUES (1, 'one'), (2, 'two'), (2, 'two'), (NULL, 'null');
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+UPDATE full_hashidx SET b = 'uno' WHERE a = 1;
+DELETE FROM full_hashidx WHERE ctid = (SELECT ctid FROM full_hashidx WHERE a = 2 LIMIT 1);
+UPDATE full_hashidx SET a = 3 WHERE a IS NULL;
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+SELECT * FROM full_hashidx ORDER BY a;
+
+-- the same lookups using the tuple hash, rows written earlier in the
+-- transaction must be found without rebuilding it
+\c :subscriber_dsn
+ALTER SYSTEM SET pglogical.keyless_tuple_hash = on;
+SELECT pg_reload_conf();
+SELECT pglogical.alter_subscription_disable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF (SELECT count(1) FROM pg_replication_slots WHERE active = false) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_enable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF (SELECT count(1) FROM pg_replication_slots WHERE active = true) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+SELECT pglogical.replicate_ddl_command($$
+	CREATE TABLE public.full_hash (
+		a integer,
+		b text
+	);
+	ALTER TABLE public.full_hash REPLICA IDENTITY FULL;
+$$);
+
+SELECT * FROM pglogical.replication_set_add_table('default', 'full_hash');
+
+INSERT INTO full_hash SELECT i, 'row' || i FROM generate_series(1, 20) i;
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+BEGIN;
+UPDATE full_hash SET b = 'upd2' WHERE a = 5;
+INSERT INTO full_hash SELECT i, 'new' FROM generate_series(21, 30) i;
+UPDATE full_hash SET b = 'upd' WHERE a BETWEEN 25 AND 35;
+UPDATE full_hash SET b = 'upd2' WHERE a = 26;
+DELETE FROM full_hash WHERE a IN (6, 27);
+UPDATE full_hash SET a = a + 100 WHERE a = 28;
+COMMIT;
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+SELECT count(*) FROM full_hash;
+SELECT * FROM full_hash WHERE a > 20 OR a IN (5, 6) ORDER BY a;
+
+ALTER SYSTEM RESET pglogical.keyless_tuple_hash;
+SELECT pg_reload_conf();
+SELECT pglogical.alter_subscription_disable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF (SELECT count(1) FROM pg_replication_slots WHERE active = false) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_enable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF (SELECT count(1) FROM pg_replication_slots WHERE active = true) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+\c :provider_dsn
+\set VERBOSITY terse
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.full_idx CASCADE;
+$$);
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.full_noidx CASCADE;
+$$);
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.full_hash CASCADE;
+$$);
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.full_hashidx CASCADE;
+$$);
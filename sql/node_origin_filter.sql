@@ -0,0 +1,86 @@
+-- forward_origins listing origins by name: changes of the listed origins are
+-- forwarded along with local changes, changes of other origins are not
+SELECT * FROM pglogical_regress_variables()
+\gset
+
+\c :orig_provider_dsn
+SET client_min_messages = 'warning';
+CREATE EXTENSION IF NOT EXISTS pglogical;
+SELECT * FROM pglogical.create_node(node_name := 'test_orig_provider', dsn := (SELECT orig_provider_dsn FROM pglogical_regress_variables()) || ' user=super');
+
+\c :provider_dsn
+SET client_min_messages = 'warning';
+BEGIN;
+SELECT * FROM pglogical.create_subscription(
+    subscription_name := 'test_orig_subscription',
+    provider_dsn := (SELECT orig_provider_dsn FROM pglogical_regress_variables()) || ' user=super',
+	synchronize_structure := false,
+	forward_origins := '{}');
+COMMIT;
+
+BEGIN;
+SET LOCAL statement_timeout = '10s';
+SELECT pglogical.wait_for_subscription_sync_complete('test_orig_subscription');
+COMMIT;
+
+\c :subscriber_dsn
+CREATE TABLE public.origin_filter_tbl (id integer primary key, source text);
+
+\c :provider_dsn
+CREATE TABLE public.origin_filter_tbl (id integer primary key, source text);
+SELECT * FROM pglogical.create_replication_set('origin_filter');
+SELECT * FROM pglogical.replication_set_add_table('origin_filter', 'origin_filter_tbl');
+
+-- changes applied by test_orig_subscription carry its slot name as origin
+SELECT sub_slot_name AS cascade_origin FROM pglogical.subscription WHERE sub_name = 'test_orig_subscription'
+\gset
+SELECT pg_replication_origin_create('test_dropped_origin') IS NOT NULL;
+
+\c :subscriber_dsn
+SELECT * FROM pglogical.create_subscription(
+    subscription_name := 'test_origin_filter_subscription',
+    provider_dsn := (SELECT provider_dsn FROM pglogical_regress_variables()) || ' user=super',
+	replication_sets := '{origin_filter}',
+	synchronize_structure := false,
+	synchronize_data := false,
+	forward_origins := ARRAY[:'cascade_origin']);
+
+BEGIN;
+SET LOCAL statement_timeout = '10s';
+SELECT pglogical.wait_for_subscription_sync_complete('test_origin_filter_subscription');
+COMMIT;
+
+\c :orig_provider_dsn
+CREATE TABLE public.origin_filter_tbl (id integer primary key, source text);
+SELECT * FROM pglogical.replication_set_add_table('default', 'origin_filter_tbl');
+INSERT INTO origin_filter_tbl VALUES (1, 'orig_provider');
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :provider_dsn
+INSERT INTO origin_filter_tbl VALUES (2, 'provider');
+SELECT pg_replication_origin_session_setup('test_dropped_origin');
+INSERT INTO origin_filter_tbl VALUES (3, 'test_dropped_origin');
+SELECT pg_replication_origin_session_reset();
+SELECT id, source FROM origin_filter_tbl ORDER BY id;
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+SELECT id, source FROM origin_filter_tbl ORDER BY id;
+
+SELECT * FROM pglogical.drop_subscription('test_origin_filter_subscription');
+DROP TABLE public.origin_filter_tbl;
+
+\c :provider_dsn
+SELECT * FROM pglogical.drop_replication_set('origin_filter');
+DROP TABLE public.origin_filter_tbl;
+SELECT pg_replication_origin_drop('test_dropped_origin');
+
+\c :orig_provider_dsn
+\set VERBOSITY terse
+DROP TABLE public.origin_filter_tbl CASCADE;
+
+\c :provider_dsn
+SELECT * FROM pglogical.drop_subscription('test_orig_subscription');
+
+\c :orig_provider_dsn
+SELECT * FROM pglogical.drop_node(node_name := 'test_orig_provider');
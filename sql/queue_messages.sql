@@ -0,0 +1,42 @@
+-- queued commands sent as logical decoding messages
+SELECT * FROM pglogical_regress_variables()
+\gset
+
+\c :provider_dsn
+ALTER SYSTEM SET pglogical.queue_messages = on;
+SELECT pg_reload_conf();
+
+\c :provider_dsn
+SELECT count(*) AS queued FROM pglogical.queue
+\gset
+
+SELECT pglogical.replicate_ddl_command($$
+	CREATE TABLE public.queue_msg (
+		id integer PRIMARY KEY,
+		data text
+	);
+$$);
+
+SELECT * FROM pglogical.replication_set_add_table('default', 'queue_msg');
+
+INSERT INTO queue_msg SELECT i, 'row ' || i FROM generate_series(1, 10) i;
+TRUNCATE queue_msg;
+INSERT INTO queue_msg VALUES (11, 'after truncate');
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+-- nothing went through the queue table
+SELECT count(*) = :queued AS queue_unchanged FROM pglogical.queue;
+
+\c :subscriber_dsn
+SELECT * FROM queue_msg ORDER BY id;
+
+\c :provider_dsn
+ALTER SYSTEM RESET pglogical.queue_messages;
+SELECT pg_reload_conf();
+
+\c :provider_dsn
+\set VERBOSITY terse
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.queue_msg CASCADE;
+$$);
@@ -0,0 +1,130 @@
+-- large transactions applied while in progress, pglogical.stream_apply_workers
+-- is set in regress-postgresql.conf
+SELECT current_setting('server_version_num')::integer < 140000 AS skip_test
+\gset
+\if :skip_test
+\quit
+\endif
+SELECT * FROM pglogical_regress_variables()
+\gset
+
+-- The provider streams transactions which outgrow 64kB, which takes a new
+-- walsender.
+\c :provider_dsn
+ALTER DATABASE regression SET logical_decoding_work_mem = '64kB';
+
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_disable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF NOT EXISTS (SELECT 1 FROM pg_replication_slots WHERE database = current_database() AND active) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_enable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF EXISTS (SELECT 1 FROM pg_replication_slots WHERE database = current_database() AND active) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+SELECT pglogical.replicate_ddl_command($$
+	CREATE TABLE public.stream_tbl (id integer PRIMARY KEY, data text);
+$$);
+SELECT * FROM pglogical.replication_set_add_table('default', 'stream_tbl');
+
+-- a subtransaction is rolled back
+BEGIN;
+INSERT INTO stream_tbl SELECT i, repeat('a', 100) FROM generate_series(1, 3000) i;
+SAVEPOINT s1;
+INSERT INTO stream_tbl SELECT i, repeat('b', 100) FROM generate_series(3001, 6000) i;
+ROLLBACK TO SAVEPOINT s1;
+INSERT INTO stream_tbl SELECT i, repeat('c', 100) FROM generate_series(6001, 7000) i;
+COMMIT;
+
+-- the whole transaction is rolled back
+BEGIN;
+INSERT INTO stream_tbl SELECT i, repeat('d', 100) FROM generate_series(10001, 15000) i;
+ROLLBACK;
+
+-- changes of rows sent in earlier blocks
+BEGIN;
+INSERT INTO stream_tbl SELECT i, repeat('e', 100) FROM generate_series(20001, 25000) i;
+UPDATE stream_tbl SET data = 'updated' WHERE id <= 1000;
+DELETE FROM stream_tbl WHERE id > 24000;
+COMMIT;
+
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		PERFORM pg_stat_clear_snapshot();
+		IF EXISTS (SELECT 1 FROM pg_stat_replication_slots s JOIN pg_replication_slots r USING (slot_name) WHERE r.database = current_database() AND s.stream_txns > 0) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+SELECT s.stream_txns > 0 AS streamed
+FROM pg_stat_replication_slots s JOIN pg_replication_slots r USING (slot_name)
+WHERE r.database = current_database();
+
+\c :subscriber_dsn
+SELECT count(*), min(id), max(id) FROM stream_tbl;
+SELECT left(data, 1) AS data, count(*) FROM stream_tbl GROUP BY 1 ORDER BY 1;
+
+\c :provider_dsn
+ALTER DATABASE regression RESET logical_decoding_work_mem;
+
+\set VERBOSITY terse
+SELECT pglogical.replicate_ddl_command($$
+	DROP TABLE public.stream_tbl CASCADE;
+$$);
+SELECT pglogical.wait_slot_confirm_lsn(NULL, NULL);
+
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_disable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF NOT EXISTS (SELECT 1 FROM pg_replication_slots WHERE database = current_database() AND active) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+
+\c :subscriber_dsn
+SELECT pglogical.alter_subscription_enable('test_subscription', true);
+
+\c :provider_dsn
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		IF EXISTS (SELECT 1 FROM pg_replication_slots WHERE database = current_database() AND active) THEN
+			RETURN;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
@@ -0,0 +1,124 @@
+use strict;
+use warnings;
+use Cwd;
+use Config;
+use TestLib;
+use Test::More;
+
+my $pg_version = `pg_config --version| sed 's/[^0-9\.]//g' | awk -F . '{ print \$1\$2 }'`;
+
+if ($pg_version < 100) {
+    plan skip_all => 'pglogical.apply_idle_timeout requires PostgreSQL 10 or higher';
+} else {
+    plan tests => 5;
+}
+
+my $PGPORT=65434; #subscriber's port
+my $PROVIDER_PORT=65433;
+my $PROVIDER_DSN = "postgresql://super\@localhost:$PROVIDER_PORT/postgres";
+my $SUBSCRIBER_DSN = "postgresql://super\@localhost:$PGPORT/postgres";
+
+# Returns the result of the query as a string.
+sub psql_value {
+    my ($port, $sql) = @_;
+    my $out = `psql -p $port -d postgres -At -c "$sql"`;
+    chomp $out;
+    return $out;
+}
+
+# Waits up to a minute for the query to return the expected value.
+sub wait_for_value {
+    my ($port, $sql, $expected) = @_;
+    for (my $i = 0; $i < 600; $i++) {
+        return 1 if psql_value($port, $sql) eq $expected;
+        select(undef, undef, undef, 0.1);
+    }
+    return 0;
+}
+
+system_or_bail 'rm', '-rf', '/tmp/tmp_050_pdatadir';
+system_or_bail 'rm', '-rf', '/tmp/tmp_050_sdatadir';
+
+#provider's and subscriber's datadir
+system_or_bail 'initdb', '-A trust', '-D', '/tmp/tmp_050_pdatadir';
+system_or_bail 'initdb', '-A trust', '-D', '/tmp/tmp_050_sdatadir';
+
+system_or_bail 'cp', 'regress-pg_hba.conf', '/tmp/tmp_050_pdatadir/pg_hba.conf';
+system_or_bail 'cp', 'regress-pg_hba.conf', '/tmp/tmp_050_sdatadir/pg_hba.conf';
+
+`cat t/perl-95-postgresql.conf>>/tmp/tmp_050_pdatadir/postgresql.conf`;
+`cat t/perl-95-postgresql.conf>>/tmp/tmp_050_sdatadir/postgresql.conf`;
+
+# The apply worker exits after two seconds without changes.
+`echo "pglogical.apply_idle_timeout = 2000" >>/tmp/tmp_050_sdatadir/postgresql.conf`;
+
+system("postgres -p $PROVIDER_PORT -D /tmp/tmp_050_pdatadir -c logging_collector=on &");
+system("postgres -p $PGPORT -D /tmp/tmp_050_sdatadir -c logging_collector=on &");
+
+#allow Postgres servers to startup
+system_or_bail 'sleep', '17';
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "CREATE USER super SUPERUSER";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE USER super SUPERUSER";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "CREATE EXTENSION IF NOT EXISTS pglogical";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE EXTENSION IF NOT EXISTS pglogical";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.create_node(node_name := 'test_provider', dsn := '$PROVIDER_DSN')";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.create_node(node_name := 'test_subscriber', dsn := '$SUBSCRIBER_DSN')";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "CREATE TABLE public.idle_tbl (id integer primary key, data text)";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE TABLE public.idle_tbl (id integer primary key, data text)";
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.replication_set_add_table('default', 'idle_tbl')";
+
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.create_subscription(
+    subscription_name := 'test_idle',
+    provider_dsn := '$PROVIDER_DSN',
+        forward_origins := '{}',
+        synchronize_structure := false,
+        synchronize_data := false
+)";
+
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "DO \$\$
+BEGIN
+        FOR i IN 1..100 LOOP
+                IF EXISTS (SELECT 1 FROM pglogical.show_subscription_status() WHERE status = 'replicating') THEN
+                        RETURN;
+                END IF;
+                PERFORM pg_sleep(0.1);
+        END LOOP;
+END;
+\$\$";
+
+# The manager streams for the idle subscription under the name of the
+# subscription with the suffix "_idle", the apply worker under the plain name.
+my $parked = "SELECT count(*) FROM pg_stat_replication WHERE application_name = 'test_idle_idle'";
+
+ok(wait_for_value($PROVIDER_PORT, $parked, '1'), 'manager streams for the idle subscription');
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "INSERT INTO idle_tbl VALUES (1, 'wake')";
+ok(wait_for_value($PGPORT, "SELECT count(*) FROM idle_tbl", '1'), 'change is applied after the apply worker was started again');
+
+ok(wait_for_value($PROVIDER_PORT, $parked, '1'), 'subscription is handed to the manager again');
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "INSERT INTO idle_tbl VALUES (2, 'wake again')";
+ok(wait_for_value($PGPORT, "SELECT count(*) FROM idle_tbl", '2'), 'second change is applied');
+
+# The manager releases the slot before the apply worker is started, so the
+# worker must not fail to start streaming. The manager itself may have to
+# retry while the walsender of the exiting worker holds the slot.
+my $slot_in_use = 0;
+foreach my $log (glob('/tmp/tmp_050_sdatadir/log/*'))
+{
+    open(my $fh, '<', $log) or next;
+    while (my $line = <$fh>)
+    {
+        $slot_in_use = 1 if $line =~ /FATAL:.*replication slot .* is active/;
+    }
+    close($fh);
+}
+ok(!$slot_in_use, 'apply worker found the replication slot released');
+
+#cleanup
+system("pg_ctl stop -D /tmp/tmp_050_sdatadir -m immediate &");
+system("pg_ctl stop -D /tmp/tmp_050_pdatadir -m immediate &");
@@ -0,0 +1,133 @@
+use strict;
+use warnings;
+use Cwd;
+use Config;
+use TestLib;
+use Test::More;
+
+my $pg_version = `pg_config --version| sed 's/[^0-9\.]//g' | awk -F . '{ print \$1 }'`;
+
+if ($pg_version < 14) {
+    plan skip_all => 'pglogical.stream_apply_workers requires PostgreSQL 14 or higher';
+} else {
+    plan tests => 3;
+}
+
+my $PGPORT=65436; #subscriber's port
+my $PROVIDER_PORT=65435;
+my $PROVIDER_DSN = "postgresql://super\@localhost:$PROVIDER_PORT/postgres";
+my $SUBSCRIBER_DSN = "postgresql://super\@localhost:$PGPORT/postgres";
+
+# Returns the result of the query as a string.
+sub psql_value {
+    my ($port, $sql) = @_;
+    my $out = `psql -p $port -d postgres -At -c "$sql"`;
+    chomp $out;
+    return $out;
+}
+
+# Waits up to a minute for the query to return the expected value.
+sub wait_for_value {
+    my ($port, $sql, $expected) = @_;
+    for (my $i = 0; $i < 600; $i++) {
+        return 1 if psql_value($port, $sql) eq $expected;
+        select(undef, undef, undef, 0.1);
+    }
+    return 0;
+}
+
+system_or_bail 'rm', '-rf', '/tmp/tmp_060_pdatadir';
+system_or_bail 'rm', '-rf', '/tmp/tmp_060_sdatadir';
+
+#provider's and subscriber's datadir
+system_or_bail 'initdb', '-A trust', '-D', '/tmp/tmp_060_pdatadir';
+system_or_bail 'initdb', '-A trust', '-D', '/tmp/tmp_060_sdatadir';
+
+system_or_bail 'cp', 'regress-pg_hba.conf', '/tmp/tmp_060_pdatadir/pg_hba.conf';
+system_or_bail 'cp', 'regress-pg_hba.conf', '/tmp/tmp_060_sdatadir/pg_hba.conf';
+
+`cat t/perl-95-postgresql.conf>>/tmp/tmp_060_pdatadir/postgresql.conf`;
+`cat t/perl-95-postgresql.conf>>/tmp/tmp_060_sdatadir/postgresql.conf`;
+
+# The provider streams transactions which outgrow 64kB, the subscriber applies
+# them in helpers and looks for deadlocks soon.
+`echo "logical_decoding_work_mem = 64kB" >>/tmp/tmp_060_pdatadir/postgresql.conf`;
+`echo "pglogical.stream_apply_workers = 2" >>/tmp/tmp_060_sdatadir/postgresql.conf`;
+`echo "deadlock_timeout = 100ms" >>/tmp/tmp_060_sdatadir/postgresql.conf`;
+
+system("postgres -p $PROVIDER_PORT -D /tmp/tmp_060_pdatadir -c logging_collector=on &");
+system("postgres -p $PGPORT -D /tmp/tmp_060_sdatadir -c logging_collector=on &");
+
+#allow Postgres servers to startup
+system_or_bail 'sleep', '17';
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "CREATE USER super SUPERUSER";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE USER super SUPERUSER";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "CREATE EXTENSION IF NOT EXISTS pglogical";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE EXTENSION IF NOT EXISTS pglogical";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.create_node(node_name := 'test_provider', dsn := '$PROVIDER_DSN')";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.create_node(node_name := 'test_subscriber', dsn := '$SUBSCRIBER_DSN')";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "CREATE TABLE public.stream_tbl (id integer primary key, data text)";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE TABLE public.stream_tbl (id integer primary key, data text)";
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.replication_set_add_table('default', 'stream_tbl')";
+
+# Every row applied on the subscriber locks the same row of a table the
+# provider doesn't have.
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE TABLE public.stream_count (n integer)";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "INSERT INTO public.stream_count VALUES (0)";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE FUNCTION public.stream_count_trg() RETURNS trigger LANGUAGE plpgsql AS \$\$
+BEGIN
+        UPDATE public.stream_count SET n = n + 1;
+        RETURN NEW;
+END;
+\$\$";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE TRIGGER stream_count_trg AFTER INSERT ON public.stream_tbl FOR EACH ROW EXECUTE PROCEDURE public.stream_count_trg()";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "ALTER TABLE public.stream_tbl ENABLE ALWAYS TRIGGER stream_count_trg";
+
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.create_subscription(
+    subscription_name := 'test_stream',
+    provider_dsn := '$PROVIDER_DSN',
+        forward_origins := '{}',
+        synchronize_structure := false,
+        synchronize_data := false
+)";
+
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "DO \$\$
+BEGIN
+        FOR i IN 1..100 LOOP
+                IF EXISTS (SELECT 1 FROM pglogical.show_subscription_status() WHERE status = 'replicating') THEN
+                        RETURN;
+                END IF;
+                PERFORM pg_sleep(0.1);
+        END LOOP;
+END;
+\$\$";
+
+# A large transaction is streamed to a helper, which keeps the counter row
+# locked. A small one commits on the provider meanwhile, the apply worker
+# waits for the counter row, and the helper for the next block.
+system("psql -p $PROVIDER_PORT -d postgres -c \"BEGIN; INSERT INTO stream_tbl SELECT i, repeat('a', 100) FROM generate_series(1, 5000) i; SELECT pg_sleep(5); INSERT INTO stream_tbl SELECT i, repeat('b', 100) FROM generate_series(5001, 6000) i; COMMIT;\" &");
+system_or_bail 'sleep', '2';
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "INSERT INTO stream_tbl VALUES (10001, 'small')";
+
+ok(wait_for_value($PGPORT, "SELECT count(*) FROM stream_tbl", '6001'), 'both transactions are applied');
+is(psql_value($PGPORT, "SELECT n FROM stream_count"), '6001', 'trigger ran once for every row');
+
+my $deadlock = 0;
+foreach my $log (glob('/tmp/tmp_060_sdatadir/log/*'))
+{
+    open(my $fh, '<', $log) or next;
+    while (my $line = <$fh>)
+    {
+        $deadlock = 1 if $line =~ /deadlock detected/;
+    }
+    close($fh);
+}
+ok($deadlock, 'deadlock between the apply worker and the helper was detected');
+
+#cleanup
+system("pg_ctl stop -D /tmp/tmp_060_sdatadir -m immediate &");
+system("pg_ctl stop -D /tmp/tmp_060_pdatadir -m immediate &");
@@ -0,0 +1,129 @@
+use strict;
+use warnings;
+use Cwd;
+use Config;
+use TestLib;
+use Test::More;
+
+my $pg_version = `pg_config --version| sed 's/[^0-9\.]//g' | awk -F . '{ print \$1 }'`;
+
+if ($pg_version < 14) {
+    plan skip_all => 'pg_log_backend_memory_contexts requires PostgreSQL 14 or higher';
+} else {
+    plan tests => 3;
+}
+
+my $PGPORT=65438; #subscriber's port
+my $PROVIDER_PORT=65437;
+my $PROVIDER_DSN = "postgresql://super\@localhost:$PROVIDER_PORT/postgres";
+my $SUBSCRIBER_DSN = "postgresql://super\@localhost:$PGPORT/postgres";
+
+# Returns the result of the query as a string.
+sub psql_value {
+    my ($port, $sql) = @_;
+    my $out = `psql -p $port -d postgres -At -c "$sql"`;
+    chomp $out;
+    return $out;
+}
+
+# Waits up to a minute for the query to return the expected value.
+sub wait_for_value {
+    my ($port, $sql, $expected) = @_;
+    for (my $i = 0; $i < 600; $i++) {
+        return 1 if psql_value($port, $sql) eq $expected;
+        select(undef, undef, undef, 0.1);
+    }
+    return 0;
+}
+
+system_or_bail 'rm', '-rf', '/tmp/tmp_070_pdatadir';
+system_or_bail 'rm', '-rf', '/tmp/tmp_070_sdatadir';
+
+#provider's and subscriber's datadir
+system_or_bail 'initdb', '-A trust', '-D', '/tmp/tmp_070_pdatadir';
+system_or_bail 'initdb', '-A trust', '-D', '/tmp/tmp_070_sdatadir';
+
+system_or_bail 'cp', 'regress-pg_hba.conf', '/tmp/tmp_070_pdatadir/pg_hba.conf';
+system_or_bail 'cp', 'regress-pg_hba.conf', '/tmp/tmp_070_sdatadir/pg_hba.conf';
+
+`cat t/perl-95-postgresql.conf>>/tmp/tmp_070_pdatadir/postgresql.conf`;
+`cat t/perl-95-postgresql.conf>>/tmp/tmp_070_sdatadir/postgresql.conf`;
+
+system("postgres -p $PROVIDER_PORT -D /tmp/tmp_070_pdatadir -c logging_collector=on &");
+system("postgres -p $PGPORT -D /tmp/tmp_070_sdatadir -c logging_collector=on &");
+
+#allow Postgres servers to startup
+system_or_bail 'sleep', '17';
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "CREATE USER super SUPERUSER";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE USER super SUPERUSER";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "CREATE EXTENSION IF NOT EXISTS pglogical";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE EXTENSION IF NOT EXISTS pglogical";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.create_node(node_name := 'test_provider', dsn := '$PROVIDER_DSN')";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.create_node(node_name := 'test_subscriber', dsn := '$SUBSCRIBER_DSN')";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "CREATE TABLE public.mem_tbl (id integer primary key, data text)";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE TABLE public.mem_tbl (id integer primary key, data text)";
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.replication_set_add_table('default', 'mem_tbl')";
+
+# The apply worker pauses in the middle of the transaction, so that its
+# memory can be looked at.
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE FUNCTION public.mem_tbl_trg() RETURNS trigger LANGUAGE plpgsql AS \$\$
+BEGIN
+        IF NEW.id = 150000 THEN
+                PERFORM pg_sleep(15);
+        END IF;
+        RETURN NEW;
+END;
+\$\$";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "CREATE TRIGGER mem_tbl_trg BEFORE INSERT ON public.mem_tbl FOR EACH ROW EXECUTE PROCEDURE public.mem_tbl_trg()";
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "ALTER TABLE public.mem_tbl ENABLE ALWAYS TRIGGER mem_tbl_trg";
+
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "SELECT * FROM pglogical.create_subscription(
+    subscription_name := 'test_memory',
+    provider_dsn := '$PROVIDER_DSN',
+        forward_origins := '{}',
+        synchronize_structure := false,
+        synchronize_data := false
+)";
+
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "DO \$\$
+BEGIN
+        FOR i IN 1..100 LOOP
+                IF EXISTS (SELECT 1 FROM pglogical.show_subscription_status() WHERE status = 'replicating') THEN
+                        RETURN;
+                END IF;
+                PERFORM pg_sleep(0.1);
+        END LOOP;
+END;
+\$\$";
+
+system_or_bail 'psql', '-p', "$PROVIDER_PORT", '-d', "postgres", '-c', "INSERT INTO mem_tbl SELECT i, repeat('x', 100) FROM generate_series(1, 200000) i";
+
+my $sleeping = "SELECT count(*) FROM pg_stat_activity WHERE application_name LIKE 'pglogical apply %' AND wait_event = 'PgSleep'";
+ok(wait_for_value($PGPORT, $sleeping, '1'), 'apply worker is in the middle of the transaction');
+
+# MessageContext is reset after every message, so it holds only the change
+# being applied rather than all the changes before it.
+system_or_bail 'psql', '-p', "$PGPORT", '-d', "postgres", '-c', "SELECT pg_log_backend_memory_contexts(pid) FROM pg_stat_activity WHERE application_name LIKE 'pglogical apply %'";
+system_or_bail 'sleep', '2';
+
+my $message_context = -1;
+foreach my $log (glob('/tmp/tmp_070_sdatadir/log/*'))
+{
+    open(my $fh, '<', $log) or next;
+    while (my $line = <$fh>)
+    {
+        $message_context = $1 if $line =~ /level: \d+; MessageContext: (\d+) total/;
+    }
+    close($fh);
+}
+ok($message_context >= 0 && $message_context < 1024 * 1024, "MessageContext of the apply worker is small ($message_context bytes)");
+
+ok(wait_for_value($PGPORT, "SELECT count(*) FROM mem_tbl", '200000'), 'transaction is applied');
+
+#cleanup
+system("pg_ctl stop -D /tmp/tmp_070_sdatadir -m immediate &");
+system("pg_ctl stop -D /tmp/tmp_070_pdatadir -m immediate &");